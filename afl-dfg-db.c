@@ -0,0 +1,725 @@
+/*
+   DAFL - DFG database compiler
+   ----------------------------
+
+   Compiles the DFG (DAFL_DFG_SCORE) and the list of instrumentation targets
+   (DAFL_SELECTIVE_COV) into a single binary database, for DAFL_DFG_DB; see
+   dfg-db.h for the format. The LLVM pass then maps the database in every
+   compiler process instead of parsing the text files each time.
+
+   The database is written to a temporary file first and renamed into
+   place, so that compiler processes that are already running never see a
+   partial file.
+*/
+
+#define AFL_MAIN
+#include "android-ashmem.h"
+
+#include "config.h"
+#include "types.h"
+#include "debug.h"
+#include "alloc-inl.h"
+#include "dfg-db.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/* Key to place in a table, with the slot it ended up in. */
+
+struct db_key {
+
+  u8* key;                            /* Key bytes                        */
+  u32 len;                            /* Key length                       */
+  u32 bucket;                         /* First-level bucket               */
+  u32 slot;                           /* Assigned slot                    */
+  u32 id;                             /* Caller's index                   */
+
+};
+
+/* DFG node, as parsed from the DFG file. */
+
+struct dfg_ent {
+
+  u8* file;                           /* Source file name                 */
+  u32 line;                           /* Line number                      */
+  u32 order;                          /* Line in the DFG file             */
+  struct dfg_db_node node;            /* Node, sans file_id               */
+
+};
+
+static u8 *dfg_file,                  /* DFG file (-d)                    */
+          *cov_file,                  /* Instrumentation targets (-s)     */
+          *out_file,                  /* Database to write (-o)           */
+          *doc_path;                  /* Path to docs                     */
+
+static u8*  blob;                     /* String blob                      */
+static u32  blob_len,                 /* Bytes used in the blob           */
+            blob_size;                /* Bytes allocated for the blob     */
+
+static struct dfg_ent* dfg_ents;      /* Parsed DFG, in file order        */
+static u32  dfg_cnt,                  /* Entries in dfg_ents              */
+            node_cnt;                 /* DFG indices used                 */
+
+static u8** cov_lines;                /* Instrumentation target lines     */
+static u32  cov_cnt;                  /* Entries in cov_lines             */
+
+
+/* Append bytes and a NUL to the blob, returning their offset. */
+
+static u32 blob_add(u8* str, u32 len) {
+
+  u32 off = blob_len;
+
+  if ((u64)blob_len + len + 1 > 0xffffffffULL)
+    FATAL("Too many strings for a DFG database");
+
+  while (blob_len + len + 1 > blob_size) {
+    blob_size = blob_size ? blob_size * 2 : 4096;
+    blob = ck_realloc(blob, blob_size);
+  }
+
+  memcpy(blob + blob_len, str, len);
+  blob[blob_len + len] = 0;
+  blob_len += len + 1;
+
+  return off;
+
+}
+
+
+/* Read all lines of a text file, without the trailing newlines. */
+
+static u8** read_lines(u8* fn, u32* cnt) {
+
+  FILE* f = fopen(fn, "r");
+  u8**  lines = NULL;
+  char* line = NULL;
+  size_t size = 0;
+  ssize_t len;
+
+  if (!f) PFATAL("Unable to open '%s'", fn);
+
+  *cnt = 0;
+
+  while ((len = getline(&line, &size, f)) >= 0) {
+
+    if (len && line[len - 1] == '\n') line[--len] = 0;
+
+    if (!(*cnt & 1023)) lines = ck_realloc(lines, (*cnt + 1024) * sizeof(u8*));
+    lines[(*cnt)++] = ck_strdup((u8*)line);
+
+  }
+
+  free(line);
+  fclose(f);
+
+  return lines;
+
+}
+
+
+/* Split "file:line" the way the pass does. Returns 0 if the line number is
+   not a plain decimal number, as such a location can never match. */
+
+static u32 split_file_line(u8* loc, u8** file) {
+
+  u8* colon = (u8*)strrchr((char*)loc, ':');
+  u64 line_no = 0;
+  u8* p;
+
+  if (!colon || !colon[1]) return 0;
+
+  for (p = colon + 1; *p; p++) {
+    if (*p < '0' || *p > '9' || line_no > 0xffffffffULL / 10) return 0;
+    line_no = line_no * 10 + (*p - '0');
+  }
+
+  if (line_no > 0xffffffffULL) return 0;
+
+  *file = ck_alloc(colon - loc + 1);
+  memcpy(*file, loc, colon - loc);
+
+  return (u32)line_no;
+
+}
+
+
+/* Parse the DFG file: "score path_cnt file:line" per line, with the DFG
+   index given by the line number in the file. */
+
+static void read_dfg(void) {
+
+  u32 cnt, i;
+  u8** lines = read_lines(dfg_file, &cnt);
+
+  dfg_ents = ck_alloc(cnt * sizeof(struct dfg_ent) + 1);
+
+  for (i = 0; i < cnt; i++) {
+
+    u8 *sp1 = (u8*)strchr((char*)lines[i], ' '), *sp2 = NULL, *end, *loc;
+    struct dfg_ent* e = &dfg_ents[dfg_cnt];
+    s64 score;
+
+    score = strtoll((char*)lines[i], (char**)&end, 10);
+
+    if (end == lines[i] || !sp1) FATAL("Malformed line %u in '%s'", i + 1,
+                                       dfg_file);
+
+    e->node.path_cnt = strtoull((char*)sp1 + 1, (char**)&end, 10);
+
+    if (end == sp1 + 1) FATAL("Malformed line %u in '%s'", i + 1, dfg_file);
+
+    sp2 = (u8*)strchr((char*)sp1 + 1, ' ');
+    loc = sp2 ? sp2 + 1 : lines[i];
+
+    e->node.idx   = node_cnt++;
+    e->node.score = (u32)score;
+    e->order      = i;
+
+    if (node_cnt > DFG_MAX_SIZE)
+      FATAL("Input DFG is too large (check DFG_MAX_SIZE)");
+
+    e->line = split_file_line(loc, &e->file);
+    if (e->line) dfg_cnt++;
+
+  }
+
+  for (i = 0; i < cnt; i++) ck_free(lines[i]);
+  ck_free(lines);
+
+}
+
+
+/* Order DFG entries by location, then by position in the file. */
+
+static int compare_dfg(const void* a, const void* b) {
+
+  const struct dfg_ent *x = a, *y = b;
+  int r = strcmp((char*)x->file, (char*)y->file);
+
+  if (r) return r;
+  if (x->line != y->line) return x->line < y->line ? -1 : 1;
+  return x->order < y->order ? -1 : x->order > y->order;
+
+}
+
+
+static int compare_str(const void* a, const void* b) {
+
+  return strcmp(*(char**)a, *(char**)b);
+
+}
+
+
+/* Order keys by content, then by the caller's index. */
+
+static int compare_key(const void* a, const void* b) {
+
+  const struct db_key *x = a, *y = b;
+  int r;
+
+  if (x->len != y->len) return x->len < y->len ? -1 : 1;
+  r = memcmp(x->key, y->key, x->len);
+  if (r) return r;
+  return x->id < y->id ? -1 : x->id > y->id;
+
+}
+
+
+/* Order keys by the size of their bucket (largest first), then bucket. */
+
+static u32* bucket_size;
+
+static int compare_bucket(const void* a, const void* b) {
+
+  const struct db_key *x = a, *y = b;
+
+  if (bucket_size[x->bucket] != bucket_size[y->bucket])
+    return bucket_size[x->bucket] > bucket_size[y->bucket] ? -1 : 1;
+
+  return x->bucket < y->bucket ? -1 : x->bucket > y->bucket;
+
+}
+
+
+/* Build a minimal perfect hash table over distinct keys, filling in their
+   slots. Returns the displacements. */
+
+static u32* build_table(struct dfg_db_table* t, struct db_key* keys, u32 cnt) {
+
+  u32 *disp, i = 0, slot = 0;
+  u8* taken;
+
+  t->cnt     = cnt;
+  t->buckets = cnt / 4 + 1;
+
+  disp        = ck_alloc(t->buckets * sizeof(u32));
+  bucket_size = ck_alloc(t->buckets * sizeof(u32));
+  taken       = ck_alloc(cnt + 1);
+
+  for (i = 0; i < cnt; i++) {
+    keys[i].bucket = dfg_db_hash(keys[i].key, keys[i].len, 0) % t->buckets;
+    bucket_size[keys[i].bucket]++;
+  }
+
+  qsort(keys, cnt, sizeof(struct db_key), compare_bucket);
+
+  /* Buckets with several keys get a seed under which all of their keys
+     land in free slots, largest buckets first, while the table is still
+     mostly empty. */
+
+  i = 0;
+
+  while (i < cnt && bucket_size[keys[i].bucket] > 1) {
+
+    u32 b = keys[i].bucket, n = bucket_size[b], seed, j, k;
+
+    for (seed = 1; seed < DFG_DB_DIRECT; seed++) {
+
+      for (j = 0; j < n; j++) {
+
+        keys[i + j].slot = dfg_db_hash(keys[i + j].key, keys[i + j].len,
+                                       seed) % cnt;
+
+        if (taken[keys[i + j].slot]) break;
+
+        for (k = 0; k < j; k++)
+          if (keys[i + k].slot == keys[i + j].slot) break;
+
+        if (k < j) break;
+
+      }
+
+      if (j == n) break;
+
+    }
+
+    if (seed == DFG_DB_DIRECT) FATAL("Unable to place bucket %u", b);
+
+    for (j = 0; j < n; j++) taken[keys[i + j].slot] = 1;
+
+    disp[b] = seed;
+    i += n;
+
+  }
+
+  /* Single keys just take the remaining slots. */
+
+  for (; i < cnt; i++) {
+
+    while (taken[slot]) slot++;
+
+    keys[i].slot = slot;
+    taken[slot] = 1;
+    disp[keys[i].bucket] = DFG_DB_DIRECT | slot;
+
+  }
+
+  ck_free(bucket_size);
+  ck_free(taken);
+
+  return disp;
+
+}
+
+
+/* Drop keys that are already in the list, keeping the one with the lowest
+   caller's index. Returns the new count. */
+
+static u32 unique_keys(struct db_key* keys, u32 cnt) {
+
+  u32 i, n = 0;
+
+  qsort(keys, cnt, sizeof(struct db_key), compare_key);
+
+  for (i = 0; i < cnt; i++)
+    if (!n || keys[n - 1].len != keys[i].len ||
+        memcmp(keys[n - 1].key, keys[i].key, keys[i].len))
+      keys[n++] = keys[i];
+
+  return n;
+
+}
+
+
+/* Output buffer. */
+
+static u8* out_buf;
+static u64 out_len;
+
+static u64 out_add(void* data, u64 len) {
+
+  u64 off = (out_len + 7) & ~7ULL;
+
+  out_buf = ck_realloc(out_buf, off + len);
+  memset(out_buf + out_len, 0, off - out_len);
+  if (data) memcpy(out_buf + off, data, len);
+  out_len = off + len;
+
+  return off;
+
+}
+
+
+/* Lay out a table and its slots in the output. */
+
+static void put_table(struct dfg_db_table* t, u32* disp, void* slots,
+                      u32 slot_len) {
+
+  t->disp_off = out_add(disp, t->buckets * sizeof(u32));
+  t->slot_off = out_add(slots, (u64)t->cnt * slot_len);
+
+  ck_free(disp);
+
+}
+
+
+/* Build the whole database in out_buf. */
+
+static void build_db(void) {
+
+  struct dfg_db hdr;
+  struct db_key *keys;
+  struct dfg_db_str* files;
+  struct dfg_db_node* nodes;
+  struct dfg_db_target* targets;
+  u32 *disp, *file_nums, *file_slots, i, n = 0;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, DFG_DB_MAGIC, DFG_DB_MAGIC_LEN);
+
+  out_add(&hdr, sizeof(hdr));
+
+  if (dfg_file) {
+
+    hdr.flags   |= DFG_DB_HAS_DFG;
+    hdr.node_cnt = node_cnt;
+
+    /* A location listed twice keeps the last entry, as in the pass. */
+
+    qsort(dfg_ents, dfg_cnt, sizeof(struct dfg_ent), compare_dfg);
+
+    for (i = 0; i < dfg_cnt; i++) {
+
+      if (i + 1 < dfg_cnt && !strcmp((char*)dfg_ents[i].file,
+                                     (char*)dfg_ents[i + 1].file) &&
+          dfg_ents[i].line == dfg_ents[i + 1].line) continue;
+
+      dfg_ents[n++] = dfg_ents[i];
+
+    }
+
+    dfg_cnt = n;
+
+    /* Files, numbered in sorted order first; their IDs are their slots. */
+
+    keys      = ck_alloc(dfg_cnt * sizeof(struct db_key) + 1);
+    file_nums = ck_alloc(dfg_cnt * sizeof(u32) + 1);
+    n = 0;
+
+    for (i = 0; i < dfg_cnt; i++) {
+
+      if (!i || strcmp((char*)dfg_ents[i - 1].file, (char*)dfg_ents[i].file)) {
+        keys[n].key = dfg_ents[i].file;
+        keys[n].len = strlen((char*)dfg_ents[i].file);
+        keys[n].id  = n;
+        n++;
+      }
+
+      file_nums[i] = n - 1;
+
+    }
+
+    disp       = build_table(&hdr.files, keys, n);
+    files      = ck_alloc(n * sizeof(struct dfg_db_str) + 1);
+    file_slots = ck_alloc(n * sizeof(u32) + 1);
+
+    for (i = 0; i < n; i++) {
+      files[keys[i].slot].off = blob_add(keys[i].key, keys[i].len);
+      files[keys[i].slot].len = keys[i].len;
+      file_slots[keys[i].id]  = keys[i].slot;
+    }
+
+    for (i = 0; i < dfg_cnt; i++)
+      dfg_ents[i].node.file_id = file_slots[file_nums[i]];
+
+    put_table(&hdr.files, disp, files, sizeof(struct dfg_db_str));
+    ck_free(files);
+    ck_free(file_slots);
+    ck_free(file_nums);
+
+    /* Locations. */
+
+    for (i = 0; i < dfg_cnt; i++) {
+
+      dfg_ents[i].node.line = dfg_ents[i].line;
+
+      keys[i].key = (u8*)&dfg_ents[i].node.file_id;
+      keys[i].len = 2 * sizeof(u32);
+      keys[i].id  = i;
+
+    }
+
+    disp  = build_table(&hdr.locs, keys, dfg_cnt);
+    nodes = ck_alloc(dfg_cnt * sizeof(struct dfg_db_node) + 1);
+
+    for (i = 0; i < dfg_cnt; i++)
+      nodes[keys[i].slot] = dfg_ents[keys[i].id].node;
+
+    put_table(&hdr.locs, disp, nodes, sizeof(struct dfg_db_node));
+    ck_free(nodes);
+    ck_free(keys);
+
+  }
+
+  if (cov_file) {
+
+    u32* line_offs = ck_alloc(cov_cnt * sizeof(u32) + 1);
+    u8** key_mem   = ck_alloc(cov_cnt * sizeof(u8*) + 1);
+    u32 t;
+
+    hdr.flags |= DFG_DB_HAS_COV;
+
+    /* The lowest line wins where several select the same key, as with the
+       sorted set in the pass. */
+
+    qsort(cov_lines, cov_cnt, sizeof(u8*), compare_str);
+
+    for (i = 0; i < cov_cnt; i++)
+      line_offs[i] = blob_add(cov_lines[i], strlen((char*)cov_lines[i]));
+
+    keys = ck_alloc(cov_cnt * sizeof(struct db_key) + 1);
+
+    for (t = 0; t < 2; t++) {
+
+      struct dfg_db_table* tab = t ? &hdr.funcs : &hdr.targets;
+
+      for (i = 0; i < cov_cnt; i++) {
+
+        u8* l = cov_lines[i];
+        u8* colon = (u8*)strchr((char*)l, ':');
+        u32 len = strlen((char*)l);
+
+        /* "file:function" becomes "file\0function"; a line without a
+           colon is both the file and the function. */
+
+        if (!t) {
+
+          u32 flen = colon ? colon - l : len;
+          u8* func = colon ? colon + 1 : l;
+
+          keys[i].len = flen + 1 + strlen((char*)func);
+          keys[i].key = ck_alloc(keys[i].len);
+          memcpy(keys[i].key, l, flen);
+          memcpy(keys[i].key + flen + 1, func, strlen((char*)func));
+
+        } else {
+
+          keys[i].key = ck_strdup(colon ? colon + 1 : l);
+          keys[i].len = strlen((char*)keys[i].key);
+
+        }
+
+        keys[i].id = i;
+        key_mem[i] = keys[i].key;
+
+      }
+
+      n = unique_keys(keys, cov_cnt);
+
+      disp    = build_table(tab, keys, n);
+      targets = ck_alloc(n * sizeof(struct dfg_db_target) + 1);
+
+      for (i = 0; i < n; i++) {
+
+        struct dfg_db_target* ent = &targets[keys[i].slot];
+
+        ent->key.off  = blob_add(keys[i].key, keys[i].len);
+        ent->key.len  = keys[i].len;
+        ent->line_off = line_offs[keys[i].id];
+
+      }
+
+      put_table(tab, disp, targets, sizeof(struct dfg_db_target));
+      ck_free(targets);
+
+      for (i = 0; i < cov_cnt; i++) ck_free(key_mem[i]);
+
+    }
+
+    ck_free(keys);
+    ck_free(key_mem);
+    ck_free(line_offs);
+
+  }
+
+  hdr.str_off = out_add(blob, blob_len);
+  hdr.str_len = blob_len;
+  hdr.size    = out_len;
+
+  memcpy(out_buf, &hdr, sizeof(hdr));
+
+}
+
+
+/* Look every DFG node and target up again in the finished database. */
+
+static void verify_db(void) {
+
+  const struct dfg_db* hdr = (struct dfg_db*)out_buf;
+  const char* err = dfg_db_check(out_buf, out_len);
+  u32 i;
+
+  if (err) FATAL("Database check failed: %s", err);
+
+  for (i = 0; i < dfg_cnt; i++) {
+
+    u8* file = dfg_ents[i].file;
+    u32 id = dfg_db_find_file(out_buf, file, strlen((char*)file));
+    const struct dfg_db_node* node;
+
+    if (id == DFG_DB_NONE) FATAL("Database check failed for '%s'", file);
+
+    node = dfg_db_find_node(out_buf, id, dfg_ents[i].line);
+
+    if (!node || node->idx != dfg_ents[i].node.idx)
+      FATAL("Database check failed for '%s:%u'", file, dfg_ents[i].line);
+
+  }
+
+  for (i = 0; i < cov_cnt; i++) {
+
+    u8* l = cov_lines[i];
+    u8* colon = (u8*)strchr((char*)l, ':');
+    u8* func = colon ? colon + 1 : l;
+    u32 flen = colon ? colon - l : strlen((char*)l);
+    u32 klen = flen + 1 + strlen((char*)func);
+    u8* key = ck_alloc(klen);
+
+    memcpy(key, l, flen);
+    memcpy(key + flen + 1, func, klen - flen - 1);
+
+    if (!dfg_db_find_target(out_buf, &hdr->targets, key, klen) ||
+        !dfg_db_find_target(out_buf, &hdr->funcs, func, strlen((char*)func)))
+      FATAL("Database check failed for '%s'", l);
+
+    ck_free(key);
+
+  }
+
+}
+
+
+/* Write out_buf to out_file, via a temporary file. */
+
+static void write_db(void) {
+
+  u8* tmp = alloc_printf("%s.%u.tmp", out_file, getpid());
+  s32 fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+
+  if (fd < 0) PFATAL("Unable to create '%s'", tmp);
+
+  ck_write(fd, out_buf, out_len, tmp);
+
+  if (fsync(fd)) PFATAL("fsync() failed");
+  close(fd);
+
+  if (rename(tmp, out_file)) PFATAL("Unable to rename '%s'", tmp);
+
+  ck_free(tmp);
+
+}
+
+
+/* Display usage hints. */
+
+static void usage(u8* argv0) {
+
+  SAYF("\n%s [ -d file ] [ -s file ] -o file\n\n"
+
+       "Required parameters:\n\n"
+
+       "  -o file   - database to write, for DAFL_DFG_DB\n\n"
+
+       "Inputs (at least one is required):\n\n"
+
+       "  -d file   - DFG, as given with DAFL_DFG_SCORE\n"
+       "  -s file   - instrumentation targets, as with DAFL_SELECTIVE_COV\n\n"
+
+       "For additional tips, please consult %s/README.\n\n",
+
+       argv0, doc_path);
+
+  exit(1);
+
+}
+
+
+/* Main entry point */
+
+int main(int argc, char** argv) {
+
+  s32 opt;
+
+  doc_path = access(DOC_PATH, F_OK) ? "docs" : DOC_PATH;
+
+  SAYF(cCYA "afl-dfg-db " cBRI VERSION cRST " (DAFL DFG database compiler)\n");
+
+  while ((opt = getopt(argc, argv, "+d:s:o:")) > 0)
+
+    switch (opt) {
+
+      case 'd':
+
+        if (dfg_file) FATAL("Multiple -d options not supported");
+        dfg_file = optarg;
+        break;
+
+      case 's':
+
+        if (cov_file) FATAL("Multiple -s options not supported");
+        cov_file = optarg;
+        break;
+
+      case 'o':
+
+        if (out_file) FATAL("Multiple -o options not supported");
+        out_file = optarg;
+        break;
+
+      default:
+
+        usage(argv[0]);
+
+    }
+
+  if (optind != argc || !out_file || (!dfg_file && !cov_file))
+    usage(argv[0]);
+
+  if (dfg_file) {
+    ACTF("Reading the DFG from '%s'...", dfg_file);
+    read_dfg();
+  }
+
+  if (cov_file) {
+    ACTF("Reading instrumentation targets from '%s'...", cov_file);
+    cov_lines = read_lines(cov_file, &cov_cnt);
+  }
+
+  build_db();
+  verify_db();
+  write_db();
+
+  OKF("Wrote %u DFG nodes (%u locations) and %u targets to '%s' (%llu bytes).",
+      node_cnt, dfg_cnt, cov_cnt, out_file, out_len);
+
+  exit(0);
+
+}
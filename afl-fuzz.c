@@ -42,6 +42,11 @@
 #include "debug.h"
 #include "alloc-inl.h"
 #include "hash.h"
+#include "dfg-meta.h"
+#include "dfg-set.h"
+#include "packed-store.h"
+#include "sync-bus.h"
+#include "bitmap-simd.h"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -56,6 +61,7 @@
 #include <termios.h>
 #include <dlfcn.h>
 #include <sched.h>
+#include <poll.h>
 
 #include <sys/wait.h>
 #include <sys/time.h>
@@ -67,6 +73,10 @@
 #include <sys/ioctl.h>
 #include <sys/file.h>
 
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif /* __linux__ */
+
 #include <math.h>
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined (__OpenBSD__)
@@ -129,12 +139,22 @@ EXP_ST u8  skip_deterministic,        /* Skip deterministic stages?       */
            no_cpu_meter_red,          /* Feng shui on the status screen   */
            no_arith,                  /* Skip most arithmetic ops         */
            shuffle_queue,             /* Shuffle input queue?             */
+           splice_prox,               /* Proximity-weighted splicing?     */
+           packed_store,              /* Pack saved cases into segments?  */
+           no_dedup,                  /* Save byte-identical repeats?     */
+           dedup_trace,               /* Key dedup on the trace, too?     */
+           sync_new_dfg,              /* Import only if new DFG nodes?    */
            bitmap_changed = 1,        /* Time to update bitmap?           */
            qemu_mode,                 /* Running in QEMU mode?            */
            skip_requested,            /* Skip request, via SIGUSR1        */
            run_over10m,               /* Run time over 10 minutes?        */
            persistent_mode,           /* Running in persistent mode?      */
            deferred_mode,             /* Deferred forkserver mode?        */
+           dfg_sparse,                /* Target lists touched DFG nodes?  */
+           dfg_target,                /* Target flags the target line?    */
+           dfg_self_reset,            /* Target resets DFG maps itself?   */
+           shm_fuzz,                  /* Target reads test cases from SHM? */
+           memfd_input,               /* Keep .cur_input in a memfd?      */
            fast_cal;                  /* Try to calibrate faster?         */
 
 static s32 out_fd,                    /* Persistent fd for out_file       */
@@ -148,10 +168,43 @@ static s32 forksrv_pid,               /* PID of the fork server           */
            out_dir_fd = -1;           /* FD of the lock file              */
 
 EXP_ST u8* trace_bits;                /* SHM with code coverage bitmap    */
-EXP_ST u32* dfg_bits;                 /* SHM with DFG coverage bitmap     */
-EXP_ST u64* dfg_counts;                /* SHM with DFG path count          */
+EXP_ST u32* dfg_list;                 /* SHM with touched DFG nodes       */
+
+static u8* dfg_hit;                   /* Nodes already in dfg_list[]      */
+
+static u8 bitmap_simd;                /* Map kernels to use (BITMAP_*)    */
+
+/* What the post-exec pass found out about the trace in trace_bits; see
+   analyze_trace(). */
+
+struct trace_info {
+
+  u8* map;                            /* trace_bits at the time           */
+  u64 execs;                          /* total_execs at the time          */
+  u32 bytes;                          /* Non-zero bytes in the trace      */
+  u32 cksum;                          /* hash32() of the trace            */
+  u8  has_cksum,                      /* Is cksum filled in?              */
+      new_bits;                       /* has_new_bits(virgin_bits) then   */
 
-EXP_ST u64 dfg_node_count[DFG_MAP_SIZE];  /* Node counts for DFG              */
+};
+
+static struct trace_info last_trace;  /* Latest trace analyzed            */
+
+static u32 want_cksum;                /* Checksum in analyze_trace()?     */
+
+EXP_ST u32 dfg_size = DFG_MAP_SIZE;   /* Nodes in the target's DFG        */
+
+EXP_ST u64* dfg_node_count;           /* Node counts for DFG              */
+static u32* dfg_node_score;           /* Proximity scores of DFG nodes    */
+static u64* dfg_node_paths;           /* Path counts of DFG nodes         */
+static u32* dfg_node_desc;            /* Where DFG nodes are, 0 = unknown */
+
+static u8*  dfg_desc_buf;             /* "file:line (function)" strings   */
+static u32  dfg_desc_len;             /* Bytes used in dfg_desc_buf       */
+
+static u32  dfg_nodes_known,          /* Nodes in the DFG node tables     */
+            dfg_nodes_hit;            /* Nodes reached by queue entries   */
+static s32  dfg_closest = -1;         /* Reached node with the top score  */
 
 EXP_ST u8  virgin_bits[MAP_SIZE],     /* Regions yet untouched by fuzzing */
            virgin_tmout[MAP_SIZE],    /* Bits we haven't seen in tmouts   */
@@ -160,13 +213,67 @@ EXP_ST u8  virgin_bits[MAP_SIZE],     /* Regions yet untouched by fuzzing */
 static u8  var_bytes[MAP_SIZE];       /* Bytes that appear to be variable */
 
 static s32 shm_id;                    /* ID of the SHM for code coverage  */
-static s32 shm_id_dfg;                /* ID of the SHM for DFG coverage   */
-static s32 shm_id_dfg_count;          /* ID of the SHM for DFG path count      */
+static s32 shm_id_dfg_list = -1;      /* ID of the SHM for DFG node list  */
+static s32 shm_id_pacfix = -1;        /* ID of the PACFIX oracles' SHM    */
+static s32 shm_id_fuzz = -1;          /* ID of the SHM for test cases     */
+
+static u32* shm_fuzz_len;             /* Test case length, in the SHM     */
+static u8*  shm_fuzz_buf;             /* Test case data, in the SHM       */
+
+/* An executor is a fork server along with its own SHM maps and input file.
+   With AFL_EXECUTORS, several of them run test cases side by side; the one
+   that is selected has its state in the usual globals (trace_bits,
+   fsrv_ctl_fd, out_file, etc). See select_executor(). */
+
+struct executor {
+
+  s32 fsrv_pid,                       /* PID of the fork server           */
+      ctl_fd,                         /* Fork server control pipe (write) */
+      st_fd,                          /* Fork server status pipe (read)   */
+      child_pid,                      /* PID of the running child         */
+      out_fd;                         /* Input file descriptor, if any    */
+
+  u8* out_file;                       /* Input file name, if any          */
+
+  s32 shm_id,                         /* IDs of the private SHM regions   */
+      shm_id_dfg_list,
+      shm_id_fuzz;
+
+  u8*  trace_bits;                    /* Private copies of the SHM maps   */
+  u32* dfg_list;
+  u8*  dfg_hit;
+
+  u32* shm_fuzz_len;                  /* Test case channel, if used       */
+  u8*  shm_fuzz_buf;
+
+  u32 prev_timed_out;                 /* Previous run was killed?         */
+
+  u8  busy,                           /* Run in progress?                 */
+      timed_out;                      /* Current run killed for timeout?  */
+
+  s32 status;                         /* Exit status of the last run      */
+
+  u64 start_us,                       /* Start of the current run (us)    */
+      deadline,                       /* When to kill it (ms)             */
+      run_us;                         /* Duration of the last run (us)    */
+
+  u8* buf;                            /* Havoc test case being run        */
+  u32 buf_len,                        /* Its length                       */
+      buf_size;                       /* Allocated size of buf            */
+  s32 stage_val;                      /* stage_cur_val for the test case  */
+
+};
+
+static struct executor* executors;    /* Executor pool, [0] = main one    */
+static struct executor* cur_executor; /* Executor owning the globals      */
+static u32 executor_cnt = 1;          /* Number of executors              */
 
 static volatile u8 stop_soon,         /* Ctrl-C pressed?                  */
                    clear_screen = 1,  /* Window resized?                  */
                    child_timed_out;   /* Traced process timed out?        */
 
+static u32 prev_timed_out;            /* Previous run was killed?         */
+
 EXP_ST u32 queued_paths,              /* Total number of queued testcases */
            queued_variable,           /* Testcases with variable behavior */
            queued_at_start,           /* Total number of initial inputs   */
@@ -192,6 +299,9 @@ EXP_ST u64 total_crashes,             /* Total number of crashes          */
            total_tmouts,              /* Total number of timeouts         */
            unique_tmouts,             /* Timeouts with unique signatures  */
            unique_hangs,              /* Hangs with unique signatures     */
+           dedup_hits,                /* Repeats caught by the dedup set  */
+           dedup_misses,              /* Inputs added to the dedup set    */
+           sync_filtered,             /* Imports turned down by filters   */
            total_execs,               /* Total execve() calls             */
            slowest_exec_ms,           /* Slowest testcase non hang in ms  */
            start_time,                /* Unix start time (ms)             */
@@ -220,6 +330,9 @@ static u32 master_id, master_max;     /* Master instance job splitting    */
 
 static u32 syncing_case;              /* Syncing with case #...           */
 
+static u64 sync_min_prox;             /* Min proximity of imports         */
+static u32 sync_top_k;                /* Max imports per peer and sync    */
+
 static s32 stage_cur_byte,            /* Byte offset of current stage op  */
            stage_cur_val;             /* Value used for stage op          */
 
@@ -259,7 +372,8 @@ struct queue_entry {
       has_new_cov,                    /* Triggers new coverage?           */
       var_behavior,                   /* Variable behavior?               */
       favored,                        /* Currently favored?               */
-      fs_redundant;                   /* Marked as redundant in the fs?   */
+      fs_redundant,                   /* Marked as redundant in the fs?   */
+      dfg_observed;                   /* Counted in dfg_node_count[]?     */
 
   u32 bitmap_size,                    /* Number of bits set in bitmap     */
       exec_cksum;                     /* Checksum of the execution trace  */
@@ -272,24 +386,54 @@ struct queue_entry {
       depth;                          /* Path depth                       */
 
   u8* trace_mini;                     /* Trace bytes, if kept             */
+  u8* dfg_nodes;                      /* DFG nodes reached (dfg-set.h)    */
+  u32 dfg_nodes_len,                  /* Encoded size of dfg_nodes        */
+      dfg_nodes_cnt;                  /* Number of DFG nodes reached      */
   u32 tc_ref;                         /* Trace bytes ref count            */
 
   struct queue_entry *next;           /* Next element, if any             */
 
+  struct queue_entry *tree_left,      /* Queue order treap children       */
+                     *tree_right;
+  u32 tree_prio,                      /* Treap heap priority              */
+      tree_size,                      /* Entries in this treap subtree    */
+      heap_idx;                       /* Slot in unhandled heap, 1-based  */
+
 };
 
 static struct queue_entry *queue,     /* Fuzzing queue (linked list)      */
                           *queue_cur, /* Current offset within the queue  */
                           *queue_last;/* Lastly added to the queue        */
 static struct queue_entry*
-  first_unhandled;                    /* 1st unhandled item in the queue  */
+  queue_root;                         /* Root of the queue order treap    */
 
-static struct queue_entry*
-  shortcut_per_100[1024];             /* 100*N entries (replace next_100) */
+static struct queue_entry**
+  unhandled;                          /* Heap of entries not yet handled  */
+
+static u32 unhandled_cnt,             /* Entries in the unhandled heap    */
+           unhandled_size;            /* Allocated unhandled heap slots   */
+
+static struct queue_entry**
+  splice_vec;                         /* Alias table: queue entries       */
+
+static u32 *splice_prob,              /* Alias table: keep probabilities  */
+           *splice_alias,             /* Alias table: alias indices       */
+           *splice_work,              /* Alias table: scratch space       */
+           splice_vec_cnt,            /* Entries in splice_vec[]          */
+           splice_vec_size;           /* Allocated splice_vec[] slots     */
+
+static double* splice_p;              /* Alias table: scaled weights      */
+
+static u8  splice_dirty = 1;          /* Alias table needs a rebuild?     */
+
+static u8  defer_queue_order;         /* Sort the queue later, in bulk?   */
 
 static struct queue_entry*
   top_rated[MAP_SIZE];                /* Top entries for bitmap bytes     */
 
+static struct queue_entry**
+  top_rated_dfg;                      /* Top entries for DFG nodes        */
+
 struct extra_data {
   u8* data;                           /* Dictionary token data            */
   u32 len;                            /* Dictionary token length          */
@@ -808,2739 +952,5446 @@ static void mark_as_redundant(struct queue_entry* q, u8 state) {
 }
 
 
-/* Insert a test case to the queue, preserving the sorted order based on the
- * proximity score. Updates global variables 'queue', 'shortcut_per_100', and
- * 'first_unhandled'. */
-static void sorted_insert_to_queue(struct queue_entry* q) {
+/* The queue is kept sorted by descending proximity score, ties broken by
+   entry ID (i.e., insertion order). The order lives in a treap augmented
+   with subtree sizes, giving O(log n) insertion, removal and rank lookup;
+   the 'next' links are spliced alongside, so walking 'queue' still visits
+   entries in the same order. Entries not yet handled in the current cycle
+   are also kept in a binary heap with the same ordering, so the next one
+   to fuzz is always at its top. */
 
-  if (!queue) shortcut_per_100[0] = queue = q;
-  else {
-    struct queue_entry* q_probe;
-    u32 is_inserted = 0, i = 0;
-    first_unhandled = NULL;
-
-    // Special case handling when we have to insert at the front.
-    if (queue->prox_score < q->prox_score) {
-      q->next = queue;
-      queue = q;
-      is_inserted = 1;
-    }
+#define TREE_SIZE(_q) ((_q) ? (_q)->tree_size : 0)
 
-    // Traverse through the list to (1) update 'shortcut_per_100', (2) update
-    // 'first_unhandled', and (3) insert 'q' at the proper position.
-    q_probe = queue;
-    while (q_probe) {
+static inline u8 queue_before(struct queue_entry* a, struct queue_entry* b) {
 
-      if ((i % 100 == 0) && (i / 100 < 1024)) {
-        shortcut_per_100[(i / 100)] = q_probe;
-      }
+  if (a->prox_score != b->prox_score) return a->prox_score > b->prox_score;
+  return a->entry_id < b->entry_id;
 
-      if (!first_unhandled && !q_probe->handled_in_cycle)
-        first_unhandled = q_probe;
+}
 
-      if (!is_inserted) {
-        // If reached the end or found the proper position, insert there.
-        if (!q_probe->next || q_probe->next->prox_score < q->prox_score) {
-          q->next = q_probe->next;
-          q_probe->next = q;
-          is_inserted = 1;
-        }
-      }
 
-      q_probe = q_probe->next;
-      i++;
+static inline void tree_fix_size(struct queue_entry* t) {
 
-    }
-  }
+  t->tree_size = 1 + TREE_SIZE(t->tree_left) + TREE_SIZE(t->tree_right);
 
 }
 
-/* Append new test case to the queue. */
-
-static void add_to_queue(u8* fname, u32 len, u8 passed_det, u64 prox_score) {
-
-  struct queue_entry* q = ck_alloc(sizeof(struct queue_entry));
-
-  q->fname        = fname;
-  q->len          = len;
-  q->depth        = cur_depth + 1;
-  q->passed_det   = passed_det;
-  q->prox_score   = prox_score;
-  q->entry_id     = queued_paths;
 
-  if (q->depth > max_depth) max_depth = q->depth;
+static struct queue_entry* tree_insert(struct queue_entry* t,
+                                       struct queue_entry* q) {
 
-  sorted_insert_to_queue(q);
+  struct queue_entry* c;
 
-  queue_last = q;
-  queued_paths++;
-  pending_not_fuzzed++;
+  if (!t) return q;
 
-  cycles_wo_finds = 0;
+  t->tree_size++;
 
-  last_path_time = get_cur_time();
+  if (queue_before(q, t)) {
 
-}
+    c = t->tree_left = tree_insert(t->tree_left, q);
+    if (c->tree_prio <= t->tree_prio) return t;
 
-/* Sort the queue based on the proximity score. Needed after the dry-run. */
+    /* Rotate right. */
 
-static void sort_queue(void) {
+    t->tree_left = c->tree_right;
+    c->tree_right = t;
 
-  struct queue_entry *q_next, *q_cur;
-  u32 i;
+  } else {
 
-  // First, backup 'queue'. Then, reset 'queue' and 'shortcut_per_100'.
-  q_cur = queue;
-  queue = NULL;
-  for (i = 0; i < 1024; i++) shortcut_per_100[i] = NULL;
+    c = t->tree_right = tree_insert(t->tree_right, q);
+    if (c->tree_prio <= t->tree_prio) return t;
 
-  while (q_cur) {
+    /* Rotate left. */
 
-    q_next = q_cur->next;
-    q_cur->next = NULL; // To satisfy sorted_insert_to_queue()'s assumption
-    sorted_insert_to_queue(q_cur);
-    q_cur = q_next;
+    t->tree_right = c->tree_left;
+    c->tree_left = t;
 
   }
 
-}
+  tree_fix_size(t);
+  tree_fix_size(c);
+  return c;
 
+}
 
-/* Destroy the entire queue. */
 
-EXP_ST void destroy_queue(void) {
+static struct queue_entry* tree_merge(struct queue_entry* l,
+                                      struct queue_entry* r) {
 
-  struct queue_entry *q = queue, *n;
+  if (!l) return r;
+  if (!r) return l;
 
-  while (q) {
+  if (l->tree_prio > r->tree_prio) {
 
-    n = q->next;
-    ck_free(q->fname);
-    ck_free(q->trace_mini);
-    ck_free(q);
-    q = n;
+    l->tree_right = tree_merge(l->tree_right, r);
+    tree_fix_size(l);
+    return l;
 
   }
 
-}
+  r->tree_left = tree_merge(l, r->tree_left);
+  tree_fix_size(r);
+  return r;
 
+}
 
-/* Write bitmap to file. The bitmap is useful mostly for the secret
-   -B option, to focus a separate fuzzing session on a particular
-   interesting input without rediscovering all the others. */
 
-EXP_ST void write_bitmap(void) {
+static struct queue_entry* tree_remove(struct queue_entry* t,
+                                       struct queue_entry* q) {
 
-  u8* fname;
-  s32 fd;
+  if (t == q) {
 
-  if (!bitmap_changed) return;
-  bitmap_changed = 0;
+    t = tree_merge(q->tree_left, q->tree_right);
+    q->tree_left = q->tree_right = NULL;
+    q->tree_size = 1;
+    return t;
 
-  fname = alloc_printf("%s/fuzz_bitmap", out_dir);
-  fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  }
 
-  if (fd < 0) PFATAL("Unable to open '%s'", fname);
+  t->tree_size--;
 
-  ck_write(fd, virgin_bits, MAP_SIZE, fname);
+  if (queue_before(q, t)) t->tree_left = tree_remove(t->tree_left, q);
+  else t->tree_right = tree_remove(t->tree_right, q);
 
-  close(fd);
-  ck_free(fname);
+  return t;
 
 }
 
 
-/* Read bitmap from file. This is for the -B option again. */
+/* Find the entry preceding 'q' in queue order, or NULL if 'q' comes first. */
 
-EXP_ST void read_bitmap(u8* fname) {
+static struct queue_entry* tree_pred(struct queue_entry* q) {
 
-  s32 fd = open(fname, O_RDONLY);
+  struct queue_entry *t = queue_root, *pred = NULL;
 
-  if (fd < 0) PFATAL("Unable to open '%s'", fname);
+  while (t != q) {
 
-  ck_read(fd, virgin_bits, MAP_SIZE, fname);
+    if (queue_before(q, t)) t = t->tree_left;
+    else { pred = t; t = t->tree_right; }
 
-  close(fd);
+  }
 
-}
+  if (q->tree_left) {
 
+    pred = q->tree_left;
+    while (pred->tree_right) pred = pred->tree_right;
 
-/* Check if the current execution path brings anything new to the table.
-   Update virgin bits to reflect the finds. Returns 1 if the only change is
-   the hit-count for a particular tuple; 2 if there are new tuples seen.
-   Updates the map, so subsequent calls will always return 0.
+  }
 
-   This function is called after every exec() on a fairly large buffer, so
-   it needs to be fast. We do this in 32-bit and 64-bit flavors. */
+  return pred;
 
-static inline u8 has_new_bits(u8* virgin_map) {
+}
 
-#ifdef WORD_SIZE_64
 
-  u64* current = (u64*)trace_bits;
-  u64* virgin  = (u64*)virgin_map;
+/* Return the queue entry at the given rank (0 = highest score). */
 
-  u32  i = (MAP_SIZE >> 3);
+static struct queue_entry* queue_at_rank(u32 rank) {
 
-#else
+  struct queue_entry* t = queue_root;
 
-  u32* current = (u32*)trace_bits;
-  u32* virgin  = (u32*)virgin_map;
+  while (t) {
 
-  u32  i = (MAP_SIZE >> 2);
+    u32 ls = TREE_SIZE(t->tree_left);
 
-#endif /* ^WORD_SIZE_64 */
+    if (rank < ls) t = t->tree_left;
+    else if (rank == ls) return t;
+    else { rank -= ls + 1; t = t->tree_right; }
 
-  u8   ret = 0;
+  }
 
-  while (i--) {
+  return NULL;
 
-    /* Optimize for (*current & *virgin) == 0 - i.e., no bits in current bitmap
-       that have not been already cleared from the virgin map - since this will
-       almost always be the case. */
+}
 
-    if (unlikely(*current) && unlikely(*current & *virgin)) {
 
-      if (likely(ret < 2)) {
+/* Unhandled heap primitives. 'heap_idx' is 1-based, 0 = not in the heap. */
 
-        u8* cur = (u8*)current;
-        u8* vir = (u8*)virgin;
+static inline void heap_place(struct queue_entry* q, u32 i) {
 
-        /* Looks like we have not found any new bytes yet; see if any non-zero
-           bytes in current[] are pristine in virgin[]. */
+  unhandled[i] = q;
+  q->heap_idx  = i + 1;
 
-#ifdef WORD_SIZE_64
+}
 
-        if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
-            (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff) ||
-            (cur[4] && vir[4] == 0xff) || (cur[5] && vir[5] == 0xff) ||
-            (cur[6] && vir[6] == 0xff) || (cur[7] && vir[7] == 0xff)) ret = 2;
-        else ret = 1;
 
-#else
+static void heap_sift_up(u32 i) {
 
-        if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
-            (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff)) ret = 2;
-        else ret = 1;
+  struct queue_entry* q = unhandled[i];
 
-#endif /* ^WORD_SIZE_64 */
+  while (i) {
 
-      }
+    u32 p = (i - 1) / 2;
+    if (!queue_before(q, unhandled[p])) break;
+    heap_place(unhandled[p], i);
+    i = p;
 
-      *virgin &= ~*current;
+  }
 
-    }
+  heap_place(q, i);
 
-    current++;
-    virgin++;
+}
 
-  }
 
-  if (ret && virgin_map == virgin_bits) bitmap_changed = 1;
+static void heap_sift_down(u32 i) {
 
-  return ret;
+  struct queue_entry* q = unhandled[i];
 
-}
+  while (1) {
 
+    u32 c = i * 2 + 1;
 
-/* Count the number of bits set in the provided bitmap. Used for the status
-   screen several times every second, does not have to be fast. */
+    if (c >= unhandled_cnt) break;
+    if (c + 1 < unhandled_cnt && queue_before(unhandled[c + 1], unhandled[c]))
+      c++;
+    if (!queue_before(unhandled[c], q)) break;
 
-static u32 count_bits(u8* mem) {
+    heap_place(unhandled[c], i);
+    i = c;
 
-  u32* ptr = (u32*)mem;
-  u32  i   = (MAP_SIZE >> 2);
-  u32  ret = 0;
+  }
 
-  while (i--) {
+  heap_place(q, i);
 
-    u32 v = *(ptr++);
+}
 
-    /* This gets called on the inverse, virgin bitmap; optimize for sparse
-       data. */
 
-    if (v == 0xffffffff) {
-      ret += 32;
-      continue;
-    }
+static void push_unhandled(struct queue_entry* q) {
 
-    v -= ((v >> 1) & 0x55555555);
-    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
-    ret += (((v + (v >> 4)) & 0xF0F0F0F) * 0x01010101) >> 24;
+  if (unhandled_cnt == unhandled_size) {
+
+    unhandled_size = unhandled_size ? unhandled_size * 2 : 1024;
+    unhandled = ck_realloc(unhandled, unhandled_size * sizeof(struct queue_entry*));
 
   }
 
-  return ret;
+  heap_place(q, unhandled_cnt++);
+  heap_sift_up(unhandled_cnt - 1);
 
 }
 
 
-#define FF(_b)  (0xff << ((_b) << 3))
-
-/* Count the number of bytes set in the bitmap. Called fairly sporadically,
-   mostly to update the status screen or calibrate and examine confirmed
-   new paths. */
-
-static u32 count_bytes(u8* mem) {
+/* Take the best entry not yet handled in this cycle, or NULL if none. */
 
-  u32* ptr = (u32*)mem;
-  u32  i   = (MAP_SIZE >> 2);
-  u32  ret = 0;
+static struct queue_entry* pop_unhandled(void) {
 
-  while (i--) {
+  struct queue_entry* q;
 
-    u32 v = *(ptr++);
+  if (!unhandled_cnt) return NULL;
 
-    if (!v) continue;
-    if (v & FF(0)) ret++;
-    if (v & FF(1)) ret++;
-    if (v & FF(2)) ret++;
-    if (v & FF(3)) ret++;
+  q = unhandled[0];
+  q->heap_idx = 0;
 
+  if (--unhandled_cnt) {
+    heap_place(unhandled[unhandled_cnt], 0);
+    heap_sift_down(0);
   }
 
-  return ret;
+  return q;
 
 }
 
 
-/* Count the number of non-255 bytes set in the bitmap. Used strictly for the
-   status screen, several calls per second or so. */
-
-static u32 count_non_255_bytes(u8* mem) {
+/* Start a new cycle: mark every entry as unhandled. The queue is already in
+   heap order, so no sifting is needed. */
 
-  u32* ptr = (u32*)mem;
-  u32  i   = (MAP_SIZE >> 2);
-  u32  ret = 0;
+static void reset_unhandled(void) {
 
-  while (i--) {
+  struct queue_entry* q;
 
-    u32 v = *(ptr++);
+  unhandled_cnt = 0;
 
-    /* This is called on the virgin bitmap, so optimize for the most likely
-       case. */
+  for (q = queue; q; q = q->next) {
 
-    if (v == 0xffffffff) continue;
-    if ((v & FF(0)) != FF(0)) ret++;
-    if ((v & FF(1)) != FF(1)) ret++;
-    if ((v & FF(2)) != FF(2)) ret++;
-    if ((v & FF(3)) != FF(3)) ret++;
+    q->handled_in_cycle = 0;
+    q->heap_idx = 0;
+    push_unhandled(q);
 
   }
 
-  return ret;
-
 }
 
-static u64 compute_proximity_score(void) {
 
-  u64 prox_score = 0;
-  u64 path_score = 0;
-  u32 i = DFG_MAP_SIZE;
+/* Insert a test case to the queue, preserving the sorted order based on the
+   proximity score. New entries are unhandled in the current cycle. */
 
-  while (i--) {
-    if (dfg_counts[i] > 0){
-      dfg_node_count[i]++;
-      path_score += dfg_node_count[i] * 1000 / dfg_counts[i];
-    }
-  }
+static void sorted_insert_to_queue(struct queue_entry* q) {
 
-  i = DFG_MAP_SIZE;
+  struct queue_entry* pred;
 
-  while (i--) {
-    prox_score += dfg_bits[i];
+  q->tree_left = q->tree_right = NULL;
+  q->tree_size = 1;
+  q->tree_prio = random();
+
+  queue_root = tree_insert(queue_root, q);
+
+  pred = tree_pred(q);
+
+  if (pred) {
+    q->next = pred->next;
+    pred->next = q;
+  } else {
+    q->next = queue;
+    queue = q;
   }
 
-  path_score = path_score * 14 / 10000 ;
+  if (!q->handled_in_cycle) push_unhandled(q);
 
-  if (prox_score < path_score) return 0;
-  return (prox_score - path_score);
+  splice_dirty = 1;
 
 }
 
-/* Destructively simplify trace by eliminating hit count information
-   and replacing it with 0x80 or 0x01 depending on whether the tuple
-   is hit or not. Called on every new crash or timeout, should be
-   reasonably fast. */
 
-static const u8 simplify_lookup[256] = {
+/* Update the proximity score of a queued test case, moving it to its new
+   position in the queue (and in the unhandled heap, if it's there). While
+   defer_queue_order is set, only the score is stored, and the order is left
+   for rebuild_queue_order() to fix up. */
 
-  [0]         = 1,
-  [1 ... 255] = 128
+static void update_prox_score(struct queue_entry* q, u64 prox_score) {
 
-};
+  struct queue_entry* pred;
 
-#ifdef WORD_SIZE_64
+  if (q->prox_score == prox_score) return;
 
-static void simplify_trace(u64* mem) {
+  if (defer_queue_order) {
+    q->prox_score = prox_score;
+    return;
+  }
 
-  u32 i = MAP_SIZE >> 3;
+  pred = tree_pred(q);
+  if (pred) pred->next = q->next; else queue = q->next;
 
-  while (i--) {
+  queue_root = tree_remove(queue_root, q);
+  q->prox_score = prox_score;
+  queue_root = tree_insert(queue_root, q);
 
-    /* Optimize for sparse bitmaps. */
+  pred = tree_pred(q);
 
-    if (unlikely(*mem)) {
+  if (pred) {
+    q->next = pred->next;
+    pred->next = q;
+  } else {
+    q->next = queue;
+    queue = q;
+  }
 
-      u8* mem8 = (u8*)mem;
+  if (q->heap_idx) {
+    heap_sift_up(q->heap_idx - 1);
+    heap_sift_down(q->heap_idx - 1);
+  }
 
-      mem8[0] = simplify_lookup[mem8[0]];
-      mem8[1] = simplify_lookup[mem8[1]];
-      mem8[2] = simplify_lookup[mem8[2]];
-      mem8[3] = simplify_lookup[mem8[3]];
-      mem8[4] = simplify_lookup[mem8[4]];
-      mem8[5] = simplify_lookup[mem8[5]];
-      mem8[6] = simplify_lookup[mem8[6]];
-      mem8[7] = simplify_lookup[mem8[7]];
+  splice_dirty = 1;
 
-    } else *mem = 0x0101010101010101ULL;
+}
 
-    mem++;
+/* Put the whole queue back in order after scores were updated with
+   defer_queue_order set: one sort, then the list, the treap and the
+   unhandled heap are rebuilt from the sorted array. This beats moving the
+   entries one by one when all of them get scored at once, as in the dry
+   run. */
 
-  }
+static int compare_queue_order(const void* a, const void* b) {
+
+  struct queue_entry *qa = *(struct queue_entry**)a,
+                     *qb = *(struct queue_entry**)b;
+
+  if (queue_before(qa, qb)) return -1;
+  return queue_before(qb, qa);
 
 }
 
-#else
 
-static void simplify_trace(u32* mem) {
+static void rebuild_queue_order(void) {
 
-  u32 i = MAP_SIZE >> 2;
+  struct queue_entry** all;
+  struct queue_entry* q;
+  u32 i = 0, cnt = 0;
 
-  while (i--) {
+  if (!queue) return;
 
-    /* Optimize for sparse bitmaps. */
+  all = ck_alloc(queued_paths * sizeof(struct queue_entry*));
 
-    if (unlikely(*mem)) {
+  for (q = queue; q; q = q->next) all[cnt++] = q;
 
-      u8* mem8 = (u8*)mem;
+  qsort(all, cnt, sizeof(struct queue_entry*), compare_queue_order);
 
-      mem8[0] = simplify_lookup[mem8[0]];
-      mem8[1] = simplify_lookup[mem8[1]];
-      mem8[2] = simplify_lookup[mem8[2]];
-      mem8[3] = simplify_lookup[mem8[3]];
+  queue = all[0];
+  queue_root = NULL;
+  unhandled_cnt = 0;
 
-    } else *mem = 0x01010101;
+  for (i = 0; i < cnt; i++) {
 
-    mem++;
-  }
+    q = all[i];
 
-}
+    q->next = i + 1 < cnt ? all[i + 1] : NULL;
+    q->tree_left = q->tree_right = NULL;
+    q->tree_size = 1;
+    queue_root = tree_insert(queue_root, q);
 
-#endif /* ^WORD_SIZE_64 */
+    /* A sorted array is a valid heap, so entries can be placed as is. */
 
+    if (q->heap_idx) heap_place(q, unhandled_cnt++);
 
-/* Destructively classify execution counts in a trace. This is used as a
-   preprocessing step for any newly acquired traces. Called on every exec,
-   must be fast. */
+  }
 
-static const u8 count_class_lookup8[256] = {
+  ck_free(all);
 
-  [0]           = 0,
-  [1]           = 1,
-  [2]           = 2,
-  [3]           = 4,
-  [4 ... 7]     = 8,
-  [8 ... 15]    = 16,
-  [16 ... 31]   = 32,
-  [32 ... 127]  = 64,
-  [128 ... 255] = 128
+  splice_dirty = 1;
 
-};
+}
 
-static u16 count_class_lookup16[65536];
 
+/* (Re)build the alias table (Vose's method) for drawing splicing partners
+   in proportion to their proximity score, with AFL_SPLICE_PROX. Done at
+   most once per splicing stage, and only if the queue changed since the
+   last build; the buffers are kept around between rebuilds. */
 
-EXP_ST void init_count_class16(void) {
+static void build_splice_table(void) {
 
-  u32 b1, b2;
+  struct queue_entry* q;
+  u64 min_score = U64_MAX;
+  double sum = 0;
+  u32 *small, *large, n_small = 0, n_large = 0, i = 0;
 
-  for (b1 = 0; b1 < 256; b1++)
-    for (b2 = 0; b2 < 256; b2++)
-      count_class_lookup16[(b1 << 8) + b2] =
-        (count_class_lookup8[b1] << 8) |
-        count_class_lookup8[b2];
+  if (splice_vec_size < queued_paths) {
 
-}
+    splice_vec_size = queued_paths * 2;
+    splice_vec   = ck_realloc(splice_vec, splice_vec_size * sizeof(struct queue_entry*));
+    splice_prob  = ck_realloc(splice_prob, splice_vec_size * sizeof(u32));
+    splice_alias = ck_realloc(splice_alias, splice_vec_size * sizeof(u32));
+    splice_work  = ck_realloc(splice_work, splice_vec_size * 2 * sizeof(u32));
+    splice_p     = ck_realloc(splice_p, splice_vec_size * sizeof(double));
 
+  }
 
-#ifdef WORD_SIZE_64
+  for (q = queue; q; q = q->next) {
 
-static inline void classify_counts(u64* mem) {
+    splice_vec[i++] = q;
+    if (q->prox_score < min_score) min_score = q->prox_score;
 
-  u32 i = MAP_SIZE >> 3;
+  }
 
-  while (i--) {
+  splice_vec_cnt = queued_paths;
+  splice_dirty   = 0;
 
-    /* Optimize for sparse bitmaps. */
+  /* Weights are shifted so that the least promising entry still has a
+     small chance of being picked. */
 
-    if (unlikely(*mem)) {
+  for (i = 0; i < queued_paths; i++)
+    sum += splice_vec[i]->prox_score - min_score + 1;
 
-      u16* mem16 = (u16*)mem;
+  small = splice_work;
+  large = splice_work + queued_paths;
 
-      mem16[0] = count_class_lookup16[mem16[0]];
-      mem16[1] = count_class_lookup16[mem16[1]];
-      mem16[2] = count_class_lookup16[mem16[2]];
-      mem16[3] = count_class_lookup16[mem16[3]];
+  for (i = 0; i < queued_paths; i++) {
 
-    }
+    splice_p[i] = (splice_vec[i]->prox_score - min_score + 1) *
+                  queued_paths / sum;
 
-    mem++;
+    if (splice_p[i] < 1.0) small[n_small++] = i; else large[n_large++] = i;
 
   }
 
-}
-
-#else
+  while (n_small && n_large) {
 
-static inline void classify_counts(u32* mem) {
+    u32 s = small[--n_small], l = large[--n_large];
 
-  u32 i = MAP_SIZE >> 2;
+    splice_prob[s]  = splice_p[s] * SPLICE_PROB_ONE;
+    splice_alias[s] = l;
 
-  while (i--) {
+    splice_p[l] -= 1.0 - splice_p[s];
+    if (splice_p[l] < 1.0) small[n_small++] = l; else large[n_large++] = l;
 
-    /* Optimize for sparse bitmaps. */
+  }
 
-    if (unlikely(*mem)) {
+  /* Whatever is left over is 1.0, give or take rounding errors. */
 
-      u16* mem16 = (u16*)mem;
+  while (n_large) splice_prob[large[--n_large]] = SPLICE_PROB_ONE;
+  while (n_small) splice_prob[small[--n_small]] = SPLICE_PROB_ONE;
 
-      mem16[0] = count_class_lookup16[mem16[0]];
-      mem16[1] = count_class_lookup16[mem16[1]];
+}
 
-    }
 
-    mem++;
+/* Pick a random splicing partner: uniformly across the queue by rank in the
+   treap, or weighted by proximity score through the alias table. The table
+   is only refreshed on the first draw of a splicing stage (new_stage); paths
+   found or rescored later in the stage wait for the next one. */
 
-  }
+static struct queue_entry* pick_splice_partner(u8 new_stage) {
 
-}
+  u32 idx;
 
-#endif /* ^WORD_SIZE_64 */
+  if (!splice_prox) return queue_at_rank(UR(queued_paths));
 
+  if (splice_dirty && new_stage) build_splice_table();
 
-/* Get rid of shared memory (atexit handler). */
+  idx = UR(splice_vec_cnt);
 
-static void remove_shm(void) {
+  if (UR(SPLICE_PROB_ONE) >= splice_prob[idx]) idx = splice_alias[idx];
 
-  shmctl(shm_id, IPC_RMID, NULL);
-  shmctl(shm_id_dfg, IPC_RMID, NULL);
-  shmctl(shm_id_dfg_count, IPC_RMID, NULL);
+  return splice_vec[idx];
 
 }
 
 
-/* Compact trace bytes into a smaller bitmap. We effectively just drop the
-   count information here. This is called only sporadically, for some
-   new paths. */
+/* Append new test case to the queue. */
 
-static void minimize_bits(u8* dst, u8* src) {
+static void add_to_queue(u8* fname, u32 len, u8 passed_det, u64 prox_score) {
 
-  u32 i = 0;
+  struct queue_entry* q = ck_alloc(sizeof(struct queue_entry));
 
-  while (i < MAP_SIZE) {
+  q->fname        = fname;
+  q->len          = len;
+  q->depth        = cur_depth + 1;
+  q->passed_det   = passed_det;
+  q->prox_score   = prox_score;
+  q->entry_id     = queued_paths;
 
-    if (*(src++)) dst[i >> 3] |= 1 << (i & 7);
-    i++;
+  if (q->depth > max_depth) max_depth = q->depth;
 
-  }
+  sorted_insert_to_queue(q);
 
-}
+  queue_last = q;
+  queued_paths++;
+  pending_not_fuzzed++;
 
+  cycles_wo_finds = 0;
 
-/* When we bump into a new path, we call this to see if the path appears
-   more "favorable" than any of the existing ones. The purpose of the
-   "favorables" is to have a minimal set of paths that trigger all the bits
-   seen in the bitmap so far, and focus on fuzzing them at the expense of
-   the rest.
+  last_path_time = get_cur_time();
 
-   The first step of the process is to maintain a list of top_rated[] entries
-   for every byte in the bitmap. We win that slot if there is no previous
-   contender, or if the contender has a more favorable speed x size factor. */
+}
 
-static void update_bitmap_score(struct queue_entry* q) {
+/* Destroy the entire queue. */
 
-  u32 i;
-  u64 fav_factor = q->exec_us * q->len;
+EXP_ST void destroy_queue(void) {
 
-  /* For every byte set in trace_bits[], see if there is a previous winner,
-     and how it compares to us. */
+  struct queue_entry *q = queue, *n;
 
-  for (i = 0; i < MAP_SIZE; i++)
+  while (q) {
 
-    if (trace_bits[i]) {
+    n = q->next;
+    ck_free(q->fname);
+    ck_free(q->trace_mini);
+    ck_free(q->dfg_nodes);
+    ck_free(q);
+    q = n;
 
-       if (top_rated[i]) {
+  }
 
-         /* Faster-executing or smaller test cases are favored. */
+  ck_free(unhandled);
+  ck_free(splice_vec);
+  ck_free(splice_prob);
+  ck_free(splice_alias);
+  ck_free(splice_work);
+  ck_free(splice_p);
 
-         if (fav_factor > top_rated[i]->exec_us * top_rated[i]->len) continue;
+}
 
-         /* Looks like we're going to win. Decrease ref count for the
-            previous winner, discard its trace_bits[] if necessary. */
 
-         if (!--top_rated[i]->tc_ref) {
-           ck_free(top_rated[i]->trace_mini);
-           top_rated[i]->trace_mini = 0;
-         }
+/* Write bitmap to file. The bitmap is useful mostly for the secret
+   -B option, to focus a separate fuzzing session on a particular
+   interesting input without rediscovering all the others. */
 
-       }
+EXP_ST void write_bitmap(void) {
 
-       /* Insert ourselves as the new winner. */
+  u8* fname;
+  s32 fd;
 
-       top_rated[i] = q;
-       q->tc_ref++;
+  if (!bitmap_changed) return;
+  bitmap_changed = 0;
 
-       if (!q->trace_mini) {
-         q->trace_mini = ck_alloc(MAP_SIZE >> 3);
-         minimize_bits(q->trace_mini, trace_bits);
-       }
+  fname = alloc_printf("%s/fuzz_bitmap", out_dir);
+  fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
 
-       score_changed = 1;
+  if (fd < 0) PFATAL("Unable to open '%s'", fname);
 
-     }
+  ck_write(fd, virgin_bits, MAP_SIZE, fname);
 
-}
+  close(fd);
+  ck_free(fname);
 
+}
 
-/* The second part of the mechanism discussed above is a routine that
-   goes over top_rated[] entries, and then sequentially grabs winners for
-   previously-unseen bytes (temp_v) and marks them as favored, at least
-   until the next run. The favored entries are given more air time during
-   all fuzzing steps. */
 
-static void cull_queue(void) {
+/* Read bitmap from file. This is for the -B option again. */
 
-  struct queue_entry* q;
-  static u8 temp_v[MAP_SIZE >> 3];
-  u32 i;
+EXP_ST void read_bitmap(u8* fname) {
 
-  if (dumb_mode || !score_changed) return;
+  s32 fd = open(fname, O_RDONLY);
 
-  score_changed = 0;
+  if (fd < 0) PFATAL("Unable to open '%s'", fname);
 
-  memset(temp_v, 255, MAP_SIZE >> 3);
+  ck_read(fd, virgin_bits, MAP_SIZE, fname);
 
-  queued_favored  = 0;
-  pending_favored = 0;
+  close(fd);
 
-  q = queue;
+}
 
-  while (q) {
-    q->favored = 0;
-    q = q->next;
-  }
 
-  /* Let's see if anything in the bitmap isn't captured in temp_v.
-     If yes, and if it has a top_rated[] contender, let's use it. */
+/* Check if last_trace still describes trace_bits, i.e. if nothing ran or
+   touched the map since analyze_trace(). */
 
-  for (i = 0; i < MAP_SIZE; i++)
-    if (top_rated[i] && (temp_v[i >> 3] & (1 << (i & 7)))) {
+static inline u8 trace_known(void) {
 
-      u32 j = MAP_SIZE >> 3;
+  return last_trace.map == trace_bits && last_trace.execs == total_execs;
 
-      /* Remove all bits belonging to the current entry from temp_v. */
+}
 
-      while (j--)
-        if (top_rated[i]->trace_mini[j])
-          temp_v[j] &= ~top_rated[i]->trace_mini[j];
 
-      top_rated[i]->favored = 1;
-      queued_favored++;
+/* Check if the current execution path brings anything new to the table.
+   Update virgin bits to reflect the finds. Returns 1 if the only change is
+   the hit-count for a particular tuple; 2 if there are new tuples seen.
+   Updates the map, so subsequent calls will always return 0.
 
-      if (!top_rated[i]->was_fuzzed) pending_favored++;
+   This function is called after every exec() on a fairly large buffer, so
+   it needs to be fast. We do this in 32-bit and 64-bit flavors. Most of the
+   time, though, analyze_trace() has already found that there is nothing
+   new, and since virgin bits only ever get cleared, that still holds. */
 
-    }
+static inline u8 has_new_bits(u8* virgin_map) {
 
-  q = queue;
+#ifdef WORD_SIZE_64
 
-  while (q) {
-    mark_as_redundant(q, !q->favored);
-    q = q->next;
-  }
+  u64* current = (u64*)trace_bits;
+  u64* virgin  = (u64*)virgin_map;
 
-}
+  u32  i = (MAP_SIZE >> 3);
 
+#else
 
-/* Configure shared memory and virgin_bits. This is called at startup. */
+  u32* current = (u32*)trace_bits;
+  u32* virgin  = (u32*)virgin_map;
 
-EXP_ST void setup_shm(void) {
+  u32  i = (MAP_SIZE >> 2);
 
-  u8* shm_str;
-  u8* shm_str_dfg;
-  u8* shm_str_dfg_count;
+#endif /* ^WORD_SIZE_64 */
 
-  if (!in_bitmap) memset(virgin_bits, 255, MAP_SIZE);
+  u8   ret = 0;
 
-  memset(virgin_tmout, 255, MAP_SIZE);
-  memset(virgin_crash, 255, MAP_SIZE);
+  if (virgin_map == virgin_bits && !last_trace.new_bits && trace_known())
+    return 0;
 
-  shm_id = shmget(IPC_PRIVATE, MAP_SIZE, IPC_CREAT | IPC_EXCL | 0600);
-  shm_id_dfg = shmget(IPC_PRIVATE, sizeof(u32) * DFG_MAP_SIZE,
-                      IPC_CREAT | IPC_EXCL | 0600);
-  shm_id_dfg_count = shmget(IPC_PRIVATE, sizeof(u64) * DFG_MAP_SIZE,
-                            IPC_CREAT | IPC_EXCL | 0600);
+#ifdef HAVE_BITMAP_SIMD
 
-  if (shm_id < 0) PFATAL("shmget() failed");
+  if (bitmap_simd) {
+    ret = bitmap_new_bits(bitmap_simd, trace_bits, virgin_map, MAP_SIZE);
+    i   = 0;
+  }
 
-  atexit(remove_shm);
+#endif /* HAVE_BITMAP_SIMD */
 
-  shm_str = alloc_printf("%d", shm_id);
-  shm_str_dfg = alloc_printf("%d", shm_id_dfg);
-  shm_str_dfg_count = alloc_printf("%d", shm_id_dfg_count);
+  while (i--) {
 
-  /* If somebody is asking us to fuzz instrumented binaries in dumb mode,
-     we don't want them to detect instrumentation, since we won't be sending
-     fork server commands. This should be replaced with better auto-detection
-     later on, perhaps? */
+    /* Optimize for (*current & *virgin) == 0 - i.e., no bits in current bitmap
+       that have not been already cleared from the virgin map - since this will
+       almost always be the case. */
 
-  if (!dumb_mode) setenv(SHM_ENV_VAR, shm_str, 1);
-  if (!dumb_mode) setenv(SHM_ENV_VAR_DFG, shm_str_dfg, 1);
-  if (!dumb_mode) setenv(SHM_ENV_VAR_DFG_COUNT, shm_str_dfg_count, 1);
+    if (unlikely(*current) && unlikely(*current & *virgin)) {
 
-  ck_free(shm_str);
-  ck_free(shm_str_dfg);
-  ck_free(shm_str_dfg_count);
+      if (likely(ret < 2)) {
 
-  trace_bits = shmat(shm_id, NULL, 0);
-  dfg_bits = shmat(shm_id_dfg, NULL, 0);
-  dfg_counts = shmat(shm_id_dfg_count, NULL, 0);
+        u8* cur = (u8*)current;
+        u8* vir = (u8*)virgin;
 
-  if (trace_bits == (void *)-1) PFATAL("shmat() failed");
-  if (dfg_bits == (void *)-1) PFATAL("shmat() failed");
-  if (dfg_counts == (void *)-1) PFATAL("shmat() failed");
+        /* Looks like we have not found any new bytes yet; see if any non-zero
+           bytes in current[] are pristine in virgin[]. */
 
-}
+#ifdef WORD_SIZE_64
 
+        if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
+            (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff) ||
+            (cur[4] && vir[4] == 0xff) || (cur[5] && vir[5] == 0xff) ||
+            (cur[6] && vir[6] == 0xff) || (cur[7] && vir[7] == 0xff)) ret = 2;
+        else ret = 1;
 
-/* Load postprocessor, if available. */
+#else
 
-static void setup_post(void) {
+        if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
+            (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff)) ret = 2;
+        else ret = 1;
 
-  void* dh;
-  u8* fn = getenv("AFL_POST_LIBRARY");
-  u32 tlen = 6;
+#endif /* ^WORD_SIZE_64 */
 
-  if (!fn) return;
+      }
 
-  ACTF("Loading postprocessor from '%s'...", fn);
+      *virgin &= ~*current;
 
-  dh = dlopen(fn, RTLD_NOW);
-  if (!dh) FATAL("%s", dlerror());
+    }
 
-  post_handler = dlsym(dh, "afl_postprocess");
-  if (!post_handler) FATAL("Symbol 'afl_postprocess' not found.");
+    current++;
+    virgin++;
 
-  /* Do a quick test. It's better to segfault now than later =) */
+  }
 
-  post_handler("hello", &tlen);
+  if (ret && virgin_map == virgin_bits) bitmap_changed = 1;
 
-  OKF("Postprocessor installed successfully.");
+  return ret;
 
 }
 
 
-/* Read all testcases from the input directory, then queue them for testing.
-   Called at startup. */
+/* Count the number of bits set in the provided bitmap. Used for the status
+   screen several times every second, does not have to be fast. */
 
-static void read_testcases(void) {
+static u32 count_bits(u8* mem) {
 
-  struct dirent **nl;
-  s32 nl_cnt;
-  u32 i;
-  u8* fn;
+  u32* ptr = (u32*)mem;
+  u32  i   = (MAP_SIZE >> 2);
+  u32  ret = 0;
 
-  /* Auto-detect non-in-place resumption attempts. */
+#ifdef HAVE_BITMAP_SIMD
+  if (bitmap_simd) return bitmap_count_bits(bitmap_simd, mem, MAP_SIZE);
+#endif /* HAVE_BITMAP_SIMD */
 
-  fn = alloc_printf("%s/queue", in_dir);
-  if (!access(fn, F_OK)) in_dir = fn; else ck_free(fn);
+  while (i--) {
 
-  ACTF("Scanning '%s'...", in_dir);
+    u32 v = *(ptr++);
 
-  /* We use scandir() + alphasort() rather than readdir() because otherwise,
-     the ordering  of test cases would vary somewhat randomly and would be
-     difficult to control. */
+    /* This gets called on the inverse, virgin bitmap; optimize for sparse
+       data. */
 
-  nl_cnt = scandir(in_dir, &nl, NULL, alphasort);
+    if (v == 0xffffffff) {
+      ret += 32;
+      continue;
+    }
 
-  if (nl_cnt < 0) {
+    v -= ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    ret += (((v + (v >> 4)) & 0xF0F0F0F) * 0x01010101) >> 24;
 
-    if (errno == ENOENT || errno == ENOTDIR)
+  }
 
-      SAYF("\n" cLRD "[-] " cRST
-           "The input directory does not seem to be valid - try again. The fuzzer needs\n"
-           "    one or more test case to start with - ideally, a small file under 1 kB\n"
-           "    or so. The cases must be stored as regular files directly in the input\n"
-           "    directory.\n");
+  return ret;
 
-    PFATAL("Unable to open '%s'", in_dir);
+}
 
-  }
 
-  if (shuffle_queue && nl_cnt > 1) {
+#define FF(_b)  (0xff << ((_b) << 3))
 
-    ACTF("Shuffling queue...");
-    shuffle_ptrs((void**)nl, nl_cnt);
+/* Count the number of bytes set in the bitmap. Called fairly sporadically,
+   mostly to update the status screen or calibrate and examine confirmed
+   new paths. */
 
-  }
+static u32 count_bytes(u8* mem) {
 
-  for (i = 0; i < nl_cnt; i++) {
+  u32* ptr = (u32*)mem;
+  u32  i   = (MAP_SIZE >> 2);
+  u32  ret = 0;
 
-    struct stat st;
+  while (i--) {
 
-    u8* fn = alloc_printf("%s/%s", in_dir, nl[i]->d_name);
-    u8* dfn = alloc_printf("%s/.state/deterministic_done/%s", in_dir, nl[i]->d_name);
+    u32 v = *(ptr++);
 
-    u8  passed_det = 0;
+    if (!v) continue;
+    if (v & FF(0)) ret++;
+    if (v & FF(1)) ret++;
+    if (v & FF(2)) ret++;
+    if (v & FF(3)) ret++;
 
-    free(nl[i]); /* not tracked */
+  }
 
-    if (lstat(fn, &st) || access(fn, R_OK))
-      PFATAL("Unable to access '%s'", fn);
+  return ret;
 
-    /* This also takes care of . and .. */
+}
 
-    if (!S_ISREG(st.st_mode) || !st.st_size || strstr(fn, "/README.txt")) {
 
-      ck_free(fn);
-      ck_free(dfn);
-      continue;
+/* Count the number of non-255 bytes set in the bitmap. Used strictly for the
+   status screen, several calls per second or so. */
 
-    }
+static u32 count_non_255_bytes(u8* mem) {
 
-    if (st.st_size > MAX_FILE)
-      FATAL("Test case '%s' is too big (%s, limit is %s)", fn,
-            DMS(st.st_size), DMS(MAX_FILE));
+  u32* ptr = (u32*)mem;
+  u32  i   = (MAP_SIZE >> 2);
+  u32  ret = 0;
 
-    /* Check for metadata that indicates that deterministic fuzzing
-       is complete for this entry. We don't want to repeat deterministic
-       fuzzing when resuming aborted scans, because it would be pointless
-       and probably very time-consuming. */
+  while (i--) {
 
-    if (!access(dfn, F_OK)) passed_det = 1;
-    ck_free(dfn);
+    u32 v = *(ptr++);
 
-    // Provide 0 as the proximity score and update later in calibrate_case(),
-    // and sort later after the dry-run phase.
-    add_to_queue(fn, st.st_size, passed_det, 0);
+    /* This is called on the virgin bitmap, so optimize for the most likely
+       case. */
+
+    if (v == 0xffffffff) continue;
+    if ((v & FF(0)) != FF(0)) ret++;
+    if ((v & FF(1)) != FF(1)) ret++;
+    if ((v & FF(2)) != FF(2)) ret++;
+    if ((v & FF(3)) != FF(3)) ret++;
 
   }
 
-  free(nl); /* not tracked */
+  return ret;
 
-  if (!queued_paths) {
+}
 
-    SAYF("\n" cLRD "[-] " cRST
-         "Looks like there are no valid test cases in the input directory! The fuzzer\n"
-         "    needs one or more test case to start with - ideally, a small file under\n"
-         "    1 kB or so. The cases must be stored as regular files directly in the\n"
-         "    input directory.\n");
+/* List the DFG nodes reached by the last execution. With sparse DFG
+   feedback, the target keeps the list in dfg_list[]; otherwise, we sweep the
+   hit map, a word at a time, and keep the result until the next execution
+   (or until the map is reset). */
 
-    FATAL("No usable test cases in '%s'", in_dir);
+static u32* dfg_swept;                /* Nodes found by the last sweep    */
+static u32  dfg_swept_cnt;            /* Number of those                  */
+static u64  dfg_swept_execs;          /* total_execs as of the sweep      */
+static u8*  dfg_swept_map;            /* Hit map swept, NULL if none      */
 
-  }
+static u32* dfg_touched(u32* cnt) {
 
-  last_path_time = 0;
-  queued_at_start = queued_paths;
+  u32 i, j;
 
-}
+  if (dfg_sparse) {
 
+    *cnt = MIN(dfg_list[0], dfg_size);
+    return dfg_list + 1;
 
-/* Helper function for load_extras. */
+  }
 
-static int compare_extras_len(const void* p1, const void* p2) {
-  struct extra_data *e1 = (struct extra_data*)p1,
-                    *e2 = (struct extra_data*)p2;
+  if (dfg_swept_map == dfg_hit && dfg_swept_execs == total_execs) {
 
-  return e1->len - e2->len;
-}
+    *cnt = dfg_swept_cnt;
+    return dfg_swept;
 
-static int compare_extras_use_d(const void* p1, const void* p2) {
-  struct extra_data *e1 = (struct extra_data*)p1,
-                    *e2 = (struct extra_data*)p2;
+  }
 
-  return e2->hit_cnt - e1->hit_cnt;
-}
+  if (!dfg_swept) dfg_swept = ck_alloc(dfg_size * sizeof(u32) + 1);
 
+  dfg_swept_cnt = 0;
 
-/* Read extras from a file, sort by size. */
+  for (i = 0; i + sizeof(u64) <= dfg_size; i += sizeof(u64)) {
 
-static void load_extras_file(u8* fname, u32* min_len, u32* max_len,
-                             u32 dict_level) {
+    u64 word;
 
-  FILE* f;
-  u8  buf[MAX_LINE];
-  u8  *lptr;
-  u32 cur_line = 0;
+    memcpy(&word, dfg_hit + i, sizeof(u64));
+    if (!word) continue;
 
-  f = fopen(fname, "r");
+    for (j = i; j < i + sizeof(u64); j++)
+      if (dfg_hit[j]) dfg_swept[dfg_swept_cnt++] = j;
 
-  if (!f) PFATAL("Unable to open '%s'", fname);
+  }
 
-  while ((lptr = fgets(buf, MAX_LINE, f))) {
+  for (; i < dfg_size; i++)
+    if (dfg_hit[i]) dfg_swept[dfg_swept_cnt++] = i;
 
-    u8 *rptr, *wptr;
-    u32 klen = 0;
+  dfg_swept_execs = total_execs;
+  dfg_swept_map   = dfg_hit;
 
-    cur_line++;
+  *cnt = dfg_swept_cnt;
+  return dfg_swept;
 
-    /* Trim on left and right. */
+}
 
-    while (isspace(*lptr)) lptr++;
 
-    rptr = lptr + strlen(lptr) - 1;
-    while (rptr >= lptr && isspace(*rptr)) rptr--;
-    rptr++;
-    *rptr = 0;
+/* DFG scoring is split in two. observe_dfg_trace() records which DFG nodes
+   the last execution reached; this is done once per queue entry, and the
+   counts make the nodes that many seeds reach worth less. Scoring the trace
+   against those counts leaves them untouched, so a trace always gets the
+   same score until the next observation. dfg_epoch tells the two apart. */
 
-    /* Skip empty lines and comments. */
+static u64 dfg_epoch,                 /* Bumped when dfg_node_count[] moves */
+           rescore_epoch;             /* dfg_epoch as of the last rescore */
 
-    if (!*lptr || *lptr == '#') continue;
+static void observe_dfg_trace(void) {
 
-    /* All other lines must end with '"', which we can consume. */
+  u32 i, cnt, *nodes = dfg_touched(&cnt);
 
-    rptr--;
+  for (i = 0; i < cnt; i++) {
 
-    if (rptr < lptr || *rptr != '"')
-      FATAL("Malformed name=\"value\" pair in line %u.", cur_line);
+    u32 idx = nodes[i];
 
-    *rptr = 0;
+    if (idx < dfg_size && dfg_node_paths[idx]) dfg_node_count[idx]++;
 
-    /* Skip alphanumerics and dashes (label). */
+  }
 
-    while (isalnum(*lptr) || *lptr == '_') lptr++;
+  dfg_epoch++;
 
-    /* If @number follows, parse that. */
+}
 
-    if (*lptr == '@') {
 
-      lptr++;
-      if (atoi(lptr) > dict_level) continue;
-      while (isdigit(*lptr)) lptr++;
+/* Check if the last execution reached a DFG node that no queue entry has
+   reached so far. Used to filter imports with AFL_SYNC_NEW_DFG. */
 
-    }
+static u8 reaches_new_dfg_node(void) {
 
-    /* Skip whitespace and = signs. */
+  u32 i, cnt, *nodes = dfg_touched(&cnt);
 
-    while (isspace(*lptr) || *lptr == '=') lptr++;
+  for (i = 0; i < cnt; i++) {
 
-    /* Consume opening '"'. */
+    u32 idx = nodes[i];
 
-    if (*lptr != '"')
-      FATAL("Malformed name=\"keyword\" pair in line %u.", cur_line);
+    if (idx < dfg_size && dfg_node_paths[idx] && !dfg_node_count[idx])
+      return 1;
 
-    lptr++;
+  }
 
-    if (!*lptr) FATAL("Empty keyword in line %u.", cur_line);
+  return 0;
 
-    /* Okay, let's allocate memory and copy data between "...", handling
-       \xNN escaping, \\, and \". */
+}
 
-    extras = ck_realloc_block(extras, (extras_cnt + 1) *
-               sizeof(struct extra_data));
 
-    wptr = extras[extras_cnt].data = ck_alloc(rptr - lptr);
+/* Compute the proximity score of the last execution from the DFG nodes it
+   reached and the scores and path counts of those. The result is cached
+   until the next execution or observation (or until another executor is
+   selected), since the same run often gets scored more than once. */
 
-    while (*lptr) {
+static u64 compute_proximity_score(void) {
 
-      char* hexdigits = "0123456789abcdef";
+  static u64 cached_score, cached_execs = U64_MAX, cached_epoch;
+  static u32* cached_maps;
 
-      switch (*lptr) {
+  u64 prox_score = 0;
+  u64 path_score = 0;
+  u32 i, cnt, *nodes;
 
-        case 1 ... 31:
-        case 128 ... 255:
-          FATAL("Non-printable characters in line %u.", cur_line);
+  if (cached_execs == total_execs && cached_epoch == dfg_epoch &&
+      cached_maps == dfg_list)
+    return cached_score;
 
-        case '\\':
+  nodes = dfg_touched(&cnt);
 
-          lptr++;
+  for (i = 0; i < cnt; i++) {
 
-          if (*lptr == '\\' || *lptr == '"') {
-            *(wptr++) = *(lptr++);
-            klen++;
-            break;
-          }
+    u32 idx = nodes[i];
 
-          if (*lptr != 'x' || !isxdigit(lptr[1]) || !isxdigit(lptr[2]))
-            FATAL("Invalid escaping (not \\xNN) in line %u.", cur_line);
-
-          *(wptr++) =
-            ((strchr(hexdigits, tolower(lptr[1])) - hexdigits) << 4) |
-            (strchr(hexdigits, tolower(lptr[2])) - hexdigits);
-
-          lptr += 3;
-          klen++;
+    if (idx >= dfg_size) continue;
 
-          break;
+    if (dfg_node_paths[idx] > 0)
+      path_score += dfg_node_count[idx] * 1000 / dfg_node_paths[idx];
 
-        default:
+    prox_score += dfg_node_score[idx];
 
-          *(wptr++) = *(lptr++);
-          klen++;
+  }
 
-      }
+  path_score = path_score * 14 / 10000 ;
 
-    }
+  cached_execs = total_execs;
+  cached_epoch = dfg_epoch;
+  cached_maps  = dfg_list;
+  cached_score = prox_score < path_score ? 0 : prox_score - path_score;
 
-    extras[extras_cnt].len = klen;
+  return cached_score;
 
-    if (extras[extras_cnt].len > MAX_DICT_FILE)
-      FATAL("Keyword too big in line %u (%s, limit is %s)", cur_line,
-            DMS(klen), DMS(MAX_DICT_FILE));
+}
 
-    if (*min_len > klen) *min_len = klen;
-    if (*max_len < klen) *max_len = klen;
+/* Record the DFG nodes reached by the last execution in q->dfg_nodes, as a
+   compact set. This is what lets rescore_queue() re-evaluate seeds without
+   running them again. */
 
-    extras_cnt++;
+static int compare_u32(const void* a, const void* b) {
 
-  }
+  u32 x = *(u32*)a, y = *(u32*)b;
 
-  fclose(f);
+  return x < y ? -1 : x > y;
 
 }
 
 
-/* Read extras from the extras directory and sort them by size. */
-
-static void load_extras(u8* dir) {
+static void save_dfg_nodes(struct queue_entry* q) {
 
-  DIR* d;
-  struct dirent* de;
-  u32 min_len = MAX_DICT_FILE, max_len = 0, dict_level = 0;
-  u8* x;
+  static u32* nodes;
+  u32 i, listed, cnt = 0, *touched = dfg_touched(&listed);
 
-  /* If the name ends with @, extract level and continue. */
+  if (!nodes) nodes = ck_alloc(dfg_size * sizeof(u32) + 1);
 
-  if ((x = strchr(dir, '@'))) {
+  for (i = 0; i < listed; i++)
+    if (touched[i] < dfg_size) nodes[cnt++] = touched[i];
 
-    *x = 0;
-    dict_level = atoi(x + 1);
+  /* Sweeps come out sorted already. */
 
-  }
+  if (dfg_sparse) qsort(nodes, cnt, sizeof(u32), compare_u32);
 
-  ACTF("Loading extra dictionary from '%s' (level %u)...", dir, dict_level);
+  ck_free(q->dfg_nodes);
+  q->dfg_nodes     = dfg_set_encode(nodes, cnt, &q->dfg_nodes_len);
+  q->dfg_nodes_cnt = cnt;
 
-  d = opendir(dir);
+}
 
-  if (!d) {
 
-    if (errno == ENOTDIR) {
-      load_extras_file(dir, &min_len, &max_len, dict_level);
-      goto check_and_sort;
-    }
+static void update_dfg_score(struct queue_entry* q);
 
-    PFATAL("Unable to open '%s'", dir);
+/* Bring the proximity scores of the whole queue up to date with the current
+   node counts, repositioning the entries as needed. Done every now and then,
+   as the counts drift (see DFG_RESCORE_EPOCHS). */
 
-  }
+static void rescore_queue(void) {
 
-  if (x) FATAL("Dictionary levels not supported for directories.");
+  static u64* penalty;
+  struct queue_entry* q;
+  u32 i, n;
 
-  while ((de = readdir(d))) {
+  if (!penalty) penalty = ck_alloc(dfg_size * sizeof(u64) + 1);
 
-    struct stat st;
-    u8* fn = alloc_printf("%s/%s", dir, de->d_name);
-    s32 fd;
+  rescore_epoch = dfg_epoch;
 
-    if (lstat(fn, &st) || access(fn, R_OK))
-      PFATAL("Unable to access '%s'", fn);
+  for (i = 0; i < dfg_size; i++)
+    penalty[i] = dfg_node_paths[i] ?
+                 dfg_node_count[i] * 1000 / dfg_node_paths[i] : 0;
 
-    /* This also takes care of . and .. */
-    if (!S_ISREG(st.st_mode) || !st.st_size) {
+  total_prox_score = 0;
+  min_prox_score   = U64_MAX;
+  max_prox_score   = 0;
 
-      ck_free(fn);
-      continue;
+  /* Most entries move, so the queue is sorted once at the end instead. */
 
-    }
+  defer_queue_order = 1;
 
-    if (st.st_size > MAX_DICT_FILE)
-      FATAL("Extra '%s' is too big (%s, limit is %s)", fn,
-            DMS(st.st_size), DMS(MAX_DICT_FILE));
+  for (q = queue; q; q = q->next) {
 
-    if (min_len > st.st_size) min_len = st.st_size;
-    if (max_len < st.st_size) max_len = st.st_size;
+    if (q->dfg_nodes) {
 
-    extras = ck_realloc_block(extras, (extras_cnt + 1) *
-               sizeof(struct extra_data));
+      struct dfg_set_iter it;
+      u64 prox_score = 0, path_score = 0;
 
-    extras[extras_cnt].data = ck_alloc(st.st_size);
-    extras[extras_cnt].len  = st.st_size;
+      dfg_set_iter_init(&it, q->dfg_nodes, q->dfg_nodes_len);
 
-    fd = open(fn, O_RDONLY);
+      while (dfg_set_next(&it, &n)) {
+        prox_score += dfg_node_score[n];
+        path_score += penalty[n];
+      }
 
-    if (fd < 0) PFATAL("Unable to open '%s'", fn);
+      path_score = path_score * 14 / 10000;
 
-    ck_read(fd, extras[extras_cnt].data, st.st_size, fn);
+      update_prox_score(q, prox_score < path_score ? 0 :
+                           prox_score - path_score);
 
-    close(fd);
-    ck_free(fn);
+    }
 
-    extras_cnt++;
+    total_prox_score += q->prox_score;
+    if (min_prox_score > q->prox_score) min_prox_score = q->prox_score;
+    if (max_prox_score < q->prox_score) max_prox_score = q->prox_score;
 
   }
 
-  closedir(d);
-
-check_and_sort:
-
-  if (!extras_cnt) FATAL("No usable files in '%s'", dir);
+  defer_queue_order = 0;
+  rebuild_queue_order();
 
-  qsort(extras, extras_cnt, sizeof(struct extra_data), compare_extras_len);
+  /* The top_rated_dfg[] winners were picked by the old scores. Every entry
+     gets to compete again, so each node ends up with the best contender by
+     the new ones, and cull_queue() picks the favorites anew. */
 
-  OKF("Loaded %u extra tokens, size range %s to %s.", extras_cnt,
-      DMS(min_len), DMS(max_len));
+  for (q = queue; q; q = q->next)
+    if (q->dfg_nodes) update_dfg_score(q);
 
-  if (max_len > 32)
-    WARNF("Some tokens are relatively large (%s) - consider trimming.",
-          DMS(max_len));
+  score_changed = 1;
 
-  if (extras_cnt > MAX_DET_EXTRAS)
-    WARNF("More than %u tokens - will use them probabilistically.",
-          MAX_DET_EXTRAS);
+  avg_prox_score = total_prox_score / queued_paths;
 
 }
 
 
+/* Destructively simplify trace by eliminating hit count information
+   and replacing it with 0x80 or 0x01 depending on whether the tuple
+   is hit or not. Called on every new crash or timeout, should be
+   reasonably fast. */
 
+static const u8 simplify_lookup[256] = {
 
-/* Helper function for maybe_add_auto() */
-
-static inline u8 memcmp_nocase(u8* m1, u8* m2, u32 len) {
+  [0]         = 1,
+  [1 ... 255] = 128
 
-  while (len--) if (tolower(*(m1++)) ^ tolower(*(m2++))) return 1;
-  return 0;
+};
 
-}
+#ifdef WORD_SIZE_64
 
+static void simplify_trace(u64* mem) {
 
-/* Maybe add automatic extra. */
+  u32 i = MAP_SIZE >> 3;
 
-static void maybe_add_auto(u8* mem, u32 len) {
+  last_trace.map = NULL;
 
-  u32 i;
+#ifdef HAVE_BITMAP_SIMD
 
-  /* Allow users to specify that they don't want auto dictionaries. */
+  if (bitmap_simd) {
+    bitmap_simplify(bitmap_simd, (u8*)mem, MAP_SIZE);
+    return;
+  }
 
-  if (!MAX_AUTO_EXTRAS || !USE_AUTO_EXTRAS) return;
+#endif /* HAVE_BITMAP_SIMD */
 
-  /* Skip runs of identical bytes. */
+  while (i--) {
 
-  for (i = 1; i < len; i++)
-    if (mem[0] ^ mem[i]) break;
+    /* Optimize for sparse bitmaps. */
 
-  if (i == len) return;
+    if (unlikely(*mem)) {
 
-  /* Reject builtin interesting values. */
+      u8* mem8 = (u8*)mem;
 
-  if (len == 2) {
+      mem8[0] = simplify_lookup[mem8[0]];
+      mem8[1] = simplify_lookup[mem8[1]];
+      mem8[2] = simplify_lookup[mem8[2]];
+      mem8[3] = simplify_lookup[mem8[3]];
+      mem8[4] = simplify_lookup[mem8[4]];
+      mem8[5] = simplify_lookup[mem8[5]];
+      mem8[6] = simplify_lookup[mem8[6]];
+      mem8[7] = simplify_lookup[mem8[7]];
 
-    i = sizeof(interesting_16) >> 1;
+    } else *mem = 0x0101010101010101ULL;
 
-    while (i--)
-      if (*((u16*)mem) == interesting_16[i] ||
-          *((u16*)mem) == SWAP16(interesting_16[i])) return;
+    mem++;
 
   }
 
-  if (len == 4) {
-
-    i = sizeof(interesting_32) >> 2;
-
-    while (i--)
-      if (*((u32*)mem) == interesting_32[i] ||
-          *((u32*)mem) == SWAP32(interesting_32[i])) return;
+}
 
-  }
+#else
 
-  /* Reject anything that matches existing extras. Do a case-insensitive
-     match. We optimize by exploiting the fact that extras[] are sorted
-     by size. */
+static void simplify_trace(u32* mem) {
 
-  for (i = 0; i < extras_cnt; i++)
-    if (extras[i].len >= len) break;
+  u32 i = MAP_SIZE >> 2;
 
-  for (; i < extras_cnt && extras[i].len == len; i++)
-    if (!memcmp_nocase(extras[i].data, mem, len)) return;
+  last_trace.map = NULL;
 
-  /* Last but not least, check a_extras[] for matches. There are no
-     guarantees of a particular sort order. */
+  while (i--) {
 
-  auto_changed = 1;
+    /* Optimize for sparse bitmaps. */
 
-  for (i = 0; i < a_extras_cnt; i++) {
+    if (unlikely(*mem)) {
 
-    if (a_extras[i].len == len && !memcmp_nocase(a_extras[i].data, mem, len)) {
+      u8* mem8 = (u8*)mem;
 
-      a_extras[i].hit_cnt++;
-      goto sort_a_extras;
+      mem8[0] = simplify_lookup[mem8[0]];
+      mem8[1] = simplify_lookup[mem8[1]];
+      mem8[2] = simplify_lookup[mem8[2]];
+      mem8[3] = simplify_lookup[mem8[3]];
 
-    }
+    } else *mem = 0x01010101;
 
+    mem++;
   }
 
-  /* At this point, looks like we're dealing with a new entry. So, let's
-     append it if we have room. Otherwise, let's randomly evict some other
-     entry from the bottom half of the list. */
-
-  if (a_extras_cnt < MAX_AUTO_EXTRAS) {
-
-    a_extras = ck_realloc_block(a_extras, (a_extras_cnt + 1) *
-                                sizeof(struct extra_data));
+}
 
-    a_extras[a_extras_cnt].data = ck_memdup(mem, len);
-    a_extras[a_extras_cnt].len  = len;
-    a_extras_cnt++;
+#endif /* ^WORD_SIZE_64 */
 
-  } else {
 
-    i = MAX_AUTO_EXTRAS / 2 +
-        UR((MAX_AUTO_EXTRAS + 1) / 2);
+/* Destructively classify execution counts in a trace. This is used as a
+   preprocessing step for any newly acquired traces. Called on every exec,
+   must be fast. */
 
-    ck_free(a_extras[i].data);
+static const u8 count_class_lookup8[256] = {
 
-    a_extras[i].data    = ck_memdup(mem, len);
-    a_extras[i].len     = len;
-    a_extras[i].hit_cnt = 0;
+  [0]           = 0,
+  [1]           = 1,
+  [2]           = 2,
+  [3]           = 4,
+  [4 ... 7]     = 8,
+  [8 ... 15]    = 16,
+  [16 ... 31]   = 32,
+  [32 ... 127]  = 64,
+  [128 ... 255] = 128
 
-  }
+};
 
-sort_a_extras:
+static u16 count_class_lookup16[65536];
 
-  /* First, sort all auto extras by use count, descending order. */
 
-  qsort(a_extras, a_extras_cnt, sizeof(struct extra_data),
-        compare_extras_use_d);
+EXP_ST void init_count_class16(void) {
 
-  /* Then, sort the top USE_AUTO_EXTRAS entries by size. */
+  u32 b1, b2;
 
-  qsort(a_extras, MIN(USE_AUTO_EXTRAS, a_extras_cnt),
-        sizeof(struct extra_data), compare_extras_len);
+  for (b1 = 0; b1 < 256; b1++)
+    for (b2 = 0; b2 < 256; b2++)
+      count_class_lookup16[(b1 << 8) + b2] =
+        (count_class_lookup8[b1] << 8) |
+        count_class_lookup8[b2];
 
 }
 
 
-/* Save automatically generated extras. */
+#ifdef WORD_SIZE_64
 
-static void save_auto(void) {
+static inline void classify_counts(u64* mem) {
 
-  u32 i;
+  u32 i = MAP_SIZE >> 3;
 
-  if (!auto_changed) return;
-  auto_changed = 0;
+#ifdef HAVE_BITMAP_SIMD
 
-  for (i = 0; i < MIN(USE_AUTO_EXTRAS, a_extras_cnt); i++) {
+  if (bitmap_simd) {
+    bitmap_classify(bitmap_simd, (u8*)mem, MAP_SIZE, count_class_lookup16);
+    return;
+  }
 
-    u8* fn = alloc_printf("%s/queue/.state/auto_extras/auto_%06u", out_dir, i);
-    s32 fd;
+#endif /* HAVE_BITMAP_SIMD */
 
-    fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  while (i--) {
 
-    if (fd < 0) PFATAL("Unable to create '%s'", fn);
+    /* Optimize for sparse bitmaps. */
 
-    ck_write(fd, a_extras[i].data, a_extras[i].len, fn);
+    if (unlikely(*mem)) {
 
-    close(fd);
-    ck_free(fn);
+      u16* mem16 = (u16*)mem;
 
-  }
+      mem16[0] = count_class_lookup16[mem16[0]];
+      mem16[1] = count_class_lookup16[mem16[1]];
+      mem16[2] = count_class_lookup16[mem16[2]];
+      mem16[3] = count_class_lookup16[mem16[3]];
 
-}
-
-
-/* Load automatically generated extras. */
+    }
 
-static void load_auto(void) {
+    mem++;
 
-  u32 i;
+  }
 
-  for (i = 0; i < USE_AUTO_EXTRAS; i++) {
+}
 
-    u8  tmp[MAX_AUTO_EXTRA + 1];
-    u8* fn = alloc_printf("%s/.state/auto_extras/auto_%06u", in_dir, i);
-    s32 fd, len;
+#else
 
-    fd = open(fn, O_RDONLY, 0600);
+static inline void classify_counts(u32* mem) {
 
-    if (fd < 0) {
+  u32 i = MAP_SIZE >> 2;
 
-      if (errno != ENOENT) PFATAL("Unable to open '%s'", fn);
-      ck_free(fn);
-      break;
+  while (i--) {
 
-    }
+    /* Optimize for sparse bitmaps. */
 
-    /* We read one byte more to cheaply detect tokens that are too
-       long (and skip them). */
+    if (unlikely(*mem)) {
 
-    len = read(fd, tmp, MAX_AUTO_EXTRA + 1);
+      u16* mem16 = (u16*)mem;
 
-    if (len < 0) PFATAL("Unable to read from '%s'", fn);
+      mem16[0] = count_class_lookup16[mem16[0]];
+      mem16[1] = count_class_lookup16[mem16[1]];
 
-    if (len >= MIN_AUTO_EXTRA && len <= MAX_AUTO_EXTRA)
-      maybe_add_auto(tmp, len);
+    }
 
-    close(fd);
-    ck_free(fn);
+    mem++;
 
   }
 
-  if (i) OKF("Loaded %u auto-discovered dictionary tokens.", i);
-  else OKF("No auto-generated dictionary tokens to reuse.");
-
 }
 
+#endif /* ^WORD_SIZE_64 */
 
-/* Destroy extras. */
-
-static void destroy_extras(void) {
 
-  u32 i;
+/* Post-exec analysis of trace_bits, done in place of classify_counts() after
+   every run. A single pass over the map and virgin_bits classifies the hit
+   counts, works out what has_new_bits(virgin_bits) would return (without
+   touching virgin_bits), counts the non-zero bytes and, while anyone needs
+   it (want_cksum), computes the checksum. The results go to last_trace,
+   where has_new_bits(), trace_bytes() and trace_cksum() pick them up. */
 
-  for (i = 0; i < extras_cnt; i++)
-    ck_free(extras[i].data);
+static void analyze_trace(void) {
 
-  ck_free(extras);
+#ifdef WORD_SIZE_64
 
-  for (i = 0; i < a_extras_cnt; i++)
-    ck_free(a_extras[i].data);
+  u64* cur  = (u64*)trace_bits;
+  u64* vir  = (u64*)virgin_bits;
+  u32  i    = MAP_SIZE >> 3, bytes = 0;
+  u8   ret  = 0;
 
-  ck_free(a_extras);
+#ifdef __x86_64__
+  u8   want = !!want_cksum;
+  u64  h1   = HASH_CONST ^ MAP_SIZE;
+#else
+  u8   want = 0; /* No hash32_step() here. */
+#endif /* ^__x86_64__ */
 
-}
+  last_trace.map       = trace_bits;
+  last_trace.execs     = total_execs;
+  last_trace.has_cksum = want;
 
+#ifdef HAVE_BITMAP_SIMD
 
-/* Spin up fork server (instrumented mode only). The idea is explained here:
+  if (bitmap_simd) {
 
-   http://lcamtuf.blogspot.com/2014/10/fuzzing-binaries-without-execve.html
+    last_trace.new_bits = bitmap_analyze(bitmap_simd, trace_bits, virgin_bits,
+                                         MAP_SIZE, &last_trace.bytes,
+                                         want ? &h1 : NULL,
+                                         count_class_lookup16);
 
-   In essence, the instrumentation allows us to skip execve(), and just keep
-   cloning a stopped child. So, we just execute once, and then send commands
-   through a pipe. The other part of this logic is in afl-as.h. */
+    if (want) last_trace.cksum = hash32_final(h1);
+    return;
 
-EXP_ST void init_forkserver(char** argv) {
+  }
 
-  static struct itimerval it;
-  int st_pipe[2], ctl_pipe[2];
-  int status;
-  s32 rlen;
+#endif /* HAVE_BITMAP_SIMD */
 
-  ACTF("Spinning up the fork server...");
+  while (i--) {
 
-  if (pipe(st_pipe) || pipe(ctl_pipe)) PFATAL("pipe() failed");
+    u64 w = *cur;
 
-  forksrv_pid = fork();
+    /* Optimize for sparse bitmaps. The word is classified in a register,
+       so that the checksum below sees the new value. */
 
-  if (forksrv_pid < 0) PFATAL("fork() failed");
+    if (unlikely(w)) {
 
-  if (!forksrv_pid) {
+      u64 v = *vir;
+      u8  new_tuple = 0;
+      u32 j;
 
-    struct rlimit r;
+      w = (u64)count_class_lookup16[(u16)w] |
+          (u64)count_class_lookup16[(u16)(w >> 16)] << 16 |
+          (u64)count_class_lookup16[(u16)(w >> 32)] << 32 |
+          (u64)count_class_lookup16[(u16)(w >> 48)] << 48;
 
-    /* Umpf. On OpenBSD, the default fd limit for root users is set to
-       soft 128. Let's try to fix that... */
+      *cur = w;
 
-    if (!getrlimit(RLIMIT_NOFILE, &r) && r.rlim_cur < FORKSRV_FD + 2) {
+      for (j = 0; j < 64; j += 8)
+        if ((w >> j) & 0xff) {
+          bytes++;
+          if (((v >> j) & 0xff) == 0xff) new_tuple = 1;
+        }
 
-      r.rlim_cur = FORKSRV_FD + 2;
-      setrlimit(RLIMIT_NOFILE, &r); /* Ignore errors */
+      if (ret < 2 && (w & v)) ret = new_tuple ? 2 : 1;
 
     }
 
-    if (mem_limit) {
+#ifdef __x86_64__
+    if (want) h1 = hash32_step(h1, w);
+#endif /* __x86_64__ */
 
-      r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
+    cur++;
+    vir++;
 
-#ifdef RLIMIT_AS
+  }
 
-      setrlimit(RLIMIT_AS, &r); /* Ignore errors */
+  last_trace.bytes    = bytes;
+  last_trace.new_bits = ret;
 
-#else
+#ifdef __x86_64__
+  if (want) last_trace.cksum = hash32_final(h1);
+#endif /* __x86_64__ */
 
-      /* This takes care of OpenBSD, which doesn't have RLIMIT_AS, but
-         according to reliable sources, RLIMIT_DATA covers anonymous
-         maps - so we should be getting good protection against OOM bugs. */
+#else
 
-      setrlimit(RLIMIT_DATA, &r); /* Ignore errors */
+  /* On 32-bit systems, just classify; the rest is done on demand. */
 
-#endif /* ^RLIMIT_AS */
+  classify_counts((u32*)trace_bits);
 
+  last_trace.map       = trace_bits;
+  last_trace.execs     = total_execs;
+  last_trace.bytes     = count_bytes(trace_bits);
+  last_trace.has_cksum = 0;
+  last_trace.new_bits  = 2;
 
-    }
+#endif /* ^WORD_SIZE_64 */
 
-    /* Dumping cores is slow and can lead to anomalies if SIGKILL is delivered
-       before the dump is complete. */
+}
 
-    r.rlim_max = r.rlim_cur = 0;
 
-    setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
+/* Number of non-zero bytes in trace_bits, as count_bytes() would say. */
 
-    /* Isolate the process and configure standard descriptors. If out_file is
-       specified, stdin is /dev/null; otherwise, out_fd is cloned instead. */
+static u32 trace_bytes(void) {
 
-    setsid();
+  if (trace_known()) return last_trace.bytes;
 
-    dup2(dev_null_fd, 1);
-    dup2(dev_null_fd, 2);
+  return count_bytes(trace_bits);
 
-    if (out_file) {
+}
 
-      dup2(dev_null_fd, 0);
 
-    } else {
+/* Checksum of trace_bits, computed on the fly by analyze_trace() if it was
+   asked to, or now. */
 
-      dup2(out_fd, 0);
-      close(out_fd);
+static u32 trace_cksum(void) {
 
-    }
+  if (!trace_known()) return hash32(trace_bits, MAP_SIZE, HASH_CONST);
 
-    /* Set up control and status pipes, close the unneeded original fds. */
+  if (!last_trace.has_cksum) {
+    last_trace.cksum     = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+    last_trace.has_cksum = 1;
+  }
 
-    if (dup2(ctl_pipe[0], FORKSRV_FD) < 0) PFATAL("dup2() failed");
-    if (dup2(st_pipe[1], FORKSRV_FD + 1) < 0) PFATAL("dup2() failed");
+  return last_trace.cksum;
 
-    close(ctl_pipe[0]);
-    close(ctl_pipe[1]);
-    close(st_pipe[0]);
-    close(st_pipe[1]);
+}
 
-    close(out_dir_fd);
-    close(dev_null_fd);
-    close(dev_urandom_fd);
-    close(fileno(plot_file));
 
-    /* This should improve performance a bit, since it stops the linker from
-       doing extra work post-fork(). */
+/* Get rid of shared memory (atexit handler). */
 
-    if (!getenv("LD_BIND_LAZY")) setenv("LD_BIND_NOW", "1", 0);
+static void remove_shm(void) {
 
-    /* Set sane defaults for ASAN if nothing else specified. */
+  u32 i;
 
-    setenv("ASAN_OPTIONS", "abort_on_error=1:"
-                           "detect_leaks=0:"
-                           "symbolize=0:"
-                           "allocator_may_return_null=1", 0);
+  shmctl(shm_id, IPC_RMID, NULL);
 
-    /* MSAN is tricky, because it doesn't support abort_on_error=1 at this
-       point. So, we do this in a very hacky way. */
+  if (shm_id_dfg_list >= 0) shmctl(shm_id_dfg_list, IPC_RMID, NULL);
 
-    setenv("MSAN_OPTIONS", "exit_code=" STRINGIFY(MSAN_ERROR) ":"
-                           "symbolize=0:"
-                           "abort_on_error=1:"
-                           "allocator_may_return_null=1:"
-                           "msan_track_origins=0", 0);
+  if (shm_id_pacfix >= 0) shmctl(shm_id_pacfix, IPC_RMID, NULL);
+  if (shm_id_fuzz >= 0) shmctl(shm_id_fuzz, IPC_RMID, NULL);
 
-    execv(target_path, argv);
+  for (i = 1; i < executor_cnt && executors; i++) {
 
-    /* Use a distinctive bitmap signature to tell the parent about execv()
-       falling through. */
+    struct executor* e = executors + i;
 
-    *(u32*)trace_bits = EXEC_FAIL_SIG;
-    exit(0);
+    if (e->shm_id >= 0) shmctl(e->shm_id, IPC_RMID, NULL);
+    if (e->shm_id_dfg_list >= 0) shmctl(e->shm_id_dfg_list, IPC_RMID, NULL);
+    if (e->shm_id_fuzz >= 0) shmctl(e->shm_id_fuzz, IPC_RMID, NULL);
 
   }
 
-  /* Close the unneeded endpoints. */
+}
 
-  close(ctl_pipe[0]);
-  close(st_pipe[1]);
 
-  fsrv_ctl_fd = ctl_pipe[1];
-  fsrv_st_fd  = st_pipe[0];
+/* Clear the DFG maps ahead of an execution. If the target keeps a list of
+   touched nodes, only the listed entries can be dirty; otherwise (or when
+   the list can't be trusted, e.g. after a run was killed) wipe everything.
+   Without the list, the region is just the hit map, which is no bigger than
+   the coverage map. */
 
-  /* Wait for the fork server to come up, but don't wait too long. */
+static void reset_dfg_maps(u8 full) {
 
-  it.it_value.tv_sec = ((exec_tmout * FORK_WAIT_MULT) / 1000);
-  it.it_value.tv_usec = ((exec_tmout * FORK_WAIT_MULT) % 1000) * 1000;
+  if (dfg_swept_map == dfg_hit) dfg_swept_map = NULL;
 
-  setitimer(ITIMER_REAL, &it, NULL);
+  if (dfg_sparse && !full) {
 
-  rlen = read(fsrv_st_fd, &status, 4);
+    u32 i, cnt = MIN(dfg_list[0], dfg_size);
 
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 0;
+    for (i = 1; i <= cnt; i++) {
 
-  setitimer(ITIMER_REAL, &it, NULL);
+      u32 idx = dfg_list[i];
 
-  /* If we have a four-byte "hello" message from the server, we're all set.
-     Otherwise, try to figure out what went wrong. */
+      if (idx >= dfg_size) continue;
 
-  if (rlen == 4) {
-    OKF("All right - fork server is up.");
+      dfg_hit[idx] = 0;
+
+    }
+
+    dfg_hit[dfg_size] = 0;
+    dfg_list[0] = 0;
     return;
+
   }
 
-  if (child_timed_out)
-    FATAL("Timeout while initializing fork server (adjusting -t may help)");
+  memset(dfg_hit, 0, dfg_size + 1);
+  if (DFG_SPARSE(dfg_size)) dfg_list[0] = 0;
 
-  if (waitpid(forksrv_pid, &status, 0) <= 0)
-    PFATAL("waitpid() failed");
+}
 
-  if (WIFSIGNALED(status)) {
 
-    if (mem_limit && mem_limit < 500 && uses_asan) {
+/* Compact trace bytes into a smaller bitmap. We effectively just drop the
+   count information here. This is called only sporadically, for some
+   new paths. */
 
-      SAYF("\n" cLRD "[-] " cRST
-           "Whoops, the target binary crashed suddenly, before receiving any input\n"
-           "    from the fuzzer! Since it seems to be built with ASAN and you have a\n"
-           "    restrictive memory limit configured, this is expected; please read\n"
-           "    %s/notes_for_asan.txt for help.\n", doc_path);
+static void minimize_bits(u8* dst, u8* src) {
 
-    } else if (!mem_limit) {
+  u32 i = 0;
 
-      SAYF("\n" cLRD "[-] " cRST
-           "Whoops, the target binary crashed suddenly, before receiving any input\n"
-           "    from the fuzzer! There are several probable explanations:\n\n"
+  while (i < MAP_SIZE) {
 
-           "    - The binary is just buggy and explodes entirely on its own. If so, you\n"
-           "      need to fix the underlying problem or find a better replacement.\n\n"
+    if (*(src++)) dst[i >> 3] |= 1 << (i & 7);
+    i++;
 
-#ifdef __APPLE__
+  }
 
-           "    - On MacOS X, the semantics of fork() syscalls are non-standard and may\n"
-           "      break afl-fuzz performance optimizations when running platform-specific\n"
-           "      targets. To fix this, set AFL_NO_FORKSRV=1 in the environment.\n\n"
+}
 
-#endif /* __APPLE__ */
 
-           "    - Less likely, there is a horrible bug in the fuzzer. If other options\n"
-           "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n");
+/* The same as update_bitmap_score() below, but for the DFG nodes reached by
+   the entry. Here, speed x size is weighed against proximity, so that each
+   node goes to the cheapest way of getting close to the target through it. */
 
-    } else {
+static void update_dfg_score(struct queue_entry* q) {
 
-      SAYF("\n" cLRD "[-] " cRST
-           "Whoops, the target binary crashed suddenly, before receiving any input\n"
-           "    from the fuzzer! There are several probable explanations:\n\n"
+  struct dfg_set_iter it;
+  double fav_factor = (double)q->exec_us * q->len / (q->prox_score + 1);
+  u32 n;
 
-           "    - The current memory limit (%s) is too restrictive, causing the\n"
-           "      target to hit an OOM condition in the dynamic linker. Try bumping up\n"
-           "      the limit with the -m setting in the command line. A simple way confirm\n"
-           "      this diagnosis would be:\n\n"
+  dfg_set_iter_init(&it, q->dfg_nodes, q->dfg_nodes_len);
 
-#ifdef RLIMIT_AS
-           "      ( ulimit -Sv $[%llu << 10]; /path/to/fuzzed_app )\n\n"
-#else
-           "      ( ulimit -Sd $[%llu << 10]; /path/to/fuzzed_app )\n\n"
-#endif /* ^RLIMIT_AS */
+  while (dfg_set_next(&it, &n)) {
 
-           "      Tip: you can use http://jwilk.net/software/recidivm to quickly\n"
-           "      estimate the required amount of virtual memory for the binary.\n\n"
+    struct queue_entry* top = top_rated_dfg[n];
 
-           "    - The binary is just buggy and explodes entirely on its own. If so, you\n"
-           "      need to fix the underlying problem or find a better replacement.\n\n"
+    if (top == q) continue;
 
-#ifdef __APPLE__
+    /* First entry to reach the node; keep track of how close we got. */
 
-           "    - On MacOS X, the semantics of fork() syscalls are non-standard and may\n"
-           "      break afl-fuzz performance optimizations when running platform-specific\n"
-           "      targets. To fix this, set AFL_NO_FORKSRV=1 in the environment.\n\n"
+    if (!top) {
 
-#endif /* __APPLE__ */
+      dfg_nodes_hit++;
 
-           "    - Less likely, there is a horrible bug in the fuzzer. If other options\n"
-           "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n",
-           DMS(mem_limit << 20), mem_limit - 1);
+      if (dfg_closest < 0 || dfg_node_score[n] > dfg_node_score[dfg_closest])
+        dfg_closest = n;
 
     }
 
-    FATAL("Fork server crashed with signal %d", WTERMSIG(status));
+    if (top && fav_factor >
+        (double)top->exec_us * top->len / (top->prox_score + 1)) continue;
+
+    top_rated_dfg[n] = q;
+    score_changed = 1;
 
   }
 
-  if (*(u32*)trace_bits == EXEC_FAIL_SIG)
-    FATAL("Unable to execute target application ('%s')", argv[0]);
+}
 
-  if (mem_limit && mem_limit < 500 && uses_asan) {
 
-    SAYF("\n" cLRD "[-] " cRST
-           "Hmm, looks like the target binary terminated before we could complete a\n"
-           "    handshake with the injected code. Since it seems to be built with ASAN and\n"
-           "    you have a restrictive memory limit configured, this is expected; please\n"
-           "    read %s/notes_for_asan.txt for help.\n", doc_path);
+/* When we bump into a new path, we call this to see if the path appears
+   more "favorable" than any of the existing ones. The purpose of the
+   "favorables" is to have a minimal set of paths that trigger all the bits
+   seen in the bitmap so far, and focus on fuzzing them at the expense of
+   the rest.
 
-  } else if (!mem_limit) {
+   The first step of the process is to maintain a list of top_rated[] entries
+   for every byte in the bitmap. We win that slot if there is no previous
+   contender, or if the contender has a more favorable speed x size factor. */
 
-    SAYF("\n" cLRD "[-] " cRST
-         "Hmm, looks like the target binary terminated before we could complete a\n"
-         "    handshake with the injected code. Perhaps there is a horrible bug in the\n"
-         "    fuzzer. Poke <lcamtuf@coredump.cx> for troubleshooting tips.\n");
+static void update_bitmap_score(struct queue_entry* q) {
 
-  } else {
+  u32 i;
+  u64 fav_factor = q->exec_us * q->len;
 
-    SAYF("\n" cLRD "[-] " cRST
-         "Hmm, looks like the target binary terminated before we could complete a\n"
-         "    handshake with the injected code. There are %s probable explanations:\n\n"
+  /* For every byte set in trace_bits[], see if there is a previous winner,
+     and how it compares to us. */
 
-         "%s"
-         "    - The current memory limit (%s) is too restrictive, causing an OOM\n"
-         "      fault in the dynamic linker. This can be fixed with the -m option. A\n"
-         "      simple way to confirm the diagnosis may be:\n\n"
+  for (i = 0; i < MAP_SIZE; i++)
 
-#ifdef RLIMIT_AS
-         "      ( ulimit -Sv $[%llu << 10]; /path/to/fuzzed_app )\n\n"
-#else
-         "      ( ulimit -Sd $[%llu << 10]; /path/to/fuzzed_app )\n\n"
-#endif /* ^RLIMIT_AS */
+    if (trace_bits[i]) {
 
-         "      Tip: you can use http://jwilk.net/software/recidivm to quickly\n"
-         "      estimate the required amount of virtual memory for the binary.\n\n"
+       if (top_rated[i]) {
 
-         "    - Less likely, there is a horrible bug in the fuzzer. If other options\n"
-         "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n",
-         getenv(DEFER_ENV_VAR) ? "three" : "two",
-         getenv(DEFER_ENV_VAR) ?
-         "    - You are using deferred forkserver, but __AFL_INIT() is never\n"
-         "      reached before the program terminates.\n\n" : "",
-         DMS(mem_limit << 20), mem_limit - 1);
+         /* Faster-executing or smaller test cases are favored. */
 
-  }
+         if (fav_factor > top_rated[i]->exec_us * top_rated[i]->len) continue;
 
-  FATAL("Fork server handshake failed");
+         /* Looks like we're going to win. Decrease ref count for the
+            previous winner, discard its trace_bits[] if necessary. */
 
-}
+         if (!--top_rated[i]->tc_ref) {
+           ck_free(top_rated[i]->trace_mini);
+           top_rated[i]->trace_mini = 0;
+         }
 
+       }
 
-/* Execute target application, monitoring for timeouts. Return status
-   information. The called program will update trace_bits[]. */
+       /* Insert ourselves as the new winner. */
 
-static u8 run_target(char** argv, u32 timeout, char* env_opt, u8 force_dumb_mode) {
+       top_rated[i] = q;
+       q->tc_ref++;
 
-  static struct itimerval it;
-  static u32 prev_timed_out = 0;
-  static u64 exec_ms = 0;
+       if (!q->trace_mini) {
+         q->trace_mini = ck_alloc(MAP_SIZE >> 3);
+         minimize_bits(q->trace_mini, trace_bits);
+       }
 
-  int status = 0;
-  u32 tb4;
+       score_changed = 1;
 
-  child_timed_out = 0;
+     }
 
-  /* After this memset, trace_bits[] are effectively volatile, so we
-     must prevent any earlier operations from venturing into that
-     territory. */
+  if (q->dfg_nodes) update_dfg_score(q);
 
-  memset(trace_bits, 0, MAP_SIZE);
-  memset(dfg_bits, 0, sizeof(u32) * DFG_MAP_SIZE);
-  memset(dfg_counts, 0, sizeof(u64) * DFG_MAP_SIZE);
-  MEM_BARRIER();
+}
 
-  /* If we're running in "dumb" mode, we can't rely on the fork server
-     logic compiled into the target program, so we will just keep calling
-     execve(). There is a bit of code duplication between here and
-     init_forkserver(), but c'est la vie. */
 
-  if (force_dumb_mode == 1 || dumb_mode == 1 || no_forkserver) {
+/* The second part of the mechanism discussed above is a routine that
+   goes over top_rated[] entries, and then sequentially grabs winners for
+   previously-unseen bytes (temp_v) and marks them as favored, at least
+   until the next run. The favored entries are given more air time during
+   all fuzzing steps. */
 
-    child_pid = fork();
+static void cull_queue(void) {
 
-    if (child_pid < 0) PFATAL("fork() failed");
+  struct queue_entry* q;
+  static u8 temp_v[MAP_SIZE >> 3];
+  static u8* temp_dfg_v;
+  u32 i;
 
-    if (!child_pid) {
+  if (dumb_mode || !score_changed) return;
 
-      struct rlimit r;
+  if (!temp_dfg_v) temp_dfg_v = ck_alloc((dfg_size + 7) >> 3);
 
-      if (mem_limit) {
+  score_changed = 0;
 
-        r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
+  memset(temp_v, 255, MAP_SIZE >> 3);
 
-#ifdef RLIMIT_AS
+  queued_favored  = 0;
+  pending_favored = 0;
 
-        setrlimit(RLIMIT_AS, &r); /* Ignore errors */
+  q = queue;
 
-#else
+  while (q) {
+    q->favored = 0;
+    q = q->next;
+  }
 
-        setrlimit(RLIMIT_DATA, &r); /* Ignore errors */
+  /* Let's see if anything in the bitmap isn't captured in temp_v.
+     If yes, and if it has a top_rated[] contender, let's use it. */
 
-#endif /* ^RLIMIT_AS */
+  for (i = 0; i < MAP_SIZE; i++)
+    if (top_rated[i] && (temp_v[i >> 3] & (1 << (i & 7)))) {
 
-      }
+      u32 j = MAP_SIZE >> 3;
 
-      r.rlim_max = r.rlim_cur = 0;
+      /* Remove all bits belonging to the current entry from temp_v. */
 
-      setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
+      while (j--)
+        if (top_rated[i]->trace_mini[j])
+          temp_v[j] &= ~top_rated[i]->trace_mini[j];
 
-      /* Isolate the process and configure standard descriptors. If out_file is
-         specified, stdin is /dev/null; otherwise, out_fd is cloned instead. */
+      top_rated[i]->favored = 1;
+      queued_favored++;
 
-      setsid();
+      if (!top_rated[i]->was_fuzzed) pending_favored++;
 
-      dup2(dev_null_fd, 1);
-      dup2(dev_null_fd, 2);
+    }
 
-      if (out_file) {
+  /* Do the same for the DFG nodes. The favored set is the union of both
+     covers, so every node reached so far has a favored entry that gets
+     there, too. */
 
-        dup2(dev_null_fd, 0);
+  memset(temp_dfg_v, 255, (dfg_size + 7) >> 3);
 
-      } else {
+  for (i = 0; i < dfg_size; i++)
+    if (top_rated_dfg[i] && (temp_dfg_v[i >> 3] & (1 << (i & 7)))) {
 
-        dup2(out_fd, 0);
-        close(out_fd);
+      struct dfg_set_iter it;
+      u32 n;
 
-      }
+      dfg_set_iter_init(&it, top_rated_dfg[i]->dfg_nodes,
+                        top_rated_dfg[i]->dfg_nodes_len);
 
-      /* On Linux, would be faster to use O_CLOEXEC. Maybe TODO. */
+      while (dfg_set_next(&it, &n))
+        temp_dfg_v[n >> 3] &= ~(1 << (n & 7));
 
-      close(dev_null_fd);
-      close(out_dir_fd);
-      close(dev_urandom_fd);
-      close(fileno(plot_file));
+      if (top_rated_dfg[i]->favored) continue;
 
-      /* Set sane defaults for ASAN if nothing else specified. */
+      top_rated_dfg[i]->favored = 1;
+      queued_favored++;
 
-      char *envp[] =
-      {
-          "ASAN_OPTIONS=abort_on_error=1:detect_leaks=0:symbolize=0:allocator_may_return_null=1",
-          "MSAN_OPTIONS=exit_code=86:symbolize=0:msan_track_origins=0",
-          env_opt,
-          0
-      };
+      if (!top_rated_dfg[i]->was_fuzzed) pending_favored++;
 
-      execve(argv[0], argv, envp);
+    }
 
-      /* Use a distinctive bitmap value to tell the parent about execv()
-         falling through. */
+  q = queue;
 
-      *(u32*)trace_bits = EXEC_FAIL_SIG;
-      exit(0);
+  while (q) {
+    mark_as_redundant(q, !q->favored);
+    q = q->next;
+  }
 
-    }
+}
 
-  } else {
 
-    s32 res;
+/* Configure shared memory and virgin_bits. This is called at startup. */
 
-    /* In non-dumb mode, we have the fork server up and running, so simply
-       tell it to have at it, and then read back PID. */
+EXP_ST void setup_shm(void) {
 
-    if ((res = write(fsrv_ctl_fd, &prev_timed_out, 4)) != 4) {
+  u8* shm_str;
 
-      if (stop_soon) return 0;
-      RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+  if (!in_bitmap) memset(virgin_bits, 255, MAP_SIZE);
 
-    }
+  memset(virgin_tmout, 255, MAP_SIZE);
+  memset(virgin_crash, 255, MAP_SIZE);
 
-    if ((res = read(fsrv_st_fd, &child_pid, 4)) != 4) {
+  shm_id = shmget(IPC_PRIVATE, MAP_SIZE, IPC_CREAT | IPC_EXCL | 0600);
 
-      if (stop_soon) return 0;
-      RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+  if (shm_id < 0) PFATAL("shmget() failed");
 
-    }
+  atexit(remove_shm);
 
-    if (child_pid <= 0) FATAL("Fork server is misbehaving (OOM?)");
+  shm_str = alloc_printf("%d", shm_id);
 
-  }
+  /* If somebody is asking us to fuzz instrumented binaries in dumb mode,
+     we don't want them to detect instrumentation, since we won't be sending
+     fork server commands. This should be replaced with better auto-detection
+     later on, perhaps? */
 
-  /* Configure timeout, as requested by user, then wait for child to terminate. */
+  if (!dumb_mode) setenv(SHM_ENV_VAR, shm_str, 1);
 
-  it.it_value.tv_sec = (timeout / 1000);
-  it.it_value.tv_usec = (timeout % 1000) * 1000;
+  ck_free(shm_str);
 
-  setitimer(ITIMER_REAL, &it, NULL);
+  trace_bits = shmat(shm_id, NULL, 0);
 
-  /* The SIGALRM handler simply kills the child_pid and sets child_timed_out. */
+  if (trace_bits == (void *)-1) PFATAL("shmat() failed");
 
-  if (force_dumb_mode == 1 || dumb_mode == 1 || no_forkserver) {
+}
 
-    if (waitpid(child_pid, &status, 0) <= 0) PFATAL("waitpid() failed");
 
-  } else {
+/* Load what is known about the DFG nodes from the tables in the target
+   binary (see dfg-meta.h): scores and path counts, and where each node is,
+   as a "file:line (function)" string in dfg_desc_buf. */
 
-    s32 res;
+static void load_dfg_nodes(void) {
 
-    if ((res = read(fsrv_st_fd, &status, 4)) != 4) {
+  struct stat st;
+  u8 *f_data, *sig, *end;
+  u32 sig_len = strlen(DFG_NODES_SIG), tables = 0;
+  s32 fd;
 
-      if (stop_soon) return 0;
-      RPFATAL(res, "Unable to communicate with fork server (OOM?)");
+  fd = open(target_path, O_RDONLY);
 
-    }
+  if (fd < 0) PFATAL("Unable to open '%s'", target_path);
+  if (fstat(fd, &st)) PFATAL("fstat() failed");
 
+  if (!st.st_size) {
+    close(fd);
+    return;
   }
 
-  if (!WIFSTOPPED(status)) child_pid = 0;
+  f_data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
-  getitimer(ITIMER_REAL, &it);
-  exec_ms = (u64) timeout - (it.it_value.tv_sec * 1000 +
-                             it.it_value.tv_usec / 1000);
+  if (f_data == MAP_FAILED) PFATAL("Unable to mmap file '%s'", target_path);
 
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 0;
+  close(fd);
 
-  setitimer(ITIMER_REAL, &it, NULL);
+  /* Offset 0 stands for no description. */
 
-  total_execs++;
+  dfg_desc_buf = ck_realloc_block(dfg_desc_buf, 1);
+  dfg_desc_len = 1;
 
-  /* Any subsequent operations on trace_bits must not be moved by the
-     compiler below this point. Past this location, trace_bits[] behave
-     very normally and do not have to be treated as volatile. */
+  sig = f_data;
+  end = f_data + st.st_size;
 
-  MEM_BARRIER();
+  while ((sig = memmem(sig, end - sig, DFG_NODES_SIG, sig_len))) {
 
-  tb4 = *(u32*)trace_bits;
+    u32 cnt, str_len, i;
+    u8* strings;
 
-#ifdef WORD_SIZE_64
-  classify_counts((u64*)trace_bits);
-#else
-  classify_counts((u32*)trace_bits);
-#endif /* ^WORD_SIZE_64 */
+    sig += sig_len;
 
-  prev_timed_out = child_timed_out;
+    if (end - sig < 2 * sizeof(u32)) break;
 
-  /* Report outcome to caller. */
+    memcpy(&cnt, sig, sizeof(u32));
+    memcpy(&str_len, sig + sizeof(u32), sizeof(u32));
 
-  if (WIFSIGNALED(status) && !stop_soon) {
+    /* Not a table; e.g. the signature string itself, in a binary that
+       happens to contain it. */
 
-    kill_signal = WTERMSIG(status);
+    if ((u64)cnt * sizeof(struct dfg_meta_node) + str_len >
+        end - sig - 2 * sizeof(u32)) continue;
 
-    if (child_timed_out && kill_signal == SIGKILL) return FAULT_TMOUT;
+    sig    += 2 * sizeof(u32);
+    strings = sig + cnt * sizeof(struct dfg_meta_node);
 
-    return FAULT_CRASH;
+    for (i = 0; i < cnt; i++) {
 
-  }
+      struct dfg_meta_node ent;
+      u8 *file = "?", *func = "?", *desc;
+      u32 len;
 
-  /* A somewhat nasty hack for MSAN, which doesn't support abort_on_error and
-     must use a special exit code. */
+      memcpy(&ent, sig + i * sizeof(struct dfg_meta_node), sizeof(ent));
 
-  if (uses_asan && WEXITSTATUS(status) == MSAN_ERROR) {
-    kill_signal = 0;
-    return FAULT_CRASH;
-  }
+      if (ent.idx >= dfg_size)
+        FATAL("DFG node %u of '%s' is out of range", ent.idx, target_path);
 
-  if ((force_dumb_mode == 1 || dumb_mode == 1 || no_forkserver) && tb4 == EXEC_FAIL_SIG)
-    return FAULT_ERROR;
+      dfg_node_score[ent.idx] = ent.score;
+      dfg_node_paths[ent.idx] = ent.path_cnt;
 
-  /* It makes sense to account for the slowest units only if the testcase was run
-  under the user defined timeout. */
-  if (!(timeout > exec_tmout) && (slowest_exec_ms < exec_ms)) {
-    slowest_exec_ms = exec_ms;
-  }
+      if (dfg_node_desc[ent.idx]) continue;
 
-  return FAULT_NONE;
+      if (ent.file_off < str_len &&
+          memchr(strings + ent.file_off, 0, str_len - ent.file_off))
+        file = strings + ent.file_off;
 
-}
+      if (ent.func_off < str_len &&
+          memchr(strings + ent.func_off, 0, str_len - ent.func_off))
+        func = strings + ent.func_off;
 
+      desc = alloc_printf("%s:%u (%s)", file, ent.line, func);
+      len  = strlen(desc) + 1;
 
-/* Write modified data to file for testing. If out_file is set, the old file
-   is unlinked and a new one is created. Otherwise, out_fd is rewound and
-   truncated. */
+      dfg_desc_buf = ck_realloc_block(dfg_desc_buf, dfg_desc_len + len);
+      memcpy(dfg_desc_buf + dfg_desc_len, desc, len);
+      ck_free(desc);
 
-static void write_to_testcase(void* mem, u32 len) {
+      dfg_node_desc[ent.idx] = dfg_desc_len;
+      dfg_desc_len += len;
+      dfg_nodes_known++;
 
-  s32 fd = out_fd;
+    }
 
-  if (out_file) {
+    sig = strings + str_len;
+    tables++;
 
-    unlink(out_file); /* Ignore errors. */
+  }
 
-    fd = open(out_file, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (munmap(f_data, st.st_size)) PFATAL("unmap() failed");
 
-    if (fd < 0) PFATAL("Unable to create '%s'", out_file);
+  if (tables)
+    OKF("Loaded %u DFG node%s from %u table%s.", dfg_nodes_known,
+        dfg_nodes_known == 1 ? "" : "s", tables, tables == 1 ? "" : "s");
 
-  } else lseek(fd, 0, SEEK_SET);
+}
 
-  ck_write(fd, mem, len, out_file);
-
-  if (!out_file) {
-
-    if (ftruncate(fd, len)) PFATAL("ftruncate() failed");
-    lseek(fd, 0, SEEK_SET);
-
-  } else close(fd);
-
-}
 
+/* Set up the DFG maps, in shared memory and on our side, once check_binary()
+   has found out how many nodes the DFG of the target has. */
 
-/* The same, but with an adjustable gap. Used for trimming. */
+EXP_ST void setup_dfg_shm(void) {
 
-static void write_with_gap(void* mem, u32 len, u32 skip_at, u32 skip_len) {
+  u8* shm_str_dfg_list;
 
-  s32 fd = out_fd;
-  u32 tail_len = len - skip_at - skip_len;
+  shm_id_dfg_list = shmget(IPC_PRIVATE, DFG_LIST_SIZE(dfg_size),
+                           IPC_CREAT | IPC_EXCL | 0600);
 
-  if (out_file) {
+  if (shm_id_dfg_list < 0) PFATAL("shmget() failed");
 
-    unlink(out_file); /* Ignore errors. */
+  shm_str_dfg_list = alloc_printf("%d", shm_id_dfg_list);
 
-    fd = open(out_file, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (!dumb_mode) setenv(SHM_ENV_VAR_DFG_LIST, shm_str_dfg_list, 1);
 
-    if (fd < 0) PFATAL("Unable to create '%s'", out_file);
+  ck_free(shm_str_dfg_list);
 
-  } else lseek(fd, 0, SEEK_SET);
+  dfg_list = shmat(shm_id_dfg_list, NULL, 0);
 
-  if (skip_at) ck_write(fd, mem, skip_at, out_file);
+  if (dfg_list == (void *)-1) PFATAL("shmat() failed");
 
-  if (tail_len) ck_write(fd, mem + skip_at + skip_len, tail_len, out_file);
+  dfg_hit = (u8*)dfg_list + DFG_LIST_HIT_OFF(dfg_size);
 
-  if (!out_file) {
+  /* The +1s keep the allocations non-empty for binaries without a DFG. */
 
-    if (ftruncate(fd, len - skip_len)) PFATAL("ftruncate() failed");
-    lseek(fd, 0, SEEK_SET);
+  dfg_node_count = ck_alloc(dfg_size * sizeof(u64) + 1);
+  dfg_node_score = ck_alloc(dfg_size * sizeof(u32) + 1);
+  dfg_node_paths = ck_alloc(dfg_size * sizeof(u64) + 1);
+  dfg_node_desc  = ck_alloc(dfg_size * sizeof(u32) + 1);
+  top_rated_dfg  = ck_alloc(dfg_size * sizeof(struct queue_entry*) + 1);
 
-  } else close(fd);
+  if (!dumb_mode) load_dfg_nodes();
 
 }
 
 
-static void show_stats(void);
-
-/* Calibrate a new test case. This is done when processing the input directory
-   to warn about flaky or otherwise problematic test cases early on; and when
-   new paths are discovered to detect variable behavior and so on. */
-
-static u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
-                         u32 handicap, u8 from_queue) {
+/* Set up the SHM that test cases are handed over in, for harnesses built
+   around __AFL_FUZZ_TESTCASE_BUF and __AFL_FUZZ_TESTCASE_LEN. This saves the
+   file system calls of write_to_testcase() on every execution. The region
+   holds the length of the test case, followed by up to MAX_FILE bytes. */
 
-  static u8 first_trace[MAP_SIZE];
+static void setup_shm_fuzz(void) {
 
-  u8  fault = 0, new_bits = 0, var_detected = 0, hnb = 0,
-      first_run = (q->exec_cksum == 0);
+  u8* shm_str;
+  u32* mem;
 
-  u64 start_us, stop_us;
+  if (!shm_fuzz) return;
 
-  s32 old_sc = stage_cur, old_sm = stage_max;
-  u32 use_tmout = exec_tmout;
-  u8* old_sn = stage_name;
+  shm_id_fuzz = shmget(IPC_PRIVATE, sizeof(u32) + MAX_FILE,
+                       IPC_CREAT | IPC_EXCL | 0600);
 
-  /* Be a bit more generous about timeouts when resuming sessions, or when
-     trying to calibrate already-added finds. This helps avoid trouble due
-     to intermittent latency. */
+  if (shm_id_fuzz < 0) PFATAL("shmget() failed");
 
-  if (!from_queue || resuming_fuzz)
-    use_tmout = MAX(exec_tmout + CAL_TMOUT_ADD,
-                    exec_tmout * CAL_TMOUT_PERC / 100);
+  shm_str = alloc_printf("%d", shm_id_fuzz);
+  setenv(SHM_FUZZ_ENV_VAR, shm_str, 1);
+  ck_free(shm_str);
 
-  q->cal_failed++;
+  mem = shmat(shm_id_fuzz, NULL, 0);
+  if (mem == (void *)-1) PFATAL("shmat() failed");
 
-  stage_name = "calibration";
-  stage_max  = fast_cal ? 3 : CAL_CYCLES;
+  shm_fuzz_len = mem;
+  shm_fuzz_buf = (u8*)(mem + 1);
 
-  /* Make sure the forkserver is up before we do anything, and let's not
-     count its spin-up time toward binary calibration. */
+}
 
-  if (dumb_mode != 1 && !no_forkserver && !forksrv_pid)
-    init_forkserver(argv);
 
-  if (q->exec_cksum) {
+/* Load postprocessor, if available. */
 
-    memcpy(first_trace, trace_bits, MAP_SIZE);
-    hnb = has_new_bits(virgin_bits);
-    if (hnb > new_bits) new_bits = hnb;
+static void setup_post(void) {
 
-  }
+  void* dh;
+  u8* fn = getenv("AFL_POST_LIBRARY");
+  u32 tlen = 6;
 
-  start_us = get_cur_time_us();
+  if (!fn) return;
 
-  for (stage_cur = 0; stage_cur < stage_max; stage_cur++) {
+  ACTF("Loading postprocessor from '%s'...", fn);
 
-    u32 cksum;
+  dh = dlopen(fn, RTLD_NOW);
+  if (!dh) FATAL("%s", dlerror());
 
-    if (!first_run && !(stage_cur % stats_update_freq)) show_stats();
+  post_handler = dlsym(dh, "afl_postprocess");
+  if (!post_handler) FATAL("Symbol 'afl_postprocess' not found.");
 
-    write_to_testcase(use_mem, q->len);
+  /* Do a quick test. It's better to segfault now than later =) */
 
-    fault = run_target(argv, use_tmout, "USELESS=0", 0);
+  post_handler("hello", &tlen);
 
-    /* stop_soon is set by the handler for Ctrl+C. When it's pressed,
-       we want to bail out quickly. */
+  OKF("Postprocessor installed successfully.");
 
-    if (stop_soon || fault != crash_mode) goto abort_calibration;
+}
 
-    if (!dumb_mode && !stage_cur && !count_bytes(trace_bits)) {
-      fault = FAULT_NOINST;
-      goto abort_calibration;
-    }
 
-    cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+/* Read all testcases from the input directory, then queue them for testing.
+   Called at startup. */
 
-    if (q->exec_cksum != cksum) {
+static void read_testcases(void) {
 
-      hnb = has_new_bits(virgin_bits);
-      if (hnb > new_bits) new_bits = hnb;
+  struct dirent **nl;
+  s32 nl_cnt;
+  u32 i;
+  u8* fn;
 
-      if (q->exec_cksum) {
+  /* Auto-detect non-in-place resumption attempts. */
 
-        u32 i;
+  fn = alloc_printf("%s/queue", in_dir);
+  if (!access(fn, F_OK)) in_dir = fn; else ck_free(fn);
 
-        for (i = 0; i < MAP_SIZE; i++) {
+  ACTF("Scanning '%s'...", in_dir);
 
-          if (!var_bytes[i] && first_trace[i] != trace_bits[i]) {
+  /* We use scandir() + alphasort() rather than readdir() because otherwise,
+     the ordering  of test cases would vary somewhat randomly and would be
+     difficult to control. */
 
-            var_bytes[i] = 1;
-            stage_max    = CAL_CYCLES_LONG;
+  nl_cnt = scandir(in_dir, &nl, NULL, alphasort);
 
-          }
+  if (nl_cnt < 0) {
 
-        }
+    if (errno == ENOENT || errno == ENOTDIR)
 
-        var_detected = 1;
+      SAYF("\n" cLRD "[-] " cRST
+           "The input directory does not seem to be valid - try again. The fuzzer needs\n"
+           "    one or more test case to start with - ideally, a small file under 1 kB\n"
+           "    or so. The cases must be stored as regular files directly in the input\n"
+           "    directory.\n");
 
-      } else {
+    PFATAL("Unable to open '%s'", in_dir);
 
-        q->exec_cksum = cksum;
-        memcpy(first_trace, trace_bits, MAP_SIZE);
+  }
 
-      }
+  if (shuffle_queue && nl_cnt > 1) {
 
-    }
+    ACTF("Shuffling queue...");
+    shuffle_ptrs((void**)nl, nl_cnt);
 
   }
 
-  stop_us = get_cur_time_us();
-
-  total_cal_us     += stop_us - start_us;
-  total_cal_cycles += stage_max;
+  for (i = 0; i < nl_cnt; i++) {
 
-  /* OK, let's collect some stats about the performance of this test case.
-     This is used for fuzzing air time calculations in calculate_score(). */
+    struct stat st;
 
-  q->exec_us     = (stop_us - start_us) / stage_max;
-  q->bitmap_size = count_bytes(trace_bits);
-  q->prox_score  = compute_proximity_score();
-  q->handicap    = handicap;
-  q->cal_failed  = 0;
+    u8* fn = alloc_printf("%s/%s", in_dir, nl[i]->d_name);
+    u8* dfn = alloc_printf("%s/.state/deterministic_done/%s", in_dir, nl[i]->d_name);
 
-  total_bitmap_size += q->bitmap_size;
-  total_bitmap_entries++;
+    u8  passed_det = 0;
 
-  /* Update proximity score information */
-  total_prox_score += q->prox_score;
-  avg_prox_score = total_prox_score / queued_paths;
-  if (min_prox_score > q->prox_score) min_prox_score = q->prox_score;
-  if (max_prox_score < q->prox_score) max_prox_score = q->prox_score;
+    free(nl[i]); /* not tracked */
 
-  update_bitmap_score(q);
+    if (lstat(fn, &st) || access(fn, R_OK))
+      PFATAL("Unable to access '%s'", fn);
 
-  /* If this case didn't result in new output from the instrumentation, tell
-     parent. This is a non-critical problem, but something to warn the user
-     about. */
+    /* This also takes care of . and .. */
 
-  if (!dumb_mode && first_run && !fault && !new_bits) fault = FAULT_NOBITS;
+    if (!S_ISREG(st.st_mode) || !st.st_size || strstr(fn, "/README.txt")) {
 
-abort_calibration:
+      ck_free(fn);
+      ck_free(dfn);
+      continue;
 
-  if (new_bits == 2 && !q->has_new_cov) {
-    q->has_new_cov = 1;
-    queued_with_cov++;
-  }
+    }
 
-  /* Mark variable paths. */
+    if (st.st_size > MAX_FILE)
+      FATAL("Test case '%s' is too big (%s, limit is %s)", fn,
+            DMS(st.st_size), DMS(MAX_FILE));
 
-  if (var_detected) {
+    /* Check for metadata that indicates that deterministic fuzzing
+       is complete for this entry. We don't want to repeat deterministic
+       fuzzing when resuming aborted scans, because it would be pointless
+       and probably very time-consuming. */
 
-    var_byte_count = count_bytes(var_bytes);
+    if (!access(dfn, F_OK)) passed_det = 1;
+    ck_free(dfn);
 
-    if (!q->var_behavior) {
-      mark_as_variable(q);
-      queued_variable++;
-    }
+    // Provide 0 as the proximity score and update later in calibrate_case(),
+    // and sort later after the dry-run phase.
+    add_to_queue(fn, st.st_size, passed_det, 0);
 
   }
 
-  stage_name = old_sn;
-  stage_cur  = old_sc;
-  stage_max  = old_sm;
-
-  if (!first_run) show_stats();
+  free(nl); /* not tracked */
 
-  return fault;
+  if (!queued_paths) {
 
-}
+    SAYF("\n" cLRD "[-] " cRST
+         "Looks like there are no valid test cases in the input directory! The fuzzer\n"
+         "    needs one or more test case to start with - ideally, a small file under\n"
+         "    1 kB or so. The cases must be stored as regular files directly in the\n"
+         "    input directory.\n");
 
+    FATAL("No usable test cases in '%s'", in_dir);
 
-/* Examine map coverage. Called once, for first test case. */
+  }
 
-static void check_map_coverage(void) {
+  last_path_time = 0;
+  queued_at_start = queued_paths;
 
-  u32 i;
+}
 
-  if (count_bytes(trace_bits) < 100) return;
 
-  for (i = (1 << (MAP_SIZE_POW2 - 1)); i < MAP_SIZE; i++)
-    if (trace_bits[i]) return;
+/* Helper function for load_extras. */
 
-  WARNF("Recompile binary with newer version of afl to improve coverage!");
+static int compare_extras_len(const void* p1, const void* p2) {
+  struct extra_data *e1 = (struct extra_data*)p1,
+                    *e2 = (struct extra_data*)p2;
 
+  return e1->len - e2->len;
 }
 
+static int compare_extras_use_d(const void* p1, const void* p2) {
+  struct extra_data *e1 = (struct extra_data*)p1,
+                    *e2 = (struct extra_data*)p2;
 
-/* Perform dry run of all test cases to confirm that the app is working as
-   expected. This is done only for the initial inputs, and only once. */
-
-static void perform_dry_run(char** argv) {
+  return e2->hit_cnt - e1->hit_cnt;
+}
 
-  struct queue_entry* q = queue;
-  u32 cal_failures = 0;
-  u8* skip_crashes = getenv("AFL_SKIP_CRASHES");
 
-  while (q) {
+/* Read extras from a file, sort by size. */
 
-    u8* use_mem;
-    u8  res;
-    s32 fd;
+static void load_extras_file(u8* fname, u32* min_len, u32* max_len,
+                             u32 dict_level) {
 
-    u8* fn = strrchr(q->fname, '/') + 1;
+  FILE* f;
+  u8  buf[MAX_LINE];
+  u8  *lptr;
+  u32 cur_line = 0;
 
-    ACTF("Attempting dry run with '%s'...", fn);
+  f = fopen(fname, "r");
 
-    fd = open(q->fname, O_RDONLY);
-    if (fd < 0) PFATAL("Unable to open '%s'", q->fname);
+  if (!f) PFATAL("Unable to open '%s'", fname);
 
-    use_mem = ck_alloc_nozero(q->len);
+  while ((lptr = fgets(buf, MAX_LINE, f))) {
 
-    if (read(fd, use_mem, q->len) != q->len)
-      FATAL("Short read from '%s'", q->fname);
+    u8 *rptr, *wptr;
+    u32 klen = 0;
 
-    close(fd);
+    cur_line++;
 
-    res = calibrate_case(argv, q, use_mem, 0, 1);
-    ck_free(use_mem);
+    /* Trim on left and right. */
 
-    if (stop_soon) return;
+    while (isspace(*lptr)) lptr++;
 
-    if (res == crash_mode || res == FAULT_NOBITS)
-      SAYF(cGRA "    len = %u, map size = %u, exec speed = %llu us\n" cRST,
-           q->len, q->bitmap_size, q->exec_us);
+    rptr = lptr + strlen(lptr) - 1;
+    while (rptr >= lptr && isspace(*rptr)) rptr--;
+    rptr++;
+    *rptr = 0;
 
-    switch (res) {
+    /* Skip empty lines and comments. */
 
-      case FAULT_NONE:
+    if (!*lptr || *lptr == '#') continue;
 
-        if (q == queue) check_map_coverage();
+    /* All other lines must end with '"', which we can consume. */
 
-        if (crash_mode) FATAL("Test case '%s' does *NOT* crash", fn);
+    rptr--;
 
-        break;
+    if (rptr < lptr || *rptr != '"')
+      FATAL("Malformed name=\"value\" pair in line %u.", cur_line);
 
-      case FAULT_TMOUT:
+    *rptr = 0;
 
-        if (timeout_given) {
+    /* Skip alphanumerics and dashes (label). */
 
-          /* The -t nn+ syntax in the command line sets timeout_given to '2' and
-             instructs afl-fuzz to tolerate but skip queue entries that time
-             out. */
+    while (isalnum(*lptr) || *lptr == '_') lptr++;
 
-          if (timeout_given > 1) {
-            WARNF("Test case results in a timeout (skipping)");
-            q->cal_failed = CAL_CHANCES;
-            cal_failures++;
-            break;
-          }
+    /* If @number follows, parse that. */
 
-          SAYF("\n" cLRD "[-] " cRST
-               "The program took more than %u ms to process one of the initial test cases.\n"
-               "    Usually, the right thing to do is to relax the -t option - or to delete it\n"
-               "    altogether and allow the fuzzer to auto-calibrate. That said, if you know\n"
-               "    what you are doing and want to simply skip the unruly test cases, append\n"
-               "    '+' at the end of the value passed to -t ('-t %u+').\n", exec_tmout,
-               exec_tmout);
+    if (*lptr == '@') {
 
-          FATAL("Test case '%s' results in a timeout", fn);
+      lptr++;
+      if (atoi(lptr) > dict_level) continue;
+      while (isdigit(*lptr)) lptr++;
 
-        } else {
+    }
 
-          SAYF("\n" cLRD "[-] " cRST
-               "The program took more than %u ms to process one of the initial test cases.\n"
-               "    This is bad news; raising the limit with the -t option is possible, but\n"
-               "    will probably make the fuzzing process extremely slow.\n\n"
+    /* Skip whitespace and = signs. */
 
-               "    If this test case is just a fluke, the other option is to just avoid it\n"
-               "    altogether, and find one that is less of a CPU hog.\n", exec_tmout);
+    while (isspace(*lptr) || *lptr == '=') lptr++;
 
-          FATAL("Test case '%s' results in a timeout", fn);
+    /* Consume opening '"'. */
 
-        }
+    if (*lptr != '"')
+      FATAL("Malformed name=\"keyword\" pair in line %u.", cur_line);
 
-      case FAULT_CRASH:
+    lptr++;
 
-        if (crash_mode) break;
+    if (!*lptr) FATAL("Empty keyword in line %u.", cur_line);
 
-        if (skip_crashes) {
-          WARNF("Test case results in a crash (skipping)");
-          q->cal_failed = CAL_CHANCES;
-          cal_failures++;
-          break;
-        }
+    /* Okay, let's allocate memory and copy data between "...", handling
+       \xNN escaping, \\, and \". */
 
-        if (mem_limit) {
+    extras = ck_realloc_block(extras, (extras_cnt + 1) *
+               sizeof(struct extra_data));
 
-          SAYF("\n" cLRD "[-] " cRST
-               "Oops, the program crashed with one of the test cases provided. There are\n"
-               "    several possible explanations:\n\n"
+    wptr = extras[extras_cnt].data = ck_alloc(rptr - lptr);
 
-               "    - The test case causes known crashes under normal working conditions. If\n"
-               "      so, please remove it. The fuzzer should be seeded with interesting\n"
-               "      inputs - but not ones that cause an outright crash.\n\n"
+    while (*lptr) {
 
-               "    - The current memory limit (%s) is too low for this program, causing\n"
-               "      it to die due to OOM when parsing valid files. To fix this, try\n"
-               "      bumping it up with the -m setting in the command line. If in doubt,\n"
-               "      try something along the lines of:\n\n"
+      char* hexdigits = "0123456789abcdef";
 
-#ifdef RLIMIT_AS
-               "      ( ulimit -Sv $[%llu << 10]; /path/to/binary [...] <testcase )\n\n"
-#else
-               "      ( ulimit -Sd $[%llu << 10]; /path/to/binary [...] <testcase )\n\n"
-#endif /* ^RLIMIT_AS */
+      switch (*lptr) {
 
-               "      Tip: you can use http://jwilk.net/software/recidivm to quickly\n"
-               "      estimate the required amount of virtual memory for the binary. Also,\n"
-               "      if you are using ASAN, see %s/notes_for_asan.txt.\n\n"
+        case 1 ... 31:
+        case 128 ... 255:
+          FATAL("Non-printable characters in line %u.", cur_line);
 
-#ifdef __APPLE__
+        case '\\':
 
-               "    - On MacOS X, the semantics of fork() syscalls are non-standard and may\n"
-               "      break afl-fuzz performance optimizations when running platform-specific\n"
-               "      binaries. To fix this, set AFL_NO_FORKSRV=1 in the environment.\n\n"
+          lptr++;
 
-#endif /* __APPLE__ */
+          if (*lptr == '\\' || *lptr == '"') {
+            *(wptr++) = *(lptr++);
+            klen++;
+            break;
+          }
 
-               "    - Least likely, there is a horrible bug in the fuzzer. If other options\n"
-               "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n",
-               DMS(mem_limit << 20), mem_limit - 1, doc_path);
+          if (*lptr != 'x' || !isxdigit(lptr[1]) || !isxdigit(lptr[2]))
+            FATAL("Invalid escaping (not \\xNN) in line %u.", cur_line);
 
-        } else {
+          *(wptr++) =
+            ((strchr(hexdigits, tolower(lptr[1])) - hexdigits) << 4) |
+            (strchr(hexdigits, tolower(lptr[2])) - hexdigits);
 
-          SAYF("\n" cLRD "[-] " cRST
-               "Oops, the program crashed with one of the test cases provided. There are\n"
-               "    several possible explanations:\n\n"
+          lptr += 3;
+          klen++;
 
-               "    - The test case causes known crashes under normal working conditions. If\n"
-               "      so, please remove it. The fuzzer should be seeded with interesting\n"
-               "      inputs - but not ones that cause an outright crash.\n\n"
+          break;
 
-#ifdef __APPLE__
+        default:
 
-               "    - On MacOS X, the semantics of fork() syscalls are non-standard and may\n"
-               "      break afl-fuzz performance optimizations when running platform-specific\n"
-               "      binaries. To fix this, set AFL_NO_FORKSRV=1 in the environment.\n\n"
+          *(wptr++) = *(lptr++);
+          klen++;
 
-#endif /* __APPLE__ */
+      }
 
-               "    - Least likely, there is a horrible bug in the fuzzer. If other options\n"
-               "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n");
+    }
 
-        }
+    extras[extras_cnt].len = klen;
+
+    if (extras[extras_cnt].len > MAX_DICT_FILE)
+      FATAL("Keyword too big in line %u (%s, limit is %s)", cur_line,
+            DMS(klen), DMS(MAX_DICT_FILE));
 
-        FATAL("Test case '%s' results in a crash", fn);
+    if (*min_len > klen) *min_len = klen;
+    if (*max_len < klen) *max_len = klen;
 
-      case FAULT_ERROR:
+    extras_cnt++;
 
-        FATAL("Unable to execute target application ('%s')", argv[0]);
+  }
 
-      case FAULT_NOINST:
+  fclose(f);
 
-        FATAL("No instrumentation detected");
+}
 
-      case FAULT_NOBITS:
 
-        useless_at_start++;
+/* Read extras from the extras directory and sort them by size. */
 
-        if (!in_bitmap && !shuffle_queue)
-          WARNF("No new instrumentation output, test case may be useless.");
+static void load_extras(u8* dir) {
 
-        break;
+  DIR* d;
+  struct dirent* de;
+  u32 min_len = MAX_DICT_FILE, max_len = 0, dict_level = 0;
+  u8* x;
 
-    }
+  /* If the name ends with @, extract level and continue. */
 
-    if (q->var_behavior) WARNF("Instrumentation output varies across runs.");
+  if ((x = strchr(dir, '@'))) {
 
-    q = q->next;
+    *x = 0;
+    dict_level = atoi(x + 1);
 
   }
 
-  if (cal_failures) {
+  ACTF("Loading extra dictionary from '%s' (level %u)...", dir, dict_level);
 
-    if (cal_failures == queued_paths)
-      FATAL("All test cases time out%s, giving up!",
-            skip_crashes ? " or crash" : "");
+  d = opendir(dir);
 
-    WARNF("Skipped %u test cases (%0.02f%%) due to timeouts%s.", cal_failures,
-          ((double)cal_failures) * 100 / queued_paths,
-          skip_crashes ? " or crashes" : "");
+  if (!d) {
 
-    if (cal_failures * 5 > queued_paths)
-      WARNF(cLRD "High percentage of rejected test cases, check settings!");
+    if (errno == ENOTDIR) {
+      load_extras_file(dir, &min_len, &max_len, dict_level);
+      goto check_and_sort;
+    }
+
+    PFATAL("Unable to open '%s'", dir);
 
   }
 
-  OKF("All test cases processed.");
+  if (x) FATAL("Dictionary levels not supported for directories.");
 
-}
+  while ((de = readdir(d))) {
 
+    struct stat st;
+    u8* fn = alloc_printf("%s/%s", dir, de->d_name);
+    s32 fd;
 
-/* Helper function: link() if possible, copy otherwise. */
+    if (lstat(fn, &st) || access(fn, R_OK))
+      PFATAL("Unable to access '%s'", fn);
 
-static void link_or_copy(u8* old_path, u8* new_path) {
+    /* This also takes care of . and .. */
+    if (!S_ISREG(st.st_mode) || !st.st_size) {
 
-  s32 i = link(old_path, new_path);
-  s32 sfd, dfd;
-  u8* tmp;
+      ck_free(fn);
+      continue;
 
-  if (!i) return;
+    }
 
-  sfd = open(old_path, O_RDONLY);
-  if (sfd < 0) PFATAL("Unable to open '%s'", old_path);
+    if (st.st_size > MAX_DICT_FILE)
+      FATAL("Extra '%s' is too big (%s, limit is %s)", fn,
+            DMS(st.st_size), DMS(MAX_DICT_FILE));
 
-  dfd = open(new_path, O_WRONLY | O_CREAT | O_EXCL, 0600);
-  if (dfd < 0) PFATAL("Unable to create '%s'", new_path);
+    if (min_len > st.st_size) min_len = st.st_size;
+    if (max_len < st.st_size) max_len = st.st_size;
 
-  tmp = ck_alloc(64 * 1024);
+    extras = ck_realloc_block(extras, (extras_cnt + 1) *
+               sizeof(struct extra_data));
 
-  while ((i = read(sfd, tmp, 64 * 1024)) > 0)
-    ck_write(dfd, tmp, i, new_path);
+    extras[extras_cnt].data = ck_alloc(st.st_size);
+    extras[extras_cnt].len  = st.st_size;
 
-  if (i < 0) PFATAL("read() failed");
+    fd = open(fn, O_RDONLY);
 
-  ck_free(tmp);
-  close(sfd);
-  close(dfd);
+    if (fd < 0) PFATAL("Unable to open '%s'", fn);
 
-}
+    ck_read(fd, extras[extras_cnt].data, st.st_size, fn);
 
+    close(fd);
+    ck_free(fn);
 
-static void nuke_resume_dir(void);
+    extras_cnt++;
 
-/* Create hard links for input test cases in the output directory, choosing
-   good names and pivoting accordingly. */
+  }
 
-static void pivot_inputs(void) {
+  closedir(d);
 
-  struct queue_entry* q = queue;
-  u32 id = 0;
+check_and_sort:
 
-  ACTF("Creating hard links for all input files...");
+  if (!extras_cnt) FATAL("No usable files in '%s'", dir);
 
-  while (q) {
+  qsort(extras, extras_cnt, sizeof(struct extra_data), compare_extras_len);
 
-    u8  *nfn, *rsl = strrchr(q->fname, '/');
-    u32 orig_id;
+  OKF("Loaded %u extra tokens, size range %s to %s.", extras_cnt,
+      DMS(min_len), DMS(max_len));
 
-    if (!rsl) rsl = q->fname; else rsl++;
+  if (max_len > 32)
+    WARNF("Some tokens are relatively large (%s) - consider trimming.",
+          DMS(max_len));
 
-    /* If the original file name conforms to the syntax and the recorded
-       ID matches the one we'd assign, just use the original file name.
-       This is valuable for resuming fuzzing runs. */
+  if (extras_cnt > MAX_DET_EXTRAS)
+    WARNF("More than %u tokens - will use them probabilistically.",
+          MAX_DET_EXTRAS);
 
-#ifndef SIMPLE_FILES
-#  define CASE_PREFIX "id:"
-#else
-#  define CASE_PREFIX "id_"
-#endif /* ^!SIMPLE_FILES */
+}
 
-    if (!strncmp(rsl, CASE_PREFIX, 3) &&
-        sscanf(rsl + 3, "%06u", &orig_id) == 1 && orig_id == id) {
 
-      u8* src_str;
-      u32 src_id;
 
-      resuming_fuzz = 1;
-      nfn = alloc_printf("%s/queue/%s", out_dir, rsl);
 
-      /* Since we're at it, let's also try to find parent and figure out the
-         appropriate depth for this entry. */
+/* Helper function for maybe_add_auto() */
 
-      src_str = strchr(rsl + 3, ':');
+static inline u8 memcmp_nocase(u8* m1, u8* m2, u32 len) {
 
-      if (src_str && sscanf(src_str + 1, "%06u", &src_id) == 1) {
+  while (len--) if (tolower(*(m1++)) ^ tolower(*(m2++))) return 1;
+  return 0;
 
-        struct queue_entry* s = queue;
-        while (src_id-- && s) s = s->next;
-        if (s) q->depth = s->depth + 1;
+}
 
-        if (max_depth < q->depth) max_depth = q->depth;
 
-      }
+/* Maybe add automatic extra. */
 
-    } else {
+static void maybe_add_auto(u8* mem, u32 len) {
 
-      /* No dice - invent a new name, capturing the original one as a
-         substring. */
+  u32 i;
 
-#ifndef SIMPLE_FILES
+  /* Allow users to specify that they don't want auto dictionaries. */
 
-      u8* use_name = strstr(rsl, ",orig:");
+  if (!MAX_AUTO_EXTRAS || !USE_AUTO_EXTRAS) return;
 
-      if (use_name) use_name += 6; else use_name = rsl;
-      nfn = alloc_printf("%s/queue/id:%06u,orig:%s", out_dir, id, use_name);
+  /* Skip runs of identical bytes. */
 
-#else
+  for (i = 1; i < len; i++)
+    if (mem[0] ^ mem[i]) break;
 
-      nfn = alloc_printf("%s/queue/id_%06u", out_dir, id);
+  if (i == len) return;
 
-#endif /* ^!SIMPLE_FILES */
+  /* Reject builtin interesting values. */
 
-    }
+  if (len == 2) {
 
-    /* Pivot to the new queue entry. */
+    i = sizeof(interesting_16) >> 1;
 
-    link_or_copy(q->fname, nfn);
-    ck_free(q->fname);
-    q->fname = nfn;
+    while (i--)
+      if (*((u16*)mem) == interesting_16[i] ||
+          *((u16*)mem) == SWAP16(interesting_16[i])) return;
 
-    /* Make sure that the passed_det value carries over, too. */
+  }
 
-    if (q->passed_det) mark_as_det_done(q);
+  if (len == 4) {
 
-    q = q->next;
-    id++;
+    i = sizeof(interesting_32) >> 2;
+
+    while (i--)
+      if (*((u32*)mem) == interesting_32[i] ||
+          *((u32*)mem) == SWAP32(interesting_32[i])) return;
 
   }
 
-  if (in_place_resume) nuke_resume_dir();
+  /* Reject anything that matches existing extras. Do a case-insensitive
+     match. We optimize by exploiting the fact that extras[] are sorted
+     by size. */
 
-}
+  for (i = 0; i < extras_cnt; i++)
+    if (extras[i].len >= len) break;
 
+  for (; i < extras_cnt && extras[i].len == len; i++)
+    if (!memcmp_nocase(extras[i].data, mem, len)) return;
 
-#ifndef SIMPLE_FILES
+  /* Last but not least, check a_extras[] for matches. There are no
+     guarantees of a particular sort order. */
 
-/* Construct a file name for a new test case, capturing the operation
-   that led to its discovery. Uses a static buffer. */
+  auto_changed = 1;
 
-static u8* describe_op(u8 hnb) {
+  for (i = 0; i < a_extras_cnt; i++) {
 
-  static u8 ret[256];
+    if (a_extras[i].len == len && !memcmp_nocase(a_extras[i].data, mem, len)) {
 
-  if (syncing_party) {
+      a_extras[i].hit_cnt++;
+      goto sort_a_extras;
 
-    sprintf(ret, "sync:%s,src:%06u", syncing_party, syncing_case);
+    }
 
-  } else {
+  }
 
-    sprintf(ret, "src:%06u", current_entry);
+  /* At this point, looks like we're dealing with a new entry. So, let's
+     append it if we have room. Otherwise, let's randomly evict some other
+     entry from the bottom half of the list. */
 
-    if (splicing_with >= 0)
-      sprintf(ret + strlen(ret), "+%06u", splicing_with);
+  if (a_extras_cnt < MAX_AUTO_EXTRAS) {
 
-    sprintf(ret + strlen(ret), ",op:%s", stage_short);
+    a_extras = ck_realloc_block(a_extras, (a_extras_cnt + 1) *
+                                sizeof(struct extra_data));
 
-    if (stage_cur_byte >= 0) {
+    a_extras[a_extras_cnt].data = ck_memdup(mem, len);
+    a_extras[a_extras_cnt].len  = len;
+    a_extras_cnt++;
 
-      sprintf(ret + strlen(ret), ",pos:%u", stage_cur_byte);
+  } else {
 
-      if (stage_val_type != STAGE_VAL_NONE)
-        sprintf(ret + strlen(ret), ",val:%s%+d",
-                (stage_val_type == STAGE_VAL_BE) ? "be:" : "",
-                stage_cur_val);
+    i = MAX_AUTO_EXTRAS / 2 +
+        UR((MAX_AUTO_EXTRAS + 1) / 2);
 
-    } else sprintf(ret + strlen(ret), ",rep:%u", stage_cur_val);
+    ck_free(a_extras[i].data);
 
-  }
-
-  if (hnb == 2) strcat(ret, ",+cov");
-
-  return ret;
-
-}
+    a_extras[i].data    = ck_memdup(mem, len);
+    a_extras[i].len     = len;
+    a_extras[i].hit_cnt = 0;
 
-#endif /* !SIMPLE_FILES */
+  }
 
+sort_a_extras:
 
-/* Write a message accompanying the crash directory :-) */
+  /* First, sort all auto extras by use count, descending order. */
 
-static void write_crash_readme(void) {
+  qsort(a_extras, a_extras_cnt, sizeof(struct extra_data),
+        compare_extras_use_d);
 
-  u8* fn = alloc_printf("%s/crashes/README.txt", out_dir);
-  s32 fd;
-  FILE* f;
+  /* Then, sort the top USE_AUTO_EXTRAS entries by size. */
 
-  fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
-  ck_free(fn);
+  qsort(a_extras, MIN(USE_AUTO_EXTRAS, a_extras_cnt),
+        sizeof(struct extra_data), compare_extras_len);
 
-  /* Do not die on errors here - that would be impolite. */
+}
 
-  if (fd < 0) return;
 
-  f = fdopen(fd, "w");
+/* Save automatically generated extras. */
 
-  if (!f) {
-    close(fd);
-    return;
-  }
+static void save_auto(void) {
 
-  fprintf(f, "Command line used to find this crash:\n\n"
+  u32 i;
 
-             "%s\n\n"
+  if (!auto_changed) return;
+  auto_changed = 0;
 
-             "If you can't reproduce a bug outside of afl-fuzz, be sure to set the same\n"
-             "memory limit. The limit used for this fuzzing session was %s.\n\n"
+  for (i = 0; i < MIN(USE_AUTO_EXTRAS, a_extras_cnt); i++) {
 
-             "Need a tool to minimize test cases before investigating the crashes or sending\n"
-             "them to a vendor? Check out the afl-tmin that comes with the fuzzer!\n\n"
+    u8* fn = alloc_printf("%s/queue/.state/auto_extras/auto_%06u", out_dir, i);
+    s32 fd;
 
-             "Found any cool bugs in open-source tools using afl-fuzz? If yes, please drop\n"
-             "me a mail at <lcamtuf@coredump.cx> once the issues are fixed - I'd love to\n"
-             "add your finds to the gallery at:\n\n"
+    fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
 
-             "  http://lcamtuf.coredump.cx/afl/\n\n"
+    if (fd < 0) PFATAL("Unable to create '%s'", fn);
 
-             "Thanks :-)\n",
+    ck_write(fd, a_extras[i].data, a_extras[i].len, fn);
 
-             orig_cmdline, DMS(mem_limit << 20)); /* ignore errors */
+    close(fd);
+    ck_free(fn);
 
-  fclose(f);
+  }
 
 }
 
-static u8 check_coverage(u8 crashed, char** argv, void* mem, u32 len) {
-  u8 *covexe = "";
-  u8 *covdir = "";
-  u8 *tmpfile = "";
-  u8 *tmpfile_env = "";
-  u8 *cmd = "";
-  u8 covered[100] = "";
-  u8 *tmp_argv1 = "";
-
-  u8 fault_tmp;
-  u32 line = 0;
-  u32 parsed_line = 0;
-  u32 num = 1 + UR(ARITH_MAX);
-
-  if(!getenv("PACFIX_COV_EXE")) return 1;
-  if(!getenv("PACFIX_COV_DIR")) return 1;
-  if(!getenv("PACFIX_TARGET_LINE")) return 1;
-  covexe = getenv("PACFIX_COV_EXE");
-  covdir = getenv("PACFIX_COV_DIR");
-  sscanf(getenv("PACFIX_TARGET_LINE"), "%d", &line);
-
-  tmpfile = alloc_printf("%s/__tmp_file_%d", covdir, num);
-  tmpfile_env = alloc_printf("PACFIX_FILENAME=%s", tmpfile);
-  // Remove covdir + "/__tmp_file" (It might not exist, but that's okay)
-  unlink(tmpfile);
-  write_to_testcase(mem, len);
-  tmp_argv1 = argv[0];
-  argv[0] = covexe;
-  fault_tmp = run_target(argv, 10000, tmpfile_env, 1);
-  argv[0] = tmp_argv1;
-
-  if (access(tmpfile, F_OK) == -1) return 0;
-
-  if (crashed == 1) {
-    // Read last line of covdir + "/__tmp_file" with tail -n 1 command
-    cmd = alloc_printf("tail -n 1 %s", tmpfile);
-    FILE *fp = popen(cmd, "r");
-    if (fp == NULL) return 1;
-    // __localize: <line_number> if line_number == line then return 1 else return 0
-    u8 *result = fgets(covered, 100, fp);
-    pclose(fp);
-    if (result == NULL) return 1;
-    if(sscanf(covered, "__localize: %d", &parsed_line) != 1) return 1;
-    if(parsed_line == line) return 1;
-    else return 0;
-  } 
-  else {
-    cmd = alloc_printf("grep \"%d\" %s | wc -l", line, tmpfile);
-    FILE *fp = popen(cmd, "r");
-    if (fp == NULL) return 0;
-    u8 *result = fgets(covered, 100, fp);
-    pclose(fp);
-    if (result == NULL) return 0;
-    if(sscanf(covered, "%d", &parsed_line) != 1) return 0;
-    if (parsed_line == 0) return 0;
-    else return 1;
-  }
-}
 
-static void get_valuation(u8 crashed, char** argv, void* mem, u32 len) {
-  u8 *valexe = "";
-  u8 *covdir = "";
-  u8 *tmpfile = "";
-  u8 *tmpfile_env = "";
-  u8 *cmd = "";
-  u8 fault_tmp;
-  u8 *tmp_argv1 = "";
-  u32 num = 1 + UR(ARITH_MAX);
-
-  if(!getenv("PACFIX_VAL_EXE")) return;
-  if(!getenv("PACFIX_COV_DIR")) return;
-  valexe = getenv("PACFIX_VAL_EXE");
-  covdir = getenv("PACFIX_COV_DIR");
-  tmpfile = alloc_printf("%s/__tmp_file_%d", covdir, num);
-  tmpfile_env = alloc_printf("PACFIX_FILENAME=%s", tmpfile);
-
-  // Remove covdir + "/__tmp_file" (It might not exist, but that's okay)
-  unlink(tmpfile);
-  write_to_testcase(mem, len);
-  tmp_argv1 = argv[0];
-  argv[0] = valexe;
-  fault_tmp = run_target(argv, 10000, tmpfile_env, 1);
-  argv[0] = tmp_argv1;
+/* Load automatically generated extras. */
 
-  if (access(tmpfile, F_OK) != 0) return;
+static void load_auto(void) {
 
-  if (crashed == 1) {
-     cmd = alloc_printf("mv %s %s/memory/neg/id:%06llu", tmpfile, out_dir, total_saved_crashes);
-     total_saved_crashes++;
-  }
-  else {
-    cmd = alloc_printf("mv %s %s/memory/pos/id:%06llu", tmpfile, out_dir, total_saved_positives);
-    total_saved_positives++;
-  }
+  u32 i;
 
-  FILE *fp = popen(cmd, "r");
-  if (fp == NULL) return;
-  pclose(fp);
-}
+  for (i = 0; i < USE_AUTO_EXTRAS; i++) {
 
+    u8  tmp[MAX_AUTO_EXTRA + 1];
+    u8* fn = alloc_printf("%s/.state/auto_extras/auto_%06u", in_dir, i);
+    s32 fd, len;
 
-/* Check if the result of an execve() during routine fuzzing is interesting,
-   save or queue the input test case for further analysis if so. Returns 1 if
-   entry is saved, 0 otherwise. */
+    fd = open(fn, O_RDONLY, 0600);
 
-static u8 save_if_interesting(char** argv, void* mem, u32 len, u8 fault) {
+    if (fd < 0) {
 
-  u8  *fn = "";
-  u8  hnb;
-  s32 fd;
-  u8  keeping = 0, res;
-  u64 prox_score;
+      if (errno != ENOENT) PFATAL("Unable to open '%s'", fn);
+      ck_free(fn);
+      break;
 
-  if (fault == crash_mode) {
+    }
 
-    hnb = has_new_bits(virgin_bits);
-    if (hnb) {
+    /* We read one byte more to cheaply detect tokens that are too
+       long (and skip them). */
 
-    /* Keep only if there are new bits in the map, add to queue for
-       future fuzzing, etc. */
+    len = read(fd, tmp, MAX_AUTO_EXTRA + 1);
 
-    // if (!(hnb = has_new_bits(virgin_bits))) {
-    //   if (crash_mode) total_crashes++;
-    //   return 0;
-    // }
-    
-      prox_score = compute_proximity_score();
+    if (len < 0) PFATAL("Unable to read from '%s'", fn);
 
-#ifndef SIMPLE_FILES
+    if (len >= MIN_AUTO_EXTRA && len <= MAX_AUTO_EXTRA)
+      maybe_add_auto(tmp, len);
 
-      fn = alloc_printf("%s/queue/id:%06u,%llu,%s", out_dir, queued_paths,
-                        prox_score, describe_op(hnb));
+    close(fd);
+    ck_free(fn);
 
-#else
+  }
 
-      fn = alloc_printf("%s/queue/id_%06u", out_dir, queued_paths);
+  if (i) OKF("Loaded %u auto-discovered dictionary tokens.", i);
+  else OKF("No auto-generated dictionary tokens to reuse.");
 
-#endif /* ^!SIMPLE_FILES */
+}
 
-      add_to_queue(fn, len, 0, prox_score);
 
-      if (hnb == 2) {
-        queue_last->has_new_cov = 1;
-        queued_with_cov++;
-      }
+/* Destroy extras. */
 
-      queue_last->exec_cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+static void destroy_extras(void) {
 
-      /* Try to calibrate inline; this also calls update_bitmap_score() when
-        successful. */
+  u32 i;
 
-      res = calibrate_case(argv, queue_last, mem, queue_cycle - 1, 0);
+  for (i = 0; i < extras_cnt; i++)
+    ck_free(extras[i].data);
 
-      if (res == FAULT_ERROR)
-        FATAL("Unable to execute target application");
+  ck_free(extras);
 
-      fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
-      if (fd < 0) PFATAL("Unable to create '%s'", fn);
-      ck_write(fd, mem, len, fn);
-      close(fd);
+  for (i = 0; i < a_extras_cnt; i++)
+    ck_free(a_extras[i].data);
 
-      keeping = 1;
-    }
+  ck_free(a_extras);
 
-  }
+}
 
-  switch (fault) {
 
-    case FAULT_TMOUT:
+/* Spin up fork server (instrumented mode only). The idea is explained here:
 
-      /* Timeouts are not very interesting, but we're still obliged to keep
-         a handful of samples. We use the presence of new bits in the
-         hang-specific bitmap as a signal of uniqueness. In "dumb" mode, we
-         just keep everything. */
+   http://lcamtuf.blogspot.com/2014/10/fuzzing-binaries-without-execve.html
 
-      total_tmouts++;
+   In essence, the instrumentation allows us to skip execve(), and just keep
+   cloning a stopped child. So, we just execute once, and then send commands
+   through a pipe. The other part of this logic is in afl-as.h. */
 
-      if (unique_hangs >= KEEP_UNIQUE_HANG) return keeping;
+EXP_ST void init_forkserver(char** argv) {
 
-      if (!dumb_mode) {
+  static struct itimerval it;
+  int st_pipe[2], ctl_pipe[2];
+  int status;
+  s32 rlen;
 
-#ifdef WORD_SIZE_64
-        simplify_trace((u64*)trace_bits);
-#else
-        simplify_trace((u32*)trace_bits);
-#endif /* ^WORD_SIZE_64 */
+  ACTF("Spinning up the fork server...");
 
-        if (!has_new_bits(virgin_tmout)) return keeping;
+  if (pipe(st_pipe) || pipe(ctl_pipe)) PFATAL("pipe() failed");
 
-      }
+  forksrv_pid = fork();
 
-      unique_tmouts++;
+  if (forksrv_pid < 0) PFATAL("fork() failed");
 
-      /* Before saving, we make sure that it's a genuine hang by re-running
-         the target with a more generous timeout (unless the default timeout
-         is already generous). */
+  if (!forksrv_pid) {
 
-      if (exec_tmout < hang_tmout) {
+    struct rlimit r;
 
-        u8 new_fault;
-        write_to_testcase(mem, len);
-        new_fault = run_target(argv, hang_tmout, "USELESS=0", 0);
+    /* Umpf. On OpenBSD, the default fd limit for root users is set to
+       soft 128. Let's try to fix that... */
 
-        /* A corner case that one user reported bumping into: increasing the
-           timeout actually uncovers a crash. Make sure we don't discard it if
-           so. */
+    if (!getrlimit(RLIMIT_NOFILE, &r) && r.rlim_cur < FORKSRV_FD + 2) {
 
-        if (!stop_soon && new_fault == FAULT_CRASH) goto keep_as_crash;
+      r.rlim_cur = FORKSRV_FD + 2;
+      setrlimit(RLIMIT_NOFILE, &r); /* Ignore errors */
 
-        if (stop_soon || new_fault != FAULT_TMOUT) return keeping;
+    }
 
-      }
+    if (mem_limit) {
 
-#ifndef SIMPLE_FILES
+      r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
 
-      fn = alloc_printf("%s/hangs/id:%06llu,%s", out_dir,
-                        unique_hangs, describe_op(0));
+#ifdef RLIMIT_AS
 
-#else
+      setrlimit(RLIMIT_AS, &r); /* Ignore errors */
 
-      fn = alloc_printf("%s/hangs/id_%06llu", out_dir,
-                        unique_hangs);
+#else
 
-#endif /* ^!SIMPLE_FILES */
+      /* This takes care of OpenBSD, which doesn't have RLIMIT_AS, but
+         according to reliable sources, RLIMIT_DATA covers anonymous
+         maps - so we should be getting good protection against OOM bugs. */
 
-      unique_hangs++;
+      setrlimit(RLIMIT_DATA, &r); /* Ignore errors */
 
-      last_hang_time = get_cur_time();
+#endif /* ^RLIMIT_AS */
 
-      break;
 
-    case FAULT_CRASH:
+    }
 
-keep_as_crash:
+    /* Dumping cores is slow and can lead to anomalies if SIGKILL is delivered
+       before the dump is complete. */
 
-      if (!check_coverage(1, argv, mem, len)) return keeping;
-      get_valuation(1, argv, mem, len);
+    r.rlim_max = r.rlim_cur = 0;
 
-      /* This is handled in a manner roughly similar to timeouts,
-         except for slightly different limits and no need to re-run test
-         cases. */
+    setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
 
-      total_crashes++;
+    /* Isolate the process and configure standard descriptors. If out_file is
+       specified, stdin is /dev/null; otherwise, out_fd is cloned instead. */
 
-      if (unique_crashes >= KEEP_UNIQUE_CRASH) return keeping;
+    setsid();
 
-      if (!dumb_mode) {
+    dup2(dev_null_fd, 1);
+    dup2(dev_null_fd, 2);
 
-#ifdef WORD_SIZE_64
-        simplify_trace((u64*)trace_bits);
-#else
-        simplify_trace((u32*)trace_bits);
-#endif /* ^WORD_SIZE_64 */
+    if (out_file) {
 
-        // if (!has_new_bits(virgin_crash)) return keeping;
+      dup2(dev_null_fd, 0);
 
-      }
+    } else {
 
-      if (!unique_crashes) write_crash_readme();
+      dup2(out_fd, 0);
+      close(out_fd);
 
-      // Temporary computation for debugging.
-      prox_score = compute_proximity_score();
+    }
 
-#ifndef SIMPLE_FILES
+    /* Set up control and status pipes, close the unneeded original fds. */
+
+    if (dup2(ctl_pipe[0], FORKSRV_FD) < 0) PFATAL("dup2() failed");
+    if (dup2(st_pipe[1], FORKSRV_FD + 1) < 0) PFATAL("dup2() failed");
+
+    close(ctl_pipe[0]);
+    close(ctl_pipe[1]);
+    close(st_pipe[0]);
+    close(st_pipe[1]);
+
+    close(out_dir_fd);
+    close(dev_null_fd);
+    close(dev_urandom_fd);
+    close(fileno(plot_file));
+
+    /* This should improve performance a bit, since it stops the linker from
+       doing extra work post-fork(). */
+
+    if (!getenv("LD_BIND_LAZY")) setenv("LD_BIND_NOW", "1", 0);
+
+    /* Set sane defaults for ASAN if nothing else specified. */
+
+    setenv("ASAN_OPTIONS", "abort_on_error=1:"
+                           "detect_leaks=0:"
+                           "symbolize=0:"
+                           "allocator_may_return_null=1", 0);
+
+    /* MSAN is tricky, because it doesn't support abort_on_error=1 at this
+       point. So, we do this in a very hacky way. */
+
+    setenv("MSAN_OPTIONS", "exit_code=" STRINGIFY(MSAN_ERROR) ":"
+                           "symbolize=0:"
+                           "abort_on_error=1:"
+                           "allocator_may_return_null=1:"
+                           "msan_track_origins=0", 0);
+
+    execv(target_path, argv);
+
+    /* Use a distinctive bitmap signature to tell the parent about execv()
+       falling through. */
+
+    *(u32*)trace_bits = EXEC_FAIL_SIG;
+    exit(0);
+
+  }
+
+  /* Close the unneeded endpoints. */
+
+  close(ctl_pipe[0]);
+  close(st_pipe[1]);
+
+  fsrv_ctl_fd = ctl_pipe[1];
+  fsrv_st_fd  = st_pipe[0];
+
+  /* Wait for the fork server to come up, but don't wait too long. */
+
+  it.it_value.tv_sec = ((exec_tmout * FORK_WAIT_MULT) / 1000);
+  it.it_value.tv_usec = ((exec_tmout * FORK_WAIT_MULT) % 1000) * 1000;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  rlen = read(fsrv_st_fd, &status, 4);
+
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  /* If we have a four-byte "hello" message from the server, we're all set.
+     Otherwise, try to figure out what went wrong. */
+
+  if (rlen == 4) {
+    OKF("All right - fork server is up.");
+    return;
+  }
+
+  if (child_timed_out)
+    FATAL("Timeout while initializing fork server (adjusting -t may help)");
+
+  if (waitpid(forksrv_pid, &status, 0) <= 0)
+    PFATAL("waitpid() failed");
+
+  if (WIFSIGNALED(status)) {
+
+    if (mem_limit && mem_limit < 500 && uses_asan) {
+
+      SAYF("\n" cLRD "[-] " cRST
+           "Whoops, the target binary crashed suddenly, before receiving any input\n"
+           "    from the fuzzer! Since it seems to be built with ASAN and you have a\n"
+           "    restrictive memory limit configured, this is expected; please read\n"
+           "    %s/notes_for_asan.txt for help.\n", doc_path);
+
+    } else if (!mem_limit) {
+
+      SAYF("\n" cLRD "[-] " cRST
+           "Whoops, the target binary crashed suddenly, before receiving any input\n"
+           "    from the fuzzer! There are several probable explanations:\n\n"
+
+           "    - The binary is just buggy and explodes entirely on its own. If so, you\n"
+           "      need to fix the underlying problem or find a better replacement.\n\n"
+
+#ifdef __APPLE__
+
+           "    - On MacOS X, the semantics of fork() syscalls are non-standard and may\n"
+           "      break afl-fuzz performance optimizations when running platform-specific\n"
+           "      targets. To fix this, set AFL_NO_FORKSRV=1 in the environment.\n\n"
+
+#endif /* __APPLE__ */
+
+           "    - Less likely, there is a horrible bug in the fuzzer. If other options\n"
+           "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n");
+
+    } else {
+
+      SAYF("\n" cLRD "[-] " cRST
+           "Whoops, the target binary crashed suddenly, before receiving any input\n"
+           "    from the fuzzer! There are several probable explanations:\n\n"
+
+           "    - The current memory limit (%s) is too restrictive, causing the\n"
+           "      target to hit an OOM condition in the dynamic linker. Try bumping up\n"
+           "      the limit with the -m setting in the command line. A simple way confirm\n"
+           "      this diagnosis would be:\n\n"
+
+#ifdef RLIMIT_AS
+           "      ( ulimit -Sv $[%llu << 10]; /path/to/fuzzed_app )\n\n"
+#else
+           "      ( ulimit -Sd $[%llu << 10]; /path/to/fuzzed_app )\n\n"
+#endif /* ^RLIMIT_AS */
+
+           "      Tip: you can use http://jwilk.net/software/recidivm to quickly\n"
+           "      estimate the required amount of virtual memory for the binary.\n\n"
+
+           "    - The binary is just buggy and explodes entirely on its own. If so, you\n"
+           "      need to fix the underlying problem or find a better replacement.\n\n"
+
+#ifdef __APPLE__
+
+           "    - On MacOS X, the semantics of fork() syscalls are non-standard and may\n"
+           "      break afl-fuzz performance optimizations when running platform-specific\n"
+           "      targets. To fix this, set AFL_NO_FORKSRV=1 in the environment.\n\n"
+
+#endif /* __APPLE__ */
+
+           "    - Less likely, there is a horrible bug in the fuzzer. If other options\n"
+           "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n",
+           DMS(mem_limit << 20), mem_limit - 1);
+
+    }
+
+    FATAL("Fork server crashed with signal %d", WTERMSIG(status));
+
+  }
+
+  if (*(u32*)trace_bits == EXEC_FAIL_SIG)
+    FATAL("Unable to execute target application ('%s')", argv[0]);
+
+  if (mem_limit && mem_limit < 500 && uses_asan) {
+
+    SAYF("\n" cLRD "[-] " cRST
+           "Hmm, looks like the target binary terminated before we could complete a\n"
+           "    handshake with the injected code. Since it seems to be built with ASAN and\n"
+           "    you have a restrictive memory limit configured, this is expected; please\n"
+           "    read %s/notes_for_asan.txt for help.\n", doc_path);
+
+  } else if (!mem_limit) {
+
+    SAYF("\n" cLRD "[-] " cRST
+         "Hmm, looks like the target binary terminated before we could complete a\n"
+         "    handshake with the injected code. Perhaps there is a horrible bug in the\n"
+         "    fuzzer. Poke <lcamtuf@coredump.cx> for troubleshooting tips.\n");
+
+  } else {
+
+    SAYF("\n" cLRD "[-] " cRST
+         "Hmm, looks like the target binary terminated before we could complete a\n"
+         "    handshake with the injected code. There are %s probable explanations:\n\n"
+
+         "%s"
+         "    - The current memory limit (%s) is too restrictive, causing an OOM\n"
+         "      fault in the dynamic linker. This can be fixed with the -m option. A\n"
+         "      simple way to confirm the diagnosis may be:\n\n"
+
+#ifdef RLIMIT_AS
+         "      ( ulimit -Sv $[%llu << 10]; /path/to/fuzzed_app )\n\n"
+#else
+         "      ( ulimit -Sd $[%llu << 10]; /path/to/fuzzed_app )\n\n"
+#endif /* ^RLIMIT_AS */
+
+         "      Tip: you can use http://jwilk.net/software/recidivm to quickly\n"
+         "      estimate the required amount of virtual memory for the binary.\n\n"
+
+         "    - Less likely, there is a horrible bug in the fuzzer. If other options\n"
+         "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n",
+         getenv(DEFER_ENV_VAR) ? "three" : "two",
+         getenv(DEFER_ENV_VAR) ?
+         "    - You are using deferred forkserver, but __AFL_INIT() is never\n"
+         "      reached before the program terminates.\n\n" : "",
+         DMS(mem_limit << 20), mem_limit - 1);
+
+  }
+
+  FATAL("Fork server handshake failed");
+
+}
+
+
+/* Execute target application, monitoring for timeouts. Return status
+   information. The called program will update trace_bits[]. */
+
+/* Turn the exit status of the target into a FAULT_* code (or FAULT_NONE),
+   setting kill_signal for crashes. */
+
+static u8 fault_from_status(s32 status, u8 timed_out) {
+
+  if (WIFSIGNALED(status) && !stop_soon) {
+
+    kill_signal = WTERMSIG(status);
+
+    if (timed_out && kill_signal == SIGKILL) return FAULT_TMOUT;
+
+    return FAULT_CRASH;
+
+  }
+
+  /* A somewhat nasty hack for MSAN, which doesn't support abort_on_error and
+     must use a special exit code. */
+
+  if (uses_asan && WEXITSTATUS(status) == MSAN_ERROR) {
+    kill_signal = 0;
+    return FAULT_CRASH;
+  }
+
+  return FAULT_NONE;
+
+}
+
+
+static u8 run_target(char** argv, u32 timeout, char* env_opt, u8 force_dumb_mode) {
+
+  static struct itimerval it;
+  static u64 exec_ms = 0;
+
+  int status = 0;
+  u32 tb4;
+  u8  fault;
+
+  child_timed_out = 0;
+
+  /* After this memset, trace_bits[] are effectively volatile, so we
+     must prevent any earlier operations from venturing into that
+     territory. */
+
+  memset(trace_bits, 0, MAP_SIZE);
+
+  /* Persistent mode targets may reset the DFG maps between iterations on
+     their own; the previous run's may not have had the chance to, though. */
+
+  if (!dfg_self_reset || prev_timed_out) reset_dfg_maps(prev_timed_out);
+
+  MEM_BARRIER();
+
+  /* If we're running in "dumb" mode, we can't rely on the fork server
+     logic compiled into the target program, so we will just keep calling
+     execve(). There is a bit of code duplication between here and
+     init_forkserver(), but c'est la vie. */
+
+  if (force_dumb_mode == 1 || dumb_mode == 1 || no_forkserver) {
+
+    child_pid = fork();
+
+    if (child_pid < 0) PFATAL("fork() failed");
+
+    if (!child_pid) {
+
+      struct rlimit r;
+
+      if (mem_limit) {
+
+        r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
+
+#ifdef RLIMIT_AS
+
+        setrlimit(RLIMIT_AS, &r); /* Ignore errors */
+
+#else
+
+        setrlimit(RLIMIT_DATA, &r); /* Ignore errors */
+
+#endif /* ^RLIMIT_AS */
+
+      }
+
+      r.rlim_max = r.rlim_cur = 0;
+
+      setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
+
+      /* Isolate the process and configure standard descriptors. If out_file is
+         specified, stdin is /dev/null; otherwise, out_fd is cloned instead. */
+
+      setsid();
+
+      dup2(dev_null_fd, 1);
+      dup2(dev_null_fd, 2);
+
+      if (out_file) {
+
+        dup2(dev_null_fd, 0);
+
+      } else {
+
+        dup2(out_fd, 0);
+        close(out_fd);
+
+      }
+
+      /* On Linux, would be faster to use O_CLOEXEC. Maybe TODO. */
+
+      close(dev_null_fd);
+      close(out_dir_fd);
+      close(dev_urandom_fd);
+      close(fileno(plot_file));
+
+      /* Set sane defaults for ASAN if nothing else specified. */
+
+      char *envp[] =
+      {
+          "ASAN_OPTIONS=abort_on_error=1:detect_leaks=0:symbolize=0:allocator_may_return_null=1",
+          "MSAN_OPTIONS=exit_code=86:symbolize=0:msan_track_origins=0",
+          env_opt,
+          0
+      };
+
+      execve(argv[0], argv, envp);
+
+      /* Use a distinctive bitmap value to tell the parent about execv()
+         falling through. */
+
+      *(u32*)trace_bits = EXEC_FAIL_SIG;
+      exit(0);
+
+    }
+
+  } else {
+
+    s32 res;
+
+    /* In non-dumb mode, we have the fork server up and running, so simply
+       tell it to have at it, and then read back PID. */
+
+    if ((res = write(fsrv_ctl_fd, &prev_timed_out, 4)) != 4) {
+
+      if (stop_soon) return 0;
+      RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+
+    }
+
+    if ((res = read(fsrv_st_fd, &child_pid, 4)) != 4) {
+
+      if (stop_soon) return 0;
+      RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+
+    }
+
+    if (child_pid <= 0) FATAL("Fork server is misbehaving (OOM?)");
+
+  }
+
+  /* Configure timeout, as requested by user, then wait for child to terminate. */
+
+  it.it_value.tv_sec = (timeout / 1000);
+  it.it_value.tv_usec = (timeout % 1000) * 1000;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  /* The SIGALRM handler simply kills the child_pid and sets child_timed_out. */
+
+  if (force_dumb_mode == 1 || dumb_mode == 1 || no_forkserver) {
+
+    if (waitpid(child_pid, &status, 0) <= 0) PFATAL("waitpid() failed");
+
+  } else {
+
+    s32 res;
+
+    if ((res = read(fsrv_st_fd, &status, 4)) != 4) {
+
+      if (stop_soon) return 0;
+      RPFATAL(res, "Unable to communicate with fork server (OOM?)");
+
+    }
+
+  }
+
+  if (!WIFSTOPPED(status)) child_pid = 0;
+
+  getitimer(ITIMER_REAL, &it);
+  exec_ms = (u64) timeout - (it.it_value.tv_sec * 1000 +
+                             it.it_value.tv_usec / 1000);
+
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  total_execs++;
+
+  /* Any subsequent operations on trace_bits must not be moved by the
+     compiler below this point. Past this location, trace_bits[] behave
+     very normally and do not have to be treated as volatile. */
+
+  MEM_BARRIER();
+
+  tb4 = *(u32*)trace_bits;
+
+  analyze_trace();
+
+  prev_timed_out = child_timed_out;
+
+  /* Report outcome to caller. */
+
+  fault = fault_from_status(status, child_timed_out);
+  if (fault) return fault;
+
+  if ((force_dumb_mode == 1 || dumb_mode == 1 || no_forkserver) && tb4 == EXEC_FAIL_SIG)
+    return FAULT_ERROR;
+
+  /* It makes sense to account for the slowest units only if the testcase was run
+  under the user defined timeout. */
+  if (!(timeout > exec_tmout) && (slowest_exec_ms < exec_ms)) {
+    slowest_exec_ms = exec_ms;
+  }
+
+  return FAULT_NONE;
+
+}
+
+
+/* Write modified data to file for testing. A memfd is simply overwritten in
+   place. Otherwise, if out_file is set, the old file is unlinked and a new
+   one is created; if not, out_fd is rewound and truncated. */
+
+static void write_testcase_file(void* mem, u32 len) {
+
+  s32 fd = out_fd;
+
+  if (memfd_input) {
+
+    if (pwrite(fd, mem, len, 0) != len) PFATAL("pwrite() failed");
+    if (ftruncate(fd, len)) PFATAL("ftruncate() failed");
+    if (!out_file) lseek(fd, 0, SEEK_SET);
+    return;
+
+  }
+
+  if (out_file) {
+
+    unlink(out_file); /* Ignore errors. */
+
+    fd = open(out_file, O_WRONLY | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0) PFATAL("Unable to create '%s'", out_file);
+
+  } else lseek(fd, 0, SEEK_SET);
+
+  ck_write(fd, mem, len, out_file);
+
+  if (!out_file) {
+
+    if (ftruncate(fd, len)) PFATAL("ftruncate() failed");
+    lseek(fd, 0, SEEK_SET);
+
+  } else close(fd);
+
+}
+
+
+/* Hand the test case over to the target, through the SHM if the harness
+   supports it, or through the input file otherwise. */
+
+static void write_to_testcase(void* mem, u32 len) {
+
+  if (shm_fuzz) {
+
+    memcpy(shm_fuzz_buf, mem, len);
+    *shm_fuzz_len = len;
+    return;
+
+  }
+
+  write_testcase_file(mem, len);
+
+}
+
+
+/* The same, but with an adjustable gap. Used for trimming. */
+
+static void write_with_gap(void* mem, u32 len, u32 skip_at, u32 skip_len) {
+
+  s32 fd = out_fd;
+  u32 tail_len = len - skip_at - skip_len;
+
+  if (shm_fuzz) {
+
+    memcpy(shm_fuzz_buf, mem, skip_at);
+    memcpy(shm_fuzz_buf + skip_at, mem + skip_at + skip_len, tail_len);
+    *shm_fuzz_len = len - skip_len;
+    return;
+
+  }
+
+  if (memfd_input) {
+
+    if (pwrite(fd, mem, skip_at, 0) != skip_at ||
+        pwrite(fd, mem + skip_at + skip_len, tail_len, skip_at) != tail_len)
+      PFATAL("pwrite() failed");
+
+    if (ftruncate(fd, len - skip_len)) PFATAL("ftruncate() failed");
+    if (!out_file) lseek(fd, 0, SEEK_SET);
+    return;
+
+  }
+
+  if (out_file) {
+
+    unlink(out_file); /* Ignore errors. */
+
+    fd = open(out_file, O_WRONLY | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0) PFATAL("Unable to create '%s'", out_file);
+
+  } else lseek(fd, 0, SEEK_SET);
+
+  if (skip_at) ck_write(fd, mem, skip_at, out_file);
+
+  if (tail_len) ck_write(fd, mem + skip_at + skip_len, tail_len, out_file);
+
+  if (!out_file) {
+
+    if (ftruncate(fd, len - skip_len)) PFATAL("ftruncate() failed");
+    lseek(fd, 0, SEEK_SET);
+
+  } else close(fd);
+
+}
+
+
+/* Make executor 'e' the current one: save the state of the previously
+   selected executor from the globals, and load that of 'e' into them. All
+   the code that works with the maps, the fork server or the input file
+   then acts on 'e'. */
+
+static void select_executor(struct executor* e) {
+
+  struct executor* c = cur_executor;
+
+  if (e == c) return;
+
+  c->trace_bits     = trace_bits;
+  c->dfg_list       = dfg_list;
+  c->dfg_hit        = dfg_hit;
+  c->fsrv_pid       = forksrv_pid;
+  c->child_pid      = child_pid;
+  c->ctl_fd         = fsrv_ctl_fd;
+  c->st_fd          = fsrv_st_fd;
+  c->out_fd         = out_fd;
+  c->out_file       = out_file;
+  c->shm_fuzz_len   = shm_fuzz_len;
+  c->shm_fuzz_buf   = shm_fuzz_buf;
+  c->prev_timed_out = prev_timed_out;
+
+  trace_bits     = e->trace_bits;
+  dfg_list       = e->dfg_list;
+  dfg_hit        = e->dfg_hit;
+  forksrv_pid    = e->fsrv_pid;
+  child_pid      = e->child_pid;
+  fsrv_ctl_fd    = e->ctl_fd;
+  fsrv_st_fd     = e->st_fd;
+  out_fd         = e->out_fd;
+  out_file       = e->out_file;
+  shm_fuzz_len   = e->shm_fuzz_len;
+  shm_fuzz_buf   = e->shm_fuzz_buf;
+  prev_timed_out = e->prev_timed_out;
+
+  cur_executor = e;
+
+}
+
+
+/* Point the SHM environment variables at a set of regions, for the next
+   fork server to pick up. */
+
+static void export_shm_ids(s32 id, s32 id_dfg_list, s32 id_fuzz) {
+
+  u8* tmp;
+
+  tmp = alloc_printf("%d", id);
+  setenv(SHM_ENV_VAR, tmp, 1);
+  ck_free(tmp);
+
+  tmp = alloc_printf("%d", id_dfg_list);
+  setenv(SHM_ENV_VAR_DFG_LIST, tmp, 1);
+  ck_free(tmp);
+
+  if (id_fuzz < 0) return;
+
+  tmp = alloc_printf("%d", id_fuzz);
+  setenv(SHM_FUZZ_ENV_VAR, tmp, 1);
+  ck_free(tmp);
+
+}
+
+
+/* Attach to a newly created SHM region. */
+
+static void* shm_attach(s32* id, u32 size) {
+
+  void* mem;
+
+  *id = shmget(IPC_PRIVATE, size, IPC_CREAT | IPC_EXCL | 0600);
+  if (*id < 0) PFATAL("shmget() failed");
+
+  mem = shmat(*id, NULL, 0);
+  if (mem == (void *)-1) PFATAL("shmat() failed");
+
+  return mem;
+
+}
+
+
+/* Make a copy of argv[] with every occurrence of 'from' replaced by 'to'. */
+
+static char** subst_argv(char** argv, u8* from, u8* to) {
+
+  u32 i = 0, flen = strlen(from);
+  char** new_argv;
+
+  while (argv[i]) i++;
+
+  new_argv = ck_alloc(sizeof(char*) * (i + 1));
+
+  for (i = 0; argv[i]; i++) {
+
+    u8 *arg = argv[i], *hit;
+
+    if (!flen || !(hit = strstr(arg, from))) {
+      new_argv[i] = arg;
+      continue;
+    }
+
+    new_argv[i] = ck_strdup("");
+
+    do {
+
+      u8* tmp = alloc_printf("%s%.*s%s", new_argv[i], (s32)(hit - arg), arg, to);
+      ck_free(new_argv[i]);
+      new_argv[i] = tmp;
+      arg = hit + flen;
+
+    } while ((hit = strstr(arg, from)));
+
+    arg = alloc_printf("%s%s", new_argv[i], arg);
+    ck_free(new_argv[i]);
+    new_argv[i] = arg;
+
+  }
+
+  return new_argv;
+
+}
+
+
+/* Start an additional executor: private SHM maps and input file, and a fork
+   server of its own. */
+
+static void init_executor(struct executor* e, char** argv, u32 id) {
+
+  char** e_argv = argv;
+  void*  mem;
+
+  e->trace_bits = shm_attach(&e->shm_id, MAP_SIZE);
+  e->dfg_list   = shm_attach(&e->shm_id_dfg_list, DFG_LIST_SIZE(dfg_size));
+  e->dfg_hit    = (u8*)e->dfg_list + DFG_LIST_HIT_OFF(dfg_size);
+
+  if (shm_fuzz) {
+
+    mem = shm_attach(&e->shm_id_fuzz, sizeof(u32) + MAX_FILE);
+    e->shm_fuzz_len = mem;
+    e->shm_fuzz_buf = (u8*)mem + sizeof(u32);
+
+  }
+
+  e->out_fd = -1;
+
+  if (memfd_input) {
+
+#ifdef SYS_memfd_create
+    e->out_fd = syscall(SYS_memfd_create, "cur_input", 0);
+#endif /* SYS_memfd_create */
+
+    if (e->out_fd < 0) PFATAL("memfd_create() failed");
+    if (out_file) e->out_file = alloc_printf("/dev/fd/%d", e->out_fd);
+
+  } else if (out_file) {
+
+    e->out_file = alloc_printf("%s.%u", out_file, id);
+
+  } else {
+
+    u8* fn = alloc_printf("%s/.cur_input.%u", out_dir, id);
+
+    unlink(fn); /* Ignore errors */
+
+    e->out_fd = open(fn, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (e->out_fd < 0) PFATAL("Unable to create '%s'", fn);
+
+    ck_free(fn);
+
+  }
+
+  if (out_file) e_argv = subst_argv(argv, out_file, e->out_file);
+
+  export_shm_ids(e->shm_id, e->shm_id_dfg_list, e->shm_id_fuzz);
+
+  select_executor(e);
+  init_forkserver(e_argv);
+
+  /* Keep the pipes away from the fork servers started after this one. */
+
+  fcntl(fsrv_ctl_fd, F_SETFD, FD_CLOEXEC);
+  fcntl(fsrv_st_fd, F_SETFD, FD_CLOEXEC);
+
+  select_executor(executors);
+
+  export_shm_ids(shm_id, shm_id_dfg_list, shm_id_fuzz);
+
+  if (e_argv != argv) ck_free(e_argv);
+
+}
+
+
+/* Set up the executor pool requested with AFL_EXECUTORS. The main fork
+   server becomes executor 0, and stays selected outside of the code that
+   spreads work over the pool. */
+
+static void setup_executors(char** argv) {
+
+  u8* x = getenv("AFL_EXECUTORS");
+  u32 i;
+
+  if (x) {
+
+    executor_cnt = atoi(x);
+
+    if (executor_cnt < 1 || executor_cnt > EXECUTORS_MAX)
+      FATAL("Bad value of AFL_EXECUTORS (must be between 1 and %u)",
+            EXECUTORS_MAX);
+
+  }
+
+  if (executor_cnt > 1 && (dumb_mode || no_forkserver)) {
+
+    WARNF("AFL_EXECUTORS needs a fork server, using just one executor.");
+    executor_cnt = 1;
+
+  }
+
+  /* A fixed input file (-f without @@) can't be told apart per executor. */
+
+  if (executor_cnt > 1 && out_file) {
+
+    for (i = 0; argv[i]; i++)
+      if (strstr(argv[i], out_file)) break;
+
+    if (!argv[i]) {
+
+      WARNF("AFL_EXECUTORS needs @@ or stdin input, using just one executor.");
+      executor_cnt = 1;
+
+    }
+
+  }
+
+  executors = ck_alloc(sizeof(struct executor) * executor_cnt);
+  cur_executor = executors;
+
+  if (executor_cnt == 1) return;
+
+  for (i = 1; i < executor_cnt; i++) {
+
+    executors[i].shm_id = executors[i].shm_id_dfg_list =
+      executors[i].shm_id_fuzz = -1;
+
+    executors[i].child_pid = -1;
+
+  }
+
+  if (!forksrv_pid) init_forkserver(argv);
+
+  /* Same as in init_executor(): the pipes of each fork server must not leak
+     into the others, or a dead one would never be seen to hit EOF. */
+
+  fcntl(fsrv_ctl_fd, F_SETFD, FD_CLOEXEC);
+  fcntl(fsrv_st_fd, F_SETFD, FD_CLOEXEC);
+
+  for (i = 1; i < executor_cnt; i++) init_executor(executors + i, argv, i);
+
+  OKF("Started %u executors.", executor_cnt);
+
+}
+
+
+/* Hand a test case to executor 'e' and start running it, without waiting for
+   the result; see wait_executor(). If stop_soon is set in the meantime, the
+   executor is left idle. */
+
+static void launch_executor(struct executor* e, void* mem, u32 len,
+                            u32 timeout) {
+
+  s32 res;
+
+  select_executor(e);
+
+  write_to_testcase(mem, len);
+
+  memset(trace_bits, 0, MAP_SIZE);
+  last_trace.map = NULL;
+
+  if (!dfg_self_reset || prev_timed_out) reset_dfg_maps(prev_timed_out);
+
+  MEM_BARRIER();
+
+  if ((res = write(fsrv_ctl_fd, &prev_timed_out, 4)) != 4) {
+
+    if (stop_soon) return;
+    RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+
+  }
+
+  if ((res = read(fsrv_st_fd, &child_pid, 4)) != 4) {
+
+    if (stop_soon) return;
+    RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+
+  }
+
+  if (child_pid <= 0) FATAL("Fork server is misbehaving (OOM?)");
+
+  e->busy      = 1;
+  e->timed_out = 0;
+  e->start_us  = get_cur_time_us();
+  e->deadline  = e->start_us / 1000 + timeout;
+
+}
+
+
+/* Wait for any of the busy executors to finish its run, killing the ones
+   that go past their deadline. Returns the executor, with its fault code
+   in 'fault', or NULL if stop_soon got set in the meantime. */
+
+static struct executor* wait_executor(u8* fault) {
+
+  static struct pollfd* pfds;
+  static struct executor** busy;
+
+  struct executor* e;
+  u32 i, cnt;
+  s32 res, pid;
+
+  if (!pfds) {
+
+    pfds = ck_alloc(sizeof(struct pollfd) * executor_cnt);
+    busy = ck_alloc(sizeof(struct executor*) * executor_cnt);
+
+  }
+
+  while (1) {
+
+    u64 now = get_cur_time(), wait_ms = U64_MAX;
+
+    if (stop_soon) {
+
+      for (i = 0; i < executor_cnt; i++) {
+
+        e   = executors + i;
+        pid = e == cur_executor ? child_pid : e->child_pid;
+
+        if (e->busy && pid > 0) kill(pid, SIGKILL);
+        e->busy = 0;
+
+      }
+
+      return NULL;
+
+    }
+
+    for (i = cnt = 0; i < executor_cnt; i++) {
+
+      e = executors + i;
+      if (!e->busy) continue;
+
+      if (!e->timed_out) {
+
+        if (e->deadline <= now) {
+
+          kill(e == cur_executor ? child_pid : e->child_pid, SIGKILL);
+          e->timed_out = 1;
+
+        } else wait_ms = MIN(wait_ms, e->deadline - now);
+
+      }
+
+      pfds[cnt].fd     = e == cur_executor ? fsrv_st_fd : e->st_fd;
+      pfds[cnt].events = POLLIN;
+      busy[cnt++]      = e;
+
+    }
+
+    if (!cnt) FATAL("No executor is busy");
+
+    res = poll(pfds, cnt, wait_ms == U64_MAX ? -1 : wait_ms);
+
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      PFATAL("poll() failed");
+    }
+
+    for (i = 0; i < cnt; i++)
+      if (pfds[i].revents) break;
+
+    if (i == cnt) continue;
+
+    e = busy[i];
+
+    if ((res = read(pfds[i].fd, &e->status, 4)) != 4) {
+
+      if (stop_soon) continue;
+      RPFATAL(res, "Unable to communicate with fork server (OOM?)");
+
+    }
+
+    e->run_us = get_cur_time_us() - e->start_us;
+    e->busy   = 0;
+
+    select_executor(e);
+
+    if (!WIFSTOPPED(e->status)) child_pid = 0;
+
+    total_execs++;
+
+    MEM_BARRIER();
+
+    analyze_trace();
+
+    prev_timed_out = e->timed_out;
+
+    *fault = fault_from_status(e->status, e->timed_out);
+    return e;
+
+  }
+
+}
+
+
+static void show_stats(void);
+
+/* Calibration state of a single test case, so that several can be in
+   flight at once (one per executor) during the dry run. */
+
+static u8 cal_defer_dfg;              /* Leave DFG scoring to the caller? */
+
+struct cal_job {
+
+  struct queue_entry* q;              /* Test case being calibrated       */
+  u8* mem;                            /* Its contents                     */
+
+  u8  fault,                          /* Outcome of the latest run        */
+      new_bits,                       /* Best has_new_bits() result       */
+      var_detected,                   /* Variable behavior seen?          */
+      first_run,                      /* Never calibrated before?         */
+      aborted;                        /* Stopped early?                   */
+
+  u32 handicap,                       /* Queue cycles behind              */
+      use_tmout;                      /* Timeout for each run             */
+
+  s32 stage_cur,                      /* Runs done so far                 */
+      stage_max;                      /* Runs to do                       */
+
+  u64 run_us;                         /* Total duration of the runs       */
+
+  u8  first_trace[MAP_SIZE];          /* Trace of the first run           */
+
+};
+
+
+/* Add the proximity score of a freshly calibrated entry to the stats. */
+
+static void account_prox_score(struct queue_entry* q) {
+
+  total_prox_score += q->prox_score;
+  avg_prox_score = total_prox_score / queued_paths;
+  if (min_prox_score > q->prox_score) min_prox_score = q->prox_score;
+  if (max_prox_score < q->prox_score) max_prox_score = q->prox_score;
+
+}
+
+
+/* Do what cal_end() leaves to the caller with cal_defer_dfg set: count the
+   DFG nodes of 'q' in, as observe_dfg_trace() would have for its last run,
+   then score it from those nodes, as compute_proximity_score() would
+   have. */
+
+static void score_cal_entry(struct queue_entry* q) {
+
+  struct dfg_set_iter it;
+  u64 prox_score = 0, path_score = 0;
+  u32 n;
+
+  if (!q->dfg_observed) {
+
+    dfg_set_iter_init(&it, q->dfg_nodes, q->dfg_nodes_len);
+
+    while (dfg_set_next(&it, &n))
+      if (dfg_node_paths[n]) dfg_node_count[n]++;
+
+    dfg_epoch++;
+    q->dfg_observed = 1;
+
+  }
+
+  dfg_set_iter_init(&it, q->dfg_nodes, q->dfg_nodes_len);
+
+  while (dfg_set_next(&it, &n)) {
+
+    if (dfg_node_paths[n] > 0)
+      path_score += dfg_node_count[n] * 1000 / dfg_node_paths[n];
+
+    prox_score += dfg_node_score[n];
+
+  }
+
+  path_score = path_score * 14 / 10000;
+
+  update_prox_score(q, prox_score < path_score ? 0 : prox_score - path_score);
+  account_prox_score(q);
+
+}
+
+
+/* Start calibrating 'q'. */
+
+static void cal_begin(struct cal_job* job, struct queue_entry* q, u8* use_mem,
+                      u32 handicap, u8 from_queue) {
+
+  job->q            = q;
+  job->mem          = use_mem;
+  job->fault        = 0;
+  job->new_bits     = 0;
+  job->var_detected = 0;
+  job->first_run    = (q->exec_cksum == 0);
+  job->aborted      = 0;
+  job->handicap     = handicap;
+  job->use_tmout    = exec_tmout;
+  job->stage_cur    = 0;
+  job->stage_max    = fast_cal ? 3 : CAL_CYCLES;
+  job->run_us       = 0;
+
+  /* Be a bit more generous about timeouts when resuming sessions, or when
+     trying to calibrate already-added finds. This helps avoid trouble due
+     to intermittent latency. */
+
+  if (!from_queue || resuming_fuzz)
+    job->use_tmout = MAX(exec_tmout + CAL_TMOUT_ADD,
+                         exec_tmout * CAL_TMOUT_PERC / 100);
+
+  q->cal_failed++;
+
+  if (q->exec_cksum) {
+
+    memcpy(job->first_trace, trace_bits, MAP_SIZE);
+    job->new_bits = has_new_bits(virgin_bits);
+
+  }
+
+}
+
+
+/* Account for one calibration run, whose result is in trace_bits and the
+   DFG maps. Returns 1 if more runs are needed. */
+
+static u8 cal_step(struct cal_job* job, u8 fault) {
+
+  struct queue_entry* q = job->q;
+  u32 cksum;
+  u8  hnb;
+
+  job->fault = fault;
+
+  /* stop_soon is set by the handler for Ctrl+C. When it's pressed,
+     we want to bail out quickly. */
+
+  if (stop_soon || fault != crash_mode) {
+    job->aborted = 1;
+    return 0;
+  }
+
+  if (!dumb_mode && !job->stage_cur && !trace_bytes()) {
+    job->fault   = FAULT_NOINST;
+    job->aborted = 1;
+    return 0;
+  }
+
+  cksum = trace_cksum();
+
+  if (q->exec_cksum != cksum) {
+
+    hnb = has_new_bits(virgin_bits);
+    if (hnb > job->new_bits) job->new_bits = hnb;
+
+    if (q->exec_cksum) {
+
+      u32 i;
+
+      for (i = 0; i < MAP_SIZE; i++) {
+
+        if (!var_bytes[i] && job->first_trace[i] != trace_bits[i]) {
+
+          var_bytes[i]   = 1;
+          job->stage_max = CAL_CYCLES_LONG;
+
+        }
+
+      }
+
+      job->var_detected = 1;
+
+    } else {
+
+      q->exec_cksum = cksum;
+      memcpy(job->first_trace, trace_bits, MAP_SIZE);
+
+    }
+
+  }
+
+  return ++job->stage_cur < job->stage_max;
+
+}
+
+
+/* Wrap up the calibration, with the maps of the last run still in place.
+   Returns the fault code for the test case. */
+
+static u8 cal_end(struct cal_job* job) {
+
+  struct queue_entry* q = job->q;
+
+  if (!job->aborted) {
+
+    total_cal_us     += job->run_us;
+    total_cal_cycles += job->stage_max;
+
+    /* OK, let's collect some stats about the performance of this test case.
+       This is used for fuzzing air time calculations in calculate_score(). */
+
+    q->exec_us     = job->run_us / job->stage_max;
+    q->bitmap_size = trace_bytes();
+
+    save_dfg_nodes(q);
+
+    /* Scores depend on the nodes observed so far, so with cal_defer_dfg
+       set, the caller observes and scores the entries in an order of its
+       own choosing; see score_cal_entry(). */
+
+    if (!cal_defer_dfg) {
+
+      if (!q->dfg_observed) {
+        observe_dfg_trace();
+        q->dfg_observed = 1;
+      }
+
+      update_prox_score(q, compute_proximity_score());
+      account_prox_score(q);
+
+    }
+
+    q->handicap    = job->handicap;
+    q->cal_failed  = 0;
+
+    total_bitmap_size += q->bitmap_size;
+    total_bitmap_entries++;
+
+    update_bitmap_score(q);
+
+    /* If this case didn't result in new output from the instrumentation, tell
+       parent. This is a non-critical problem, but something to warn the user
+       about. */
+
+    if (!dumb_mode && job->first_run && !job->fault && !job->new_bits)
+      job->fault = FAULT_NOBITS;
+
+  }
+
+  if (job->new_bits == 2 && !q->has_new_cov) {
+    q->has_new_cov = 1;
+    queued_with_cov++;
+  }
+
+  /* Mark variable paths. */
+
+  if (job->var_detected) {
+
+    var_byte_count = count_bytes(var_bytes);
+
+    if (!q->var_behavior) {
+      mark_as_variable(q);
+      queued_variable++;
+    }
+
+  }
+
+  return job->fault;
+
+}
+
+
+/* Calibrate a new test case. This is done when processing the input directory
+   to warn about flaky or otherwise problematic test cases early on; and when
+   new paths are discovered to detect variable behavior and so on. */
+
+static u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
+                         u32 handicap, u8 from_queue) {
+
+  static struct cal_job job;
+
+  u64 start_us;
+  u8  fault;
+
+  s32 old_sc = stage_cur, old_sm = stage_max;
+  u8* old_sn = stage_name;
+
+  stage_name = "calibration";
+
+  /* Make sure the forkserver is up before we do anything, and let's not
+     count its spin-up time toward binary calibration. */
+
+  if (dumb_mode != 1 && !no_forkserver && !forksrv_pid)
+    init_forkserver(argv);
+
+  want_cksum++;
+
+  cal_begin(&job, q, use_mem, handicap, from_queue);
+
+  do {
+
+    stage_cur = job.stage_cur;
+    stage_max = job.stage_max;
+
+    if (!job.first_run && !(stage_cur % stats_update_freq)) show_stats();
+
+    start_us = get_cur_time_us();
+
+    write_to_testcase(use_mem, q->len);
+
+    fault = run_target(argv, job.use_tmout, "USELESS=0", 0);
+
+    job.run_us += get_cur_time_us() - start_us;
+
+  } while (cal_step(&job, fault));
+
+  fault = cal_end(&job);
+
+  want_cksum--;
+
+  stage_name = old_sn;
+  stage_cur  = old_sc;
+  stage_max  = old_sm;
+
+  if (!job.first_run) show_stats();
+
+  return fault;
+
+}
+
+
+/* Examine map coverage. Called once, for first test case. */
+
+static void check_map_coverage(void) {
+
+  u32 i;
+
+  if (trace_bytes() < 100) return;
+
+  for (i = (1 << (MAP_SIZE_POW2 - 1)); i < MAP_SIZE; i++)
+    if (trace_bits[i]) return;
+
+  WARNF("Recompile binary with newer version of afl to improve coverage!");
+
+}
+
+
+/* Read the contents of a queue entry into a new buffer. */
+
+static u8* read_queue_entry(struct queue_entry* q) {
+
+  u8* mem;
+  s32 fd;
+
+  fd = open(q->fname, O_RDONLY);
+  if (fd < 0) PFATAL("Unable to open '%s'", q->fname);
+
+  mem = ck_alloc_nozero(q->len);
+
+  if (read(fd, mem, q->len) != q->len)
+    FATAL("Short read from '%s'", q->fname);
+
+  close(fd);
+
+  return mem;
+
+}
+
+
+/* Check the result of the dry run with one of the initial test cases. */
+
+static void dry_run_result(char** argv, struct queue_entry* q, u8 res,
+                           u32* cal_failures) {
+
+  u8* skip_crashes = getenv("AFL_SKIP_CRASHES");
+  u8* fn = strrchr(q->fname, '/') + 1;
+
+  if (res == crash_mode || res == FAULT_NOBITS)
+    SAYF(cGRA "    len = %u, map size = %u, exec speed = %llu us\n" cRST,
+         q->len, q->bitmap_size, q->exec_us);
+
+  switch (res) {
+
+    case FAULT_NONE:
+
+      if (q == queue) check_map_coverage();
+
+      if (crash_mode) FATAL("Test case '%s' does *NOT* crash", fn);
+
+      break;
+
+    case FAULT_TMOUT:
+
+      if (timeout_given) {
+
+        /* The -t nn+ syntax in the command line sets timeout_given to '2' and
+           instructs afl-fuzz to tolerate but skip queue entries that time
+           out. */
+
+        if (timeout_given > 1) {
+          WARNF("Test case results in a timeout (skipping)");
+          q->cal_failed = CAL_CHANCES;
+          (*cal_failures)++;
+          break;
+        }
+
+        SAYF("\n" cLRD "[-] " cRST
+             "The program took more than %u ms to process one of the initial test cases.\n"
+             "    Usually, the right thing to do is to relax the -t option - or to delete it\n"
+             "    altogether and allow the fuzzer to auto-calibrate. That said, if you know\n"
+             "    what you are doing and want to simply skip the unruly test cases, append\n"
+             "    '+' at the end of the value passed to -t ('-t %u+').\n", exec_tmout,
+             exec_tmout);
+
+        FATAL("Test case '%s' results in a timeout", fn);
+
+      } else {
+
+        SAYF("\n" cLRD "[-] " cRST
+             "The program took more than %u ms to process one of the initial test cases.\n"
+             "    This is bad news; raising the limit with the -t option is possible, but\n"
+             "    will probably make the fuzzing process extremely slow.\n\n"
+
+             "    If this test case is just a fluke, the other option is to just avoid it\n"
+             "    altogether, and find one that is less of a CPU hog.\n", exec_tmout);
+
+        FATAL("Test case '%s' results in a timeout", fn);
+
+      }
+
+    case FAULT_CRASH:
+
+      if (crash_mode) break;
+
+      if (skip_crashes) {
+        WARNF("Test case results in a crash (skipping)");
+        q->cal_failed = CAL_CHANCES;
+        (*cal_failures)++;
+        break;
+      }
+
+      if (mem_limit) {
+
+        SAYF("\n" cLRD "[-] " cRST
+             "Oops, the program crashed with one of the test cases provided. There are\n"
+             "    several possible explanations:\n\n"
+
+             "    - The test case causes known crashes under normal working conditions. If\n"
+             "      so, please remove it. The fuzzer should be seeded with interesting\n"
+             "      inputs - but not ones that cause an outright crash.\n\n"
+
+             "    - The current memory limit (%s) is too low for this program, causing\n"
+             "      it to die due to OOM when parsing valid files. To fix this, try\n"
+             "      bumping it up with the -m setting in the command line. If in doubt,\n"
+             "      try something along the lines of:\n\n"
+
+#ifdef RLIMIT_AS
+             "      ( ulimit -Sv $[%llu << 10]; /path/to/binary [...] <testcase )\n\n"
+#else
+             "      ( ulimit -Sd $[%llu << 10]; /path/to/binary [...] <testcase )\n\n"
+#endif /* ^RLIMIT_AS */
+
+             "      Tip: you can use http://jwilk.net/software/recidivm to quickly\n"
+             "      estimate the required amount of virtual memory for the binary. Also,\n"
+             "      if you are using ASAN, see %s/notes_for_asan.txt.\n\n"
+
+#ifdef __APPLE__
+
+             "    - On MacOS X, the semantics of fork() syscalls are non-standard and may\n"
+             "      break afl-fuzz performance optimizations when running platform-specific\n"
+             "      binaries. To fix this, set AFL_NO_FORKSRV=1 in the environment.\n\n"
+
+#endif /* __APPLE__ */
+
+             "    - Least likely, there is a horrible bug in the fuzzer. If other options\n"
+             "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n",
+             DMS(mem_limit << 20), mem_limit - 1, doc_path);
+
+      } else {
+
+        SAYF("\n" cLRD "[-] " cRST
+             "Oops, the program crashed with one of the test cases provided. There are\n"
+             "    several possible explanations:\n\n"
+
+             "    - The test case causes known crashes under normal working conditions. If\n"
+             "      so, please remove it. The fuzzer should be seeded with interesting\n"
+             "      inputs - but not ones that cause an outright crash.\n\n"
+
+#ifdef __APPLE__
+
+             "    - On MacOS X, the semantics of fork() syscalls are non-standard and may\n"
+             "      break afl-fuzz performance optimizations when running platform-specific\n"
+             "      binaries. To fix this, set AFL_NO_FORKSRV=1 in the environment.\n\n"
+
+#endif /* __APPLE__ */
+
+             "    - Least likely, there is a horrible bug in the fuzzer. If other options\n"
+             "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n");
+
+      }
+
+      FATAL("Test case '%s' results in a crash", fn);
+
+    case FAULT_ERROR:
+
+      FATAL("Unable to execute target application ('%s')", argv[0]);
+
+    case FAULT_NOINST:
+
+      FATAL("No instrumentation detected");
+
+    case FAULT_NOBITS:
+
+      useless_at_start++;
+
+      if (!in_bitmap && !shuffle_queue)
+        WARNF("No new instrumentation output, test case may be useless.");
+
+      break;
+
+  }
+
+  if (q->var_behavior) WARNF("Instrumentation output varies across runs.");
+
+}
+
+
+/* Calibrate the initial test cases on all executors at once. Each one picks
+   up the next seed as soon as it is done with the previous one, so seeds
+   finish out of order; the queue order is only fixed up at the end. */
+
+static void dry_run_parallel(char** argv, struct queue_entry** seeds,
+                             u32 cnt, u32* cal_failures) {
+
+  struct cal_job* jobs = ck_alloc(sizeof(struct cal_job) * executor_cnt);
+  struct executor* e;
+  u32 next = 0, busy = 0, i;
+  u8  fault;
+
+  want_cksum++;
+  cal_defer_dfg = 1;
+
+  while (1) {
+
+    for (i = 0; i < executor_cnt && next < cnt && !stop_soon; i++) {
+
+      struct queue_entry* q;
+
+      if (executors[i].busy) continue;
+
+      q = seeds[next++];
+
+      select_executor(executors + i);
+      cal_begin(jobs + i, q, read_queue_entry(q), 0, 1);
+      launch_executor(executors + i, jobs[i].mem, q->len, jobs[i].use_tmout);
+      busy++;
+
+    }
+
+    if (!busy || !(e = wait_executor(&fault))) break;
+
+    busy--;
+    i = e - executors;
+
+    jobs[i].run_us += e->run_us;
+
+    if (cal_step(jobs + i, fault)) {
+
+      launch_executor(e, jobs[i].mem, jobs[i].q->len, jobs[i].use_tmout);
+      busy++;
+      continue;
+
+    }
+
+    ACTF("Dry run with '%s' done (executor %u)...",
+         strrchr(jobs[i].q->fname, '/') + 1, i);
+
+    fault = cal_end(jobs + i);
+    ck_free(jobs[i].mem);
+    jobs[i].mem = NULL;
+
+    dry_run_result(argv, jobs[i].q, fault, cal_failures);
+
+  }
+
+  want_cksum--;
+  cal_defer_dfg = 0;
+
+  select_executor(executors);
+
+  /* Jobs still in flight when we were told to stop. */
+
+  for (i = 0; i < executor_cnt; i++) ck_free(jobs[i].mem);
+
+  ck_free(jobs);
+
+  /* Runs finish in whatever order they finish in; observe and score the
+     entries in seed order, as the serial dry run would, so that the scores
+     come out the same from one run to the next. */
+
+  if (stop_soon) return;
+
+  for (i = 0; i < cnt; i++)
+    if (!seeds[i]->cal_failed) score_cal_entry(seeds[i]);
+
+  /* The top_rated_dfg[] winners were picked before any of this. */
+
+  for (i = 0; i < cnt; i++)
+    if (!seeds[i]->cal_failed && seeds[i]->dfg_nodes)
+      update_dfg_score(seeds[i]);
+
+}
+
+
+/* Perform dry run of all test cases to confirm that the app is working as
+   expected. This is done only for the initial inputs, and only once. With
+   several executors, the test cases are run in parallel. Either way, the
+   entries are scored first and sorted by proximity in one go afterwards. */
+
+static void perform_dry_run(char** argv) {
+
+  struct queue_entry** seeds;
+  struct queue_entry* q;
+  u32 cal_failures = 0, cnt = 0, i;
+  u8* skip_crashes = getenv("AFL_SKIP_CRASHES");
+
+  /* Snapshot the initial order, so that scoring doesn't shuffle the list
+     we're walking. */
+
+  seeds = ck_alloc(queued_paths * sizeof(struct queue_entry*));
+  for (q = queue; q; q = q->next) seeds[cnt++] = q;
+
+  defer_queue_order = 1;
+
+  if (executor_cnt > 1) {
+
+    dry_run_parallel(argv, seeds, cnt, &cal_failures);
+
+  } else for (i = 0; i < cnt && !stop_soon; i++) {
+
+    u8* use_mem;
+    u8  res;
+
+    q = seeds[i];
+
+    ACTF("Attempting dry run with '%s'...", strrchr(q->fname, '/') + 1);
+
+    use_mem = read_queue_entry(q);
+    res = calibrate_case(argv, q, use_mem, 0, 1);
+    ck_free(use_mem);
+
+    if (stop_soon) break;
+
+    dry_run_result(argv, q, res, &cal_failures);
+
+  }
+
+  defer_queue_order = 0;
+  rebuild_queue_order();
+
+  ck_free(seeds);
+
+  if (stop_soon) return;
+
+  if (cal_failures) {
+
+    if (cal_failures == queued_paths)
+      FATAL("All test cases time out%s, giving up!",
+            skip_crashes ? " or crash" : "");
+
+    WARNF("Skipped %u test cases (%0.02f%%) due to timeouts%s.", cal_failures,
+          ((double)cal_failures) * 100 / queued_paths,
+          skip_crashes ? " or crashes" : "");
+
+    if (cal_failures * 5 > queued_paths)
+      WARNF(cLRD "High percentage of rejected test cases, check settings!");
+
+  }
+
+  OKF("All test cases processed.");
+
+}
+
+
+/* Helper function: link() if possible, copy otherwise. */
+
+static void link_or_copy(u8* old_path, u8* new_path) {
+
+  s32 i = link(old_path, new_path);
+  s32 sfd, dfd;
+  u8* tmp;
+
+  if (!i) return;
+
+  sfd = open(old_path, O_RDONLY);
+  if (sfd < 0) PFATAL("Unable to open '%s'", old_path);
+
+  dfd = open(new_path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (dfd < 0) PFATAL("Unable to create '%s'", new_path);
+
+  tmp = ck_alloc(64 * 1024);
+
+  while ((i = read(sfd, tmp, 64 * 1024)) > 0)
+    ck_write(dfd, tmp, i, new_path);
+
+  if (i < 0) PFATAL("read() failed");
+
+  ck_free(tmp);
+  close(sfd);
+  close(dfd);
+
+}
+
+
+static void nuke_resume_dir(void);
+
+/* Create hard links for input test cases in the output directory, choosing
+   good names and pivoting accordingly. */
+
+static void pivot_inputs(void) {
+
+  struct queue_entry* q = queue;
+  u32 id = 0;
+
+  ACTF("Creating hard links for all input files...");
+
+  while (q) {
+
+    u8  *nfn, *rsl = strrchr(q->fname, '/');
+    u32 orig_id;
+
+    if (!rsl) rsl = q->fname; else rsl++;
+
+    /* If the original file name conforms to the syntax and the recorded
+       ID matches the one we'd assign, just use the original file name.
+       This is valuable for resuming fuzzing runs. */
+
+#ifndef SIMPLE_FILES
+#  define CASE_PREFIX "id:"
+#else
+#  define CASE_PREFIX "id_"
+#endif /* ^!SIMPLE_FILES */
+
+    if (!strncmp(rsl, CASE_PREFIX, 3) &&
+        sscanf(rsl + 3, "%06u", &orig_id) == 1 && orig_id == id) {
+
+      u8* src_str;
+      u32 src_id;
+
+      resuming_fuzz = 1;
+      nfn = alloc_printf("%s/queue/%s", out_dir, rsl);
+
+      /* Since we're at it, let's also try to find parent and figure out the
+         appropriate depth for this entry. */
+
+      src_str = strchr(rsl + 3, ':');
+
+      if (src_str && sscanf(src_str + 1, "%06u", &src_id) == 1) {
+
+        struct queue_entry* s = queue;
+        while (src_id-- && s) s = s->next;
+        if (s) q->depth = s->depth + 1;
+
+        if (max_depth < q->depth) max_depth = q->depth;
+
+      }
+
+    } else {
+
+      /* No dice - invent a new name, capturing the original one as a
+         substring. */
+
+#ifndef SIMPLE_FILES
+
+      u8* use_name = strstr(rsl, ",orig:");
+
+      if (use_name) use_name += 6; else use_name = rsl;
+      nfn = alloc_printf("%s/queue/id:%06u,orig:%s", out_dir, id, use_name);
+
+#else
+
+      nfn = alloc_printf("%s/queue/id_%06u", out_dir, id);
+
+#endif /* ^!SIMPLE_FILES */
+
+    }
+
+    /* Pivot to the new queue entry. */
+
+    link_or_copy(q->fname, nfn);
+    ck_free(q->fname);
+    q->fname = nfn;
+
+    /* Make sure that the passed_det value carries over, too. */
+
+    if (q->passed_det) mark_as_det_done(q);
+
+    q = q->next;
+    id++;
+
+  }
+
+  if (in_place_resume) nuke_resume_dir();
+
+}
+
+
+#ifndef SIMPLE_FILES
+
+/* Construct a file name for a new test case, capturing the operation
+   that led to its discovery. Uses a static buffer. */
+
+static u8* describe_op(u8 hnb) {
+
+  static u8 ret[256];
+
+  if (syncing_party) {
+
+    sprintf(ret, "sync:%s,src:%06u", syncing_party, syncing_case);
+
+  } else {
+
+    sprintf(ret, "src:%06u", current_entry);
+
+    if (splicing_with >= 0)
+      sprintf(ret + strlen(ret), "+%06u", splicing_with);
+
+    sprintf(ret + strlen(ret), ",op:%s", stage_short);
+
+    if (stage_cur_byte >= 0) {
+
+      sprintf(ret + strlen(ret), ",pos:%u", stage_cur_byte);
+
+      if (stage_val_type != STAGE_VAL_NONE)
+        sprintf(ret + strlen(ret), ",val:%s%+d",
+                (stage_val_type == STAGE_VAL_BE) ? "be:" : "",
+                stage_cur_val);
+
+    } else sprintf(ret + strlen(ret), ",rep:%u", stage_cur_val);
+
+  }
+
+  if (hnb == 2) strcat(ret, ",+cov");
+
+  return ret;
+
+}
+
+#endif /* !SIMPLE_FILES */
+
+
+/* Write a message accompanying the crash directory :-) */
+
+static void write_crash_readme(void) {
+
+  u8* fn = alloc_printf("%s/crashes/README.txt", out_dir);
+  s32 fd;
+  FILE* f;
+
+  fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  ck_free(fn);
+
+  /* Do not die on errors here - that would be impolite. */
+
+  if (fd < 0) return;
+
+  f = fdopen(fd, "w");
+
+  if (!f) {
+    close(fd);
+    return;
+  }
+
+  fprintf(f, "Command line used to find this crash:\n\n"
+
+             "%s\n\n"
+
+             "If you can't reproduce a bug outside of afl-fuzz, be sure to set the same\n"
+             "memory limit. The limit used for this fuzzing session was %s.\n\n"
+
+             "Need a tool to minimize test cases before investigating the crashes or sending\n"
+             "them to a vendor? Check out the afl-tmin that comes with the fuzzer!\n\n"
+
+             "Found any cool bugs in open-source tools using afl-fuzz? If yes, please drop\n"
+             "me a mail at <lcamtuf@coredump.cx> once the issues are fixed - I'd love to\n"
+             "add your finds to the gallery at:\n\n"
+
+             "  http://lcamtuf.coredump.cx/afl/\n\n"
+
+             "Thanks :-)\n",
+
+             orig_cmdline, DMS(mem_limit << 20)); /* ignore errors */
+
+  fclose(f);
+
+}
+
+/* PACFIX oracles. The coverage and valuation executables are separate
+   builds of the target that report, through the file named in
+   PACFIX_FILENAME, which lines an input executed and the program state
+   it reached. When an oracle binary carries the AFL fork server, one is
+   kept running for it so that each check costs a fork() rather than an
+   execve(); the reports are parsed and moved around in-process. The
+   oracles get a scratch trace map of their own, which some fork server
+   implementations insist on before they start up. */
+
+struct pacfix_oracle {
+
+  u8* path;                           /* Oracle binary, or NULL if unused */
+  u8* out_path;                       /* Report file (PACFIX_FILENAME)    */
+  u8* out_env;                        /* PACFIX_FILENAME=... for envp     */
+
+  s32 fsrv_pid,                       /* PID of the oracle fork server    */
+      ctl_fd,                         /* Fork server control pipe (write) */
+      st_fd;                          /* Fork server status pipe (read)   */
+
+  u8  use_fsrv;                       /* Binary speaks the fsrv protocol? */
+
+};
+
+static struct pacfix_oracle pacfix_cov,  /* Coverage oracle               */
+                            pacfix_val;  /* Valuation oracle              */
+
+static u8* pacfix_shm_env;            /* __AFL_SHM_ID=... for the oracles */
+
+static char** pacfix_argv;            /* Target argv, with the input file */
+static s32 pacfix_in_fd = -1;         /* Input file of the oracles        */
+static u8  pacfix_stdin;              /* Oracles read their input stdin?  */
+static u8  pacfix_line_str[16];       /* Target line, as a decimal string */
+static u32 pacfix_line;               /* Target line                      */
+
+
+/* Set up the oracles requested through the environment. */
+
+static void setup_pacfix(void) {
+
+  u8* covdir = getenv("PACFIX_COV_DIR");
+  u8* cov_exe = getenv("PACFIX_COV_EXE");
+  u8* val_exe = getenv("PACFIX_VAL_EXE");
+  u8* line = getenv("PACFIX_TARGET_LINE");
+
+  struct pacfix_oracle* o[2] = { &pacfix_cov, &pacfix_val };
+  u32 i;
+
+  if (!covdir) return;
+
+  if (cov_exe && line) {
+
+    pacfix_cov.path = cov_exe;
+    pacfix_line = atoi(line);
+    sprintf((char*)pacfix_line_str, "%u", pacfix_line);
+
+  }
+
+  if (val_exe) pacfix_val.path = val_exe;
+
+  if (!pacfix_cov.path && !pacfix_val.path) return;
+
+  shm_id_pacfix = shmget(IPC_PRIVATE, MAP_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+  if (shm_id_pacfix < 0) PFATAL("shmget() failed");
+
+  pacfix_shm_env = alloc_printf(SHM_ENV_VAR "=%d", shm_id_pacfix);
+
+  for (i = 0; i < 2; i++) {
+
+    s32 fd;
+    struct stat st;
+    u8* f_data;
+
+    if (!o[i]->path) continue;
+
+    o[i]->out_path = alloc_printf("%s/__tmp_file_%u_%s", covdir, getpid(),
+                                  i ? "val" : "cov");
+    o[i]->out_env  = alloc_printf("PACFIX_FILENAME=%s", o[i]->out_path);
+
+    fd = open(o[i]->path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st)) PFATAL("Unable to open '%s'", o[i]->path);
+
+    f_data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (f_data == MAP_FAILED) PFATAL("Unable to mmap file '%s'", o[i]->path);
+    close(fd);
+
+    o[i]->use_fsrv = !!memmem(f_data, st.st_size, SHM_ENV_VAR,
+                              strlen(SHM_ENV_VAR) + 1);
+
+    munmap(f_data, st.st_size);
+
+    OKF("PACFIX %s oracle: %s%s", i ? "valuation" : "coverage", o[i]->path,
+        o[i]->use_fsrv ? " (fork server)" : "");
+
+  }
+
+}
+
+
+/* Configure the environment of an oracle process and exec it. Shared by the
+   fork server and the plain fork + execve() paths. */
+
+static void exec_pacfix_oracle(struct pacfix_oracle* o, char** argv) {
+
+  struct rlimit r;
+
+  char* envp[] = {
+    "ASAN_OPTIONS=abort_on_error=1:detect_leaks=0:symbolize=0:allocator_may_return_null=1",
+    "MSAN_OPTIONS=exit_code=86:symbolize=0:msan_track_origins=0",
+    (char*)o->out_env,
+    (char*)pacfix_shm_env,
+    0
+  };
+
+  if (mem_limit) {
+
+    r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
+
+#ifdef RLIMIT_AS
+
+    setrlimit(RLIMIT_AS, &r); /* Ignore errors */
+
+#else
+
+    setrlimit(RLIMIT_DATA, &r); /* Ignore errors */
+
+#endif /* ^RLIMIT_AS */
+
+  }
+
+  r.rlim_max = r.rlim_cur = 0;
+
+  setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
+
+  setsid();
+
+  dup2(dev_null_fd, 1);
+  dup2(dev_null_fd, 2);
+
+  if (pacfix_stdin) {
+
+    dup2(pacfix_in_fd, 0);
+    close(pacfix_in_fd);
+
+  } else {
+
+    dup2(dev_null_fd, 0);
+
+  }
+
+  close(dev_null_fd);
+  close(out_dir_fd);
+  close(dev_urandom_fd);
+  close(fileno(plot_file));
+
+  argv[0] = (char*)o->path;
+  execve(o->path, argv, envp);
+
+  exit(0);
+
+}
+
+
+/* Set up the input file of the oracles. They run from save_if_interesting(),
+   when any executor may be selected, and the others may be busy, so they
+   get a file of their own rather than using that of the current executor:
+   if the target takes the name of its input file on the command line, it is
+   replaced with ours in pacfix_argv[]; if it reads stdin, the oracles read
+   our file there. A fixed input file (-f without @@) can only be shared,
+   but then there is only one executor (see setup_executors()). */
+
+static void setup_pacfix_input(char** argv) {
+
+  u8* main_file = (!executors || cur_executor == executors) ? out_file :
+                  executors[0].out_file;
+  u8* fn;
+  u32 i;
+
+  pacfix_argv = argv;
+
+  if (main_file) {
+
+    for (i = 0; argv[i]; i++)
+      if (strstr(argv[i], (char*)main_file)) break;
+
+    if (!argv[i]) return;
+
+  }
+
+  pacfix_stdin = !main_file;
+
+  fn = alloc_printf("%s/.pacfix_input", out_dir);
+
+  unlink(fn); /* Ignore errors */
+
+  pacfix_in_fd = open(fn, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (pacfix_in_fd < 0) PFATAL("Unable to create '%s'", fn);
+
+  fcntl(pacfix_in_fd, F_SETFD, FD_CLOEXEC);
+
+  if (!pacfix_stdin) pacfix_argv = subst_argv(argv, main_file, fn);
+
+  ck_free(fn);
+
+}
+
+
+/* Write the input for the next oracle run. */
+
+static void write_pacfix_input(void* mem, u32 len) {
+
+  if (pacfix_in_fd < 0) {
+    write_testcase_file(mem, len);
+    return;
+  }
+
+  if (pwrite(pacfix_in_fd, mem, len, 0) != len) PFATAL("pwrite() failed");
+  if (ftruncate(pacfix_in_fd, len)) PFATAL("ftruncate() failed");
+  lseek(pacfix_in_fd, 0, SEEK_SET);
+
+}
+
+
+/* Start the fork server of an oracle. Falls back to fork + execve() for
+   this oracle if the server doesn't come up. */
+
+static void init_pacfix_fsrv(struct pacfix_oracle* o, char** argv) {
+
+  static struct itimerval it;
+  int st_pipe[2], ctl_pipe[2];
+  s32 status, rlen, saved_pid = child_pid;
+
+  if (pipe(st_pipe) || pipe(ctl_pipe)) PFATAL("pipe() failed");
+
+  o->fsrv_pid = fork();
+
+  if (o->fsrv_pid < 0) PFATAL("fork() failed");
+
+  if (!o->fsrv_pid) {
+
+    if (dup2(ctl_pipe[0], FORKSRV_FD) < 0) PFATAL("dup2() failed");
+    if (dup2(st_pipe[1], FORKSRV_FD + 1) < 0) PFATAL("dup2() failed");
+
+    close(ctl_pipe[0]);
+    close(ctl_pipe[1]);
+    close(st_pipe[0]);
+    close(st_pipe[1]);
+
+    if (fsrv_ctl_fd > 0) close(fsrv_ctl_fd);
+    if (fsrv_st_fd > 0) close(fsrv_st_fd);
+
+    exec_pacfix_oracle(o, argv);
+
+  }
+
+  close(ctl_pipe[0]);
+  close(st_pipe[1]);
+
+  o->ctl_fd = ctl_pipe[1];
+  o->st_fd  = st_pipe[0];
+
+  /* Wait for the hello message; handle_timeout() takes the server down if
+     it doesn't arrive in time. */
+
+  child_pid = o->fsrv_pid;
+
+  it.it_value.tv_sec = ((exec_tmout * FORK_WAIT_MULT) / 1000);
+  it.it_value.tv_usec = ((exec_tmout * FORK_WAIT_MULT) % 1000) * 1000;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  rlen = read(o->st_fd, &status, 4);
+
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  child_pid = saved_pid;
+
+  if (rlen == 4) return;
+
+  WARNF("Fork server of '%s' didn't come up, using execve() instead.",
+        o->path);
+
+  kill(o->fsrv_pid, SIGKILL);
+  waitpid(o->fsrv_pid, NULL, 0);
+  close(o->ctl_fd);
+  close(o->st_fd);
+
+  o->fsrv_pid = 0;
+  o->use_fsrv = 0;
+
+}
+
+
+/* Run an oracle on the given input. The report, if any, is left in
+   o->out_path. child_pid belongs to the selected executor, which may have
+   a stopped persistent mode child, so it is put back afterwards. */
+
+static void run_pacfix_oracle(struct pacfix_oracle* o, char** argv,
+                              void* mem, u32 len) {
+
+  static struct itimerval it;
+  s32 status = 0, zero = 0, saved_pid = child_pid;
+  u8* argv0;
+
+  unlink(o->out_path); /* Ignore errors */
+
+  if (!pacfix_argv) setup_pacfix_input(argv);
+
+  argv  = pacfix_argv;
+  argv0 = argv[0];
+
+  /* The oracles always read their input from the file. */
+
+  write_pacfix_input(mem, len);
+
+  if (o->use_fsrv && !o->fsrv_pid) init_pacfix_fsrv(o, argv);
+
+  if (o->use_fsrv) {
+
+    if (write(o->ctl_fd, &zero, 4) != 4 ||
+        read(o->st_fd, &child_pid, 4) != 4 || child_pid <= 0) {
+
+      if (stop_soon) return;
+      FATAL("Fork server of '%s' is misbehaving (OOM?)", o->path);
+
+    }
+
+  } else {
+
+    child_pid = fork();
+
+    if (child_pid < 0) PFATAL("fork() failed");
+    if (!child_pid) exec_pacfix_oracle(o, argv);
+
+  }
+
+  it.it_value.tv_sec = (PACFIX_TMOUT / 1000);
+  it.it_value.tv_usec = (PACFIX_TMOUT % 1000) * 1000;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  if (o->use_fsrv) {
+
+    if (read(o->st_fd, &status, 4) != 4 && !stop_soon)
+      FATAL("Unable to communicate with fork server of '%s'", o->path);
+
+  } else {
+
+    if (waitpid(child_pid, &status, 0) <= 0) PFATAL("waitpid() failed");
+
+  }
+
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  child_pid = saved_pid;
+  child_timed_out = 0;
+  argv[0] = argv0;
+
+}
+
+
+/* Read the whole report of an oracle. Returns NULL if there's none. */
+
+static u8* read_pacfix_report(struct pacfix_oracle* o, u32* len) {
+
+  struct stat st;
+  u8* buf;
+  s32 fd = open(o->out_path, O_RDONLY);
+
+  if (fd < 0) return NULL;
+  if (fstat(fd, &st)) PFATAL("fstat() failed");
+
+  buf = ck_alloc_nozero(st.st_size + 1);
+  ck_read(fd, buf, st.st_size, o->out_path);
+  buf[st.st_size] = 0;
+  close(fd);
+
+  *len = st.st_size;
+  return buf;
+
+}
+
+
+/* Cheap check for inputs that can't have reached the target line: if the
+   binary itself flags runs that reach it (DAFL_TARGET_LOC at build time),
+   the last run must have set the flag. Runs before dedup_seen() and the
+   oracle, so that inputs turned down here cost neither. */
+
+static inline u8 reached_target(void) {
+
+  return !dfg_target || dfg_hit[dfg_size];
+
+}
+
+
+/* Check if the input reached the target line. For crashes, the last line
+   of the report must be "__localize: <target line>"; for other inputs, the
+   target line must show up anywhere in the report. Without a coverage
+   oracle, every input qualifies. */
+
+static u8 check_coverage(u8 crashed, char** argv, void* mem, u32 len) {
+
+  u8 *report, *last;
+  u32 rlen, parsed_line;
+  u8 ret;
+
+  if (!pacfix_cov.path) return 1;
+
+  run_pacfix_oracle(&pacfix_cov, argv, mem, len);
+
+  report = read_pacfix_report(&pacfix_cov, &rlen);
+  if (!report) return 0;
+
+  if (crashed) {
+
+    while (rlen && report[rlen - 1] == '\n') report[--rlen] = 0;
+
+    last = memrchr(report, '\n', rlen);
+    last = last ? last + 1 : report;
+
+    if (sscanf((char*)last, "__localize: %u", &parsed_line) != 1) ret = 1;
+    else ret = (parsed_line == pacfix_line);
+
+  } else {
+
+    ret = !!memmem(report, rlen, pacfix_line_str, strlen((char*)pacfix_line_str));
+
+  }
+
+  ck_free(report);
+  return ret;
+
+}
+
+
+/* Move a file, copying it over if rename() can't cross file systems. */
+
+static void move_file(u8* old_path, u8* new_path) {
+
+  s32 sfd, dfd, n;
+  u8 tmp[4096];
+
+  if (!rename(old_path, new_path)) return;
+
+  if (errno != EXDEV) PFATAL("Unable to move '%s'", old_path);
+
+  sfd = open(old_path, O_RDONLY);
+  if (sfd < 0) PFATAL("Unable to open '%s'", old_path);
+
+  dfd = open(new_path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (dfd < 0) PFATAL("Unable to create '%s'", new_path);
+
+  while ((n = read(sfd, tmp, sizeof(tmp))) > 0)
+    ck_write(dfd, tmp, n, new_path);
+
+  if (n < 0) PFATAL("Unable to read '%s'", old_path);
+
+  close(sfd);
+  close(dfd);
+
+  unlink(old_path); /* Ignore errors */
+
+}
+
+
+/* Packed store (AFL_PACKED_STORE). Normals, crashes and memory valuations
+   are appended to segment files, rather than saved one file each; see
+   packed-store.h for the format. Entries are collected in memory and written
+   out in batches, and the segments are fdatasync()ed every now and then. */
+
+static s32 pack_dat_fd = -1,          /* Current data segment             */
+           pack_idx_fd = -1;          /* Current index segment            */
+
+static u32 pack_seg,                  /* Current segment number           */
+           pack_buf_len,              /* Data bytes waiting to be written */
+           pack_rec_cnt;              /* Index records waiting, likewise  */
+
+static u8* pack_buf;                  /* Data write buffer                */
+static struct packed_rec* pack_recs;  /* Index write buffer               */
+
+static u64 pack_seg_off,              /* Segment size, incl. buffered data */
+           pack_last_sync;            /* Time of the last fdatasync() (ms) */
+
+
+/* Open the next segment. */
+
+static void open_packed_seg(void) {
+
+  u8* fn;
+
+  fn = alloc_printf("%s/packed/seg_%06u.dat", out_dir, pack_seg);
+  pack_dat_fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (pack_dat_fd < 0) PFATAL("Unable to create '%s'", fn);
+  ck_free(fn);
+
+  fn = alloc_printf("%s/packed/seg_%06u.idx", out_dir, pack_seg);
+  pack_idx_fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (pack_idx_fd < 0) PFATAL("Unable to create '%s'", fn);
+  ck_write(pack_idx_fd, PACKED_MAGIC, PACKED_MAGIC_LEN, fn);
+  ck_free(fn);
+
+  pack_seg_off = 0;
+
+}
+
+
+static void setup_packed_store(void) {
+
+  u8* tmp;
+
+  if (!packed_store) return;
+
+  tmp = alloc_printf("%s/packed", out_dir);
+  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
+  ck_free(tmp);
+
+  pack_buf  = ck_alloc_nozero(PACKED_BUF_SIZE);
+  pack_recs = ck_alloc_nozero(PACKED_BUF_RECS * sizeof(struct packed_rec));
+
+  open_packed_seg();
+  pack_last_sync = get_cur_time();
+
+}
+
+
+/* Write out the buffered entries. Data goes first, so that no index record
+   ever points past the end of its segment. With sync set, the segment is
+   also fdatasync()ed if PACKED_SYNC_SEC have passed; sync > 1 forces it. */
+
+static void flush_packed_store(u8 sync) {
+
+  if (pack_dat_fd < 0) return;
+
+  if (pack_buf_len) {
+    ck_write(pack_dat_fd, pack_buf, pack_buf_len, "packed data");
+    pack_buf_len = 0;
+  }
+
+  if (pack_rec_cnt) {
+    ck_write(pack_idx_fd, pack_recs, pack_rec_cnt * sizeof(struct packed_rec),
+             "packed index");
+    pack_rec_cnt = 0;
+  }
+
+  if (sync > 1 ||
+      (sync && get_cur_time() - pack_last_sync >= PACKED_SYNC_SEC * 1000)) {
+
+    if (fdatasync(pack_dat_fd) || fdatasync(pack_idx_fd))
+      PFATAL("fdatasync() on the packed store failed");
+
+    pack_last_sync = get_cur_time();
+
+  }
+
+}
+
+
+/* Append an entry to the store. The name is the path that the classic
+   layout would have used, relative to out_dir. */
+
+static void pack_entry(u8 kind, u8* name, void* mem, u32 len, u64 prox_score,
+                       u8 sig) {
+
+  struct packed_rec* rec;
+  u32 name_len = strlen(name);
+
+  if (pack_seg_off && pack_seg_off + name_len + len > PACKED_SEG_SIZE) {
+
+    flush_packed_store(2);
+    close(pack_dat_fd);
+    close(pack_idx_fd);
+
+    pack_seg++;
+    open_packed_seg();
+
+  }
+
+  if (pack_buf_len + name_len + len > PACKED_BUF_SIZE ||
+      pack_rec_cnt == PACKED_BUF_RECS) flush_packed_store(0);
+
+  rec = pack_recs + pack_rec_cnt++;
+
+  rec->offset     = pack_seg_off;
+  hash128(mem, len, HASH_CONST, rec->hash);
+
+  rec->prox_score = prox_score;
+  rec->len        = len;
+  rec->name_len   = name_len;
+  rec->kind       = kind;
+  rec->sig        = sig;
+
+  memcpy(pack_buf + pack_buf_len, name, name_len);
+  pack_buf_len += name_len;
+
+  /* Oversized entries bypass the buffer. */
+
+  if (pack_buf_len + len > PACKED_BUF_SIZE) {
+
+    ck_write(pack_dat_fd, pack_buf, pack_buf_len, "packed data");
+    ck_write(pack_dat_fd, mem, len, "packed data");
+    pack_buf_len = 0;
+
+  } else {
+
+    memcpy(pack_buf + pack_buf_len, mem, len);
+    pack_buf_len += len;
+
+  }
+
+  pack_seg_off += name_len + len;
+
+}
+
+
+/* Record the program state reached by the input, as reported by the
+   valuation oracle, under memory/neg (crashes) or memory/pos. */
+
+static void get_valuation(u8 crashed, char** argv, void* mem, u32 len) {
+
+  u8* fn;
+
+  if (!pacfix_val.path) return;
+
+  run_pacfix_oracle(&pacfix_val, argv, mem, len);
+
+  if (access(pacfix_val.out_path, F_OK)) return;
+
+  if (crashed)
+    fn = alloc_printf("memory/neg/id:%06llu", total_saved_crashes++);
+  else
+    fn = alloc_printf("memory/pos/id:%06llu", total_saved_positives++);
+
+  if (packed_store) {
+
+    struct stat st;
+    u8* buf;
+    s32 fd = open(pacfix_val.out_path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st))
+      PFATAL("Unable to open '%s'", pacfix_val.out_path);
+
+    buf = ck_alloc_nozero(st.st_size);
+    ck_read(fd, buf, st.st_size, pacfix_val.out_path);
+    close(fd);
+
+    pack_entry(crashed ? PACKED_MEM_NEG : PACKED_MEM_POS, fn, buf, st.st_size,
+               compute_proximity_score(), crashed ? kill_signal : 0);
+
+    ck_free(buf);
+    unlink(pacfix_val.out_path); /* Ignore errors */
+
+  } else {
+
+    u8* path = alloc_printf("%s/%s", out_dir, fn);
+    move_file(pacfix_val.out_path, path);
+    ck_free(path);
+
+  }
+
+  ck_free(fn);
+
+}
+
+
+/* Content-hash set of the crashes and normals seen so far. Byte-identical
+   inputs come up again and again from different stages, and each of them
+   would otherwise cost a trip through the PACFIX oracles and another copy
+   on disk. The keys are hash128() of the input, seeded with the fault
+   type; with AFL_DEDUP_TRACE, the trace checksum is mixed in, too, so that
+   a repeat that behaved differently is still kept. The set is open-addressed
+   with linear probing; all-zero keys mark empty slots. */
+
+struct dedup_key {
+
+  u64 h[2];
+
+};
+
+static struct dedup_key* dedup_set;   /* Hash set, dedup_size slots       */
+static u32 dedup_size,                /* Number of slots (power of two)   */
+           dedup_cnt;                 /* Number of keys                   */
+
+
+/* Insert a key, assuming there is room. Returns 1 if it was already there. */
+
+static u8 dedup_insert(struct dedup_key* k) {
+
+  u32 i = k->h[0] & (dedup_size - 1);
+
+  while (dedup_set[i].h[0] || dedup_set[i].h[1]) {
+
+    if (dedup_set[i].h[0] == k->h[0] && dedup_set[i].h[1] == k->h[1])
+      return 1;
+
+    i = (i + 1) & (dedup_size - 1);
+
+  }
+
+  dedup_set[i] = *k;
+  dedup_cnt++;
+  return 0;
+
+}
+
+
+/* Check if the input was seen before with the same fault, and remember it
+   if not. Updates the hit / miss counters in fuzzer_stats. */
+
+static u8 dedup_seen(void* mem, u32 len, u8 fault) {
+
+  struct dedup_key k;
+
+  if (no_dedup) return 0;
+
+  hash128(mem, len, HASH_CONST ^ fault, k.h);
+
+  if (dedup_trace)
+    k.h[1] ^= (u64)trace_cksum() << 16;
+
+  if (!k.h[0] && !k.h[1]) k.h[0] = 1;
+
+  /* Keep the load factor under 1/2. */
+
+  if ((dedup_cnt + 1) * 2 > dedup_size) {
+
+    struct dedup_key* old = dedup_set;
+    u32 old_size = dedup_size, i;
+
+    dedup_size = dedup_size ? dedup_size * 2 : DEDUP_INIT_SIZE;
+    dedup_set  = ck_alloc(dedup_size * sizeof(struct dedup_key));
+    dedup_cnt  = 0;
+
+    for (i = 0; i < old_size; i++)
+      if (old[i].h[0] || old[i].h[1]) dedup_insert(old + i);
+
+    ck_free(old);
+
+  }
+
+  if (dedup_insert(&k)) {
+    dedup_hits++;
+    return 1;
+  }
+
+  dedup_misses++;
+  return 0;
+
+}
+
+
+/* With AFL_SYNC_BUS, local instances also hand each other their new queue
+   entries through a ring in shared memory, instead of only scanning each
+   other's queue/ directories; see sync-bus.h for the format. Here is the
+   producer side; the consumer side is called from sync_fuzzers(). */
+
+static struct sync_bus* sync_bus;     /* Shared sync bus, if attached     */
+static u8* sync_ring;                 /* Its ring                         */
+
+static u8  use_sync_bus,              /* AFL_SYNC_BUS set?                */
+           bus_trust;                 /* Import without running entries?  */
+
+static u64 bus_cursor;                /* Next record to read from the bus */
+
+static u8  bus_peers[SYNC_BUS_PEERS][SYNC_BUS_NAME_LEN];
+static u32 bus_peer_cnt;              /* Peers seen on the bus            */
+
+
+/* Map the bus, creating it if this is the first instance to get here. */
+
+static void setup_sync_bus(void) {
+
+  u8* fn;
+  s32 fd;
+  struct stat st;
+  u64 total = sizeof(struct sync_bus) + SYNC_BUS_SIZE;
+
+  if (!use_sync_bus) return;
+
+  if (!sync_id) {
+    WARNF("AFL_SYNC_BUS has no effect without -M or -S.");
+    return;
+  }
+
+  fn = alloc_printf("%s/.sync_bus", sync_dir);
+
+  fd = open(fn, O_RDWR | O_CREAT, 0600);
+  if (fd < 0) PFATAL("Unable to create '%s'", fn);
+
+  /* Whoever gets the lock first sets the bus up; the ring itself starts
+     out zeroed, which is a valid, empty state. */
+
+  if (flock(fd, LOCK_EX)) PFATAL("flock() failed");
+
+  if (fstat(fd, &st)) PFATAL("fstat() failed");
+
+  if (!st.st_size && ftruncate(fd, total)) PFATAL("ftruncate() failed");
+
+  if (st.st_size && st.st_size != total)
+    FATAL("'%s' was created with a different SYNC_BUS_SIZE", fn);
+
+  sync_bus = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (sync_bus == MAP_FAILED) PFATAL("Unable to mmap '%s'", fn);
+
+  if (!st.st_size) {
+
+    sync_bus->size = SYNC_BUS_SIZE;
+    memcpy(sync_bus->magic, SYNC_BUS_MAGIC, SYNC_BUS_MAGIC_LEN);
+
+  } else if (memcmp(sync_bus->magic, SYNC_BUS_MAGIC, SYNC_BUS_MAGIC_LEN) ||
+             sync_bus->size != SYNC_BUS_SIZE)
+    FATAL("'%s' is not a valid sync bus", fn);
+
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  sync_ring = (u8*)(sync_bus + 1);
+
+  /* Start with the oldest records still around, if we know where they
+     begin. */
+
+  bus_cursor = __atomic_load_n(&sync_bus->head, __ATOMIC_ACQUIRE);
+  if (bus_cursor <= SYNC_BUS_SIZE) bus_cursor = 0;
+
+  OKF("Attached to the sync bus in '%s'.", fn);
+
+  ck_free(fn);
+
+}
+
+
+/* Publish a new queue entry on the bus, with trace_bits and the DFG node
+   statistics still describing it (i.e., right after calibration). */
+
+static void bus_publish(struct queue_entry* q, u8* mem) {
+
+  struct sync_rec* rec;
+  struct dfg_set_iter it;
+  u64 pos, start, next, off;
+  u32 trace_cnt = trace_bytes(), rec_len, i, n;
+  u8* p;
+
+  rec_len = SYNC_REC_LEN(q->len, trace_cnt, q->dfg_nodes_cnt);
+
+  if (rec_len > SYNC_BUS_SIZE / 4) return;
+
+  /* Reserve space. If the record doesn't fit before the end of the ring,
+     skip to the start, leaving padding behind. */
+
+  pos = __atomic_load_n(&sync_bus->head, __ATOMIC_ACQUIRE);
+
+  do {
+
+    off   = pos % SYNC_BUS_SIZE;
+    start = off + rec_len > SYNC_BUS_SIZE ? pos + SYNC_BUS_SIZE - off : pos;
+    next  = start + rec_len;
+
+  } while (!__atomic_compare_exchange_n(&sync_bus->head, &pos, next, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+  if (start != pos && SYNC_BUS_SIZE - off >= sizeof(struct sync_rec)) {
+
+    rec = (struct sync_rec*)(sync_ring + off);
+
+    rec->rec_len = SYNC_BUS_SIZE - off;
+    rec->name[0] = 0;
+
+    __atomic_store_n(&rec->stamp, pos + 1, __ATOMIC_RELEASE);
+
+  }
+
+  rec = (struct sync_rec*)(sync_ring + start % SYNC_BUS_SIZE);
+
+  rec->rec_len     = rec_len;
+  rec->entry_id    = q->entry_id;
+  rec->prox_score  = q->prox_score;
+  rec->exec_us     = q->exec_us;
+  rec->len         = q->len;
+  rec->trace_cnt   = trace_cnt;
+  rec->dfg_cnt     = q->dfg_nodes_cnt;
+  rec->exec_cksum  = q->exec_cksum;
+  rec->bitmap_size = q->bitmap_size;
+  rec->dfg_size    = dfg_size;
+
+  strncpy((char*)rec->name, sync_id, SYNC_BUS_NAME_LEN - 1);
+  rec->name[SYNC_BUS_NAME_LEN - 1] = 0;
+
+  p = (u8*)(rec + 1);
+
+  memcpy(p, mem, q->len);
+  p += q->len;
+
+  for (i = 0; i < MAP_SIZE; i++)
+    if (trace_bits[i]) {
+      u16 idx = i;
+      memcpy(p, &idx, sizeof(u16));
+      p += sizeof(u16);
+    }
+
+  for (i = 0; i < MAP_SIZE; i++)
+    if (trace_bits[i]) *(p++) = trace_bits[i];
+
+  dfg_set_iter_init(&it, q->dfg_nodes, q->dfg_nodes_len);
+
+  while (dfg_set_next(&it, &n)) {
+    memcpy(p, &n, sizeof(u32));
+    p += sizeof(u32);
+  }
+
+  __atomic_store_n(&rec->stamp, start + 1, __ATOMIC_RELEASE);
+
+}
+
+
+/* Check if the result of an execve() during routine fuzzing is interesting,
+   save or queue the input test case for further analysis if so. Returns 1 if
+   entry is saved, 0 otherwise. */
+
+static u8 save_if_interesting(char** argv, void* mem, u32 len, u8 fault) {
+
+  u8  *fn = "";
+  u8  hnb;
+  s32 fd;
+  u8  keeping = 0, res;
+  u64 prox_score;
+
+  if (fault == crash_mode) {
+
+    /* With AFL_SYNC_NEW_DFG, imports that bring no new DFG node are dropped
+       before they get to touch virgin_bits. */
+
+    if (syncing_party && sync_new_dfg && !reaches_new_dfg_node()) {
+      sync_filtered++;
+      hnb = 0;
+    } else hnb = has_new_bits(virgin_bits);
+
+    if (hnb) {
+
+    /* Keep only if there are new bits in the map, add to queue for
+       future fuzzing, etc. */
+
+    // if (!(hnb = has_new_bits(virgin_bits))) {
+    //   if (crash_mode) total_crashes++;
+    //   return 0;
+    // }
+    
+      observe_dfg_trace();
+      prox_score = compute_proximity_score();
+
+#ifndef SIMPLE_FILES
+
+      fn = alloc_printf("%s/queue/id:%06u,%llu,%s", out_dir, queued_paths,
+                        prox_score, describe_op(hnb));
+
+#else
+
+      fn = alloc_printf("%s/queue/id_%06u", out_dir, queued_paths);
+
+#endif /* ^!SIMPLE_FILES */
+
+      add_to_queue(fn, len, 0, prox_score);
+      queue_last->dfg_observed = 1;
+
+      if (hnb == 2) {
+        queue_last->has_new_cov = 1;
+        queued_with_cov++;
+      }
+
+      queue_last->exec_cksum = trace_cksum();
+
+      /* Try to calibrate inline; this also calls update_bitmap_score() when
+        successful. */
+
+      res = calibrate_case(argv, queue_last, mem, queue_cycle - 1, 0);
+
+      if (res == FAULT_ERROR)
+        FATAL("Unable to execute target application");
+
+      fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+      if (fd < 0) PFATAL("Unable to create '%s'", fn);
+      ck_write(fd, mem, len, fn);
+      close(fd);
+
+      if (sync_bus && !syncing_party && !queue_last->cal_failed)
+        bus_publish(queue_last, mem);
+
+      keeping = 1;
+    }
+
+  }
+
+  switch (fault) {
+
+    case FAULT_TMOUT:
+
+      /* Timeouts are not very interesting, but we're still obliged to keep
+         a handful of samples. We use the presence of new bits in the
+         hang-specific bitmap as a signal of uniqueness. In "dumb" mode, we
+         just keep everything. */
+
+      total_tmouts++;
+
+      if (unique_hangs >= KEEP_UNIQUE_HANG) return keeping;
+
+      if (!dumb_mode) {
+
+#ifdef WORD_SIZE_64
+        simplify_trace((u64*)trace_bits);
+#else
+        simplify_trace((u32*)trace_bits);
+#endif /* ^WORD_SIZE_64 */
+
+        if (!has_new_bits(virgin_tmout)) return keeping;
+
+      }
+
+      unique_tmouts++;
+
+      /* Before saving, we make sure that it's a genuine hang by re-running
+         the target with a more generous timeout (unless the default timeout
+         is already generous). */
+
+      if (exec_tmout < hang_tmout) {
+
+        u8 new_fault;
+        write_to_testcase(mem, len);
+        new_fault = run_target(argv, hang_tmout, "USELESS=0", 0);
+
+        /* A corner case that one user reported bumping into: increasing the
+           timeout actually uncovers a crash. Make sure we don't discard it if
+           so. */
+
+        if (!stop_soon && new_fault == FAULT_CRASH) goto keep_as_crash;
+
+        if (stop_soon || new_fault != FAULT_TMOUT) return keeping;
+
+      }
+
+#ifndef SIMPLE_FILES
+
+      fn = alloc_printf("%s/hangs/id:%06llu,%s", out_dir,
+                        unique_hangs, describe_op(0));
+
+#else
+
+      fn = alloc_printf("%s/hangs/id_%06llu", out_dir,
+                        unique_hangs);
+
+#endif /* ^!SIMPLE_FILES */
+
+      unique_hangs++;
+
+      last_hang_time = get_cur_time();
+
+      break;
+
+    case FAULT_CRASH:
+
+keep_as_crash:
+
+      if (!reached_target()) return keeping;
+      if (dedup_seen(mem, len, FAULT_CRASH)) return keeping;
+      if (!check_coverage(1, argv, mem, len)) return keeping;
+      get_valuation(1, argv, mem, len);
+
+      /* This is handled in a manner roughly similar to timeouts,
+         except for slightly different limits and no need to re-run test
+         cases. Byte-identical repeats were dropped above, so this counts
+         each distinct crashing input once. */
+
+      total_crashes++;
+
+      if (unique_crashes >= KEEP_UNIQUE_CRASH) return keeping;
+
+      if (!dumb_mode) {
+
+#ifdef WORD_SIZE_64
+        simplify_trace((u64*)trace_bits);
+#else
+        simplify_trace((u32*)trace_bits);
+#endif /* ^WORD_SIZE_64 */
+
+        // if (!has_new_bits(virgin_crash)) return keeping;
+
+      }
+
+      if (!unique_crashes) write_crash_readme();
+
+      // Temporary computation for debugging.
+      prox_score = compute_proximity_score();
+
+#ifndef SIMPLE_FILES
 
       fn = alloc_printf("%s/crashes/id:%06llu,%llu,sig:%02u,%s", out_dir,
                         total_crashes, prox_score, kill_signal,
@@ -3562,11 +6413,15 @@ keep_as_crash:
 
       break;
     case FAULT_NONE:
+      if (!reached_target()) return keeping;
+      if (dedup_seen(mem, len, FAULT_NONE)) return keeping;
       if (!check_coverage(0, argv, mem, len)) return keeping;
       get_valuation(0, argv, mem, len);
 
       total_normals++;
 
+      prox_score = compute_proximity_score();
+
 #ifndef SIMPLE_FILES
 
       fn = alloc_printf("%s/normals/id:%06llu,%llu,sig:%02u,%s", out_dir,
@@ -3590,6 +6445,16 @@ keep_as_crash:
   /* If we're here, we apparently want to save the crash or hang
      test case, too. */
 
+  if (packed_store && fault != FAULT_TMOUT) {
+
+    pack_entry(fault == FAULT_NONE ? PACKED_NORMAL : PACKED_CRASH,
+               fn + strlen(out_dir) + 1, mem, len, prox_score, kill_signal);
+
+    ck_free(fn);
+    return keeping;
+
+  }
+
   fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
   if (fd < 0) PFATAL("Unable to create '%s'", fn);
   ck_write(fd, mem, len, fn);
@@ -3641,6 +6506,22 @@ static void find_timeout(void) {
 
 /* Update stats file for unattended monitoring. */
 
+/* Describe a DFG node for the status screen and fuzzer_stats. */
+
+static u8* describe_dfg_node(s32 n) {
+
+  static u8 tmp[32];
+
+  if (n < 0) return "none yet";
+
+  if (dfg_node_desc[n]) return dfg_desc_buf + dfg_node_desc[n];
+
+  sprintf(tmp, "node %u", n);
+  return tmp;
+
+}
+
+
 static void write_stats_file(double bitmap_cvg, double stability, double eps) {
 
   static double last_bcvg, last_stab, last_eps;
@@ -3696,6 +6577,13 @@ static void write_stats_file(double bitmap_cvg, double stability, double eps) {
              "last_crash        : %llu\n"
              "last_hang         : %llu\n"
              "execs_since_crash : %llu\n"
+             "dedup_hits        : %llu\n"
+             "dedup_misses      : %llu\n"
+             "sync_filtered     : %llu\n"
+             "executors         : %u\n"
+             "dfg_nodes_hit     : %u\n"
+             "dfg_nodes_total   : %u\n"
+             "dfg_closest       : %s\n"
              "exec_timeout      : %u\n" /* Must match find_timeout() */
              "afl_banner        : %s\n"
              "afl_version       : " VERSION "\n"
@@ -3709,7 +6597,10 @@ static void write_stats_file(double bitmap_cvg, double stability, double eps) {
              queued_variable, stability, bitmap_cvg, unique_crashes,
              unique_hangs, last_path_time / 1000, last_crash_time / 1000,
              last_hang_time / 1000, total_execs - last_crash_execs,
-             exec_tmout, use_banner,
+             dedup_hits, dedup_misses, sync_filtered, executor_cnt,
+             dfg_nodes_hit, dfg_nodes_known, describe_dfg_node(dfg_closest),
+             exec_tmout,
+             use_banner,
              qemu_mode ? "qemu " : "", dumb_mode ? " dumb " : "",
              no_forkserver ? "no_forksrv " : "", crash_mode ? "crash " : "",
              persistent_mode ? "persistent " : "", deferred_mode ? "deferred " : "",
@@ -4226,6 +7117,11 @@ static void show_stats(void) {
 
   }
 
+  /* Write out anything buffered in the packed store, and fdatasync() it
+     every PACKED_SYNC_SEC. */
+
+  flush_packed_store(1);
+
   /* Every now and then, write plot data. */
 
   if (cur_ms - last_plot_ms > PLOT_UPDATE_SEC * 1000) {
@@ -4266,7 +7162,7 @@ static void show_stats(void) {
   if (term_too_small) {
 
     SAYF(cBRI "Your terminal is too small to display the UI.\n"
-         "Please resize terminal window to at least 80x25.\n" cRST);
+         "Please resize terminal window to at least 80x26.\n" cRST);
 
     return;
 
@@ -4401,6 +7297,24 @@ static void show_stats(void) {
 
   SAYF(bSTOP " count coverage : " cRST "%-21s " bSTG bV "\n", tmp);
 
+  /* DFG nodes reached so far, and the one closest to the target. */
+
+  if (dfg_nodes_known)
+    sprintf(tmp, "%s (%0.02f%%)", DI(dfg_nodes_hit),
+            ((double)dfg_nodes_hit) * 100 / dfg_nodes_known);
+  else
+    strcpy(tmp, "n/a");
+
+  SAYF(bV bSTOP "   dfg nodes hit : %s%-17s " bSTG bV bSTOP,
+       dfg_nodes_known ? cRST : cPIN, tmp);
+
+  if (strlen(describe_dfg_node(dfg_closest)) > 21)
+    sprintf(tmp, "%.18s...", describe_dfg_node(dfg_closest));
+  else
+    strcpy(tmp, describe_dfg_node(dfg_closest));
+
+  SAYF("   closest node : " cRST "%-21s " bSTG bV "\n", tmp);
+
   SAYF(bVR bH bSTOP cCYA " stage progress " bSTG bH20 bX bH bSTOP cCYA
        " findings in depth " bSTG bH20 bVL "\n");
 
@@ -4771,6 +7685,8 @@ static u8 trim_case(char** argv, struct queue_entry* q, u8* in_buf) {
 
   remove_len = MAX(len_p2 / TRIM_START_STEPS, TRIM_MIN_BYTES);
 
+  want_cksum++;
+
   /* Continue until the number of steps gets too high or the stepover
      gets too small. */
 
@@ -4797,7 +7713,7 @@ static u8 trim_case(char** argv, struct queue_entry* q, u8* in_buf) {
 
       /* Note that we don't keep track of crashes or hangs here; maybe TODO? */
 
-      cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+      cksum = trace_cksum();
 
       /* If the deletion had no impact on the trace, make it permanent. This
          isn't perfect for variable-path inputs, but we're just making a
@@ -4854,12 +7770,16 @@ static u8 trim_case(char** argv, struct queue_entry* q, u8* in_buf) {
     close(fd);
 
     memcpy(trace_bits, clean_trace, MAP_SIZE);
+    last_trace.map = NULL;
+
     update_bitmap_score(q);
 
   }
 
 abort_trimming:
 
+  want_cksum--;
+
   bytes_trim_out += q->len;
   return fault;
 
@@ -4870,6 +7790,8 @@ abort_trimming:
    error conditions, returning 1 if it's time to bail out. This is
    a helper function for fuzz_one(). */
 
+static u8 common_fuzz_result(char** argv, u8* out_buf, u32 len, u8 fault);
+
 EXP_ST u8 common_fuzz_stuff(char** argv, u8* out_buf, u32 len) {
 
   u8 fault;
@@ -4885,6 +7807,16 @@ EXP_ST u8 common_fuzz_stuff(char** argv, u8* out_buf, u32 len) {
 
   fault = run_target(argv, exec_tmout, "USELESS=0", 0);
 
+  return common_fuzz_result(argv, out_buf, len, fault);
+
+}
+
+
+/* Handle the outcome of running a test case for common_fuzz_stuff() or
+   common_fuzz_async(), with the maps of the run in place. */
+
+static u8 common_fuzz_result(char** argv, u8* out_buf, u32 len, u8 fault) {
+
   if (stop_soon) return 1;
 
   if (fault == FAULT_TMOUT) {
@@ -4907,14 +7839,112 @@ EXP_ST u8 common_fuzz_stuff(char** argv, u8* out_buf, u32 len) {
 
   }
 
-  /* This handles FAULT_ERROR for us: */
+  /* This handles FAULT_ERROR for us: */
+
+  queued_discovered += save_if_interesting(argv, out_buf, len, fault);
+
+  if (!(stage_cur % stats_update_freq) || stage_cur + 1 == stage_max)
+    show_stats();
+
+  return 0;
+
+}
+
+
+/* Wrap up a run started by common_fuzz_async() on executor 'e'. */
+
+static u8 finish_fuzz_run(char** argv, struct executor* e, u8 fault) {
+
+  s32 val = stage_cur_val;
+  u8  ret;
+
+  /* For describe_op(), in case the test case gets saved. */
+
+  stage_cur_val = e->stage_val;
+
+  ret = common_fuzz_result(argv, e->buf, e->buf_len, fault);
+
+  stage_cur_val = val;
+
+  return ret;
+
+}
+
+
+/* The havoc stage counterpart of common_fuzz_stuff(): with several executors,
+   the test case is started on the first one that is free, after handling
+   the result of whatever it was running before, and the function returns
+   right away. Results are thus handled a few runs late, in completion
+   order; finish_fuzz_runs() collects the remaining ones. Returns 1 if the
+   current entry should be abandoned. */
+
+static u8 common_fuzz_async(char** argv, u8* out_buf, u32 len) {
+
+  struct executor* e = NULL;
+  u32 i;
+  u8  fault;
+
+  if (executor_cnt == 1) return common_fuzz_stuff(argv, out_buf, len);
+
+  if (post_handler) {
+
+    out_buf = post_handler(out_buf, &len);
+    if (!out_buf || !len) return 0;
+
+  }
+
+  for (i = 0; i < executor_cnt && !e; i++)
+    if (!executors[i].busy) e = executors + i;
+
+  if (!e) {
+
+    if (!(e = wait_executor(&fault))) return 1;
+    if (finish_fuzz_run(argv, e, fault)) return 1;
+
+  }
+
+  if (e->buf_size < len) {
+    e->buf_size = len;
+    e->buf = ck_realloc(e->buf, len);
+  }
+
+  memcpy(e->buf, out_buf, len);
+  e->buf_len   = len;
+  e->stage_val = stage_cur_val;
+
+  launch_executor(e, e->buf, len, exec_tmout);
+
+  return 0;
+
+}
+
+
+/* Handle the results of all the runs still in flight, and go back to the
+   main executor. Returns 1 if the current entry should be abandoned. */
+
+static u8 finish_fuzz_runs(char** argv) {
+
+  struct executor* e;
+  u32 i, busy = 0;
+  u8  fault, ret = 0;
+
+  for (i = 0; i < executor_cnt; i++)
+    if (executors[i].busy) busy++;
+
+  while (busy--) {
+
+    if (!(e = wait_executor(&fault))) {
+      ret = 1;
+      break;
+    }
+
+    if (finish_fuzz_run(argv, e, fault)) ret = 1;
 
-  queued_discovered += save_if_interesting(argv, out_buf, len, fault);
+  }
 
-  if (!(stage_cur % stats_update_freq) || stage_cur + 1 == stage_max)
-    show_stats();
+  select_executor(executors);
 
-  return 0;
+  return ret;
 
 }
 
@@ -5431,11 +8461,17 @@ static u8 fuzz_one(char** argv) {
 
   for (stage_cur = 0; stage_cur < stage_max; stage_cur++) {
 
+    u8 need_cksum = !dumb_mode && (stage_cur & 7) == 7, bail;
+
     stage_cur_byte = stage_cur >> 3;
 
     FLIP_BIT(out_buf, stage_cur);
 
-    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+    want_cksum += need_cksum;
+    bail = common_fuzz_stuff(argv, out_buf, len);
+    want_cksum -= need_cksum;
+
+    if (bail) goto abandon_entry;
 
     FLIP_BIT(out_buf, stage_cur);
 
@@ -5468,7 +8504,7 @@ static u8 fuzz_one(char** argv) {
 
     if (!dumb_mode && (stage_cur & 7) == 7) {
 
-      u32 cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+      u32 cksum = trace_cksum();
 
       if (stage_cur == stage_max - 1 && cksum == prev_cksum) {
 
@@ -5605,11 +8641,18 @@ static u8 fuzz_one(char** argv) {
 
   for (stage_cur = 0; stage_cur < stage_max; stage_cur++) {
 
+    u8 need_cksum = !eff_map[EFF_APOS(stage_cur)] && !dumb_mode &&
+                    len >= EFF_MIN_LEN, bail;
+
     stage_cur_byte = stage_cur;
 
     out_buf[stage_cur] ^= 0xFF;
 
-    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+    want_cksum += need_cksum;
+    bail = common_fuzz_stuff(argv, out_buf, len);
+    want_cksum -= need_cksum;
+
+    if (bail) goto abandon_entry;
 
     /* We also use this stage to pull off a simple trick: we identify
        bytes that seem to have no effect on the current execution path
@@ -5624,137 +8667,393 @@ static u8 fuzz_one(char** argv) {
          without wasting time on checksums. */
 
       if (!dumb_mode && len >= EFF_MIN_LEN)
-        cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+        cksum = trace_cksum();
       else
         cksum = ~queue_cur->exec_cksum;
 
-      if (cksum != queue_cur->exec_cksum) {
-        eff_map[EFF_APOS(stage_cur)] = 1;
-        eff_cnt++;
-      }
+      if (cksum != queue_cur->exec_cksum) {
+        eff_map[EFF_APOS(stage_cur)] = 1;
+        eff_cnt++;
+      }
+
+    }
+
+    out_buf[stage_cur] ^= 0xFF;
+
+  }
+
+  /* If the effector map is more than EFF_MAX_PERC dense, just flag the
+     whole thing as worth fuzzing, since we wouldn't be saving much time
+     anyway. */
+
+  if (eff_cnt != EFF_ALEN(len) &&
+      eff_cnt * 100 / EFF_ALEN(len) > EFF_MAX_PERC) {
+
+    memset(eff_map, 1, EFF_ALEN(len));
+
+    blocks_eff_select += EFF_ALEN(len);
+
+  } else {
+
+    blocks_eff_select += eff_cnt;
+
+  }
+
+  blocks_eff_total += EFF_ALEN(len);
+
+  new_hit_cnt = queued_paths + unique_crashes;
+
+  stage_finds[STAGE_FLIP8]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_FLIP8] += stage_max;
+
+  /* Two walking bytes. */
+
+  if (len < 2) goto skip_bitflip;
+
+  stage_name  = "bitflip 16/8";
+  stage_short = "flip16";
+  stage_cur   = 0;
+  stage_max   = len - 1;
+
+  orig_hit_cnt = new_hit_cnt;
+
+  for (i = 0; i < len - 1; i++) {
+
+    /* Let's consult the effector map... */
+
+    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)]) {
+      stage_max--;
+      continue;
+    }
+
+    stage_cur_byte = i;
+
+    *(u16*)(out_buf + i) ^= 0xFFFF;
+
+    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+    stage_cur++;
+
+    *(u16*)(out_buf + i) ^= 0xFFFF;
+
+
+  }
+
+  new_hit_cnt = queued_paths + unique_crashes;
+
+  stage_finds[STAGE_FLIP16]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_FLIP16] += stage_max;
+
+  if (len < 4) goto skip_bitflip;
+
+  /* Four walking bytes. */
+
+  stage_name  = "bitflip 32/8";
+  stage_short = "flip32";
+  stage_cur   = 0;
+  stage_max   = len - 3;
+
+  orig_hit_cnt = new_hit_cnt;
+
+  for (i = 0; i < len - 3; i++) {
+
+    /* Let's consult the effector map... */
+    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)] &&
+        !eff_map[EFF_APOS(i + 2)] && !eff_map[EFF_APOS(i + 3)]) {
+      stage_max--;
+      continue;
+    }
+
+    stage_cur_byte = i;
+
+    *(u32*)(out_buf + i) ^= 0xFFFFFFFF;
+
+    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+    stage_cur++;
+
+    *(u32*)(out_buf + i) ^= 0xFFFFFFFF;
+
+  }
+
+  new_hit_cnt = queued_paths + unique_crashes;
+
+  stage_finds[STAGE_FLIP32]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_FLIP32] += stage_max;
+
+skip_bitflip:
+
+  if (no_arith) goto skip_arith;
+
+  /**********************
+   * ARITHMETIC INC/DEC *
+   **********************/
+
+  /* 8-bit arithmetics. */
+
+  stage_name  = "arith 8/8";
+  stage_short = "arith8";
+  stage_cur   = 0;
+  stage_max   = 2 * len * ARITH_MAX;
+
+  stage_val_type = STAGE_VAL_LE;
+
+  orig_hit_cnt = new_hit_cnt;
+
+  for (i = 0; i < len; i++) {
+
+    u8 orig = out_buf[i];
+
+    /* Let's consult the effector map... */
+
+    if (!eff_map[EFF_APOS(i)]) {
+      stage_max -= 2 * ARITH_MAX;
+      continue;
+    }
+
+    stage_cur_byte = i;
+
+    for (j = 1; j <= ARITH_MAX; j++) {
+
+      u8 r = orig ^ (orig + j);
+
+      /* Do arithmetic operations only if the result couldn't be a product
+         of a bitflip. */
+
+      if (!could_be_bitflip(r)) {
+
+        stage_cur_val = j;
+        out_buf[i] = orig + j;
+
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
+
+      } else stage_max--;
+
+      r =  orig ^ (orig - j);
+
+      if (!could_be_bitflip(r)) {
+
+        stage_cur_val = -j;
+        out_buf[i] = orig - j;
+
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
+
+      } else stage_max--;
+
+      out_buf[i] = orig;
+
+    }
+
+  }
+
+  new_hit_cnt = queued_paths + unique_crashes;
+
+  stage_finds[STAGE_ARITH8]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_ARITH8] += stage_max;
+
+  /* 16-bit arithmetics, both endians. */
+
+  if (len < 2) goto skip_arith;
+
+  stage_name  = "arith 16/8";
+  stage_short = "arith16";
+  stage_cur   = 0;
+  stage_max   = 4 * (len - 1) * ARITH_MAX;
+
+  orig_hit_cnt = new_hit_cnt;
+
+  for (i = 0; i < len - 1; i++) {
+
+    u16 orig = *(u16*)(out_buf + i);
+
+    /* Let's consult the effector map... */
+
+    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)]) {
+      stage_max -= 4 * ARITH_MAX;
+      continue;
+    }
+
+    stage_cur_byte = i;
+
+    for (j = 1; j <= ARITH_MAX; j++) {
+
+      u16 r1 = orig ^ (orig + j),
+          r2 = orig ^ (orig - j),
+          r3 = orig ^ SWAP16(SWAP16(orig) + j),
+          r4 = orig ^ SWAP16(SWAP16(orig) - j);
+
+      /* Try little endian addition and subtraction first. Do it only
+         if the operation would affect more than one byte (hence the
+         & 0xff overflow checks) and if it couldn't be a product of
+         a bitflip. */
+
+      stage_val_type = STAGE_VAL_LE;
+
+      if ((orig & 0xff) + j > 0xff && !could_be_bitflip(r1)) {
+
+        stage_cur_val = j;
+        *(u16*)(out_buf + i) = orig + j;
+
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
+
+      } else stage_max--;
+
+      if ((orig & 0xff) < j && !could_be_bitflip(r2)) {
+
+        stage_cur_val = -j;
+        *(u16*)(out_buf + i) = orig - j;
+
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
+
+      } else stage_max--;
+
+      /* Big endian comes next. Same deal. */
+
+      stage_val_type = STAGE_VAL_BE;
+
 
-    }
+      if ((orig >> 8) + j > 0xff && !could_be_bitflip(r3)) {
 
-    out_buf[stage_cur] ^= 0xFF;
+        stage_cur_val = j;
+        *(u16*)(out_buf + i) = SWAP16(SWAP16(orig) + j);
 
-  }
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
 
-  /* If the effector map is more than EFF_MAX_PERC dense, just flag the
-     whole thing as worth fuzzing, since we wouldn't be saving much time
-     anyway. */
+      } else stage_max--;
 
-  if (eff_cnt != EFF_ALEN(len) &&
-      eff_cnt * 100 / EFF_ALEN(len) > EFF_MAX_PERC) {
+      if ((orig >> 8) < j && !could_be_bitflip(r4)) {
 
-    memset(eff_map, 1, EFF_ALEN(len));
+        stage_cur_val = -j;
+        *(u16*)(out_buf + i) = SWAP16(SWAP16(orig) - j);
 
-    blocks_eff_select += EFF_ALEN(len);
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
 
-  } else {
+      } else stage_max--;
 
-    blocks_eff_select += eff_cnt;
+      *(u16*)(out_buf + i) = orig;
 
-  }
+    }
 
-  blocks_eff_total += EFF_ALEN(len);
+  }
 
   new_hit_cnt = queued_paths + unique_crashes;
 
-  stage_finds[STAGE_FLIP8]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_FLIP8] += stage_max;
+  stage_finds[STAGE_ARITH16]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_ARITH16] += stage_max;
 
-  /* Two walking bytes. */
+  /* 32-bit arithmetics, both endians. */
 
-  if (len < 2) goto skip_bitflip;
+  if (len < 4) goto skip_arith;
 
-  stage_name  = "bitflip 16/8";
-  stage_short = "flip16";
+  stage_name  = "arith 32/8";
+  stage_short = "arith32";
   stage_cur   = 0;
-  stage_max   = len - 1;
+  stage_max   = 4 * (len - 3) * ARITH_MAX;
 
   orig_hit_cnt = new_hit_cnt;
 
-  for (i = 0; i < len - 1; i++) {
+  for (i = 0; i < len - 3; i++) {
+
+    u32 orig = *(u32*)(out_buf + i);
 
     /* Let's consult the effector map... */
 
-    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)]) {
-      stage_max--;
+    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)] &&
+        !eff_map[EFF_APOS(i + 2)] && !eff_map[EFF_APOS(i + 3)]) {
+      stage_max -= 4 * ARITH_MAX;
       continue;
     }
 
     stage_cur_byte = i;
 
-    *(u16*)(out_buf + i) ^= 0xFFFF;
+    for (j = 1; j <= ARITH_MAX; j++) {
 
-    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-    stage_cur++;
+      u32 r1 = orig ^ (orig + j),
+          r2 = orig ^ (orig - j),
+          r3 = orig ^ SWAP32(SWAP32(orig) + j),
+          r4 = orig ^ SWAP32(SWAP32(orig) - j);
 
-    *(u16*)(out_buf + i) ^= 0xFFFF;
+      /* Little endian first. Same deal as with 16-bit: we only want to
+         try if the operation would have effect on more than two bytes. */
 
+      stage_val_type = STAGE_VAL_LE;
 
-  }
+      if ((orig & 0xffff) + j > 0xffff && !could_be_bitflip(r1)) {
 
-  new_hit_cnt = queued_paths + unique_crashes;
+        stage_cur_val = j;
+        *(u32*)(out_buf + i) = orig + j;
 
-  stage_finds[STAGE_FLIP16]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_FLIP16] += stage_max;
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
 
-  if (len < 4) goto skip_bitflip;
+      } else stage_max--;
 
-  /* Four walking bytes. */
+      if ((orig & 0xffff) < j && !could_be_bitflip(r2)) {
 
-  stage_name  = "bitflip 32/8";
-  stage_short = "flip32";
-  stage_cur   = 0;
-  stage_max   = len - 3;
+        stage_cur_val = -j;
+        *(u32*)(out_buf + i) = orig - j;
 
-  orig_hit_cnt = new_hit_cnt;
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
 
-  for (i = 0; i < len - 3; i++) {
+      } else stage_max--;
 
-    /* Let's consult the effector map... */
-    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)] &&
-        !eff_map[EFF_APOS(i + 2)] && !eff_map[EFF_APOS(i + 3)]) {
-      stage_max--;
-      continue;
-    }
+      /* Big endian next. */
 
-    stage_cur_byte = i;
+      stage_val_type = STAGE_VAL_BE;
 
-    *(u32*)(out_buf + i) ^= 0xFFFFFFFF;
+      if ((SWAP32(orig) & 0xffff) + j > 0xffff && !could_be_bitflip(r3)) {
 
-    if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-    stage_cur++;
+        stage_cur_val = j;
+        *(u32*)(out_buf + i) = SWAP32(SWAP32(orig) + j);
 
-    *(u32*)(out_buf + i) ^= 0xFFFFFFFF;
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
+
+      } else stage_max--;
+
+      if ((SWAP32(orig) & 0xffff) < j && !could_be_bitflip(r4)) {
+
+        stage_cur_val = -j;
+        *(u32*)(out_buf + i) = SWAP32(SWAP32(orig) - j);
+
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
+
+      } else stage_max--;
+
+      *(u32*)(out_buf + i) = orig;
+
+    }
 
   }
 
   new_hit_cnt = queued_paths + unique_crashes;
 
-  stage_finds[STAGE_FLIP32]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_FLIP32] += stage_max;
-
-skip_bitflip:
+  stage_finds[STAGE_ARITH32]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_ARITH32] += stage_max;
 
-  if (no_arith) goto skip_arith;
+skip_arith:
 
   /**********************
-   * ARITHMETIC INC/DEC *
+   * INTERESTING VALUES *
    **********************/
 
-  /* 8-bit arithmetics. */
-
-  stage_name  = "arith 8/8";
-  stage_short = "arith8";
+  stage_name  = "interest 8/8";
+  stage_short = "int8";
   stage_cur   = 0;
-  stage_max   = 2 * len * ARITH_MAX;
+  stage_max   = len * sizeof(interesting_8);
 
   stage_val_type = STAGE_VAL_LE;
 
   orig_hit_cnt = new_hit_cnt;
 
+  /* Setting 8-bit integers. */
+
   for (i = 0; i < len; i++) {
 
     u8 orig = out_buf[i];
@@ -5762,42 +9061,29 @@ skip_bitflip:
     /* Let's consult the effector map... */
 
     if (!eff_map[EFF_APOS(i)]) {
-      stage_max -= 2 * ARITH_MAX;
+      stage_max -= sizeof(interesting_8);
       continue;
     }
 
     stage_cur_byte = i;
 
-    for (j = 1; j <= ARITH_MAX; j++) {
-
-      u8 r = orig ^ (orig + j);
-
-      /* Do arithmetic operations only if the result couldn't be a product
-         of a bitflip. */
-
-      if (!could_be_bitflip(r)) {
-
-        stage_cur_val = j;
-        out_buf[i] = orig + j;
-
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
-
-      } else stage_max--;
-
-      r =  orig ^ (orig - j);
+    for (j = 0; j < sizeof(interesting_8); j++) {
 
-      if (!could_be_bitflip(r)) {
+      /* Skip if the value could be a product of bitflips or arithmetics. */
 
-        stage_cur_val = -j;
-        out_buf[i] = orig - j;
+      if (could_be_bitflip(orig ^ (u8)interesting_8[j]) ||
+          could_be_arith(orig, (u8)interesting_8[j], 1)) {
+        stage_max--;
+        continue;
+      }
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+      stage_cur_val = interesting_8[j];
+      out_buf[i] = interesting_8[j];
 
-      } else stage_max--;
+      if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
 
       out_buf[i] = orig;
+      stage_cur++;
 
     }
 
@@ -5805,17 +9091,17 @@ skip_bitflip:
 
   new_hit_cnt = queued_paths + unique_crashes;
 
-  stage_finds[STAGE_ARITH8]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_ARITH8] += stage_max;
+  stage_finds[STAGE_INTEREST8]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_INTEREST8] += stage_max;
 
-  /* 16-bit arithmetics, both endians. */
+  /* Setting 16-bit integers, both endians. */
 
-  if (len < 2) goto skip_arith;
+  if (no_arith || len < 2) goto skip_interest;
 
-  stage_name  = "arith 16/8";
-  stage_short = "arith16";
+  stage_name  = "interest 16/8";
+  stage_short = "int16";
   stage_cur   = 0;
-  stage_max   = 4 * (len - 1) * ARITH_MAX;
+  stage_max   = 2 * (len - 1) * (sizeof(interesting_16) >> 1);
 
   orig_hit_cnt = new_hit_cnt;
 
@@ -5826,1130 +9112,1193 @@ skip_bitflip:
     /* Let's consult the effector map... */
 
     if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)]) {
-      stage_max -= 4 * ARITH_MAX;
+      stage_max -= sizeof(interesting_16);
       continue;
     }
 
     stage_cur_byte = i;
 
-    for (j = 1; j <= ARITH_MAX; j++) {
+    for (j = 0; j < sizeof(interesting_16) / 2; j++) {
 
-      u16 r1 = orig ^ (orig + j),
-          r2 = orig ^ (orig - j),
-          r3 = orig ^ SWAP16(SWAP16(orig) + j),
-          r4 = orig ^ SWAP16(SWAP16(orig) - j);
+      stage_cur_val = interesting_16[j];
 
-      /* Try little endian addition and subtraction first. Do it only
-         if the operation would affect more than one byte (hence the
-         & 0xff overflow checks) and if it couldn't be a product of
-         a bitflip. */
+      /* Skip if this could be a product of a bitflip, arithmetics,
+         or single-byte interesting value insertion. */
 
-      stage_val_type = STAGE_VAL_LE;
+      if (!could_be_bitflip(orig ^ (u16)interesting_16[j]) &&
+          !could_be_arith(orig, (u16)interesting_16[j], 2) &&
+          !could_be_interest(orig, (u16)interesting_16[j], 2, 0)) {
 
-      if ((orig & 0xff) + j > 0xff && !could_be_bitflip(r1)) {
+        stage_val_type = STAGE_VAL_LE;
+
+        *(u16*)(out_buf + i) = interesting_16[j];
+
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
+
+      } else stage_max--;
+
+      if ((u16)interesting_16[j] != SWAP16(interesting_16[j]) &&
+          !could_be_bitflip(orig ^ SWAP16(interesting_16[j])) &&
+          !could_be_arith(orig, SWAP16(interesting_16[j]), 2) &&
+          !could_be_interest(orig, SWAP16(interesting_16[j]), 2, 1)) {
+
+        stage_val_type = STAGE_VAL_BE;
+
+        *(u16*)(out_buf + i) = SWAP16(interesting_16[j]);
+        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+        stage_cur++;
+
+      } else stage_max--;
+
+    }
+
+    *(u16*)(out_buf + i) = orig;
+
+  }
+
+  new_hit_cnt = queued_paths + unique_crashes;
+
+  stage_finds[STAGE_INTEREST16]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_INTEREST16] += stage_max;
+
+  if (len < 4) goto skip_interest;
+
+  /* Setting 32-bit integers, both endians. */
+
+  stage_name  = "interest 32/8";
+  stage_short = "int32";
+  stage_cur   = 0;
+  stage_max   = 2 * (len - 3) * (sizeof(interesting_32) >> 2);
 
-        stage_cur_val = j;
-        *(u16*)(out_buf + i) = orig + j;
+  orig_hit_cnt = new_hit_cnt;
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+  for (i = 0; i < len - 3; i++) {
 
-      } else stage_max--;
+    u32 orig = *(u32*)(out_buf + i);
 
-      if ((orig & 0xff) < j && !could_be_bitflip(r2)) {
+    /* Let's consult the effector map... */
 
-        stage_cur_val = -j;
-        *(u16*)(out_buf + i) = orig - j;
+    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)] &&
+        !eff_map[EFF_APOS(i + 2)] && !eff_map[EFF_APOS(i + 3)]) {
+      stage_max -= sizeof(interesting_32) >> 1;
+      continue;
+    }
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+    stage_cur_byte = i;
 
-      } else stage_max--;
+    for (j = 0; j < sizeof(interesting_32) / 4; j++) {
 
-      /* Big endian comes next. Same deal. */
+      stage_cur_val = interesting_32[j];
 
-      stage_val_type = STAGE_VAL_BE;
+      /* Skip if this could be a product of a bitflip, arithmetics,
+         or word interesting value insertion. */
 
+      if (!could_be_bitflip(orig ^ (u32)interesting_32[j]) &&
+          !could_be_arith(orig, interesting_32[j], 4) &&
+          !could_be_interest(orig, interesting_32[j], 4, 0)) {
 
-      if ((orig >> 8) + j > 0xff && !could_be_bitflip(r3)) {
+        stage_val_type = STAGE_VAL_LE;
 
-        stage_cur_val = j;
-        *(u16*)(out_buf + i) = SWAP16(SWAP16(orig) + j);
+        *(u32*)(out_buf + i) = interesting_32[j];
 
         if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
         stage_cur++;
 
       } else stage_max--;
 
-      if ((orig >> 8) < j && !could_be_bitflip(r4)) {
+      if ((u32)interesting_32[j] != SWAP32(interesting_32[j]) &&
+          !could_be_bitflip(orig ^ SWAP32(interesting_32[j])) &&
+          !could_be_arith(orig, SWAP32(interesting_32[j]), 4) &&
+          !could_be_interest(orig, SWAP32(interesting_32[j]), 4, 1)) {
 
-        stage_cur_val = -j;
-        *(u16*)(out_buf + i) = SWAP16(SWAP16(orig) - j);
+        stage_val_type = STAGE_VAL_BE;
 
+        *(u32*)(out_buf + i) = SWAP32(interesting_32[j]);
         if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
         stage_cur++;
 
       } else stage_max--;
 
-      *(u16*)(out_buf + i) = orig;
-
     }
 
+    *(u32*)(out_buf + i) = orig;
+
   }
 
   new_hit_cnt = queued_paths + unique_crashes;
 
-  stage_finds[STAGE_ARITH16]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_ARITH16] += stage_max;
+  stage_finds[STAGE_INTEREST32]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_INTEREST32] += stage_max;
 
-  /* 32-bit arithmetics, both endians. */
+skip_interest:
 
-  if (len < 4) goto skip_arith;
+  /********************
+   * DICTIONARY STUFF *
+   ********************/
 
-  stage_name  = "arith 32/8";
-  stage_short = "arith32";
+  if (!extras_cnt) goto skip_user_extras;
+
+  /* Overwrite with user-supplied extras. */
+
+  stage_name  = "user extras (over)";
+  stage_short = "ext_UO";
   stage_cur   = 0;
-  stage_max   = 4 * (len - 3) * ARITH_MAX;
+  stage_max   = extras_cnt * len;
+
+  stage_val_type = STAGE_VAL_NONE;
 
   orig_hit_cnt = new_hit_cnt;
 
-  for (i = 0; i < len - 3; i++) {
+  for (i = 0; i < len; i++) {
 
-    u32 orig = *(u32*)(out_buf + i);
+    u32 last_len = 0;
 
-    /* Let's consult the effector map... */
+    stage_cur_byte = i;
 
-    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)] &&
-        !eff_map[EFF_APOS(i + 2)] && !eff_map[EFF_APOS(i + 3)]) {
-      stage_max -= 4 * ARITH_MAX;
-      continue;
-    }
+    /* Extras are sorted by size, from smallest to largest. This means
+       that we don't have to worry about restoring the buffer in
+       between writes at a particular offset determined by the outer
+       loop. */
 
-    stage_cur_byte = i;
+    for (j = 0; j < extras_cnt; j++) {
 
-    for (j = 1; j <= ARITH_MAX; j++) {
+      /* Skip extras probabilistically if extras_cnt > MAX_DET_EXTRAS. Also
+         skip them if there's no room to insert the payload, if the token
+         is redundant, or if its entire span has no bytes set in the effector
+         map. */
 
-      u32 r1 = orig ^ (orig + j),
-          r2 = orig ^ (orig - j),
-          r3 = orig ^ SWAP32(SWAP32(orig) + j),
-          r4 = orig ^ SWAP32(SWAP32(orig) - j);
+      if ((extras_cnt > MAX_DET_EXTRAS && UR(extras_cnt) >= MAX_DET_EXTRAS) ||
+          extras[j].len > len - i ||
+          !memcmp(extras[j].data, out_buf + i, extras[j].len) ||
+          !memchr(eff_map + EFF_APOS(i), 1, EFF_SPAN_ALEN(i, extras[j].len))) {
 
-      /* Little endian first. Same deal as with 16-bit: we only want to
-         try if the operation would have effect on more than two bytes. */
+        stage_max--;
+        continue;
 
-      stage_val_type = STAGE_VAL_LE;
+      }
 
-      if ((orig & 0xffff) + j > 0xffff && !could_be_bitflip(r1)) {
+      last_len = extras[j].len;
+      memcpy(out_buf + i, extras[j].data, last_len);
 
-        stage_cur_val = j;
-        *(u32*)(out_buf + i) = orig + j;
+      if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+      stage_cur++;
 
-      } else stage_max--;
+    }
 
-      if ((orig & 0xffff) < j && !could_be_bitflip(r2)) {
+    /* Restore all the clobbered memory. */
+    memcpy(out_buf + i, in_buf + i, last_len);
 
-        stage_cur_val = -j;
-        *(u32*)(out_buf + i) = orig - j;
+  }
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+  new_hit_cnt = queued_paths + unique_crashes;
 
-      } else stage_max--;
+  stage_finds[STAGE_EXTRAS_UO]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_EXTRAS_UO] += stage_max;
 
-      /* Big endian next. */
+  /* Insertion of user-supplied extras. */
 
-      stage_val_type = STAGE_VAL_BE;
+  stage_name  = "user extras (insert)";
+  stage_short = "ext_UI";
+  stage_cur   = 0;
+  stage_max   = extras_cnt * len;
 
-      if ((SWAP32(orig) & 0xffff) + j > 0xffff && !could_be_bitflip(r3)) {
+  orig_hit_cnt = new_hit_cnt;
 
-        stage_cur_val = j;
-        *(u32*)(out_buf + i) = SWAP32(SWAP32(orig) + j);
+  ex_tmp = ck_alloc(len + MAX_DICT_FILE);
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+  for (i = 0; i <= len; i++) {
 
-      } else stage_max--;
+    stage_cur_byte = i;
 
-      if ((SWAP32(orig) & 0xffff) < j && !could_be_bitflip(r4)) {
+    for (j = 0; j < extras_cnt; j++) {
 
-        stage_cur_val = -j;
-        *(u32*)(out_buf + i) = SWAP32(SWAP32(orig) - j);
+      if (len + extras[j].len > MAX_FILE) {
+        stage_max--;
+        continue;
+      }
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+      /* Insert token */
+      memcpy(ex_tmp + i, extras[j].data, extras[j].len);
 
-      } else stage_max--;
+      /* Copy tail */
+      memcpy(ex_tmp + i + extras[j].len, out_buf + i, len - i);
 
-      *(u32*)(out_buf + i) = orig;
+      if (common_fuzz_stuff(argv, ex_tmp, len + extras[j].len)) {
+        ck_free(ex_tmp);
+        goto abandon_entry;
+      }
+
+      stage_cur++;
 
     }
 
+    /* Copy head */
+    ex_tmp[i] = out_buf[i];
+
   }
 
+  ck_free(ex_tmp);
+
   new_hit_cnt = queued_paths + unique_crashes;
 
-  stage_finds[STAGE_ARITH32]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_ARITH32] += stage_max;
+  stage_finds[STAGE_EXTRAS_UI]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_EXTRAS_UI] += stage_max;
 
-skip_arith:
+skip_user_extras:
 
-  /**********************
-   * INTERESTING VALUES *
-   **********************/
+  if (!a_extras_cnt) goto skip_extras;
 
-  stage_name  = "interest 8/8";
-  stage_short = "int8";
+  stage_name  = "auto extras (over)";
+  stage_short = "ext_AO";
   stage_cur   = 0;
-  stage_max   = len * sizeof(interesting_8);
+  stage_max   = MIN(a_extras_cnt, USE_AUTO_EXTRAS) * len;
 
-  stage_val_type = STAGE_VAL_LE;
+  stage_val_type = STAGE_VAL_NONE;
 
   orig_hit_cnt = new_hit_cnt;
 
-  /* Setting 8-bit integers. */
-
   for (i = 0; i < len; i++) {
 
-    u8 orig = out_buf[i];
-
-    /* Let's consult the effector map... */
-
-    if (!eff_map[EFF_APOS(i)]) {
-      stage_max -= sizeof(interesting_8);
-      continue;
-    }
+    u32 last_len = 0;
 
     stage_cur_byte = i;
 
-    for (j = 0; j < sizeof(interesting_8); j++) {
+    for (j = 0; j < MIN(a_extras_cnt, USE_AUTO_EXTRAS); j++) {
 
-      /* Skip if the value could be a product of bitflips or arithmetics. */
+      /* See the comment in the earlier code; extras are sorted by size. */
+
+      if (a_extras[j].len > len - i ||
+          !memcmp(a_extras[j].data, out_buf + i, a_extras[j].len) ||
+          !memchr(eff_map + EFF_APOS(i), 1, EFF_SPAN_ALEN(i, a_extras[j].len))) {
 
-      if (could_be_bitflip(orig ^ (u8)interesting_8[j]) ||
-          could_be_arith(orig, (u8)interesting_8[j], 1)) {
         stage_max--;
         continue;
+
       }
 
-      stage_cur_val = interesting_8[j];
-      out_buf[i] = interesting_8[j];
+      last_len = a_extras[j].len;
+      memcpy(out_buf + i, a_extras[j].data, last_len);
 
       if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
 
-      out_buf[i] = orig;
       stage_cur++;
 
     }
 
+    /* Restore all the clobbered memory. */
+    memcpy(out_buf + i, in_buf + i, last_len);
+
   }
 
   new_hit_cnt = queued_paths + unique_crashes;
 
-  stage_finds[STAGE_INTEREST8]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_INTEREST8] += stage_max;
-
-  /* Setting 16-bit integers, both endians. */
+  stage_finds[STAGE_EXTRAS_AO]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_EXTRAS_AO] += stage_max;
 
-  if (no_arith || len < 2) goto skip_interest;
+skip_extras:
 
-  stage_name  = "interest 16/8";
-  stage_short = "int16";
-  stage_cur   = 0;
-  stage_max   = 2 * (len - 1) * (sizeof(interesting_16) >> 1);
+  /* If we made this to here without jumping to havoc_stage or abandon_entry,
+     we're properly done with deterministic steps and can mark it as such
+     in the .state/ directory. */
 
-  orig_hit_cnt = new_hit_cnt;
+  if (!queue_cur->passed_det) mark_as_det_done(queue_cur);
 
-  for (i = 0; i < len - 1; i++) {
+  /****************
+   * RANDOM HAVOC *
+   ****************/
 
-    u16 orig = *(u16*)(out_buf + i);
+havoc_stage:
 
-    /* Let's consult the effector map... */
+  stage_cur_byte = -1;
 
-    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)]) {
-      stage_max -= sizeof(interesting_16);
-      continue;
-    }
+  /* The havoc stage mutation code is also invoked when splicing files; if the
+     splice_cycle variable is set, generate different descriptions and such. */
 
-    stage_cur_byte = i;
+  if (!splice_cycle) {
 
-    for (j = 0; j < sizeof(interesting_16) / 2; j++) {
+    /* Adjust perf_score with the factor derived from the proximity score */
+    u64 prox_score = queue_cur->prox_score;
+    perf_score = (u32) (calculate_factor(prox_score) * (double) perf_score);
 
-      stage_cur_val = interesting_16[j];
+    stage_name  = "havoc";
+    stage_short = "havoc";
+    stage_max   = (doing_det ? HAVOC_CYCLES_INIT : HAVOC_CYCLES) *
+                  perf_score / havoc_div / 100;
 
-      /* Skip if this could be a product of a bitflip, arithmetics,
-         or single-byte interesting value insertion. */
 
-      if (!could_be_bitflip(orig ^ (u16)interesting_16[j]) &&
-          !could_be_arith(orig, (u16)interesting_16[j], 2) &&
-          !could_be_interest(orig, (u16)interesting_16[j], 2, 0)) {
+  } else {
 
-        stage_val_type = STAGE_VAL_LE;
+    static u8 tmp[32];
+   
+    perf_score = orig_perf;
 
-        *(u16*)(out_buf + i) = interesting_16[j];
+     /* Adjust perf_score with the factor derived from the proximity score */
+    u64 prox_score = (queue_cur->prox_score + target->prox_score) / 2;
+    perf_score = (u32) (calculate_factor(prox_score) * (double) perf_score);
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+    sprintf(tmp, "splice %u", splice_cycle);
+    stage_name  = tmp;
+    stage_short = "splice";
+    stage_max   = SPLICE_HAVOC * perf_score / havoc_div / 100;
 
-      } else stage_max--;
+  }
 
-      if ((u16)interesting_16[j] != SWAP16(interesting_16[j]) &&
-          !could_be_bitflip(orig ^ SWAP16(interesting_16[j])) &&
-          !could_be_arith(orig, SWAP16(interesting_16[j]), 2) &&
-          !could_be_interest(orig, SWAP16(interesting_16[j]), 2, 1)) {
+  if (stage_max < HAVOC_MIN) stage_max = HAVOC_MIN;
 
-        stage_val_type = STAGE_VAL_BE;
+  temp_len = len;
 
-        *(u16*)(out_buf + i) = SWAP16(interesting_16[j]);
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+  orig_hit_cnt = queued_paths + unique_crashes;
 
-      } else stage_max--;
+  havoc_queued = queued_paths;
 
-    }
+  /* We essentially just do several thousand runs (depending on perf_score)
+     where we take the input file and make random stacked tweaks. */
 
-    *(u16*)(out_buf + i) = orig;
+  for (stage_cur = 0; stage_cur < stage_max; stage_cur++) {
 
-  }
+    u32 use_stacking = 1 << (1 + UR(HAVOC_STACK_POW2));
 
-  new_hit_cnt = queued_paths + unique_crashes;
+    stage_cur_val = use_stacking;
 
-  stage_finds[STAGE_INTEREST16]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_INTEREST16] += stage_max;
+    for (i = 0; i < use_stacking; i++) {
 
-  if (len < 4) goto skip_interest;
+      switch (UR(15 + ((extras_cnt + a_extras_cnt) ? 2 : 0))) {
 
-  /* Setting 32-bit integers, both endians. */
+        case 0:
 
-  stage_name  = "interest 32/8";
-  stage_short = "int32";
-  stage_cur   = 0;
-  stage_max   = 2 * (len - 3) * (sizeof(interesting_32) >> 2);
+          /* Flip a single bit somewhere. Spooky! */
 
-  orig_hit_cnt = new_hit_cnt;
+          FLIP_BIT(out_buf, UR(temp_len << 3));
+          break;
 
-  for (i = 0; i < len - 3; i++) {
+        case 1:
 
-    u32 orig = *(u32*)(out_buf + i);
+          /* Set byte to interesting value. */
 
-    /* Let's consult the effector map... */
+          out_buf[UR(temp_len)] = interesting_8[UR(sizeof(interesting_8))];
+          break;
 
-    if (!eff_map[EFF_APOS(i)] && !eff_map[EFF_APOS(i + 1)] &&
-        !eff_map[EFF_APOS(i + 2)] && !eff_map[EFF_APOS(i + 3)]) {
-      stage_max -= sizeof(interesting_32) >> 1;
-      continue;
-    }
+        case 2:
 
-    stage_cur_byte = i;
+          /* Set word to interesting value, randomly choosing endian. */
 
-    for (j = 0; j < sizeof(interesting_32) / 4; j++) {
+          if (temp_len < 2) break;
 
-      stage_cur_val = interesting_32[j];
+          if (UR(2)) {
 
-      /* Skip if this could be a product of a bitflip, arithmetics,
-         or word interesting value insertion. */
+            *(u16*)(out_buf + UR(temp_len - 1)) =
+              interesting_16[UR(sizeof(interesting_16) >> 1)];
 
-      if (!could_be_bitflip(orig ^ (u32)interesting_32[j]) &&
-          !could_be_arith(orig, interesting_32[j], 4) &&
-          !could_be_interest(orig, interesting_32[j], 4, 0)) {
+          } else {
 
-        stage_val_type = STAGE_VAL_LE;
+            *(u16*)(out_buf + UR(temp_len - 1)) = SWAP16(
+              interesting_16[UR(sizeof(interesting_16) >> 1)]);
 
-        *(u32*)(out_buf + i) = interesting_32[j];
+          }
 
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+          break;
 
-      } else stage_max--;
+        case 3:
 
-      if ((u32)interesting_32[j] != SWAP32(interesting_32[j]) &&
-          !could_be_bitflip(orig ^ SWAP32(interesting_32[j])) &&
-          !could_be_arith(orig, SWAP32(interesting_32[j]), 4) &&
-          !could_be_interest(orig, SWAP32(interesting_32[j]), 4, 1)) {
+          /* Set dword to interesting value, randomly choosing endian. */
 
-        stage_val_type = STAGE_VAL_BE;
+          if (temp_len < 4) break;
 
-        *(u32*)(out_buf + i) = SWAP32(interesting_32[j]);
-        if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
-        stage_cur++;
+          if (UR(2)) {
 
-      } else stage_max--;
+            *(u32*)(out_buf + UR(temp_len - 3)) =
+              interesting_32[UR(sizeof(interesting_32) >> 2)];
 
-    }
+          } else {
 
-    *(u32*)(out_buf + i) = orig;
+            *(u32*)(out_buf + UR(temp_len - 3)) = SWAP32(
+              interesting_32[UR(sizeof(interesting_32) >> 2)]);
 
-  }
+          }
 
-  new_hit_cnt = queued_paths + unique_crashes;
+          break;
 
-  stage_finds[STAGE_INTEREST32]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_INTEREST32] += stage_max;
+        case 4:
 
-skip_interest:
+          /* Randomly subtract from byte. */
 
-  /********************
-   * DICTIONARY STUFF *
-   ********************/
+          out_buf[UR(temp_len)] -= 1 + UR(ARITH_MAX);
+          break;
 
-  if (!extras_cnt) goto skip_user_extras;
+        case 5:
 
-  /* Overwrite with user-supplied extras. */
+          /* Randomly add to byte. */
 
-  stage_name  = "user extras (over)";
-  stage_short = "ext_UO";
-  stage_cur   = 0;
-  stage_max   = extras_cnt * len;
+          out_buf[UR(temp_len)] += 1 + UR(ARITH_MAX);
+          break;
 
-  stage_val_type = STAGE_VAL_NONE;
+        case 6:
 
-  orig_hit_cnt = new_hit_cnt;
+          /* Randomly subtract from word, random endian. */
 
-  for (i = 0; i < len; i++) {
+          if (temp_len < 2) break;
 
-    u32 last_len = 0;
+          if (UR(2)) {
 
-    stage_cur_byte = i;
+            u32 pos = UR(temp_len - 1);
 
-    /* Extras are sorted by size, from smallest to largest. This means
-       that we don't have to worry about restoring the buffer in
-       between writes at a particular offset determined by the outer
-       loop. */
+            *(u16*)(out_buf + pos) -= 1 + UR(ARITH_MAX);
 
-    for (j = 0; j < extras_cnt; j++) {
+          } else {
 
-      /* Skip extras probabilistically if extras_cnt > MAX_DET_EXTRAS. Also
-         skip them if there's no room to insert the payload, if the token
-         is redundant, or if its entire span has no bytes set in the effector
-         map. */
+            u32 pos = UR(temp_len - 1);
+            u16 num = 1 + UR(ARITH_MAX);
 
-      if ((extras_cnt > MAX_DET_EXTRAS && UR(extras_cnt) >= MAX_DET_EXTRAS) ||
-          extras[j].len > len - i ||
-          !memcmp(extras[j].data, out_buf + i, extras[j].len) ||
-          !memchr(eff_map + EFF_APOS(i), 1, EFF_SPAN_ALEN(i, extras[j].len))) {
+            *(u16*)(out_buf + pos) =
+              SWAP16(SWAP16(*(u16*)(out_buf + pos)) - num);
 
-        stage_max--;
-        continue;
+          }
 
-      }
+          break;
 
-      last_len = extras[j].len;
-      memcpy(out_buf + i, extras[j].data, last_len);
+        case 7:
 
-      if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+          /* Randomly add to word, random endian. */
 
-      stage_cur++;
+          if (temp_len < 2) break;
 
-    }
+          if (UR(2)) {
 
-    /* Restore all the clobbered memory. */
-    memcpy(out_buf + i, in_buf + i, last_len);
+            u32 pos = UR(temp_len - 1);
 
-  }
+            *(u16*)(out_buf + pos) += 1 + UR(ARITH_MAX);
 
-  new_hit_cnt = queued_paths + unique_crashes;
+          } else {
 
-  stage_finds[STAGE_EXTRAS_UO]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_EXTRAS_UO] += stage_max;
+            u32 pos = UR(temp_len - 1);
+            u16 num = 1 + UR(ARITH_MAX);
 
-  /* Insertion of user-supplied extras. */
+            *(u16*)(out_buf + pos) =
+              SWAP16(SWAP16(*(u16*)(out_buf + pos)) + num);
 
-  stage_name  = "user extras (insert)";
-  stage_short = "ext_UI";
-  stage_cur   = 0;
-  stage_max   = extras_cnt * len;
+          }
 
-  orig_hit_cnt = new_hit_cnt;
+          break;
 
-  ex_tmp = ck_alloc(len + MAX_DICT_FILE);
+        case 8:
 
-  for (i = 0; i <= len; i++) {
+          /* Randomly subtract from dword, random endian. */
 
-    stage_cur_byte = i;
+          if (temp_len < 4) break;
 
-    for (j = 0; j < extras_cnt; j++) {
+          if (UR(2)) {
 
-      if (len + extras[j].len > MAX_FILE) {
-        stage_max--;
-        continue;
-      }
+            u32 pos = UR(temp_len - 3);
 
-      /* Insert token */
-      memcpy(ex_tmp + i, extras[j].data, extras[j].len);
+            *(u32*)(out_buf + pos) -= 1 + UR(ARITH_MAX);
 
-      /* Copy tail */
-      memcpy(ex_tmp + i + extras[j].len, out_buf + i, len - i);
+          } else {
 
-      if (common_fuzz_stuff(argv, ex_tmp, len + extras[j].len)) {
-        ck_free(ex_tmp);
-        goto abandon_entry;
-      }
+            u32 pos = UR(temp_len - 3);
+            u32 num = 1 + UR(ARITH_MAX);
 
-      stage_cur++;
+            *(u32*)(out_buf + pos) =
+              SWAP32(SWAP32(*(u32*)(out_buf + pos)) - num);
 
-    }
+          }
 
-    /* Copy head */
-    ex_tmp[i] = out_buf[i];
+          break;
 
-  }
+        case 9:
 
-  ck_free(ex_tmp);
+          /* Randomly add to dword, random endian. */
 
-  new_hit_cnt = queued_paths + unique_crashes;
+          if (temp_len < 4) break;
 
-  stage_finds[STAGE_EXTRAS_UI]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_EXTRAS_UI] += stage_max;
+          if (UR(2)) {
 
-skip_user_extras:
+            u32 pos = UR(temp_len - 3);
 
-  if (!a_extras_cnt) goto skip_extras;
+            *(u32*)(out_buf + pos) += 1 + UR(ARITH_MAX);
 
-  stage_name  = "auto extras (over)";
-  stage_short = "ext_AO";
-  stage_cur   = 0;
-  stage_max   = MIN(a_extras_cnt, USE_AUTO_EXTRAS) * len;
+          } else {
 
-  stage_val_type = STAGE_VAL_NONE;
+            u32 pos = UR(temp_len - 3);
+            u32 num = 1 + UR(ARITH_MAX);
 
-  orig_hit_cnt = new_hit_cnt;
+            *(u32*)(out_buf + pos) =
+              SWAP32(SWAP32(*(u32*)(out_buf + pos)) + num);
 
-  for (i = 0; i < len; i++) {
+          }
 
-    u32 last_len = 0;
+          break;
 
-    stage_cur_byte = i;
+        case 10:
 
-    for (j = 0; j < MIN(a_extras_cnt, USE_AUTO_EXTRAS); j++) {
+          /* Just set a random byte to a random value. Because,
+             why not. We use XOR with 1-255 to eliminate the
+             possibility of a no-op. */
 
-      /* See the comment in the earlier code; extras are sorted by size. */
+          out_buf[UR(temp_len)] ^= 1 + UR(255);
+          break;
 
-      if (a_extras[j].len > len - i ||
-          !memcmp(a_extras[j].data, out_buf + i, a_extras[j].len) ||
-          !memchr(eff_map + EFF_APOS(i), 1, EFF_SPAN_ALEN(i, a_extras[j].len))) {
+        case 11 ... 12: {
 
-        stage_max--;
-        continue;
+            /* Delete bytes. We're making this a bit more likely
+               than insertion (the next option) in hopes of keeping
+               files reasonably small. */
 
-      }
+            u32 del_from, del_len;
 
-      last_len = a_extras[j].len;
-      memcpy(out_buf + i, a_extras[j].data, last_len);
+            if (temp_len < 2) break;
 
-      if (common_fuzz_stuff(argv, out_buf, len)) goto abandon_entry;
+            /* Don't delete too much. */
 
-      stage_cur++;
+            del_len = choose_block_len(temp_len - 1);
 
-    }
+            del_from = UR(temp_len - del_len + 1);
 
-    /* Restore all the clobbered memory. */
-    memcpy(out_buf + i, in_buf + i, last_len);
+            memmove(out_buf + del_from, out_buf + del_from + del_len,
+                    temp_len - del_from - del_len);
 
-  }
+            temp_len -= del_len;
 
-  new_hit_cnt = queued_paths + unique_crashes;
+            break;
 
-  stage_finds[STAGE_EXTRAS_AO]  += new_hit_cnt - orig_hit_cnt;
-  stage_cycles[STAGE_EXTRAS_AO] += stage_max;
+          }
 
-skip_extras:
+        case 13:
 
-  /* If we made this to here without jumping to havoc_stage or abandon_entry,
-     we're properly done with deterministic steps and can mark it as such
-     in the .state/ directory. */
+          if (temp_len + HAVOC_BLK_XL < MAX_FILE) {
 
-  if (!queue_cur->passed_det) mark_as_det_done(queue_cur);
+            /* Clone bytes (75%) or insert a block of constant bytes (25%). */
 
-  /****************
-   * RANDOM HAVOC *
-   ****************/
+            u8  actually_clone = UR(4);
+            u32 clone_from, clone_to, clone_len;
+            u8* new_buf;
 
-havoc_stage:
+            if (actually_clone) {
 
-  stage_cur_byte = -1;
+              clone_len  = choose_block_len(temp_len);
+              clone_from = UR(temp_len - clone_len + 1);
 
-  /* The havoc stage mutation code is also invoked when splicing files; if the
-     splice_cycle variable is set, generate different descriptions and such. */
+            } else {
 
-  if (!splice_cycle) {
+              clone_len = choose_block_len(HAVOC_BLK_XL);
+              clone_from = 0;
 
-    /* Adjust perf_score with the factor derived from the proximity score */
-    u64 prox_score = queue_cur->prox_score;
-    perf_score = (u32) (calculate_factor(prox_score) * (double) perf_score);
+            }
 
-    stage_name  = "havoc";
-    stage_short = "havoc";
-    stage_max   = (doing_det ? HAVOC_CYCLES_INIT : HAVOC_CYCLES) *
-                  perf_score / havoc_div / 100;
+            clone_to   = UR(temp_len);
 
+            new_buf = ck_alloc_nozero(temp_len + clone_len);
 
-  } else {
+            /* Head */
 
-    static u8 tmp[32];
-   
-    perf_score = orig_perf;
+            memcpy(new_buf, out_buf, clone_to);
 
-     /* Adjust perf_score with the factor derived from the proximity score */
-    u64 prox_score = (queue_cur->prox_score + target->prox_score) / 2;
-    perf_score = (u32) (calculate_factor(prox_score) * (double) perf_score);
+            /* Inserted part */
 
-    sprintf(tmp, "splice %u", splice_cycle);
-    stage_name  = tmp;
-    stage_short = "splice";
-    stage_max   = SPLICE_HAVOC * perf_score / havoc_div / 100;
+            if (actually_clone)
+              memcpy(new_buf + clone_to, out_buf + clone_from, clone_len);
+            else
+              memset(new_buf + clone_to,
+                     UR(2) ? UR(256) : out_buf[UR(temp_len)], clone_len);
 
-  }
+            /* Tail */
+            memcpy(new_buf + clone_to + clone_len, out_buf + clone_to,
+                   temp_len - clone_to);
 
-  if (stage_max < HAVOC_MIN) stage_max = HAVOC_MIN;
+            ck_free(out_buf);
+            out_buf = new_buf;
+            temp_len += clone_len;
 
-  temp_len = len;
+          }
 
-  orig_hit_cnt = queued_paths + unique_crashes;
+          break;
 
-  havoc_queued = queued_paths;
+        case 14: {
 
-  /* We essentially just do several thousand runs (depending on perf_score)
-     where we take the input file and make random stacked tweaks. */
+            /* Overwrite bytes with a randomly selected chunk (75%) or fixed
+               bytes (25%). */
 
-  for (stage_cur = 0; stage_cur < stage_max; stage_cur++) {
+            u32 copy_from, copy_to, copy_len;
 
-    u32 use_stacking = 1 << (1 + UR(HAVOC_STACK_POW2));
+            if (temp_len < 2) break;
 
-    stage_cur_val = use_stacking;
+            copy_len  = choose_block_len(temp_len - 1);
 
-    for (i = 0; i < use_stacking; i++) {
+            copy_from = UR(temp_len - copy_len + 1);
+            copy_to   = UR(temp_len - copy_len + 1);
 
-      switch (UR(15 + ((extras_cnt + a_extras_cnt) ? 2 : 0))) {
+            if (UR(4)) {
 
-        case 0:
+              if (copy_from != copy_to)
+                memmove(out_buf + copy_to, out_buf + copy_from, copy_len);
 
-          /* Flip a single bit somewhere. Spooky! */
+            } else memset(out_buf + copy_to,
+                          UR(2) ? UR(256) : out_buf[UR(temp_len)], copy_len);
 
-          FLIP_BIT(out_buf, UR(temp_len << 3));
-          break;
+            break;
 
-        case 1:
+          }
 
-          /* Set byte to interesting value. */
+        /* Values 15 and 16 can be selected only if there are any extras
+           present in the dictionaries. */
 
-          out_buf[UR(temp_len)] = interesting_8[UR(sizeof(interesting_8))];
-          break;
+        case 15: {
 
-        case 2:
+            /* Overwrite bytes with an extra. */
 
-          /* Set word to interesting value, randomly choosing endian. */
+            if (!extras_cnt || (a_extras_cnt && UR(2))) {
 
-          if (temp_len < 2) break;
+              /* No user-specified extras or odds in our favor. Let's use an
+                 auto-detected one. */
 
-          if (UR(2)) {
+              u32 use_extra = UR(a_extras_cnt);
+              u32 extra_len = a_extras[use_extra].len;
+              u32 insert_at;
 
-            *(u16*)(out_buf + UR(temp_len - 1)) =
-              interesting_16[UR(sizeof(interesting_16) >> 1)];
+              if (extra_len > temp_len) break;
 
-          } else {
+              insert_at = UR(temp_len - extra_len + 1);
+              memcpy(out_buf + insert_at, a_extras[use_extra].data, extra_len);
 
-            *(u16*)(out_buf + UR(temp_len - 1)) = SWAP16(
-              interesting_16[UR(sizeof(interesting_16) >> 1)]);
+            } else {
 
-          }
+              /* No auto extras or odds in our favor. Use the dictionary. */
 
-          break;
+              u32 use_extra = UR(extras_cnt);
+              u32 extra_len = extras[use_extra].len;
+              u32 insert_at;
 
-        case 3:
+              if (extra_len > temp_len) break;
 
-          /* Set dword to interesting value, randomly choosing endian. */
+              insert_at = UR(temp_len - extra_len + 1);
+              memcpy(out_buf + insert_at, extras[use_extra].data, extra_len);
 
-          if (temp_len < 4) break;
+            }
 
-          if (UR(2)) {
+            break;
 
-            *(u32*)(out_buf + UR(temp_len - 3)) =
-              interesting_32[UR(sizeof(interesting_32) >> 2)];
+          }
 
-          } else {
+        case 16: {
 
-            *(u32*)(out_buf + UR(temp_len - 3)) = SWAP32(
-              interesting_32[UR(sizeof(interesting_32) >> 2)]);
+            u32 use_extra, extra_len, insert_at = UR(temp_len + 1);
+            u8* new_buf;
 
-          }
+            /* Insert an extra. Do the same dice-rolling stuff as for the
+               previous case. */
 
-          break;
+            if (!extras_cnt || (a_extras_cnt && UR(2))) {
 
-        case 4:
+              use_extra = UR(a_extras_cnt);
+              extra_len = a_extras[use_extra].len;
 
-          /* Randomly subtract from byte. */
+              if (temp_len + extra_len >= MAX_FILE) break;
 
-          out_buf[UR(temp_len)] -= 1 + UR(ARITH_MAX);
-          break;
+              new_buf = ck_alloc_nozero(temp_len + extra_len);
 
-        case 5:
+              /* Head */
+              memcpy(new_buf, out_buf, insert_at);
 
-          /* Randomly add to byte. */
+              /* Inserted part */
+              memcpy(new_buf + insert_at, a_extras[use_extra].data, extra_len);
 
-          out_buf[UR(temp_len)] += 1 + UR(ARITH_MAX);
-          break;
+            } else {
 
-        case 6:
+              use_extra = UR(extras_cnt);
+              extra_len = extras[use_extra].len;
 
-          /* Randomly subtract from word, random endian. */
+              if (temp_len + extra_len >= MAX_FILE) break;
 
-          if (temp_len < 2) break;
+              new_buf = ck_alloc_nozero(temp_len + extra_len);
 
-          if (UR(2)) {
+              /* Head */
+              memcpy(new_buf, out_buf, insert_at);
 
-            u32 pos = UR(temp_len - 1);
+              /* Inserted part */
+              memcpy(new_buf + insert_at, extras[use_extra].data, extra_len);
 
-            *(u16*)(out_buf + pos) -= 1 + UR(ARITH_MAX);
+            }
 
-          } else {
+            /* Tail */
+            memcpy(new_buf + insert_at + extra_len, out_buf + insert_at,
+                   temp_len - insert_at);
 
-            u32 pos = UR(temp_len - 1);
-            u16 num = 1 + UR(ARITH_MAX);
+            ck_free(out_buf);
+            out_buf   = new_buf;
+            temp_len += extra_len;
 
-            *(u16*)(out_buf + pos) =
-              SWAP16(SWAP16(*(u16*)(out_buf + pos)) - num);
+            break;
 
           }
 
-          break;
+      }
 
-        case 7:
+    }
+
+    if (common_fuzz_async(argv, out_buf, temp_len))
+      goto abandon_entry;
 
-          /* Randomly add to word, random endian. */
+    /* out_buf might have been mangled a bit, so let's restore it to its
+       original size and shape. */
 
-          if (temp_len < 2) break;
+    if (temp_len < len) out_buf = ck_realloc(out_buf, len);
+    temp_len = len;
+    memcpy(out_buf, in_buf, len);
 
-          if (UR(2)) {
+    /* If we're finding new stuff, let's run for a bit longer, limits
+       permitting. */
 
-            u32 pos = UR(temp_len - 1);
+    if (queued_paths != havoc_queued) {
 
-            *(u16*)(out_buf + pos) += 1 + UR(ARITH_MAX);
+      if (perf_score <= HAVOC_MAX_MULT * 100) {
+        stage_max  *= 2;
+        perf_score *= 2;
+      }
 
-          } else {
+      havoc_queued = queued_paths;
 
-            u32 pos = UR(temp_len - 1);
-            u16 num = 1 + UR(ARITH_MAX);
+    }
 
-            *(u16*)(out_buf + pos) =
-              SWAP16(SWAP16(*(u16*)(out_buf + pos)) + num);
+  }
 
-          }
+  if (finish_fuzz_runs(argv)) goto abandon_entry;
 
-          break;
+  new_hit_cnt = queued_paths + unique_crashes;
 
-        case 8:
+  if (!splice_cycle) {
+    stage_finds[STAGE_HAVOC]  += new_hit_cnt - orig_hit_cnt;
+    stage_cycles[STAGE_HAVOC] += stage_max;
+  } else {
+    stage_finds[STAGE_SPLICE]  += new_hit_cnt - orig_hit_cnt;
+    stage_cycles[STAGE_SPLICE] += stage_max;
+  }
 
-          /* Randomly subtract from dword, random endian. */
+#ifndef IGNORE_FINDS
 
-          if (temp_len < 4) break;
+  /************
+   * SPLICING *
+   ************/
 
-          if (UR(2)) {
+  /* This is a last-resort strategy triggered by a full round with no findings.
+     It takes the current input file, randomly selects another input, and
+     splices them together at some offset, then relies on the havoc
+     code to mutate that blob. */
 
-            u32 pos = UR(temp_len - 3);
+retry_splicing:
 
-            *(u32*)(out_buf + pos) -= 1 + UR(ARITH_MAX);
+  if (use_splicing && splice_cycle++ < SPLICE_CYCLES &&
+      queued_paths > 1 && queue_cur->len > 1) {
 
-          } else {
+    u32 split_at;
+    u8* new_buf;
+    s32 f_diff, l_diff;
 
-            u32 pos = UR(temp_len - 3);
-            u32 num = 1 + UR(ARITH_MAX);
+    /* First of all, if we've modified in_buf for havoc, let's clean that
+       up... */
 
-            *(u32*)(out_buf + pos) =
-              SWAP32(SWAP32(*(u32*)(out_buf + pos)) - num);
+    if (in_buf != orig_in) {
+      ck_free(in_buf);
+      in_buf = orig_in;
+      len = queue_cur->len;
+    }
 
-          }
+    /* Pick a random queue entry and find it. */
 
-          break;
+    target = pick_splice_partner(splice_cycle == 1);
 
-        case 9:
+    /* Make sure that the target has a reasonable length and isn't yourself. */
 
-          /* Randomly add to dword, random endian. */
+    while (target && (target->len < 2 || target == queue_cur)) {
+      target = target->next;
+    }
 
-          if (temp_len < 4) break;
+    if (!target) goto retry_splicing;
 
-          if (UR(2)) {
+    splicing_with = target->entry_id;
 
-            u32 pos = UR(temp_len - 3);
+    /* Read the testcase into a new buffer. */
 
-            *(u32*)(out_buf + pos) += 1 + UR(ARITH_MAX);
+    fd = open(target->fname, O_RDONLY);
 
-          } else {
+    if (fd < 0) PFATAL("Unable to open '%s'", target->fname);
 
-            u32 pos = UR(temp_len - 3);
-            u32 num = 1 + UR(ARITH_MAX);
+    new_buf = ck_alloc_nozero(target->len);
 
-            *(u32*)(out_buf + pos) =
-              SWAP32(SWAP32(*(u32*)(out_buf + pos)) + num);
+    ck_read(fd, new_buf, target->len, target->fname);
 
-          }
+    close(fd);
 
-          break;
+    /* Find a suitable splicing location, somewhere between the first and
+       the last differing byte. Bail out if the difference is just a single
+       byte or so. */
 
-        case 10:
+    locate_diffs(in_buf, new_buf, MIN(len, target->len), &f_diff, &l_diff);
 
-          /* Just set a random byte to a random value. Because,
-             why not. We use XOR with 1-255 to eliminate the
-             possibility of a no-op. */
+    if (f_diff < 0 || l_diff < 2 || f_diff == l_diff) {
+      ck_free(new_buf);
+      goto retry_splicing;
+    }
 
-          out_buf[UR(temp_len)] ^= 1 + UR(255);
-          break;
+    /* Split somewhere between the first and last differing byte. */
 
-        case 11 ... 12: {
+    split_at = f_diff + UR(l_diff - f_diff);
 
-            /* Delete bytes. We're making this a bit more likely
-               than insertion (the next option) in hopes of keeping
-               files reasonably small. */
+    /* Do the thing. */
 
-            u32 del_from, del_len;
+    len = target->len;
+    memcpy(new_buf, in_buf, split_at);
+    in_buf = new_buf;
 
-            if (temp_len < 2) break;
+    ck_free(out_buf);
+    out_buf = ck_alloc_nozero(len);
+    memcpy(out_buf, in_buf, len);
 
-            /* Don't delete too much. */
+    goto havoc_stage;
 
-            del_len = choose_block_len(temp_len - 1);
+  }
 
-            del_from = UR(temp_len - del_len + 1);
+#endif /* !IGNORE_FINDS */
 
-            memmove(out_buf + del_from, out_buf + del_from + del_len,
-                    temp_len - del_from - del_len);
+  ret_val = 0;
 
-            temp_len -= del_len;
+abandon_entry:
 
-            break;
+  finish_fuzz_runs(argv);
 
-          }
+  splicing_with = -1;
 
-        case 13:
+  /* Update pending_not_fuzzed count if we made it through the calibration
+     cycle and have not seen this entry before. */
 
-          if (temp_len + HAVOC_BLK_XL < MAX_FILE) {
+  if (!stop_soon && !queue_cur->cal_failed && !queue_cur->was_fuzzed) {
+    queue_cur->was_fuzzed = 1;
+    pending_not_fuzzed--;
+    if (queue_cur->favored) pending_favored--;
+  }
 
-            /* Clone bytes (75%) or insert a block of constant bytes (25%). */
+  munmap(orig_in, queue_cur->len);
 
-            u8  actually_clone = UR(4);
-            u32 clone_from, clone_to, clone_len;
-            u8* new_buf;
+  if (in_buf != orig_in) ck_free(in_buf);
+  ck_free(out_buf);
+  ck_free(eff_map);
 
-            if (actually_clone) {
+  return ret_val;
 
-              clone_len  = choose_block_len(temp_len);
-              clone_from = UR(temp_len - clone_len + 1);
+#undef FLIP_BIT
 
-            } else {
+}
 
-              clone_len = choose_block_len(HAVOC_BLK_XL);
-              clone_from = 0;
 
-            }
+/* Keep track of the peers seen on the sync bus, so that sync_fuzzers() can
+   skip their directories. */
 
-            clone_to   = UR(temp_len);
+static u8 bus_peer_known(u8* name) {
 
-            new_buf = ck_alloc_nozero(temp_len + clone_len);
+  u32 i;
 
-            /* Head */
+  for (i = 0; i < bus_peer_cnt; i++)
+    if (!strcmp(bus_peers[i], name)) return 1;
 
-            memcpy(new_buf, out_buf, clone_to);
+  return 0;
 
-            /* Inserted part */
+}
 
-            if (actually_clone)
-              memcpy(new_buf + clone_to, out_buf + clone_from, clone_len);
-            else
-              memset(new_buf + clone_to,
-                     UR(2) ? UR(256) : out_buf[UR(temp_len)], clone_len);
 
-            /* Tail */
-            memcpy(new_buf + clone_to + clone_len, out_buf + clone_to,
-                   temp_len - clone_to);
+static void bus_add_peer(u8* name) {
 
-            ck_free(out_buf);
-            out_buf = new_buf;
-            temp_len += clone_len;
+  if (bus_peer_cnt == SYNC_BUS_PEERS || bus_peer_known(name)) return;
 
-          }
+  strcpy(bus_peers[bus_peer_cnt++], name);
 
-          break;
+}
 
-        case 14: {
 
-            /* Overwrite bytes with a randomly selected chunk (75%) or fixed
-               bytes (25%). */
+/* Queue an entry from the bus as is, trusting the coverage and proximity
+   recorded by the producer; this is what save_if_interesting() and
+   calibrate_case() would do for it, minus the executions. The trace digest
+   is unpacked into trace_bits. Returns 1 if the entry was queued. */
 
-            u32 copy_from, copy_to, copy_len;
+static u8 bus_import(struct sync_rec* rec, u8* body) {
 
-            if (temp_len < 2) break;
+  static u32* nodes;
 
-            copy_len  = choose_block_len(temp_len - 1);
+  struct queue_entry* q;
+  u8 *trace_idx = body + rec->len,
+     *trace_val = trace_idx + rec->trace_cnt * sizeof(u16),
+     *dfg_nodes = trace_val + rec->trace_cnt;
+  u8 *fn, hnb, new_node = 0;
+  u32 i;
+  s32 fd;
 
-            copy_from = UR(temp_len - copy_len + 1);
-            copy_to   = UR(temp_len - copy_len + 1);
+  if (!nodes) nodes = ck_alloc(dfg_size * sizeof(u32) + 1);
 
-            if (UR(4)) {
+  /* nodes[] only has room for our own DFG; anything bigger can't be one
+     of ours, whatever the peer claims. */
 
-              if (copy_from != copy_to)
-                memmove(out_buf + copy_to, out_buf + copy_from, copy_len);
+  if (rec->dfg_cnt > dfg_size) return 0;
 
-            } else memset(out_buf + copy_to,
-                          UR(2) ? UR(256) : out_buf[UR(temp_len)], copy_len);
+  for (i = 0; i < rec->dfg_cnt; i++) {
 
-            break;
+    u32 n;
 
-          }
+    memcpy(&n, dfg_nodes + i * sizeof(u32), sizeof(u32));
 
-        /* Values 15 and 16 can be selected only if there are any extras
-           present in the dictionaries. */
+    if (n >= dfg_size) return 0;
+    if (!dfg_node_count[n]) new_node = 1;
 
-        case 15: {
+    nodes[i] = n;
 
-            /* Overwrite bytes with an extra. */
+  }
 
-            if (!extras_cnt || (a_extras_cnt && UR(2))) {
+  if (sync_new_dfg && !new_node) {
+    sync_filtered++;
+    return 0;
+  }
 
-              /* No user-specified extras or odds in our favor. Let's use an
-                 auto-detected one. */
+  memset(trace_bits, 0, MAP_SIZE);
+  last_trace.map = NULL;
 
-              u32 use_extra = UR(a_extras_cnt);
-              u32 extra_len = a_extras[use_extra].len;
-              u32 insert_at;
+  for (i = 0; i < rec->trace_cnt; i++) {
+    u16 idx;
+    memcpy(&idx, trace_idx + i * sizeof(u16), sizeof(u16));
+    trace_bits[idx] = trace_val[i];
+  }
 
-              if (extra_len > temp_len) break;
+  hnb = has_new_bits(virgin_bits);
+  if (!hnb) return 0;
 
-              insert_at = UR(temp_len - extra_len + 1);
-              memcpy(out_buf + insert_at, a_extras[use_extra].data, extra_len);
+  /* Count the entry in, as observe_dfg_trace() would. */
 
-            } else {
+  for (i = 0; i < rec->dfg_cnt; i++)
+    if (dfg_node_paths[nodes[i]]) dfg_node_count[nodes[i]]++;
 
-              /* No auto extras or odds in our favor. Use the dictionary. */
+  dfg_epoch++;
 
-              u32 use_extra = UR(extras_cnt);
-              u32 extra_len = extras[use_extra].len;
-              u32 insert_at;
+#ifndef SIMPLE_FILES
 
-              if (extra_len > temp_len) break;
+  fn = alloc_printf("%s/queue/id:%06u,%llu,%s", out_dir, queued_paths,
+                    rec->prox_score, describe_op(hnb));
 
-              insert_at = UR(temp_len - extra_len + 1);
-              memcpy(out_buf + insert_at, extras[use_extra].data, extra_len);
+#else
 
-            }
+  fn = alloc_printf("%s/queue/id_%06u", out_dir, queued_paths);
 
-            break;
+#endif /* ^!SIMPLE_FILES */
 
-          }
+  add_to_queue(fn, rec->len, 0, rec->prox_score);
 
-        case 16: {
+  q = queue_last;
 
-            u32 use_extra, extra_len, insert_at = UR(temp_len + 1);
-            u8* new_buf;
+  q->dfg_observed = 1;
+  q->exec_cksum   = rec->exec_cksum;
+  q->bitmap_size  = rec->bitmap_size;
+  q->exec_us      = rec->exec_us;
+  q->handicap     = queue_cycle - 1;
 
-            /* Insert an extra. Do the same dice-rolling stuff as for the
-               previous case. */
+  if (hnb == 2) {
+    q->has_new_cov = 1;
+    queued_with_cov++;
+  }
 
-            if (!extras_cnt || (a_extras_cnt && UR(2))) {
+  q->dfg_nodes     = dfg_set_encode(nodes, rec->dfg_cnt, &q->dfg_nodes_len);
+  q->dfg_nodes_cnt = rec->dfg_cnt;
 
-              use_extra = UR(a_extras_cnt);
-              extra_len = a_extras[use_extra].len;
+  total_bitmap_size += q->bitmap_size;
+  total_bitmap_entries++;
 
-              if (temp_len + extra_len >= MAX_FILE) break;
+  total_prox_score += q->prox_score;
+  avg_prox_score = total_prox_score / queued_paths;
+  if (min_prox_score > q->prox_score) min_prox_score = q->prox_score;
+  if (max_prox_score < q->prox_score) max_prox_score = q->prox_score;
 
-              new_buf = ck_alloc_nozero(temp_len + extra_len);
+  update_bitmap_score(q);
 
-              /* Head */
-              memcpy(new_buf, out_buf, insert_at);
+  fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) PFATAL("Unable to create '%s'", fn);
+  ck_write(fd, body, rec->len, fn);
+  close(fd);
 
-              /* Inserted part */
-              memcpy(new_buf + insert_at, a_extras[use_extra].data, extra_len);
+  return 1;
 
-            } else {
+}
 
-              use_extra = UR(extras_cnt);
-              extra_len = extras[use_extra].len;
 
-              if (temp_len + extra_len >= MAX_FILE) break;
+/* Read the records that peers put on the bus since the last sync. Each one
+   is either imported as is (AFL_SYNC_BUS_TRUST), or run and handed over to
+   save_if_interesting(), like the test cases found in peer directories. */
 
-              new_buf = ck_alloc_nozero(temp_len + extra_len);
+static void sync_from_bus(char** argv) {
 
-              /* Head */
-              memcpy(new_buf, out_buf, insert_at);
+  static u8* body;
+  static u32 body_size;
+  static u64 stuck_at;
+  static u32 stuck_cnt;
 
-              /* Inserted part */
-              memcpy(new_buf + insert_at, extras[use_extra].data, extra_len);
+  static u8 party[SYNC_BUS_NAME_LEN];
 
-            }
+  struct sync_rec rec;
 
-            /* Tail */
-            memcpy(new_buf + insert_at + extra_len, out_buf + insert_at,
-                   temp_len - insert_at);
+  stage_name = "sync bus";
+  stage_cur  = 0;
+  stage_max  = 0;
 
-            ck_free(out_buf);
-            out_buf   = new_buf;
-            temp_len += extra_len;
+  while (!stop_soon) {
 
-            break;
+    u64 head = __atomic_load_n(&sync_bus->head, __ATOMIC_ACQUIRE),
+        off  = bus_cursor % SYNC_BUS_SIZE;
+    u32 body_len;
+    struct sync_rec* r;
 
-          }
+    if (bus_cursor == head) break;
 
-      }
+    /* Lapped by the writers; whatever we missed is gone. */
 
+    if (head - bus_cursor > SYNC_BUS_SIZE) {
+      bus_cursor = head;
+      continue;
     }
 
-    if (common_fuzz_stuff(argv, out_buf, temp_len))
-      goto abandon_entry;
+    /* Gaps too short for a header are skipped without one. */
 
-    /* out_buf might have been mangled a bit, so let's restore it to its
-       original size and shape. */
+    if (SYNC_BUS_SIZE - off < sizeof(struct sync_rec)) {
+      bus_cursor += SYNC_BUS_SIZE - off;
+      continue;
+    }
 
-    if (temp_len < len) out_buf = ck_realloc(out_buf, len);
-    temp_len = len;
-    memcpy(out_buf, in_buf, len);
+    r = (struct sync_rec*)(sync_ring + off);
 
-    /* If we're finding new stuff, let's run for a bit longer, limits
-       permitting. */
+    /* Still being written? Try again next time, unless the writer seems to
+       have died halfway through. */
 
-    if (queued_paths != havoc_queued) {
+    if (__atomic_load_n(&r->stamp, __ATOMIC_ACQUIRE) != bus_cursor + 1) {
 
-      if (perf_score <= HAVOC_MAX_MULT * 100) {
-        stage_max  *= 2;
-        perf_score *= 2;
+      if (stuck_at != bus_cursor) {
+        stuck_at  = bus_cursor;
+        stuck_cnt = 0;
       }
 
-      havoc_queued = queued_paths;
+      if (++stuck_cnt >= SYNC_BUS_STALL) bus_cursor = head;
+      break;
 
     }
 
-  }
-
-  new_hit_cnt = queued_paths + unique_crashes;
+    memcpy(&rec, r, sizeof(struct sync_rec));
 
-  if (!splice_cycle) {
-    stage_finds[STAGE_HAVOC]  += new_hit_cnt - orig_hit_cnt;
-    stage_cycles[STAGE_HAVOC] += stage_max;
-  } else {
-    stage_finds[STAGE_SPLICE]  += new_hit_cnt - orig_hit_cnt;
-    stage_cycles[STAGE_SPLICE] += stage_max;
-  }
+    /* Sanity checks; anything odd means that the record was overwritten
+       while we were looking at it. */
 
-#ifndef IGNORE_FINDS
+    if (rec.rec_len < sizeof(struct sync_rec) ||
+        rec.rec_len > SYNC_BUS_SIZE - off ||
+        (rec.name[0] && (rec.len > MAX_FILE || rec.trace_cnt > MAP_SIZE ||
+                         rec.dfg_cnt > DFG_MAX_SIZE || !rec.len ||
+                         rec.rec_len != SYNC_REC_LEN(rec.len, rec.trace_cnt,
+                                                     rec.dfg_cnt)))) {
+      bus_cursor = head;
+      continue;
+    }
 
-  /************
-   * SPLICING *
-   ************/
+    body_len = rec.rec_len - sizeof(struct sync_rec);
 
-  /* This is a last-resort strategy triggered by a full round with no findings.
-     It takes the current input file, randomly selects another input, and
-     splices them together at some offset, then relies on the havoc
-     code to mutate that blob. */
+    if (rec.name[0] && body_len > body_size) {
+      body_size = body_len;
+      body = ck_realloc(body, body_size);
+    }
 
-retry_splicing:
+    if (rec.name[0]) memcpy(body, r + 1, body_len);
 
-  if (use_splicing && splice_cycle++ < SPLICE_CYCLES &&
-      queued_paths > 1 && queue_cur->len > 1) {
+    /* Make sure that nobody started writing over the record before we were
+       done copying it. */
 
-    u32 idx, idx_div, split_at;
-    u8* new_buf;
-    s32 f_diff, l_diff;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
 
-    /* First of all, if we've modified in_buf for havoc, let's clean that
-       up... */
+    head = __atomic_load_n(&sync_bus->head, __ATOMIC_ACQUIRE);
 
-    if (in_buf != orig_in) {
-      ck_free(in_buf);
-      in_buf = orig_in;
-      len = queue_cur->len;
+    if (head - bus_cursor > SYNC_BUS_SIZE) {
+      bus_cursor = head;
+      continue;
     }
 
-    /* Pick a random queue entry and find it. */
+    bus_cursor += rec.rec_len;
 
-    idx = UR(queued_paths);
+    /* Skip padding and our own records. */
 
-    idx_div = idx / 100;
-    if (idx_div < 1024) {
-      target = shortcut_per_100[idx_div];
-      idx -= idx_div * 100;
-    } else {
-      target = shortcut_per_100[1023];
-      idx -= idx_div * 1024;
-    }
+    rec.name[SYNC_BUS_NAME_LEN - 1] = 0;
 
-    while (idx--) target = target->next;
+    if (!rec.name[0] || !strcmp(rec.name, sync_id)) continue;
 
-    /* Make sure that the target has a reasonable length and isn't yourself. */
+    /* Node IDs from a binary built with another DFG would mean nothing,
+       and bus_import() only has room for as many as our DFG has nodes. */
 
-    while (target && (target->len < 2 || target == queue_cur)) {
-      target = target->next;
-    }
+    if (rec.dfg_size != dfg_size || rec.dfg_cnt > dfg_size) continue;
 
-    if (!target) goto retry_splicing;
+    bus_add_peer(rec.name);
 
-    splicing_with = target->entry_id;
+    if (rec.prox_score < sync_min_prox) {
+      sync_filtered++;
+      continue;
+    }
 
-    /* Read the testcase into a new buffer. */
+    memcpy(party, rec.name, SYNC_BUS_NAME_LEN);
 
-    fd = open(target->fname, O_RDONLY);
+    syncing_party = party;
+    syncing_case  = rec.entry_id;
 
-    if (fd < 0) PFATAL("Unable to open '%s'", target->fname);
+    if (bus_trust) {
 
-    new_buf = ck_alloc_nozero(target->len);
+      queued_imported += bus_import(&rec, body);
 
-    ck_read(fd, new_buf, target->len, target->fname);
+    } else {
 
-    close(fd);
+      u8 fault;
 
-    /* Find a suitable splicing location, somewhere between the first and
-       the last differing byte. Bail out if the difference is just a single
-       byte or so. */
+      write_to_testcase(body, rec.len);
 
-    locate_diffs(in_buf, new_buf, MIN(len, target->len), &f_diff, &l_diff);
+      fault = run_target(argv, exec_tmout, "USELESS=0", 0);
 
-    if (f_diff < 0 || l_diff < 2 || f_diff == l_diff) {
-      ck_free(new_buf);
-      goto retry_splicing;
-    }
+      if (stop_soon) {
+        syncing_party = 0;
+        return;
+      }
 
-    /* Split somewhere between the first and last differing byte. */
+      queued_imported += save_if_interesting(argv, body, rec.len, fault);
 
-    split_at = f_diff + UR(l_diff - f_diff);
+    }
 
-    /* Do the thing. */
+    syncing_party = 0;
 
-    len = target->len;
-    memcpy(new_buf, in_buf, split_at);
-    in_buf = new_buf;
+    if (!(stage_cur++ % stats_update_freq)) show_stats();
 
-    ck_free(out_buf);
-    out_buf = ck_alloc_nozero(len);
-    memcpy(out_buf, in_buf, len);
+  }
 
-    goto havoc_stage;
+}
 
-  }
 
-#endif /* !IGNORE_FINDS */
+/* New entry in the queue/ directory of a peer. The proximity score comes
+   from the file name; entries without one (say, seeds) are never filtered
+   by proximity. */
 
-  ret_val = 0;
+struct sync_cand {
 
-abandon_entry:
+  u8* name;                           /* File name                        */
+  u64 prox_score;                     /* Proximity score, if known        */
+  u8  has_prox;                       /* Score found in the file name?    */
 
-  splicing_with = -1;
+};
 
-  /* Update pending_not_fuzzed count if we made it through the calibration
-     cycle and have not seen this entry before. */
 
-  if (!stop_soon && !queue_cur->cal_failed && !queue_cur->was_fuzzed) {
-    queue_cur->was_fuzzed = 1;
-    pending_not_fuzzed--;
-    if (queue_cur->favored) pending_favored--;
-  }
+/* Put the candidates with the highest proximity first, and those with no
+   known proximity last (AFL_SYNC_TOP_K). */
 
-  munmap(orig_in, queue_cur->len);
+static int compare_sync_cand(const void* a, const void* b) {
 
-  if (in_buf != orig_in) ck_free(in_buf);
-  ck_free(out_buf);
-  ck_free(eff_map);
+  const struct sync_cand *x = a, *y = b;
 
-  return ret_val;
+  if (x->has_prox != y->has_prox) return x->has_prox ? -1 : 1;
+  if (x->prox_score != y->prox_score)
+    return x->prox_score > y->prox_score ? -1 : 1;
 
-#undef FLIP_BIT
+  return strcmp(x->name, y->name);
 
 }
 
@@ -6958,10 +10307,15 @@ abandon_entry:
 
 static void sync_fuzzers(char** argv) {
 
+  static struct sync_cand* cands;
+  static u32 cands_size;
+
   DIR* sd;
   struct dirent* sd_ent;
   u32 sync_cnt = 0;
 
+  if (sync_bus) sync_from_bus(argv);
+
   sd = opendir(sync_dir);
   if (!sd) PFATAL("Unable to open '%s'", sync_dir);
 
@@ -6977,7 +10331,7 @@ static void sync_fuzzers(char** argv) {
     DIR* qd;
     struct dirent* qd_ent;
     u8 *qd_path, *qd_synced_path;
-    u32 min_accept = 0, next_min_accept;
+    u32 min_accept = 0, next_min_accept, cand_cnt = 0, i;
 
     s32 id_fd;
 
@@ -6985,6 +10339,10 @@ static void sync_fuzzers(char** argv) {
 
     if (sd_ent->d_name[0] == '.' || !strcmp(sync_id, sd_ent->d_name)) continue;
 
+    /* Peers on the sync bus hand us their finds through it. */
+
+    if (sync_bus && bus_peer_known(sd_ent->d_name)) continue;
+
     /* Skip anything that doesn't have a queue/ subdirectory. */
 
     qd_path = alloc_printf("%s/%s/queue", sync_dir, sd_ent->d_name);
@@ -7015,24 +10373,73 @@ static void sync_fuzzers(char** argv) {
     stage_max  = 0;
 
     /* For every file queued by this fuzzer, parse ID and see if we have looked at
-       it before; exec a test case if not. */
+       it before; if not, see if it makes it past the import filters. */
 
     while ((qd_ent = readdir(qd))) {
 
-      u8* path;
-      s32 fd;
-      struct stat st;
+      struct sync_cand* c;
+      u64 prox_score;
+      u8  has_prox;
+
+      if (qd_ent->d_name[0] == '.') continue;
 
-      if (qd_ent->d_name[0] == '.' ||
-          sscanf(qd_ent->d_name, CASE_PREFIX "%06u", &syncing_case) != 1 ||
-          syncing_case < min_accept) continue;
+      has_prox = sscanf(qd_ent->d_name, CASE_PREFIX "%06u,%llu",
+                        &syncing_case, &prox_score) == 2;
+
+      if (!has_prox &&
+          sscanf(qd_ent->d_name, CASE_PREFIX "%06u", &syncing_case) != 1)
+        continue;
 
-      /* OK, sounds like a new one. Let's give it a try. */
+      if (syncing_case < min_accept) continue;
 
       if (syncing_case >= next_min_accept)
         next_min_accept = syncing_case + 1;
 
-      path = alloc_printf("%s/%s", qd_path, qd_ent->d_name);
+      /* Obviously irrelevant seeds are skipped without running them. */
+
+      if (has_prox && prox_score < sync_min_prox) {
+        sync_filtered++;
+        continue;
+      }
+
+      if (cand_cnt == cands_size) {
+        cands_size = cands_size ? cands_size * 2 : 64;
+        cands = ck_realloc(cands, cands_size * sizeof(struct sync_cand));
+      }
+
+      c = cands + cand_cnt++;
+
+      c->name       = ck_strdup(qd_ent->d_name);
+      c->prox_score = has_prox ? prox_score : 0;
+      c->has_prox   = has_prox;
+
+    }
+
+    /* With AFL_SYNC_TOP_K, only the closest few get a chance. */
+
+    if (sync_top_k && cand_cnt > sync_top_k) {
+
+      qsort(cands, cand_cnt, sizeof(struct sync_cand), compare_sync_cand);
+
+      for (i = sync_top_k; i < cand_cnt; i++) ck_free(cands[i].name);
+
+      sync_filtered += cand_cnt - sync_top_k;
+      cand_cnt = sync_top_k;
+
+    }
+
+    /* OK, these sound like new ones. Let's give them a try. */
+
+    for (i = 0; i < cand_cnt; i++) {
+
+      u8* path;
+      s32 fd;
+      struct stat st;
+
+      sscanf(cands[i].name, CASE_PREFIX "%06u", &syncing_case);
+
+      path = alloc_printf("%s/%s", qd_path, cands[i].name);
+      ck_free(cands[i].name);
 
       /* Allow this to fail in case the other fuzzer is resuming or so... */
 
@@ -7092,6 +10499,27 @@ static void sync_fuzzers(char** argv) {
 }
 
 
+/* Kill the fork servers and children of the executors other than the
+   selected one, whose PIDs are in the globals. */
+
+static void kill_executors(void) {
+
+  u32 i;
+
+  for (i = 0; executors && i < executor_cnt; i++) {
+
+    struct executor* e = executors + i;
+
+    if (e == cur_executor) continue;
+
+    if (e->child_pid > 0) kill(e->child_pid, SIGKILL);
+    if (e->fsrv_pid > 0) kill(e->fsrv_pid, SIGKILL);
+
+  }
+
+}
+
+
 /* Handle stop signal (Ctrl-C, etc). */
 
 static void handle_stop_sig(int sig) {
@@ -7101,6 +10529,8 @@ static void handle_stop_sig(int sig) {
   if (child_pid > 0) kill(child_pid, SIGKILL);
   if (forksrv_pid > 0) kill(forksrv_pid, SIGKILL);
 
+  kill_executors();
+
 }
 
 
@@ -7277,12 +10707,99 @@ EXP_ST void check_binary(u8* fname) {
     setenv(PERSIST_ENV_VAR, "1", 1);
     persistent_mode = 1;
 
+    if (memmem(f_data, f_len, DFG_RESET_SIG, strlen(DFG_RESET_SIG) + 1)) {
+
+      OKF(cPIN "DFG maps are reset by the binary between iterations.");
+      dfg_self_reset = 1;
+
+    }
+
   } else if (getenv("AFL_PERSISTENT")) {
 
     WARNF("AFL_PERSISTENT is no longer supported and may misbehave!");
 
   }
 
+  /* Binaries built with an older afl-clang-fast store the scores and path
+     counts of the DFG nodes in two more SHM regions, which are gone now (see
+     DFG_NODES_SIG). */
+
+  if (memmem(f_data, f_len, "__AFL_SHM_ID_DFG_COUNT", 23))
+    WARNF("The binary was built with an older afl-clang-fast; rebuild it to "
+          "get DFG feedback.");
+
+  /* The runtime only picks up the test case SHM along with the coverage
+     map, which is not handed over in dumb mode. */
+
+  if (!dumb_mode &&
+      memmem(f_data, f_len, SHM_FUZZ_SIG, strlen(SHM_FUZZ_SIG) + 1)) {
+
+    OKF(cPIN "Harness takes test cases through shared memory.");
+    shm_fuzz = 1;
+
+  }
+
+  /* Binaries built with a recent afl-clang-fast tell the size of their DFG.
+     Every module carries its own copy, so we make sure that they were all
+     built with the same one. */
+
+  {
+
+    u8 *sig = f_data, *end = f_data + f_len;
+    u32 sig_len = strlen(DFG_SIZE_SIG), size = 0;
+    u8  seen = 0;
+
+    while ((sig = memmem(sig, end - sig, DFG_SIZE_SIG, sig_len))) {
+
+      u64 n = 0;
+
+      sig += sig_len;
+
+      if (sig >= end || !isdigit(*sig)) continue;
+
+      while (sig < end && isdigit(*sig) && n <= DFG_MAX_SIZE)
+        n = n * 10 + (*(sig++) - '0');
+
+      if (n > DFG_MAX_SIZE) FATAL("DFG of '%s' is too large", target_path);
+
+      if (seen && n != size)
+        FATAL("Parts of '%s' were built with different DFGs (%u and %llu "
+              "nodes); rebuild them all", target_path, size, n);
+
+      size = n;
+      seen = 1;
+
+    }
+
+    if (seen) {
+
+      dfg_size = size;
+      OKF(cPIN "The binary was built with a DFG of %u node%s.", dfg_size,
+          dfg_size == 1 ? "" : "s");
+
+    }
+
+  }
+
+  /* Binaries built with a recent afl-clang-fast keep a list of the DFG nodes
+     touched during each run, if the DFG is big enough to need one. */
+
+  if (DFG_SPARSE(dfg_size) &&
+      memmem(f_data, f_len, SHM_ENV_VAR_DFG_LIST,
+             strlen(SHM_ENV_VAR_DFG_LIST) + 1)) {
+
+    OKF(cPIN "Sparse DFG feedback supported by the binary.");
+    dfg_sparse = 1;
+
+  }
+
+  if (memmem(f_data, f_len, DFG_TARGET_SIG, strlen(DFG_TARGET_SIG) + 1)) {
+
+    OKF(cPIN "The binary flags runs that reach the target line.");
+    dfg_target = 1;
+
+  }
+
   if (memmem(f_data, f_len, DEFER_SIG, strlen(DEFER_SIG) + 1)) {
 
     OKF(cPIN "Deferred forkserver binary detected.");
@@ -7366,7 +10883,7 @@ static void check_term_size(void) {
   if (ioctl(1, TIOCGWINSZ, &ws)) return;
 
   if (ws.ws_row == 0 && ws.ws_col == 0) return;
-  if (ws.ws_row < 25 || ws.ws_col < 80) term_too_small = 1;
+  if (ws.ws_row < 26 || ws.ws_col < 80) term_too_small = 1;
 
 }
 
@@ -7571,6 +11088,41 @@ EXP_ST void setup_stdio_file(void) {
 }
 
 
+/* With AFL_MEMFD_INPUT, keep the test case in an anonymous in-memory file
+   instead of .cur_input. Targets that read stdin get it as usual; @@ is
+   replaced with /dev/fd/N, which the target inherits. Either way, every
+   execution then costs a pwrite() and ftruncate(), with no directory
+   operations. */
+
+static void setup_memfd_input(void) {
+
+  if (!memfd_input) return;
+
+  if (out_file) {
+
+    WARNF("AFL_MEMFD_INPUT has no effect with -f.");
+    memfd_input = 0;
+    return;
+
+  }
+
+#ifdef SYS_memfd_create
+
+  out_fd = syscall(SYS_memfd_create, "cur_input", 0);
+  if (out_fd < 0) PFATAL("memfd_create() failed");
+
+  OKF("Test cases will be passed through a memfd.");
+
+#else
+
+  WARNF("memfd_create() is not available, using regular files.");
+  memfd_input = 0;
+
+#endif /* ^SYS_memfd_create */
+
+}
+
+
 /* Make sure that core dumps don't go to a program. */
 
 static void check_crash_handling(void) {
@@ -7879,8 +11431,12 @@ EXP_ST void detect_file_args(char** argv) {
 
       /* If we don't have a file name chosen yet, use a safe default. */
 
-      if (!out_file)
-        out_file = alloc_printf("%s/.cur_input", out_dir);
+      if (!out_file) {
+
+        if (memfd_input) out_file = alloc_printf("/dev/fd/%d", out_fd);
+        else out_file = alloc_printf("%s/.cur_input", out_dir);
+
+      }
 
       /* Be sure that we're always using fully-qualified paths. */
 
@@ -8294,13 +11850,29 @@ int main(int argc, char** argv) {
   if (getenv("AFL_NO_CPU_RED"))    no_cpu_meter_red = 1;
   if (getenv("AFL_NO_ARITH"))      no_arith         = 1;
   if (getenv("AFL_SHUFFLE_QUEUE")) shuffle_queue    = 1;
+  if (getenv("AFL_SPLICE_PROX"))   splice_prox      = 1;
+  if (getenv("AFL_PACKED_STORE"))  packed_store     = 1;
+  if (getenv("AFL_NO_DEDUP"))      no_dedup         = 1;
+  if (getenv("AFL_DEDUP_TRACE"))   dedup_trace      = 1;
+  if (getenv("AFL_MEMFD_INPUT"))   memfd_input      = 1;
+  if (getenv("AFL_SYNC_BUS"))      use_sync_bus     = 1;
+  if (getenv("AFL_SYNC_BUS_TRUST")) use_sync_bus = bus_trust = 1;
   if (getenv("AFL_FAST_CAL"))      fast_cal         = 1;
+  if (getenv("AFL_SYNC_NEW_DFG"))  sync_new_dfg     = 1;
 
   if (getenv("AFL_HANG_TMOUT")) {
     hang_tmout = atoi(getenv("AFL_HANG_TMOUT"));
     if (!hang_tmout) FATAL("Invalid value of AFL_HANG_TMOUT");
   }
 
+  if (getenv("AFL_SYNC_MIN_PROX"))
+    sync_min_prox = strtoull(getenv("AFL_SYNC_MIN_PROX"), NULL, 10);
+
+  if (getenv("AFL_SYNC_TOP_K")) {
+    sync_top_k = atoi(getenv("AFL_SYNC_TOP_K"));
+    if (!sync_top_k) FATAL("Invalid value of AFL_SYNC_TOP_K");
+  }
+
   if (dumb_mode == 2 && no_forkserver)
     FATAL("AFL_DUMB_FORKSRV and AFL_NO_FORKSRV are mutually exclusive");
 
@@ -8331,7 +11903,12 @@ int main(int argc, char** argv) {
   setup_shm();
   init_count_class16();
 
+  if (!getenv("AFL_NO_SIMD")) bitmap_simd = bitmap_simd_detect();
+
   setup_dirs_fds();
+  setup_pacfix();
+  setup_packed_store();
+  setup_sync_bus();
   read_testcases();
   load_auto();
 
@@ -8341,11 +11918,14 @@ int main(int argc, char** argv) {
 
   if (!timeout_given) find_timeout();
 
+  setup_memfd_input();
   detect_file_args(argv + optind + 1);
 
-  if (!out_file) setup_stdio_file();
+  if (!out_file && !memfd_input) setup_stdio_file();
 
   check_binary(argv[optind]);
+  setup_dfg_shm();
+  setup_shm_fuzz();
 
   start_time = get_cur_time();
 
@@ -8354,12 +11934,11 @@ int main(int argc, char** argv) {
   else
     use_argv = argv + optind;
 
+  setup_executors(use_argv);
   perform_dry_run(use_argv);
 
   cull_queue();
 
-  sort_queue();
-
   show_init_stats();
 
   write_stats_file(0, 0, 0);
@@ -8385,10 +11964,11 @@ int main(int argc, char** argv) {
 
       queue_cycle++;
       cur_skipped_paths = 0;
-      queue_cur = queue;
 
-      for (struct queue_entry* q_tmp = queue; q_tmp; q_tmp = q_tmp->next)
-        q_tmp->handled_in_cycle = 0;
+      if (dfg_epoch != rescore_epoch) rescore_queue();
+
+      reset_unhandled();
+      queue_cur = pop_unhandled();
 
       show_stats();
 
@@ -8430,13 +12010,10 @@ int main(int argc, char** argv) {
 
     if (stop_soon) break;
 
-    if (first_unhandled) { // This is set only when a new item was added.
-      queue_cur = first_unhandled;
-      first_unhandled = NULL;
-    } else { // Proceed to the next unhandled item in the queue.
-      while (queue_cur && queue_cur->handled_in_cycle)
-        queue_cur = queue_cur->next;
-    }
+    if (dfg_epoch - rescore_epoch >= DFG_RESCORE_EPOCHS) rescore_queue();
+
+    queue_cur = pop_unhandled();
+
   }
 
   if (queue_cur) show_stats();
@@ -8446,6 +12023,7 @@ int main(int argc, char** argv) {
   if (stop_soon == 2) {
       if (child_pid > 0) kill(child_pid, SIGKILL);
       if (forksrv_pid > 0) kill(forksrv_pid, SIGKILL);
+      kill_executors();
   }
   /* Now that we've killed the forkserver, we wait for it to be able to get rusage stats. */
   if (waitpid(forksrv_pid, NULL, 0) <= 0) {
@@ -8455,6 +12033,7 @@ int main(int argc, char** argv) {
   write_bitmap();
   write_stats_file(0, 0, 0);
   save_auto();
+  flush_packed_store(2);
 
 stop_fuzzing:
 
@@ -0,0 +1,259 @@
+/*
+   DAFL - packed store extractor
+   -----------------------------
+
+   Expands the segments written by afl-fuzz with AFL_PACKED_STORE set back
+   into the classic normals/, crashes/ and memory/{pos,neg} layout, for the
+   benefit of tools that expect one file per test case.
+
+   The entries are written under the output directory given with -o, or
+   back into the fuzzer output directory itself if -o is not specified.
+   Existing files of the same name are overwritten, so it is safe to run
+   the tool again on a store that is still growing.
+*/
+
+#define AFL_MAIN
+#include "android-ashmem.h"
+
+#include "config.h"
+#include "types.h"
+#include "debug.h"
+#include "alloc-inl.h"
+#include "hash.h"
+#include "packed-store.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+static u8 *in_dir,                    /* Fuzzer output directory (-i)     */
+          *out_dir,                   /* Destination directory (-o)       */
+          *doc_path;                  /* Path to docs                     */
+
+static u64 total_ents,                /* Entries written out              */
+           total_bad;                 /* Entries skipped                  */
+
+static const u8* kind_dirs[] = {
+
+  [PACKED_NORMAL]  = "normals",
+  [PACKED_CRASH]   = "crashes",
+  [PACKED_MEM_POS] = "memory/pos",
+  [PACKED_MEM_NEG] = "memory/neg"
+
+};
+
+
+/* Create the classic directory layout under out_dir. */
+
+static void setup_dirs(void) {
+
+  static const u8* dirs[] = { "", "/normals", "/crashes", "/memory",
+                              "/memory/pos", "/memory/neg" };
+  u32 i;
+
+  for (i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+
+    u8* tmp = alloc_printf("%s%s", out_dir, dirs[i]);
+
+    if (mkdir(tmp, 0700) && errno != EEXIST)
+      PFATAL("Unable to create '%s'", tmp);
+
+    ck_free(tmp);
+
+  }
+
+}
+
+
+/* Check that a stored name stays within the directory of its kind. */
+
+static u8 name_ok(u8* name, u32 len, u8 kind) {
+
+  u32 dlen;
+
+  if (kind >= sizeof(kind_dirs) / sizeof(kind_dirs[0])) return 0;
+
+  dlen = strlen(kind_dirs[kind]);
+
+  if (len <= dlen + 1 || strncmp(name, kind_dirs[kind], dlen) ||
+      name[dlen] != '/') return 0;
+
+  if (memchr(name + dlen + 1, '/', len - dlen - 1) ||
+      memchr(name, 0, len)) return 0;
+
+  return 1;
+
+}
+
+
+/* Expand one segment. Returns 0 if it does not exist. */
+
+static u8 unpack_seg(u32 seg) {
+
+  struct packed_rec rec;
+  u8  magic[PACKED_MAGIC_LEN];
+  u8 *fn, *buf = NULL;
+  u32 buf_size = 0;
+  u64 hash[2];
+  s32 dat_fd, idx_fd;
+  struct stat st;
+
+  fn = alloc_printf("%s/packed/seg_%06u.idx", in_dir, seg);
+  idx_fd = open(fn, O_RDONLY);
+
+  if (idx_fd < 0) {
+    if (errno != ENOENT) PFATAL("Unable to open '%s'", fn);
+    ck_free(fn);
+    return 0;
+  }
+
+  if (read(idx_fd, magic, PACKED_MAGIC_LEN) != PACKED_MAGIC_LEN ||
+      memcmp(magic, PACKED_MAGIC, PACKED_MAGIC_LEN))
+    FATAL("'%s' is not a packed store index", fn);
+
+  ck_free(fn);
+
+  fn = alloc_printf("%s/packed/seg_%06u.dat", in_dir, seg);
+  dat_fd = open(fn, O_RDONLY);
+
+  if (dat_fd < 0 || fstat(dat_fd, &st)) PFATAL("Unable to open '%s'", fn);
+
+  /* A short read means a torn record at the end of a live store. */
+
+  while (read(idx_fd, &rec, sizeof(rec)) == sizeof(rec)) {
+
+    u32 ent_len = rec.name_len + rec.len;
+    u8* out_fn;
+    s32 fd;
+
+    if (rec.offset + ent_len > st.st_size) {
+      total_bad++;
+      continue;
+    }
+
+    if (ent_len > buf_size) {
+      buf_size = ent_len;
+      buf = ck_realloc(buf, buf_size);
+    }
+
+    if (pread(dat_fd, buf, ent_len, rec.offset) != ent_len)
+      PFATAL("Short read from '%s'", fn);
+
+    hash128(buf + rec.name_len, rec.len, HASH_CONST, hash);
+
+    if (!name_ok(buf, rec.name_len, rec.kind) || hash[0] != rec.hash[0] ||
+        hash[1] != rec.hash[1]) {
+      total_bad++;
+      continue;
+    }
+
+    out_fn = alloc_printf("%s/%.*s", out_dir, rec.name_len, buf);
+
+    fd = open(out_fn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) PFATAL("Unable to create '%s'", out_fn);
+
+    ck_write(fd, buf + rec.name_len, rec.len, out_fn);
+    close(fd);
+
+    ck_free(out_fn);
+    total_ents++;
+
+  }
+
+  ck_free(buf);
+  ck_free(fn);
+
+  close(dat_fd);
+  close(idx_fd);
+
+  return 1;
+
+}
+
+
+/* Display usage hints. */
+
+static void usage(u8* argv0) {
+
+  SAYF("\n%s -i dir [ -o dir ]\n\n"
+
+       "Required parameters:\n\n"
+
+       "  -i dir    - afl-fuzz output directory with a packed/ store\n\n"
+
+       "Optional parameters:\n\n"
+
+       "  -o dir    - where to put the unpacked files (default: same as -i)\n\n"
+
+       "For additional tips, please consult %s/README.\n\n",
+
+       argv0, doc_path);
+
+  exit(1);
+
+}
+
+
+/* Main entry point */
+
+int main(int argc, char** argv) {
+
+  s32 opt;
+  u32 seg = 0;
+  u8* fn;
+
+  doc_path = access(DOC_PATH, F_OK) ? "docs" : DOC_PATH;
+
+  SAYF(cCYA "afl-unpack " cBRI VERSION cRST " (DAFL packed store extractor)\n");
+
+  while ((opt = getopt(argc, argv, "+i:o:")) > 0)
+
+    switch (opt) {
+
+      case 'i':
+
+        if (in_dir) FATAL("Multiple -i options not supported");
+        in_dir = optarg;
+        break;
+
+      case 'o':
+
+        if (out_dir) FATAL("Multiple -o options not supported");
+        out_dir = optarg;
+        break;
+
+      default:
+
+        usage(argv[0]);
+
+    }
+
+  if (optind != argc || !in_dir) usage(argv[0]);
+
+  if (!out_dir) out_dir = in_dir;
+
+  fn = alloc_printf("%s/packed", in_dir);
+  if (access(fn, F_OK)) FATAL("No packed store found in '%s'", in_dir);
+  ck_free(fn);
+
+  setup_dirs();
+
+  ACTF("Unpacking '%s/packed'...", in_dir);
+
+  while (unpack_seg(seg)) seg++;
+
+  if (total_bad)
+    WARNF("Skipped %llu damaged or incomplete entries.", total_bad);
+
+  OKF("Unpacked %llu entries from %u segment%s into '%s'.", total_ents, seg,
+      seg == 1 ? "" : "s", out_dir);
+
+  exit(0);
+
+}
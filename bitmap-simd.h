@@ -0,0 +1,653 @@
+/*
+   DAFL - vectorized coverage map kernels
+   --------------------------------------
+
+   SSE2, AVX2 and AVX-512 versions of the passes that afl-fuzz makes over
+   trace_bits after every execution: classify_counts(), has_new_bits(),
+   simplify_trace() and count_bits(). The scalar versions in afl-fuzz.c look
+   at the map eight bytes at a time; these take 16, 32 or 64 bytes per step,
+   and still skip all-zero chunks of the (typically very sparse) trace right
+   after loading them.
+
+   Hit counts are bucketed without the 64 kB count_class_lookup16[] table:
+   the bucket of a byte is the larger of a lookup on its low nibble (counts
+   up to 15) and one on its high nibble (everything above), both done with
+   a byte shuffle. SSE2 has no byte shuffle, so that level falls back to the
+   table for the non-zero chunks.
+
+   bitmap_analyze() fuses the classification with the other things that
+   afl-fuzz wants to know about a fresh trace: what has_new_bits() would
+   say (without updating the virgin map), the number of non-zero bytes and,
+   optionally, hash32() of the classified map. This way, the map and the
+   virgin map are only read once per execution.
+
+   The level is picked at run time with bitmap_simd_detect(); the AVX2 and
+   AVX-512 kernels are compiled with function-level target attributes, so
+   no special compiler flags are needed. All lengths must be multiples of
+   64. Other architectures only get BITMAP_SCALAR.
+*/
+
+#ifndef _HAVE_BITMAP_SIMD_H
+#define _HAVE_BITMAP_SIMD_H
+
+#include "types.h"
+#include "hash.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  define HAVE_BITMAP_SIMD 1
+#  include <immintrin.h>
+#endif /* __x86_64__ */
+
+/* Kernel levels. */
+
+enum {
+  /* 00 */ BITMAP_SCALAR,
+  /* 01 */ BITMAP_SSE2,
+  /* 02 */ BITMAP_AVX2,
+  /* 03 */ BITMAP_AVX512
+};
+
+
+/* Pick the best level that the CPU supports. */
+
+static inline u8 bitmap_simd_detect(void) {
+
+#ifdef HAVE_BITMAP_SIMD
+
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512bw")) return BITMAP_AVX512;
+  if (__builtin_cpu_supports("avx2")) return BITMAP_AVX2;
+
+  return BITMAP_SSE2;
+
+#else
+
+  return BITMAP_SCALAR;
+
+#endif /* ^HAVE_BITMAP_SIMD */
+
+}
+
+
+static inline const char* bitmap_simd_name(u8 level) {
+
+  switch (level) {
+
+    case BITMAP_SSE2:   return "SSE2";
+    case BITMAP_AVX2:   return "AVX2";
+    case BITMAP_AVX512: return "AVX-512";
+    default:            return "scalar";
+
+  }
+
+}
+
+
+#ifdef HAVE_BITMAP_SIMD
+
+#define BITMAP_TGT_AVX2   __attribute__((target("avx2")))
+#define BITMAP_TGT_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+
+/* Bucket of every count from 0 to 15, and of every count from 16 to 255 by
+   its high nibble (see count_class_lookup8[] in afl-fuzz.c). */
+
+#define BITMAP_LO_CLASSES \
+  0, 1, 2, 4, 8, 8, 8, 8, 16, 16, 16, 16, 16, 16, 16, 16
+
+#define BITMAP_HI_CLASSES \
+  0, 32, 64, 64, 64, 64, 64, 64, \
+  (char)128, (char)128, (char)128, (char)128, \
+  (char)128, (char)128, (char)128, (char)128
+
+#define BITMAP_POPCNT4 \
+  0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+
+
+/* Read a word of the map for hash32_step(), after it was written to with
+   other types. */
+
+static inline u64 bitmap_word(u8* mem) {
+
+  u64 ret;
+
+  memcpy(&ret, mem, sizeof(u64));
+  return ret;
+
+}
+
+
+/* classify_counts() */
+
+static inline void bitmap_classify_sse2(u8* mem, u32 len, const u16* lut16) {
+
+  const __m128i zero = _mm_setzero_si128();
+  u8* end = mem + len;
+
+  for (; mem < end; mem += 16) {
+
+    __m128i v = _mm_loadu_si128((__m128i*)mem);
+    u16* mem16 = (u16*)mem;
+    u32 i;
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) == 0xffff) continue;
+
+    for (i = 0; i < 8; i++) mem16[i] = lut16[mem16[i]];
+
+  }
+
+}
+
+
+static inline BITMAP_TGT_AVX2 void bitmap_classify_avx2(u8* mem, u32 len) {
+
+  const __m256i lo_lut = _mm256_setr_epi8(BITMAP_LO_CLASSES, BITMAP_LO_CLASSES),
+                hi_lut = _mm256_setr_epi8(BITMAP_HI_CLASSES, BITMAP_HI_CLASSES),
+                nibble = _mm256_set1_epi8(0x0f);
+  u8* end = mem + len;
+
+  for (; mem < end; mem += 32) {
+
+    __m256i v = _mm256_loadu_si256((__m256i*)mem), lo, hi;
+
+    if (_mm256_testz_si256(v, v)) continue;
+
+    lo = _mm256_shuffle_epi8(lo_lut, _mm256_and_si256(v, nibble));
+    hi = _mm256_shuffle_epi8(hi_lut,
+                             _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+
+    _mm256_storeu_si256((__m256i*)mem, _mm256_max_epu8(lo, hi));
+
+  }
+
+}
+
+
+static inline BITMAP_TGT_AVX512 void bitmap_classify_avx512(u8* mem, u32 len) {
+
+  const __m512i lo_lut = _mm512_broadcast_i32x4(
+                           _mm_setr_epi8(BITMAP_LO_CLASSES)),
+                hi_lut = _mm512_broadcast_i32x4(
+                           _mm_setr_epi8(BITMAP_HI_CLASSES)),
+                nibble = _mm512_set1_epi8(0x0f);
+  u8* end = mem + len;
+
+  for (; mem < end; mem += 64) {
+
+    __m512i v = _mm512_loadu_si512(mem), lo, hi;
+
+    if (!_mm512_test_epi8_mask(v, v)) continue;
+
+    lo = _mm512_shuffle_epi8(lo_lut, _mm512_and_si512(v, nibble));
+    hi = _mm512_shuffle_epi8(hi_lut,
+                             _mm512_and_si512(_mm512_srli_epi16(v, 4), nibble));
+
+    _mm512_storeu_si512(mem, _mm512_max_epu8(lo, hi));
+
+  }
+
+}
+
+
+/* has_new_bits(): clears the bits of cur[] in vir[], returns 2 if cur[]
+   hits a byte that is still pristine in vir[], 1 if it only has new bits
+   in bytes seen before, 0 otherwise. */
+
+static inline u8 bitmap_new_bits_sse2(u8* cur, u8* vir, u32 len) {
+
+  const __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi8(-1);
+  u8* end = cur + len;
+  u8  ret = 0;
+
+  for (; cur < end; cur += 16, vir += 16) {
+
+    __m128i c = _mm_loadu_si128((__m128i*)cur), v;
+    u32 c_zero = _mm_movemask_epi8(_mm_cmpeq_epi8(c, zero));
+
+    if (c_zero == 0xffff) continue;
+
+    v = _mm_loadu_si128((__m128i*)vir);
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(c, v), zero)) == 0xffff)
+      continue;
+
+    if (ret < 2)
+      ret = (_mm_movemask_epi8(_mm_cmpeq_epi8(v, ones)) & ~c_zero & 0xffff)
+            ? 2 : 1;
+
+    _mm_storeu_si128((__m128i*)vir, _mm_andnot_si128(c, v));
+
+  }
+
+  return ret;
+
+}
+
+
+static inline BITMAP_TGT_AVX2 u8 bitmap_new_bits_avx2(u8* cur, u8* vir,
+                                                     u32 len) {
+
+  const __m256i zero = _mm256_setzero_si256(), ones = _mm256_set1_epi8(-1);
+  u8* end = cur + len;
+  u8  ret = 0;
+
+  for (; cur < end; cur += 32, vir += 32) {
+
+    __m256i c = _mm256_loadu_si256((__m256i*)cur), v;
+
+    if (_mm256_testz_si256(c, c)) continue;
+
+    v = _mm256_loadu_si256((__m256i*)vir);
+
+    if (_mm256_testz_si256(c, v)) continue;
+
+    /* New tuple: cur != 0 where vir == 0xff. testc() is true if there is
+       none, i.e. if (~(cur == 0) & (vir == 0xff)) is all zero. */
+
+    if (ret < 2)
+      ret = _mm256_testc_si256(_mm256_cmpeq_epi8(c, zero),
+                               _mm256_cmpeq_epi8(v, ones)) ? 1 : 2;
+
+    _mm256_storeu_si256((__m256i*)vir, _mm256_andnot_si256(c, v));
+
+  }
+
+  return ret;
+
+}
+
+
+static inline BITMAP_TGT_AVX512 u8 bitmap_new_bits_avx512(u8* cur, u8* vir,
+                                                         u32 len) {
+
+  const __m512i ones = _mm512_set1_epi8(-1);
+  u8* end = cur + len;
+  u8  ret = 0;
+
+  for (; cur < end; cur += 64, vir += 64) {
+
+    __m512i c = _mm512_loadu_si512(cur), v;
+    __mmask64 c_set = _mm512_test_epi8_mask(c, c);
+
+    if (!c_set) continue;
+
+    v = _mm512_loadu_si512(vir);
+
+    if (!_mm512_test_epi8_mask(c, v)) continue;
+
+    if (ret < 2)
+      ret = (c_set & _mm512_cmpeq_epi8_mask(v, ones)) ? 2 : 1;
+
+    _mm512_storeu_si512(vir, _mm512_andnot_si512(c, v));
+
+  }
+
+  return ret;
+
+}
+
+
+/* simplify_trace(): 1 for tuples not hit, 128 for those hit. */
+
+static inline void bitmap_simplify_sse2(u8* mem, u32 len) {
+
+  const __m128i zero = _mm_setzero_si128(),
+                miss = _mm_set1_epi8(1), hit = _mm_set1_epi8(-128);
+  u8* end = mem + len;
+
+  for (; mem < end; mem += 16) {
+
+    __m128i z = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)mem), zero);
+
+    _mm_storeu_si128((__m128i*)mem, _mm_or_si128(_mm_and_si128(z, miss),
+                                                 _mm_andnot_si128(z, hit)));
+
+  }
+
+}
+
+
+static inline BITMAP_TGT_AVX2 void bitmap_simplify_avx2(u8* mem, u32 len) {
+
+  const __m256i zero = _mm256_setzero_si256(),
+                miss = _mm256_set1_epi8(1), hit = _mm256_set1_epi8(-128);
+  u8* end = mem + len;
+
+  for (; mem < end; mem += 32) {
+
+    __m256i z = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*)mem), zero);
+
+    _mm256_storeu_si256((__m256i*)mem, _mm256_blendv_epi8(hit, miss, z));
+
+  }
+
+}
+
+
+static inline BITMAP_TGT_AVX512 void bitmap_simplify_avx512(u8* mem, u32 len) {
+
+  const __m512i miss = _mm512_set1_epi8(1), hit = _mm512_set1_epi8(-128);
+  u8* end = mem + len;
+
+  for (; mem < end; mem += 64) {
+
+    __m512i v = _mm512_loadu_si512(mem);
+
+    _mm512_storeu_si512(mem, _mm512_mask_blend_epi8(
+                               _mm512_test_epi8_mask(v, v), miss, hit));
+
+  }
+
+}
+
+
+/* count_bits() */
+
+static inline u32 bitmap_count_bits_sse2(u8* mem, u32 len) {
+
+  const __m128i m1 = _mm_set1_epi8(0x55), m2 = _mm_set1_epi8(0x33),
+                m4 = _mm_set1_epi8(0x0f), zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  u8* end = mem + len;
+
+  for (; mem < end; mem += 16) {
+
+    __m128i v = _mm_loadu_si128((__m128i*)mem);
+
+    v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi64(v, 1), m1));
+    v = _mm_add_epi8(_mm_and_si128(v, m2),
+                     _mm_and_si128(_mm_srli_epi64(v, 2), m2));
+    v = _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi64(v, 4)), m4);
+
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+
+  }
+
+  return _mm_cvtsi128_si64(acc) +
+         _mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+
+}
+
+
+static inline BITMAP_TGT_AVX2 u32 bitmap_count_bits_avx2(u8* mem, u32 len) {
+
+  const __m256i lut = _mm256_setr_epi8(BITMAP_POPCNT4, BITMAP_POPCNT4),
+                nibble = _mm256_set1_epi8(0x0f), zero = _mm256_setzero_si256();
+  __m256i acc = zero;
+  u8* end = mem + len;
+
+  for (; mem < end; mem += 32) {
+
+    __m256i v = _mm256_loadu_si256((__m256i*)mem),
+            n = _mm256_add_epi8(
+                  _mm256_shuffle_epi8(lut, _mm256_and_si256(v, nibble)),
+                  _mm256_shuffle_epi8(lut, _mm256_and_si256(
+                                             _mm256_srli_epi16(v, 4), nibble)));
+
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(n, zero));
+
+  }
+
+  return _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+         _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+
+}
+
+
+static inline BITMAP_TGT_AVX512 u32 bitmap_count_bits_avx512(u8* mem,
+                                                            u32 len) {
+
+  const __m512i lut = _mm512_broadcast_i32x4(_mm_setr_epi8(BITMAP_POPCNT4)),
+                nibble = _mm512_set1_epi8(0x0f), zero = _mm512_setzero_si512();
+  __m512i acc = zero;
+  u8* end = mem + len;
+
+  for (; mem < end; mem += 64) {
+
+    __m512i v = _mm512_loadu_si512(mem),
+            n = _mm512_add_epi8(
+                  _mm512_shuffle_epi8(lut, _mm512_and_si512(v, nibble)),
+                  _mm512_shuffle_epi8(lut, _mm512_and_si512(
+                                             _mm512_srli_epi16(v, 4), nibble)));
+
+    acc = _mm512_add_epi64(acc, _mm512_sad_epu8(n, zero));
+
+  }
+
+  return _mm512_reduce_add_epi64(acc);
+
+}
+
+
+/* Fused post-exec pass: classifies mem[] in place, stores the number of
+   non-zero bytes in *bytes, feeds the classified words to hash32_step() if
+   h1 is not NULL, and returns what has_new_bits() would return for vir[]
+   (which is left alone). */
+
+static inline u8 bitmap_analyze_sse2(u8* mem, u8* vir, u32 len, u32* bytes,
+                                     u64* h1, const u16* lut16) {
+
+  const __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi8(-1);
+  u8* end = mem + len;
+  u32 cnt = 0;
+  u8  ret = 0;
+
+  for (; mem < end; mem += 16, vir += 16) {
+
+    __m128i c = _mm_loadu_si128((__m128i*)mem), v;
+    u16* mem16 = (u16*)mem;
+    u32 c_zero = _mm_movemask_epi8(_mm_cmpeq_epi8(c, zero)), i;
+
+    if (c_zero != 0xffff) {
+
+      for (i = 0; i < 8; i++) mem16[i] = lut16[mem16[i]];
+
+      c    = _mm_loadu_si128((__m128i*)mem);
+      cnt += 16 - __builtin_popcount(c_zero);
+
+      if (ret < 2) {
+
+        v = _mm_loadu_si128((__m128i*)vir);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(c, v), zero))
+            != 0xffff)
+          ret = (_mm_movemask_epi8(_mm_cmpeq_epi8(v, ones)) & ~c_zero &
+                 0xffff) ? 2 : 1;
+
+      }
+
+    }
+
+    if (h1) {
+      *h1 = hash32_step(*h1, bitmap_word(mem));
+      *h1 = hash32_step(*h1, bitmap_word(mem + 8));
+    }
+
+  }
+
+  *bytes = cnt;
+  return ret;
+
+}
+
+
+static inline BITMAP_TGT_AVX2 u8 bitmap_analyze_avx2(u8* mem, u8* vir,
+                                                    u32 len, u32* bytes,
+                                                    u64* h1) {
+
+  const __m256i lo_lut = _mm256_setr_epi8(BITMAP_LO_CLASSES, BITMAP_LO_CLASSES),
+                hi_lut = _mm256_setr_epi8(BITMAP_HI_CLASSES, BITMAP_HI_CLASSES),
+                nibble = _mm256_set1_epi8(0x0f),
+                zero   = _mm256_setzero_si256(),
+                ones   = _mm256_set1_epi8(-1);
+  u8* end = mem + len;
+  u32 cnt = 0, i;
+  u8  ret = 0;
+
+  for (; mem < end; mem += 32, vir += 32) {
+
+    __m256i c = _mm256_loadu_si256((__m256i*)mem), v, c_zero;
+
+    if (!_mm256_testz_si256(c, c)) {
+
+      c = _mm256_max_epu8(
+            _mm256_shuffle_epi8(lo_lut, _mm256_and_si256(c, nibble)),
+            _mm256_shuffle_epi8(hi_lut, _mm256_and_si256(
+                                          _mm256_srli_epi16(c, 4), nibble)));
+
+      _mm256_storeu_si256((__m256i*)mem, c);
+
+      c_zero = _mm256_cmpeq_epi8(c, zero);
+      cnt   += 32 - __builtin_popcount(_mm256_movemask_epi8(c_zero));
+
+      if (ret < 2) {
+
+        v = _mm256_loadu_si256((__m256i*)vir);
+
+        if (!_mm256_testz_si256(c, v))
+          ret = _mm256_testc_si256(c_zero, _mm256_cmpeq_epi8(v, ones)) ? 1 : 2;
+
+      }
+
+    }
+
+    if (h1)
+      for (i = 0; i < 4; i++) *h1 = hash32_step(*h1, bitmap_word(mem + i * 8));
+
+  }
+
+  *bytes = cnt;
+  return ret;
+
+}
+
+
+static inline BITMAP_TGT_AVX512 u8 bitmap_analyze_avx512(u8* mem, u8* vir,
+                                                        u32 len, u32* bytes,
+                                                        u64* h1) {
+
+  const __m512i lo_lut = _mm512_broadcast_i32x4(
+                           _mm_setr_epi8(BITMAP_LO_CLASSES)),
+                hi_lut = _mm512_broadcast_i32x4(
+                           _mm_setr_epi8(BITMAP_HI_CLASSES)),
+                nibble = _mm512_set1_epi8(0x0f),
+                ones   = _mm512_set1_epi8(-1);
+  u8* end = mem + len;
+  u32 cnt = 0, i;
+  u8  ret = 0;
+
+  for (; mem < end; mem += 64, vir += 64) {
+
+    __m512i c = _mm512_loadu_si512(mem), v;
+
+    if (_mm512_test_epi8_mask(c, c)) {
+
+      __mmask64 c_set;
+
+      c = _mm512_max_epu8(
+            _mm512_shuffle_epi8(lo_lut, _mm512_and_si512(c, nibble)),
+            _mm512_shuffle_epi8(hi_lut, _mm512_and_si512(
+                                          _mm512_srli_epi16(c, 4), nibble)));
+
+      _mm512_storeu_si512(mem, c);
+
+      c_set = _mm512_test_epi8_mask(c, c);
+      cnt  += __builtin_popcountll(c_set);
+
+      if (ret < 2) {
+
+        v = _mm512_loadu_si512(vir);
+
+        if (_mm512_test_epi8_mask(c, v))
+          ret = (c_set & _mm512_cmpeq_epi8_mask(v, ones)) ? 2 : 1;
+
+      }
+
+    }
+
+    if (h1)
+      for (i = 0; i < 8; i++) *h1 = hash32_step(*h1, bitmap_word(mem + i * 8));
+
+  }
+
+  *bytes = cnt;
+  return ret;
+
+}
+
+
+/* Dispatch on the level; never called with BITMAP_SCALAR. */
+
+static inline void bitmap_classify(u8 level, u8* mem, u32 len,
+                                   const u16* lut16) {
+
+  switch (level) {
+
+    case BITMAP_AVX512: bitmap_classify_avx512(mem, len); break;
+    case BITMAP_AVX2:   bitmap_classify_avx2(mem, len); break;
+    default:            bitmap_classify_sse2(mem, len, lut16);
+
+  }
+
+}
+
+
+static inline u8 bitmap_new_bits(u8 level, u8* cur, u8* vir, u32 len) {
+
+  switch (level) {
+
+    case BITMAP_AVX512: return bitmap_new_bits_avx512(cur, vir, len);
+    case BITMAP_AVX2:   return bitmap_new_bits_avx2(cur, vir, len);
+    default:            return bitmap_new_bits_sse2(cur, vir, len);
+
+  }
+
+}
+
+
+static inline void bitmap_simplify(u8 level, u8* mem, u32 len) {
+
+  switch (level) {
+
+    case BITMAP_AVX512: bitmap_simplify_avx512(mem, len); break;
+    case BITMAP_AVX2:   bitmap_simplify_avx2(mem, len); break;
+    default:            bitmap_simplify_sse2(mem, len);
+
+  }
+
+}
+
+
+static inline u32 bitmap_count_bits(u8 level, u8* mem, u32 len) {
+
+  switch (level) {
+
+    case BITMAP_AVX512: return bitmap_count_bits_avx512(mem, len);
+    case BITMAP_AVX2:   return bitmap_count_bits_avx2(mem, len);
+    default:            return bitmap_count_bits_sse2(mem, len);
+
+  }
+
+}
+
+static inline u8 bitmap_analyze(u8 level, u8* mem, u8* vir, u32 len,
+                                u32* bytes, u64* h1, const u16* lut16) {
+
+  switch (level) {
+
+    case BITMAP_AVX512:
+      return bitmap_analyze_avx512(mem, vir, len, bytes, h1);
+
+    case BITMAP_AVX2:
+      return bitmap_analyze_avx2(mem, vir, len, bytes, h1);
+
+    default:
+      return bitmap_analyze_sse2(mem, vir, len, bytes, h1, lut16);
+
+  }
+
+}
+
+#endif /* HAVE_BITMAP_SIMD */
+
+#endif /* !_HAVE_BITMAP_SIMD_H */
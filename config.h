@@ -54,6 +54,10 @@
 
 #define EXEC_TM_ROUND       20
 
+/* Timeout for the PACFIX coverage and valuation oracles (milliseconds): */
+
+#define PACFIX_TMOUT        10000
+
 /* 64bit arch MACRO */
 #if (defined (__x86_64__) || defined (__arm64__) || defined (__aarch64__))
 #define WORD_SIZE_64 1
@@ -77,6 +81,11 @@
 #define CAL_CYCLES          8
 #define CAL_CYCLES_LONG     40
 
+/* Maximum number of executors (fork servers running side by side) that can
+   be requested with AFL_EXECUTORS: */
+
+#define EXECUTORS_MAX       64
+
 /* Number of subsequent timeouts before abandoning an input file: */
 
 #define TMOUT_LIMIT         250
@@ -138,6 +147,16 @@
 
 #define SPLICE_HAVOC        32
 
+/* Fixed-point scale of the keep probabilities in the proximity-weighted
+   splicing alias table: */
+
+#define SPLICE_PROB_ONE     (1 << 24)
+
+/* Number of DFG trace observations (roughly, new queue entries) after which
+   the proximity scores of the whole queue are brought up to date: */
+
+#define DFG_RESCORE_EPOCHS  64
+
 /* Maximum offset for integer addition / subtraction stages: */
 
 #define ARITH_MAX           35
@@ -208,6 +227,19 @@
 #define STATS_UPDATE_SEC    60
 #define PLOT_UPDATE_SEC     5
 
+/* Packed store (AFL_PACKED_STORE): write buffer size, number of buffered
+   index records, segment size after which a new one is started, and the
+   interval between fdatasync() calls (sec): */
+
+#define PACKED_BUF_SIZE     (1 * 1024 * 1024)
+#define PACKED_BUF_RECS     4096
+#define PACKED_SEG_SIZE     (256 * 1024 * 1024)
+#define PACKED_SYNC_SEC     30
+
+/* Initial number of slots in the content-hash dedup set (power of two): */
+
+#define DEDUP_INIT_SIZE     (1 << 12)
+
 /* Smoothing divisor for CPU load and exec speed stats (1 - no smoothing). */
 
 #define AVG_SMOOTHING       16
@@ -216,6 +248,14 @@
 
 #define SYNC_INTERVAL       5
 
+/* Size of the ring of the shared memory sync bus (AFL_SYNC_BUS), maximum
+   number of peers tracked on it, and number of syncs a reader waits for an
+   incomplete record before giving up on it: */
+
+#define SYNC_BUS_SIZE       (64 * 1024 * 1024)
+#define SYNC_BUS_PEERS      256
+#define SYNC_BUS_STALL      3
+
 /* Output directory reuse grace period (minutes): */
 
 #define OUTPUT_GRACE        25
@@ -277,8 +317,8 @@
 /* Environment variable used to pass SHM ID to the called program. */
 
 #define SHM_ENV_VAR         "__AFL_SHM_ID"
-#define SHM_ENV_VAR_DFG     "__AFL_SHM_ID_DFG"
-#define SHM_ENV_VAR_DFG_COUNT "__AFL_SHM_ID_DFG_COUNT"
+#define SHM_ENV_VAR_DFG_LIST "__AFL_SHM_ID_DFG_LIST"
+#define SHM_FUZZ_ENV_VAR    "__AFL_SHM_FUZZ_ID"
 
 /* Other less interesting, internal-only variables. */
 
@@ -292,6 +332,31 @@
 #define PERSIST_SIG         "##SIG_AFL_PERSISTENT##"
 #define DEFER_SIG           "##SIG_AFL_DEFER_FORKSRV##"
 
+/* In-code signature of binaries that mark when they reach the target line
+   (see DFG_LIST_SIZE()): */
+
+#define DFG_TARGET_SIG      "##SIG_AFL_DFG_TARGET##"
+
+/* In-code signature of runtimes that reset the DFG maps by themselves
+   between persistent mode iterations: */
+
+#define DFG_RESET_SIG       "##SIG_AFL_DFG_RESET##"
+
+/* In-code signature telling the number of DFG nodes the binary was built
+   with, as decimal digits right after it (see DFG_MAP_SIZE): */
+
+#define DFG_SIZE_SIG        "##SIG_AFL_DFG_SIZE##"
+
+/* In-code signature of the table of DFG node scores and path counts each
+   module carries (see dfg-meta.h): */
+
+#define DFG_NODES_SIG       "##SIG_AFL_DFG_NODES##"
+
+/* In-code signature of harnesses that take their input through
+   __AFL_FUZZ_TESTCASE_BUF and __AFL_FUZZ_TESTCASE_LEN: */
+
+#define SHM_FUZZ_SIG        "##SIG_AFL_SHM_FUZZ##"
+
 /* Distinctive bitmap signature used to indicate failed execution: */
 
 #define EXEC_FAIL_SIG       0xfee1dead
@@ -329,7 +394,37 @@
 
 #define MAP_SIZE_POW2       16
 #define MAP_SIZE            (1 << MAP_SIZE_POW2)
+
+/* The DFG maps are sized to the number of nodes in the DFG the binary was
+   built with, which the binary tells afl-fuzz with DFG_SIZE_SIG. Binaries
+   that don't (built with older versions of afl-clang-fast) are assumed to
+   use the old fixed size, DFG_MAP_SIZE, which is also the size of the
+   maps the runtime starts out with. DFG_MAX_SIZE caps the number of nodes,
+   to keep the maps within reason: */
+
 #define DFG_MAP_SIZE        32568
+#define DFG_MAX_SIZE        (1 << 24)
+
+/* Whether a DFG of _n nodes is big enough to keep the list of touched
+   nodes. For smaller ones, sweeping the map after every run costs less than
+   the extra work the list takes on every first hit: */
+
+#define DFG_SPARSE_MIN      MAP_SIZE
+#define DFG_SPARSE(_n)      ((_n) >= DFG_SPARSE_MIN)
+
+/* Layout of the DFG region, for a DFG of _n nodes. This is all the DFG
+   feedback there is; everything else about the nodes comes from the binary
+   itself (see DFG_NODES_SIG). The instrumented binary sets a byte in an
+   _n-byte map for every DFG node hit during a run. With big DFGs (see
+   DFG_SPARSE()), it also appends the index of the node to a list the first
+   time, so that the fuzzer can reset and score only the touched entries;
+   the region then holds a u32 entry count, followed by _n u32 node indices
+   and the map. Otherwise, it is just the map. One more byte of the map, at
+   index _n, is set when the run reaches the target line given at compile
+   time: */
+
+#define DFG_LIST_HIT_OFF(_n) (DFG_SPARSE(_n) ? 4 * ((_n) + 1) : 0)
+#define DFG_LIST_SIZE(_n)   (DFG_LIST_HIT_OFF(_n) + (_n) + 1)
 
 /* Maximum allocator request size (keep well under INT_MAX): */
 
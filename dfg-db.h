@@ -0,0 +1,251 @@
+/*
+   DAFL - DFG database
+   -------------------
+
+   Binary form of the DAFL_DFG_SCORE and DAFL_SELECTIVE_COV inputs of the
+   LLVM pass, written by afl-dfg-db. With DAFL_DFG_DB set, the pass maps the
+   file and looks things up in place, instead of parsing the text files
+   again in every compiler process of a parallel build.
+
+   The file starts with a struct dfg_db; all offsets are from the start of
+   the file, and all sections are 8-byte aligned. There are four tables:
+
+     files   - source file name -> file ID, for the DFG node locations,
+     locs    - (file ID, line) -> struct dfg_db_node,
+     targets - "file\0function" -> DAFL_SELECTIVE_COV line selecting it,
+     funcs   - function -> the same, for DAFL_NO_FILENAME_MATCH.
+
+   Each is a minimal perfect hash table (hash and displace): a key is first
+   hashed into one of 'buckets' buckets, and the u32 displacement of that
+   bucket gives its slot. With DFG_DB_DIRECT set, the displacement is the
+   slot itself (this is used for buckets holding a single key); otherwise,
+   it seeds a second hash of the key. The ID of a file is its slot. Slots
+   name their keys, so that lookups of keys not in the table fail.
+
+   Strings are kept in a blob at the end, NUL-terminated; string offsets
+   are relative to the blob.
+*/
+
+#ifndef _HAVE_DFG_DB_H
+#define _HAVE_DFG_DB_H
+
+#include <string.h>
+
+#include "types.h"
+
+#define DFG_DB_MAGIC     "DAFLDB01"
+#define DFG_DB_MAGIC_LEN 8
+
+/* Flags, telling which inputs went into the database. */
+
+#define DFG_DB_HAS_DFG   0x01
+#define DFG_DB_HAS_COV   0x02
+
+/* Displacements that are slot numbers. */
+
+#define DFG_DB_DIRECT    0x80000000U
+
+/* Lookup miss. */
+
+#define DFG_DB_NONE      0xffffffffU
+
+struct dfg_db_table {
+
+  u32 cnt;                            /* Keys (and slots)                 */
+  u32 buckets;                        /* Displacement buckets             */
+  u64 disp_off;                       /* u32[buckets] displacements       */
+  u64 slot_off;                       /* Slots, cnt of them               */
+
+};
+
+struct dfg_db {
+
+  u8  magic[DFG_DB_MAGIC_LEN];        /* DFG_DB_MAGIC                     */
+  u32 node_cnt;                       /* DFG indices in use               */
+  u32 flags;                          /* DFG_DB_HAS_*                     */
+  u64 size;                           /* Size of the whole file           */
+  u64 str_off;                        /* String blob                      */
+  u64 str_len;                        /* Size of the string blob          */
+
+  struct dfg_db_table files,          /* struct dfg_db_str slots          */
+                      locs,           /* struct dfg_db_node slots         */
+                      targets,        /* struct dfg_db_target slots       */
+                      funcs;          /* struct dfg_db_target slots       */
+
+};
+
+struct dfg_db_str {
+
+  u32 off;                            /* Offset in the blob               */
+  u32 len;                            /* Length, without the NUL          */
+
+};
+
+struct dfg_db_node {
+
+  u32 file_id;                        /* Slot in the files table          */
+  u32 line;                           /* Line number                      */
+  u32 idx;                            /* DFG index                        */
+  u32 score;                          /* Proximity score                  */
+  u64 path_cnt;                       /* Number of DFG paths              */
+
+};
+
+struct dfg_db_target {
+
+  struct dfg_db_str key;              /* "file\0function" or "function"   */
+  u32 line_off;                       /* DAFL_SELECTIVE_COV line, in blob */
+
+};
+
+
+/* Hash a key; seed 0 picks the bucket, others the slot. */
+
+static inline u32 dfg_db_hash(const u8* key, u32 len, u32 seed) {
+
+  u64 h = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+
+  while (len--) {
+    h ^= *key++;
+    h *= 0x100000001b3ULL;
+  }
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+
+  return (u32)h;
+
+}
+
+
+/* Find the only slot a key may be in, or DFG_DB_NONE for empty tables. */
+
+static inline u32 dfg_db_slot(const u8* db, const struct dfg_db_table* t,
+                              const u8* key, u32 len) {
+
+  u32 d;
+
+  if (!t->cnt) return DFG_DB_NONE;
+
+  d = ((const u32*)(db + t->disp_off))[dfg_db_hash(key, len, 0) % t->buckets];
+
+  if (d & DFG_DB_DIRECT) return (d & ~DFG_DB_DIRECT) % t->cnt;
+
+  return dfg_db_hash(key, len, d) % t->cnt;
+
+}
+
+
+/* Check whether a blob string is the given key. */
+
+static inline u8 dfg_db_str_eq(const u8* db, const struct dfg_db_str* s,
+                               const u8* key, u32 len) {
+
+  const struct dfg_db* hdr = (const struct dfg_db*)db;
+
+  return s->len == len && (u64)s->off + len < hdr->str_len &&
+         !memcmp(db + hdr->str_off + s->off, key, len);
+
+}
+
+
+/* Look up the ID of a file, DFG_DB_NONE if it has no DFG nodes. */
+
+static inline u32 dfg_db_find_file(const u8* db, const u8* name, u32 len) {
+
+  const struct dfg_db* hdr = (const struct dfg_db*)db;
+  u32 slot = dfg_db_slot(db, &hdr->files, name, len);
+
+  if (slot == DFG_DB_NONE) return DFG_DB_NONE;
+
+  if (!dfg_db_str_eq(db, (const struct dfg_db_str*)(db + hdr->files.slot_off)
+                         + slot, name, len)) return DFG_DB_NONE;
+
+  return slot;
+
+}
+
+
+/* Look up the DFG node at a line of a file, NULL if there is none. */
+
+static inline const struct dfg_db_node* dfg_db_find_node(const u8* db,
+                                                         u32 file_id,
+                                                         u32 line) {
+
+  const struct dfg_db* hdr = (const struct dfg_db*)db;
+  const struct dfg_db_node* node;
+  u32 key[2] = { file_id, line };
+  u32 slot = dfg_db_slot(db, &hdr->locs, (const u8*)key, sizeof(key));
+
+  if (slot == DFG_DB_NONE) return NULL;
+
+  node = (const struct dfg_db_node*)(db + hdr->locs.slot_off) + slot;
+
+  if (node->file_id != file_id || node->line != line) return NULL;
+
+  return node;
+
+}
+
+
+/* Look up a key in the targets or funcs table, returning the line that
+   selected it, or NULL. */
+
+static inline const u8* dfg_db_find_target(const u8* db,
+                                           const struct dfg_db_table* t,
+                                           const u8* key, u32 len) {
+
+  const struct dfg_db* hdr = (const struct dfg_db*)db;
+  const struct dfg_db_target* ent;
+  u32 slot = dfg_db_slot(db, t, key, len);
+
+  if (slot == DFG_DB_NONE) return NULL;
+
+  ent = (const struct dfg_db_target*)(db + t->slot_off) + slot;
+
+  if (!dfg_db_str_eq(db, &ent->key, key, len) ||
+      ent->line_off >= hdr->str_len) return NULL;
+
+  return db + hdr->str_off + ent->line_off;
+
+}
+
+
+/* Sanity-check a mapped database of the given size. Returns an error
+   message, or NULL if the file looks fine. */
+
+static inline const char* dfg_db_check(const u8* db, u64 size) {
+
+  const struct dfg_db* hdr = (const struct dfg_db*)db;
+  const struct dfg_db_table* t[4];
+  u64 slot_len[4] = { sizeof(struct dfg_db_str), sizeof(struct dfg_db_node),
+                      sizeof(struct dfg_db_target),
+                      sizeof(struct dfg_db_target) };
+  u32 i;
+
+  if (size < sizeof(struct dfg_db) ||
+      memcmp(hdr->magic, DFG_DB_MAGIC, DFG_DB_MAGIC_LEN))
+    return "not a DFG database";
+
+  if (hdr->size != size) return "truncated DFG database";
+
+  t[0] = &hdr->files;
+  t[1] = &hdr->locs;
+  t[2] = &hdr->targets;
+  t[3] = &hdr->funcs;
+
+  for (i = 0; i < 4; i++)
+    if ((t[i]->cnt && !t[i]->buckets) ||
+        t[i]->disp_off + (u64)t[i]->buckets * 4 > size ||
+        t[i]->slot_off + t[i]->cnt * slot_len[i] > size ||
+        (t[i]->disp_off | t[i]->slot_off) & 7)
+      return "corrupt DFG database";
+
+  if (hdr->str_off + hdr->str_len > size) return "corrupt DFG database";
+
+  return NULL;
+
+}
+
+#endif /* !_HAVE_DFG_DB_H */
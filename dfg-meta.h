@@ -0,0 +1,48 @@
+/*
+   DAFL - DFG node tables
+   ----------------------
+
+   What is known about a DFG node is fixed when the binary is built, so
+   rather than having the target store it in shared memory on every run,
+   afl-llvm-pass.so.cc writes it into the binary, and afl-fuzz reads it once
+   at startup: the proximity score and path count of the node, which the
+   scoring works from, and where the node is, for the status screen and
+   fuzzer_stats. At run time, the target only tells which nodes it reached.
+
+   Every module with DFG nodes carries a table of its own, as a constant
+   blob in the DFG_META_SECTION section: DFG_NODES_SIG (without the NUL), a
+   u32 entry count, the u32 size of the string blob, that many struct
+   dfg_meta_node entries, then the string blob. Everything is in host byte
+   order, and nothing is aligned, so readers should memcpy() the fields
+   out. Strings are NUL-terminated, and string offsets are relative to the
+   blob.
+
+   A node may show up in the tables of several modules (e.g. when it sits in
+   an inline function of a header file); the entries then only differ in
+   the function.
+*/
+
+#ifndef _HAVE_DFG_META_H
+#define _HAVE_DFG_META_H
+
+#include "types.h"
+
+/* Section the tables go into; afl-fuzz finds them by their signature, so
+   this only keeps them together, away from the code. */
+
+#define DFG_META_SECTION       ".dafl_dfg"
+#define DFG_META_SECTION_MACHO "__TEXT,__dafl_dfg"
+
+struct dfg_meta_node {
+
+  u32 idx;                            /* DFG index                        */
+  u32 score;                          /* Proximity score                  */
+  u64 path_cnt;                       /* Number of DFG paths              */
+  u32 line;                           /* Line number                      */
+  u32 file_off;                       /* Source file name, in the blob    */
+  u32 func_off;                       /* Function name, in the blob       */
+  u32 pad;                            /* Zero                             */
+
+};
+
+#endif /* !_HAVE_DFG_META_H */
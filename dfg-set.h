@@ -0,0 +1,93 @@
+/*
+   DAFL - compact DFG node sets
+   ----------------------------
+
+   Per-seed record of the DFG nodes reached by a test case. A set is a
+   sorted list of node indices, stored as the gaps between consecutive
+   entries in a little-endian base-128 varint encoding. The nodes reached by
+   one execution tend to be clustered, so most gaps take a single byte and a
+   typical seed needs a few dozen bytes, rather than a bitmap over the whole
+   DFG.
+
+   Sets are only ever walked front to back, with dfg_set_next(), which is
+   all the fuzzer needs.
+*/
+
+#ifndef _HAVE_DFG_SET_H
+#define _HAVE_DFG_SET_H
+
+#include "types.h"
+#include "alloc-inl.h"
+
+/* Cursor for walking a set. */
+
+struct dfg_set_iter {
+
+  u8* pos;                            /* Next byte to decode              */
+  u8* end;                            /* End of the encoded set           */
+  s32 node;                           /* Last node returned, -1 at start  */
+
+};
+
+
+/* Encode a sorted, duplicate-free list of nodes. Returns a buffer from
+   ck_alloc() and stores its length in *len. */
+
+static inline u8* dfg_set_encode(u32* nodes, u32 cnt, u32* len) {
+
+  u8* buf = ck_alloc_nozero(MAX(cnt * 5, 1));
+  s32 prev = -1;
+  u32 i, off = 0;
+
+  for (i = 0; i < cnt; i++) {
+
+    u32 gap = nodes[i] - prev - 1;
+
+    while (gap >= 0x80) {
+      buf[off++] = (gap & 0x7f) | 0x80;
+      gap >>= 7;
+    }
+
+    buf[off++] = gap;
+    prev = nodes[i];
+
+  }
+
+  *len = off;
+  return ck_realloc(buf, MAX(off, 1));
+
+}
+
+
+static inline void dfg_set_iter_init(struct dfg_set_iter* it, u8* set,
+                                     u32 len) {
+
+  it->pos  = set;
+  it->end  = set + len;
+  it->node = -1;
+
+}
+
+
+/* Fetch the next node of the set into *node. Returns 0 past the end. */
+
+static inline u8 dfg_set_next(struct dfg_set_iter* it, u32* node) {
+
+  u32 gap = 0, shift = 0;
+
+  if (it->pos >= it->end) return 0;
+
+  while (*it->pos & 0x80) {
+    gap |= (*it->pos++ & 0x7f) << shift;
+    shift += 7;
+  }
+
+  gap |= *it->pos++ << shift;
+
+  it->node += gap + 1;
+  *node = it->node;
+  return 1;
+
+}
+
+#endif /* !_HAVE_DFG_SET_H */
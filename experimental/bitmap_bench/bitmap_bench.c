@@ -0,0 +1,380 @@
+/*
+   DAFL - coverage map kernel benchmark
+   ------------------------------------
+
+   Times classify_counts(), has_new_bits(), simplify_trace() and count_bits()
+   from afl-fuzz.c with every kernel level the CPU supports (scalar, SSE2,
+   AVX2, AVX-512; see bitmap-simd.h), and checks that all levels agree. The
+   fused post-exec pass, analyze_trace(), is timed against the separate
+   passes it replaces ('separate'), with and without the checksum, and
+   checked against them.
+
+   Real traces give the most meaningful numbers. To collect them, run a
+   queue through afl-showmap in binary mode:
+
+     mkdir traces
+     for i in out/queue/id*; do
+       ../../afl-showmap -q -b -o traces/`basename $i` -- ./target <$i
+     done
+
+   Then build the benchmark, and run it with the traces as arguments, i.e.
+   ./bitmap_bench traces/<file> ...:
+
+     gcc -O3 -funroll-loops -Wall -Wno-pointer-sign -I../.. bitmap_bench.c \
+       -o bitmap_bench -ldl -lm
+
+   Without arguments, a handful of made-up traces of varying density are
+   used instead. Timings are per 64 kB map; those for classify_counts() and
+   simplify_trace() include restoring the map, which is also shown on its
+   own as 'memcpy'.
+*/
+
+#define AFL_LIB
+
+#define AFL_PATH "/usr/local/lib/afl"
+#define DOC_PATH "/usr/local/share/doc/afl"
+#define BIN_PATH "/usr/local/bin"
+
+/* Only a few functions of afl-fuzz.c are used here, and with no main() to
+   set up its globals, GCC also finds some of them NULL in code that never
+   runs. Neither is worth a warning. */
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wnonnull"
+#pragma GCC diagnostic ignored "-Wformat-overflow"
+
+#include "../../afl-fuzz.c"
+
+#pragma GCC diagnostic pop
+
+#define MAX_TRACES 4096
+#define MIN_ROUNDS 2000
+
+static u8* traces[MAX_TRACES];
+static u32 trace_cnt;
+
+static u8 work[MAP_SIZE] __attribute__((aligned(64))),
+          work2[MAP_SIZE] __attribute__((aligned(64))),
+          virgin2[MAP_SIZE];
+
+
+/* Load a trace written by afl-showmap -b. */
+
+static void load_trace(u8* fn) {
+
+  struct stat st;
+  s32 fd;
+
+  if (trace_cnt == MAX_TRACES) return;
+
+  fd = open(fn, O_RDONLY);
+  if (fd < 0) PFATAL("Unable to open '%s'", fn);
+
+  if (fstat(fd, &st) || st.st_size != MAP_SIZE)
+    FATAL("'%s' is not a %u-byte map", fn, MAP_SIZE);
+
+  traces[trace_cnt] = ck_alloc_nozero(MAP_SIZE);
+  ck_read(fd, traces[trace_cnt], MAP_SIZE, fn);
+  close(fd);
+
+  trace_cnt++;
+
+}
+
+
+/* Make up traces with the given share of non-zero bytes (per mille), with
+   hits clustered into runs, as they tend to be. */
+
+static void fake_traces(void) {
+
+  static const u32 density[] = { 1, 5, 20, 80 };
+  u32 i, j;
+
+  srandom(1);
+
+  for (i = 0; i < sizeof(density) / sizeof(u32); i++)
+    for (j = 0; j < 16; j++) {
+
+      u8* t = ck_alloc(MAP_SIZE);
+      u32 k;
+
+      for (k = 0; k < MAP_SIZE; k++)
+        if ((u32)random() % 1000 < density[i]) {
+
+          u32 run = random() % 8 + 1;
+
+          while (run-- && k < MAP_SIZE)
+            t[k++] = random() % 3 ? random() % 4 + 1 : random() % 256;
+
+        }
+
+      traces[trace_cnt++] = t;
+
+    }
+
+}
+
+
+/* Rounds over the whole set of traces, for a decent run time. */
+
+static u32 rounds(void) {
+
+  return MAX(MIN_ROUNDS / trace_cnt, 1);
+
+}
+
+
+static void report(const char* what, u8 level, u64 us) {
+
+  SAYF("  %-22s %-8s %8.1f ns\n", what, bitmap_simd_name(level),
+       us * 1000.0 / ((double)rounds() * trace_cnt));
+
+}
+
+
+/* Run the kernels with the current level; store the results for the
+   checks. */
+
+static u64 classify_sum, simplify_sum, new_bits_sum;
+static u32 bits_cnt;
+
+static void run_level(u8 level) {
+
+  u32 r, i;
+  u64 start;
+
+  bitmap_simd = level;
+
+  /* Baseline: just the copy. */
+
+  start = get_cur_time_us();
+
+  for (r = 0; r < rounds(); r++)
+    for (i = 0; i < trace_cnt; i++) {
+      memcpy(work, traces[i], MAP_SIZE);
+      __asm__ volatile("" : : "r"(work) : "memory");
+    }
+
+  if (level == BITMAP_SCALAR)
+    report("memcpy", level, get_cur_time_us() - start);
+
+  trace_bits = work;
+
+  /* classify_counts() */
+
+  start = get_cur_time_us();
+
+  for (r = 0; r < rounds(); r++)
+    for (i = 0; i < trace_cnt; i++) {
+      memcpy(work, traces[i], MAP_SIZE);
+      classify_counts((u64*)work);
+    }
+
+  report("classify_counts", level, get_cur_time_us() - start);
+
+  classify_sum = 0;
+
+  for (i = 0; i < trace_cnt; i++) {
+    memcpy(work, traces[i], MAP_SIZE);
+    classify_counts((u64*)work);
+    classify_sum = classify_sum * 31 + hash32(work, MAP_SIZE, HASH_CONST);
+  }
+
+  /* simplify_trace() */
+
+  start = get_cur_time_us();
+
+  for (r = 0; r < rounds(); r++)
+    for (i = 0; i < trace_cnt; i++) {
+      memcpy(work, traces[i], MAP_SIZE);
+      simplify_trace((u64*)work);
+    }
+
+  report("simplify_trace", level, get_cur_time_us() - start);
+
+  simplify_sum = 0;
+
+  for (i = 0; i < trace_cnt; i++) {
+    memcpy(work, traces[i], MAP_SIZE);
+    simplify_trace((u64*)work);
+    simplify_sum = simplify_sum * 31 + hash32(work, MAP_SIZE, HASH_CONST);
+  }
+
+  /* has_new_bits(), on a fresh virgin map first, which is also checked, and
+     then in the steady state, where nothing is new any more. */
+
+  memset(virgin_bits, 255, MAP_SIZE);
+  new_bits_sum = 0;
+
+  for (i = 0; i < trace_cnt; i++) {
+    trace_bits   = traces[i];
+    new_bits_sum = new_bits_sum * 3 + has_new_bits(virgin_bits);
+  }
+
+  new_bits_sum = new_bits_sum * 31 + hash32(virgin_bits, MAP_SIZE, HASH_CONST);
+
+  start = get_cur_time_us();
+
+  for (r = 0; r < rounds(); r++)
+    for (i = 0; i < trace_cnt; i++) {
+      trace_bits = traces[i];
+      has_new_bits(virgin_bits);
+    }
+
+  report("has_new_bits", level, get_cur_time_us() - start);
+
+  /* analyze_trace(), first checked against the separate passes, as the
+     virgin map fills up... */
+
+  memset(virgin_bits, 255, MAP_SIZE);
+
+  for (i = 0; i < trace_cnt; i++) {
+
+    u8 hnb;
+
+    memcpy(work2, traces[i], MAP_SIZE);
+    memcpy(virgin2, virgin_bits, MAP_SIZE);
+
+    trace_bits = work2;
+    classify_counts((u64*)work2);
+    last_trace.map = NULL;
+    hnb = has_new_bits(virgin2);
+
+    memcpy(work, traces[i], MAP_SIZE);
+
+    trace_bits = work;
+    total_execs++;
+    want_cksum = i & 1;
+    analyze_trace();
+    want_cksum = 0;
+
+    if (memcmp(work, work2, MAP_SIZE) ||
+        trace_bytes() != count_bytes(work2) ||
+        trace_cksum() != hash32(work2, MAP_SIZE, HASH_CONST) ||
+        has_new_bits(virgin_bits) != hnb ||
+        memcmp(virgin_bits, virgin2, MAP_SIZE))
+      FATAL("analyze_trace() (%s) is off for trace %u",
+            bitmap_simd_name(level), i);
+
+  }
+
+  /* ...then timed in the steady state. */
+
+  start = get_cur_time_us();
+
+  for (r = 0; r < rounds(); r++)
+    for (i = 0; i < trace_cnt; i++) {
+      memcpy(work, traces[i], MAP_SIZE);
+      trace_bits = work;
+      classify_counts((u64*)work);
+      last_trace.map = NULL;
+      has_new_bits(virgin_bits);
+      bits_cnt = count_bytes(work);
+    }
+
+  report("separate", level, get_cur_time_us() - start);
+
+  start = get_cur_time_us();
+
+  for (r = 0; r < rounds(); r++)
+    for (i = 0; i < trace_cnt; i++) {
+      memcpy(work, traces[i], MAP_SIZE);
+      total_execs++;
+      analyze_trace();
+      has_new_bits(virgin_bits);
+      bits_cnt = trace_bytes();
+    }
+
+  report("analyze_trace", level, get_cur_time_us() - start);
+
+  start = get_cur_time_us();
+
+  for (r = 0; r < rounds(); r++)
+    for (i = 0; i < trace_cnt; i++) {
+      memcpy(work, traces[i], MAP_SIZE);
+      classify_counts((u64*)work);
+      last_trace.map = NULL;
+      has_new_bits(virgin_bits);
+      bits_cnt = count_bytes(work) + hash32(work, MAP_SIZE, HASH_CONST);
+    }
+
+  report("separate + cksum", level, get_cur_time_us() - start);
+
+  want_cksum = 1;
+  start = get_cur_time_us();
+
+  for (r = 0; r < rounds(); r++)
+    for (i = 0; i < trace_cnt; i++) {
+      memcpy(work, traces[i], MAP_SIZE);
+      total_execs++;
+      analyze_trace();
+      has_new_bits(virgin_bits);
+      bits_cnt = trace_bytes() + trace_cksum();
+    }
+
+  report("analyze_trace + cksum", level, get_cur_time_us() - start);
+
+  want_cksum = 0;
+
+  /* count_bits() */
+
+  start = get_cur_time_us();
+
+  for (r = 0; r < rounds(); r++)
+    for (i = 0; i < trace_cnt; i++) {
+      bits_cnt = count_bits(traces[i]);
+      __asm__ volatile("" : : "r"(bits_cnt) : "memory");
+    }
+
+  report("count_bits", level, get_cur_time_us() - start);
+
+  bits_cnt = 0;
+
+  for (i = 0; i < trace_cnt; i++) bits_cnt += count_bits(traces[i]);
+
+  SAYF("\n");
+
+}
+
+
+int main(int argc, char** argv) {
+
+  u64 ref_classify, ref_simplify, ref_new_bits;
+  u32 ref_bits, i, nz = 0;
+  u8  level, best = bitmap_simd_detect();
+
+  for (i = 1; i < argc; i++) load_trace(argv[i]);
+
+  if (!trace_cnt) fake_traces();
+
+  for (i = 0; i < trace_cnt; i++) nz += count_bytes(traces[i]);
+
+  init_count_class16();
+
+  SAYF("%u traces, %u non-zero bytes per trace on average, %u rounds.\n\n",
+       trace_cnt, nz / trace_cnt, rounds());
+
+  run_level(BITMAP_SCALAR);
+
+  ref_classify = classify_sum;
+  ref_simplify = simplify_sum;
+  ref_new_bits = new_bits_sum;
+  ref_bits     = bits_cnt;
+
+  for (level = BITMAP_SCALAR + 1; level <= best; level++) {
+
+    run_level(level);
+
+    if (classify_sum != ref_classify || simplify_sum != ref_simplify ||
+        new_bits_sum != ref_new_bits || bits_cnt != ref_bits)
+      FATAL("%s kernels disagree with the scalar ones",
+            bitmap_simd_name(level));
+
+  }
+
+  OKF("All levels agree.");
+
+  return 0;
+
+}
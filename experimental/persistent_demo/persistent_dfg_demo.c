@@ -0,0 +1,79 @@
+/*
+   DAFL - persistent mode example with DFG-directed scoring
+   --------------------------------------------------------
+
+   Based on persistent_demo.c.
+
+   This is the same kind of shim as persistent_demo.c, but compiled with a
+   data dependency graph, so that every iteration of __AFL_LOOP() also
+   reports which DFG nodes it touched. The runtime clears those entries by
+   itself between iterations, and afl-fuzz skips its own reset of the DFG
+   maps, so proximity scores stay exact at persistent mode speeds.
+
+   The graph in persistent_dfg_demo.dfg refers to line numbers in this
+   file; keep them in sync if you edit the code below. To build and run:
+
+     DAFL_DFG_SCORE=$PWD/persistent_dfg_demo.dfg \
+       ../../afl-clang-fast -g persistent_dfg_demo.c -o persistent_dfg_demo
+
+     mkdir in; echo hi >in/seed
+     ../../afl-fuzz -i in -o out ./persistent_dfg_demo
+
+   To get a baseline for comparing execs/sec, build a second copy with
+   -DNO_LOOP, which processes one input per process instead.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+
+/* The code under test. The DFG nodes lead from the first check towards the
+   abort(), with scores going up the closer they get. */
+
+static void process(char* buf) {
+
+  if (buf[0] == 'd') {
+    printf("one\n");
+    if (buf[1] == 'f') {
+      printf("two\n");
+      if (buf[2] == 'g') {
+        printf("three\n");
+        if (buf[3] == '!') {
+          printf("four\n");
+          abort();
+        }
+      }
+    }
+  }
+
+}
+
+
+/* Main entry point. */
+
+int main(int argc, char** argv) {
+
+  char buf[100];
+
+#ifndef NO_LOOP
+
+  while (__AFL_LOOP(1000)) {
+
+#endif /* !NO_LOOP */
+
+    memset(buf, 0, 100);
+    read(0, buf, 100);
+
+    process(buf);
+
+#ifndef NO_LOOP
+
+  }
+
+#endif /* !NO_LOOP */
+
+  return 0;
+
+}
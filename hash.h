@@ -34,32 +34,33 @@
 #ifndef _HAVE_HASH_H
 #define _HAVE_HASH_H
 
+#include <string.h>
+
 #include "types.h"
 
 #ifdef __x86_64__
 
 #define ROL64(_x, _r)  ((((u64)(_x)) << (_r)) | (((u64)(_x)) >> (64 - (_r))))
 
-static inline u32 hash32(const void* key, u32 len, u32 seed) {
+/* hash32() is also computed one word at a time, alongside other passes over
+   the same buffer: start with h1 = seed ^ len, feed every word to
+   hash32_step(), and finish with hash32_final(). */
 
-  const u64* data = (u64*)key;
-  u64 h1 = seed ^ len;
+static inline u64 hash32_step(u64 h1, u64 k1) {
 
-  len >>= 3;
+  k1 *= 0x87c37b91114253d5ULL;
+  k1  = ROL64(k1, 31);
+  k1 *= 0x4cf5ad432745937fULL;
 
-  while (len--) {
+  h1 ^= k1;
+  h1  = ROL64(h1, 27);
 
-    u64 k1 = *data++;
+  return h1 * 5 + 0x52dce729;
 
-    k1 *= 0x87c37b91114253d5ULL;
-    k1  = ROL64(k1, 31);
-    k1 *= 0x4cf5ad432745937fULL;
+}
 
-    h1 ^= k1;
-    h1  = ROL64(h1, 27);
-    h1  = h1 * 5 + 0x52dce729;
 
-  }
+static inline u32 hash32_final(u64 h1) {
 
   h1 ^= h1 >> 33;
   h1 *= 0xff51afd7ed558ccdULL;
@@ -71,6 +72,20 @@ static inline u32 hash32(const void* key, u32 len, u32 seed) {
 
 }
 
+
+static inline u32 hash32(const void* key, u32 len, u32 seed) {
+
+  const u64* data = (u64*)key;
+  u64 h1 = seed ^ len;
+
+  len >>= 3;
+
+  while (len--) h1 = hash32_step(h1, *data++);
+
+  return hash32_final(h1);
+
+}
+
 #else 
 
 #define ROL32(_x, _r)  ((((u32)(_x)) << (_r)) | (((u32)(_x)) >> (32 - (_r))))
@@ -108,4 +123,74 @@ static inline u32 hash32(const void* key, u32 len, u32 seed) {
 
 #endif /* ^__x86_64__ */
 
+
+/* The 128-bit flavor of MurmurHash3 (x64_128), for telling apart whole
+   test cases. Unlike hash32(), this one takes buffers of any length. */
+
+#define ROL64_128(_x, _r) ((((u64)(_x)) << (_r)) | (((u64)(_x)) >> (64 - (_r))))
+
+static inline u64 fmix64_128(u64 k) {
+
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+
+  return k;
+
+}
+
+static inline void hash128(const void* key, u32 len, u32 seed, u64* out) {
+
+  const u8* data = (const u8*)key;
+  const u64 c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+
+  u64 h1 = seed, h2 = seed, k1, k2;
+  u32 blocks = len >> 4, i;
+  u8  tail[16] = { 0 };
+
+  for (i = 0; i < blocks; i++) {
+
+    memcpy(&k1, data + i * 16, 8);
+    memcpy(&k2, data + i * 16 + 8, 8);
+
+    k1 *= c1; k1 = ROL64_128(k1, 31); k1 *= c2; h1 ^= k1;
+
+    h1 = ROL64_128(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+    k2 *= c2; k2 = ROL64_128(k2, 33); k2 *= c1; h2 ^= k2;
+
+    h2 = ROL64_128(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+
+  }
+
+  /* Tail, zero-padded. Zero words leave the state alone, so this matches
+     the reference code on little-endian machines. */
+
+  if (len & 15) {
+
+    memcpy(tail, data + blocks * 16, len & 15);
+    memcpy(&k1, tail, 8);
+    memcpy(&k2, tail + 8, 8);
+
+    k2 *= c2; k2 = ROL64_128(k2, 33); k2 *= c1; h2 ^= k2;
+    k1 *= c1; k1 = ROL64_128(k1, 31); k1 *= c2; h1 ^= k1;
+
+  }
+
+  h1 ^= len; h2 ^= len;
+
+  h1 += h2; h2 += h1;
+
+  h1 = fmix64_128(h1);
+  h2 = fmix64_128(h2);
+
+  h1 += h2; h2 += h1;
+
+  out[0] = h1;
+  out[1] = h2;
+
+}
+
 #endif /* !_HAVE_HASH_H */
@@ -229,10 +229,10 @@ static void edit_params(u32 argc, char** argv) {
   cc_params[cc_par_cnt++] = "-DFUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION=1";
 
   /* When the user tries to use persistent or deferred forkserver modes by
-     appending a single line to the program, we want to reliably inject a
-     signature into the binary (to be picked up by afl-fuzz) and we want
-     to call a function from the runtime .o file. This is unnecessarily
-     painful for three reasons:
+     appending a single line to the program, or takes test cases through
+     shared memory, we want to reliably inject a signature into the binary
+     (to be picked up by afl-fuzz) and we want to call a function from the
+     runtime .o file. This is unnecessarily painful for three reasons:
 
      1) We need to convince the compiler not to optimize out the signature.
         This is done with __attribute__((used)).
@@ -272,6 +272,30 @@ static void edit_params(u32 argc, char** argv) {
 #endif /* ^__APPLE__ */
     "_I(); } while (0)";
 
+  cc_params[cc_par_cnt++] = "-D__AFL_FUZZ_TESTCASE_BUF="
+    "({ static volatile char *_A __attribute__((used)); "
+    " _A = (char*)\"" SHM_FUZZ_SIG "\"; "
+#ifdef __APPLE__
+    "__attribute__((visibility(\"default\"))) "
+    "unsigned char *_B(void) __asm__(\"___afl_fuzz_testcase_buf\"); "
+#else
+    "__attribute__((visibility(\"default\"))) "
+    "unsigned char *_B(void) __asm__(\"__afl_fuzz_testcase_buf\"); "
+#endif /* ^__APPLE__ */
+    "_B(); })";
+
+  cc_params[cc_par_cnt++] = "-D__AFL_FUZZ_TESTCASE_LEN="
+    "({ static volatile char *_A __attribute__((used)); "
+    " _A = (char*)\"" SHM_FUZZ_SIG "\"; "
+#ifdef __APPLE__
+    "__attribute__((visibility(\"default\"))) "
+    "unsigned int _N(void) __asm__(\"___afl_fuzz_testcase_len\"); "
+#else
+    "__attribute__((visibility(\"default\"))) "
+    "unsigned int _N(void) __asm__(\"__afl_fuzz_testcase_len\"); "
+#endif /* ^__APPLE__ */
+    "_N(); })";
+
   if (x_set) {
     cc_params[cc_par_cnt++] = "-x";
     cc_params[cc_par_cnt++] = "none";
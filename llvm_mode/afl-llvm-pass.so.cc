@@ -33,33 +33,111 @@
 
 #include "../config.h"
 #include "../debug.h"
+#include "../dfg-db.h"
+#include "../dfg-meta.h"
 
+#include <chrono>
 #include <iostream>
 #include <fstream>
-#include <sstream>
+#include <map>
 #include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/Triple.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
+#include "llvm/ADT/SmallSet.h"
 #include "llvm/Support/CommandLine.h"
 
 using namespace llvm;
 
+#define DEBUG_TYPE "afl-coverage"
+
+STATISTIC(NumInstBlocks, "Number of selected blocks");
+STATISTIC(NumSkipBlocks, "Number of skipped blocks");
+STATISTIC(NumDFGNodes, "Number of instrumented DFG nodes");
+STATISTIC(NumLineLookups, "Number of DFG lookups by debug line");
+
+/* A DFG node, as listed in the DAFL_DFG_SCORE file. */
+
+struct DFGNode {
+  unsigned int idx;
+  unsigned int score;
+  unsigned long long path_cnt;
+};
+
+/* A DFG node instrumented in this module, as it goes into the node table. */
+
+struct DFGNodeMeta {
+  DFGNode node;
+  unsigned int line;
+  std::string file;
+  std::string func;
+};
+
+/* Hash for (file, function) pairs. */
+
+struct FileFuncHash {
+  std::size_t operator()(const std::pair<std::string,std::string> &p) const {
+    return std::hash<std::string>()(p.first) * 31 +
+           std::hash<std::string>()(p.second);
+  }
+};
+
+typedef std::unordered_map<unsigned int, DFGNode> DFGLineMap;
+
 bool selective_coverage = false;
 bool dfg_scoring = false;
 bool no_filename_match = false;
-std::set<std::string> instr_targets;
-std::map<std::string,std::pair<unsigned int,unsigned int>> dfg_node_map;
-std::map<std::string,unsigned long long> dfg_path_map;
+bool pass_stats = false;
+unsigned int dfg_size = 0;
+std::string target_loc;
+std::string target_file;
+unsigned int target_line = 0;
+
+/* Instrumentation targets, keyed on (file, function) and, for
+   DAFL_NO_FILENAME_MATCH, on the function alone. Both map to the
+   "file:function" line that selected them. */
+
+std::unordered_map<std::pair<std::string,std::string>,std::string,FileFuncHash>
+    instr_targets;
+std::unordered_map<std::string,std::string> instr_target_funcs;
+
+/* DFG nodes, by file, then line. */
+
+std::unordered_map<std::string,DFGLineMap> dfg_node_map;
+
+/* Both of the above, from DAFL_DFG_DB, if given. */
+
+const u8* dfg_db = nullptr;
+
+/* DFG nodes in one source file: its table from the DFG file, or its ID in
+   the database. */
+
+struct DFGFile {
+  const DFGLineMap *lines;
+  u32 db_id;
+};
 
 
 namespace {
@@ -82,12 +160,44 @@ namespace {
 }
 
 
+/* Split "file:line" into its parts. Returns 0 if the line number is not
+   a plain decimal number, as such a location can never match. */
+
+static unsigned int splitFileLine(const std::string &loc, std::string &file) {
+  std::size_t colon = loc.rfind(':');
+  if (colon == std::string::npos || colon + 1 == loc.size()) return 0;
+
+  unsigned long line_no = 0;
+  for (std::size_t i = colon + 1; i < loc.size(); i++) {
+    if (loc[i] < '0' || loc[i] > '9' || line_no > 0xffffffffUL / 10) return 0;
+    line_no = line_no * 10 + (loc[i] - '0');
+  }
+
+  file = loc.substr(0, colon);
+  return (unsigned int)line_no;
+}
+
+
 void initCoverageTarget(char* select_file) {
   std::string line;
+  std::set<std::string> lines;
   std::ifstream stream(select_file);
 
   while (std::getline(stream, line))
-    instr_targets.insert(line);
+    lines.insert(line);
+
+  /* Going through the lines in order keeps the lowest one for a function
+     without a file name match, as the old linear scan did. */
+
+  for (const std::string &l : lines) {
+    std::size_t colon = l.find(":");
+    std::string target_file = l.substr(0, colon);
+    std::string target_func =
+        colon == std::string::npos ? l : l.substr(colon + 1, std::string::npos);
+
+    instr_targets.emplace(std::make_pair(target_file, target_func), l);
+    instr_target_funcs.emplace(target_func, l);
+  }
 }
 
 
@@ -104,19 +214,125 @@ void initDFGNodeMap(char* dfg_file) {
     std::string targ_line = line.substr(space_idx2 + 1, std::string::npos);
     int score = stoi(score_str);
     unsigned long long path_cnt = stoull(path_cnt_str);
-    dfg_node_map[targ_line] = std::make_pair(idx++, (unsigned int) score);
-    dfg_path_map[targ_line] = path_cnt;
-    if (idx >= DFG_MAP_SIZE) {
-      std::cout << "Input DFG is too large (check DFG_MAP_SIZE)" << std::endl;
+    std::string file;
+    unsigned int line_no = splitFileLine(targ_line, file);
+    DFGNode node = { idx++, (unsigned int) score, path_cnt };
+    if (line_no) dfg_node_map[file][line_no] = node;
+    if (idx > DFG_MAX_SIZE) {
+      std::cout << "Input DFG is too large (check DFG_MAX_SIZE)" << std::endl;
       exit(1);
     }
   }
+  dfg_size = idx;
+}
+
+
+/* Map the database written by afl-dfg-db. It stays mapped for the life
+   of the process, and lookups go straight to it. */
+
+void initDFGDB(char* db_file) {
+  struct stat st;
+  int fd = open(db_file, O_RDONLY);
+
+  if (fd < 0 || fstat(fd, &st)) PFATAL("Unable to open '%s'", db_file);
+
+  if ((u64)st.st_size < sizeof(struct dfg_db))
+    FATAL("'%s' is not a DFG database", db_file);
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) PFATAL("Unable to map '%s'", db_file);
+
+  close(fd);
+
+  const char *err = dfg_db_check((const u8*)map, st.st_size);
+  if (err) FATAL("'%s': %s", db_file, err);
+
+  dfg_db = (const u8*)map;
+
+  const struct dfg_db *hdr = (const struct dfg_db*)dfg_db;
+  selective_coverage = hdr->flags & DFG_DB_HAS_COV;
+  dfg_scoring = hdr->flags & DFG_DB_HAS_DFG;
+  dfg_size = hdr->node_cnt;
+
+  if (dfg_size > DFG_MAX_SIZE)
+    FATAL("'%s' is too large (check DFG_MAX_SIZE)", db_file);
+}
+
+
+/* Find the DAFL_SELECTIVE_COV line that selects a function, if any. */
+
+static const char* findInstrTarget(const std::string &file,
+                                   const std::string &func) {
+  if (dfg_db) {
+    const struct dfg_db *hdr = (const struct dfg_db*)dfg_db;
+
+    if (no_filename_match)
+      return (const char*)dfg_db_find_target(dfg_db, &hdr->funcs,
+                                             (const u8*)func.data(),
+                                             func.size());
+
+    std::string key = file;
+    key.push_back('\0');
+    key += func;
+    return (const char*)dfg_db_find_target(dfg_db, &hdr->targets,
+                                           (const u8*)key.data(), key.size());
+  }
+
+  if (no_filename_match) {
+    auto it = instr_target_funcs.find(func);
+    return it == instr_target_funcs.end() ? nullptr : it->second.c_str();
+  }
+
+  auto it = instr_targets.find(std::make_pair(file, func));
+  return it == instr_targets.end() ? nullptr : it->second.c_str();
+}
+
+
+/* Find the DFG nodes of a source file. Returns false if it has none. */
+
+static bool findDFGFile(const std::string &file, DFGFile &f) {
+  if (dfg_db) {
+    f.db_id = dfg_db_find_file(dfg_db, (const u8*)file.data(), file.size());
+    return f.db_id != DFG_DB_NONE;
+  }
+
+  auto it = dfg_node_map.find(file);
+  if (it == dfg_node_map.end()) return false;
+  f.lines = &it->second;
+  return true;
+}
+
+
+/* Find the DFG node at a line of a file, if there is one. */
+
+static bool findDFGNode(const DFGFile &f, unsigned int line, DFGNode &node) {
+  if (dfg_db) {
+    const struct dfg_db_node *n = dfg_db_find_node(dfg_db, f.db_id, line);
+    if (!n) return false;
+    node.idx = n->idx;
+    node.score = n->score;
+    node.path_cnt = n->path_cnt;
+    return true;
+  }
+
+  auto it = f.lines->find(line);
+  if (it == f.lines->end()) return false;
+  node = it->second;
+  return true;
 }
 
 
 void initialize(void) {
   char* select_file = getenv("DAFL_SELECTIVE_COV");
   char* dfg_file = getenv("DAFL_DFG_SCORE");
+  char* db_file = getenv("DAFL_DFG_DB");
+
+  /* The database stands in for both text files. */
+
+  if (db_file) {
+    initDFGDB(db_file);
+    select_file = dfg_file = NULL;
+  }
 
   if (select_file) {
     selective_coverage = true;
@@ -129,6 +345,13 @@ void initialize(void) {
   }
 
   if (getenv("DAFL_NO_FILENAME_MATCH")) no_filename_match = true;
+
+  if (getenv("DAFL_PASS_STATS")) pass_stats = true;
+
+  if (getenv("DAFL_TARGET_LOC")) {
+    target_loc = getenv("DAFL_TARGET_LOC");
+    target_line = splitFileLine(target_loc, target_file);
+  }
 }
 
 
@@ -141,10 +364,13 @@ bool AFLCoverage::runOnModule(Module &M) {
 
   IntegerType *Int8Ty  = IntegerType::getInt8Ty(C);
   IntegerType *Int32Ty = IntegerType::getInt32Ty(C);
-  IntegerType *Int64Ty = IntegerType::getInt64Ty(C);
+
+  auto start_time = std::chrono::steady_clock::now();
 
   initialize();
 
+  auto init_time = std::chrono::steady_clock::now();
+
   /* Get globals for the SHM region and the previous location. Note that
      __afl_prev_loc is thread-local. */
 
@@ -152,9 +378,15 @@ bool AFLCoverage::runOnModule(Module &M) {
       new GlobalVariable(M, PointerType::get(Int8Ty, 0), false,
                          GlobalValue::ExternalLinkage, 0, "__afl_area_ptr");
 
-  GlobalVariable *AFLMapDFGPtr =
+  GlobalVariable *AFLMapDFGListPtr =
       new GlobalVariable(M, PointerType::get(Int32Ty, 0), false,
-                         GlobalValue::ExternalLinkage, 0, "__afl_area_dfg_ptr");
+                         GlobalValue::ExternalLinkage, 0,
+                         "__afl_area_dfg_list_ptr");
+
+  GlobalVariable *AFLMapDFGHitPtr =
+      new GlobalVariable(M, PointerType::get(Int8Ty, 0), false,
+                         GlobalValue::ExternalLinkage, 0,
+                         "__afl_area_dfg_hit_ptr");
 
   GlobalVariable *AFLPrevLoc = new GlobalVariable(
       M, Int32Ty, false, GlobalValue::ExternalLinkage, 0, "__afl_prev_loc",
@@ -165,10 +397,11 @@ bool AFLCoverage::runOnModule(Module &M) {
   int inst_blocks = 0;
   int skip_blocks = 0;
   int inst_dfg_nodes = 0;
+  int inst_target_blocks = 0;
+  unsigned int line_lookups = 0;
   std::string file_name = M.getSourceFileName();
   std::set<std::string> covered_targets;
-
-  
+  std::map<unsigned int, DFGNodeMeta> module_nodes;
 
   for (auto &F : M) {
 
@@ -185,32 +418,52 @@ bool AFLCoverage::runOnModule(Module &M) {
 
     bool is_inst_targ = false;
     const std::string func_name = F.getName().str();
-    std::set<std::string>::iterator it;
 
     /* Check if this function is our instrumentation target. */
     if (selective_coverage) {
-      for (it = instr_targets.begin(); it != instr_targets.end(); ++it) {
-        std::size_t colon = (*it).find(":");
-        std::string target_file = (*it).substr(0, colon);
-        std::string target_func = (*it).substr(colon + 1, std::string::npos);
-
-        if (no_filename_match || file_name.compare(target_file) == 0) {
-          if (func_name.compare(target_func) == 0) {
-            is_inst_targ = true;
-            covered_targets.insert(*it);
-            break;
-          }
-        }
+      const char *target = findInstrTarget(file_name, func_name);
+      if (target) {
+        is_inst_targ = true;
+        covered_targets.insert(target);
       }
     } else is_inst_targ = true; // If disabled, instrument all the blocks.
 
-    /* Now iterate through the basic blocks of the function. */
+    /* DFG nodes and the target line in this file, if any. */
+
+    DFGFile node_file = { nullptr, DFG_DB_NONE };
+    bool has_dfg_nodes = dfg_scoring && findDFGFile(file_name, node_file);
+
+    bool has_target = target_line && file_name == target_file;
+
+    /* Now iterate through the basic blocks of the function. The list is taken
+       up front, since recording DFG hits splits blocks as we go. */
+
+    std::vector<BasicBlock *> blocks;
+    for (auto &BB : F) blocks.push_back(&BB);
 
-    for (auto &BB : F) {
+    for (BasicBlock *BB : blocks) {
       bool is_dfg_node = false;
-      unsigned int node_idx = 0;
-      unsigned int node_score = 0;
-      unsigned long long path_cnt = 0;
+      DFGNode dfg_node;
+
+      /* Flag the runs that reach the target line. This is done regardless of
+         selective coverage, so that the flag can be trusted by afl-fuzz. */
+
+      if (has_target) {
+        for (auto &inst : *BB) {
+          DILocation* DILoc = inst.getDebugLoc().get();
+          if (!DILoc || !DILoc->getLine()) continue;
+          if (DILoc->getLine() == target_line) {
+            IRBuilder<> TargIRB(&*BB->getFirstInsertionPt());
+            LoadInst *DFGHitMap = TargIRB.CreateLoad(AFLMapDFGHitPtr);
+            DFGHitMap->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+            TargIRB.CreateStore(ConstantInt::get(Int8Ty, 1),
+                TargIRB.CreateGEP(DFGHitMap, ConstantInt::get(Int32Ty, dfg_size)))
+                ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+            inst_target_blocks++;
+            break;
+          }
+        }
+      }
 
       if (is_inst_targ) {
         inst_blocks++;
@@ -221,32 +474,27 @@ bool AFLCoverage::runOnModule(Module &M) {
       }
 
       /* Iterate through the instructions in the basic block to check if this
-       * block is a DFG node. If so, retrieve its proximity score. */
-
-      if (dfg_scoring) {
-        for (auto &inst : BB) {
-          DebugLoc dbg = inst.getDebugLoc();
-          DILocation* DILoc = dbg.get();
-          if (DILoc && DILoc->getLine()) {
-            int line_no = DILoc->getLine();
-            std::ostringstream stream;
-            stream << file_name << ":" << line_no;
-            std::string targ_str = stream.str();
-            if (dfg_node_map.count(targ_str) > 0) {
-              is_dfg_node = true;
-              auto node_info = dfg_node_map[targ_str];
-              auto path_info = dfg_path_map[targ_str];
-              node_idx = node_info.first;
-              node_score = node_info.second;
-              path_cnt = path_info;
-              inst_dfg_nodes++;
-              break;
-            }
+       * block is a DFG node. If so, retrieve its proximity score. Runs of
+       * instructions share a line, so each line is only looked up once. */
+
+      if (has_dfg_nodes) {
+        SmallSet<unsigned int, 8> seen_lines;
+        for (auto &inst : *BB) {
+          DILocation* DILoc = inst.getDebugLoc().get();
+          if (!DILoc || !DILoc->getLine()) continue;
+          if (!seen_lines.insert(DILoc->getLine()).second) continue;
+          line_lookups++;
+          if (findDFGNode(node_file, DILoc->getLine(), dfg_node)) {
+            is_dfg_node = true;
+            inst_dfg_nodes++;
+            module_nodes.emplace(dfg_node.idx,
+                DFGNodeMeta{dfg_node, DILoc->getLine(), file_name, func_name});
+            break;
           }
         }
       } // If disabled, we don't have to do anything here.
 
-      BasicBlock::iterator IP = BB.getFirstInsertionPt();
+      BasicBlock::iterator IP = BB->getFirstInsertionPt();
       IRBuilder<> IRB(&(*IP));
 
       /* Make up cur_loc */
@@ -283,29 +531,170 @@ bool AFLCoverage::runOnModule(Module &M) {
       Store->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
 
       if (is_dfg_node) {
-        /* Update DFG coverage map. */
-        LoadInst *DFGMap = IRB.CreateLoad(AFLMapDFGPtr);
-        LoadInst *DFGCntMap = IRB.CreateLoad(AFLMapDFGPtr);
-        DFGMap->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
-        ConstantInt * Idx = ConstantInt::get(Int32Ty, node_idx);
-        ConstantInt * Score = ConstantInt::get(Int32Ty, node_score);
-        ConstantInt * PathCnt = ConstantInt::get(Int64Ty, path_cnt);
-        Value *DFGMapPtrIdx = IRB.CreateGEP(DFGMap, Idx);
-        Value *DFGCntMapPtrIdx = IRB.CreateGEP(DFGCntMap, Idx);
-        IRB.CreateStore(Score, DFGMapPtrIdx)
+
+        /* Update DFG coverage map. Everything else about the node is in the
+           node table below, so all there is to do is set its hit byte. For
+           small DFGs, that's it, and afl-fuzz sweeps the hit map. */
+
+        ConstantInt * Idx = ConstantInt::get(Int32Ty, dfg_node.idx);
+
+        LoadInst *DFGHitMap = IRB.CreateLoad(AFLMapDFGHitPtr);
+        DFGHitMap->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+        Value *DFGHitMapPtrIdx = IRB.CreateGEP(DFGHitMap, Idx);
+
+        if (!DFG_SPARSE(dfg_size)) {
+          IRB.CreateStore(ConstantInt::get(Int8Ty, 1), DFGHitMapPtrIdx)
+              ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+          continue;
+        }
+
+        /* Big DFGs are too costly to sweep. There, the node is also appended
+           to the list of touched nodes the first time it is hit during a
+           run, so that afl-fuzz can reset and score just those entries.
+           Subsequent hits cost a single load and a well-predicted branch. */
+
+        LoadInst *Seen = IRB.CreateLoad(DFGHitMapPtrIdx);
+        Seen->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+
+        Instruction *FirstHit = SplitBlockAndInsertIfThen(
+            IRB.CreateICmpEQ(Seen, ConstantInt::get(Int8Ty, 0)),
+            &*IRB.GetInsertPoint(), false,
+            MDBuilder(C).createBranchWeights(1, 1000));
+
+        IRBuilder<> HitIRB(FirstHit);
+
+        /* Append to the list first and set the hit byte last, so that a run
+           killed halfway through never leaves an unlisted node behind. */
+
+        LoadInst *DFGList = HitIRB.CreateLoad(AFLMapDFGListPtr);
+        DFGList->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+        LoadInst *ListCnt = HitIRB.CreateLoad(DFGList);
+        ListCnt->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+        Value *NewCnt = HitIRB.CreateAdd(ListCnt, ConstantInt::get(Int32Ty, 1));
+        HitIRB.CreateStore(Idx, HitIRB.CreateGEP(DFGList, NewCnt))
             ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
-        IRB.CreateStore(PathCnt, DFGCntMapPtrIdx)
+        HitIRB.CreateStore(NewCnt, DFGList)
+            ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+        HitIRB.CreateStore(ConstantInt::get(Int8Ty, 1), DFGHitMapPtrIdx)
             ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
       }
     }
   }
 
+  /* Tell the runtime and afl-fuzz how large the DFG maps need to be. All
+     modules built with the same DFG define the same __afl_dfg_size, so it
+     doesn't matter which one the linker keeps; afl-fuzz checks that the
+     signatures agree. */
+
+  if (dfg_scoring || !target_loc.empty()) {
+    GlobalVariable *SizeVar =
+        new GlobalVariable(M, Int32Ty, true, GlobalValue::WeakAnyLinkage,
+                           ConstantInt::get(Int32Ty, dfg_size),
+                           "__afl_dfg_size");
+    appendToUsed(M, {SizeVar});
+
+    Constant *Sig = ConstantDataArray::getString(
+        C, std::string(DFG_SIZE_SIG) + std::to_string(dfg_size));
+    GlobalVariable *SigVar =
+        new GlobalVariable(M, Sig->getType(), true,
+                           GlobalValue::PrivateLinkage, Sig,
+                           "__afl_dfg_size_sig");
+    appendToUsed(M, {SigVar});
+
+    /* The runtime starts out with DFG regions sized for DFG_MAP_SIZE nodes,
+       and only resizes them from its own constructor. Code in this module
+       may run before that (e.g. from the constructors of a shared library
+       loaded ahead of the binary), so have the regions resized from the
+       earliest constructor of the module, too. */
+
+    FunctionType *SetupTy = FunctionType::get(Type::getVoidTy(C), false);
+    Function *SetupCtor = Function::Create(
+        SetupTy, GlobalValue::InternalLinkage, "afl.dfg_setup", &M);
+    IRBuilder<> CtorIRB(BasicBlock::Create(C, "", SetupCtor));
+    CtorIRB.CreateCall(M.getOrInsertFunction("__afl_dfg_setup", SetupTy));
+    CtorIRB.CreateRetVoid();
+    appendToGlobalCtors(M, SetupCtor, 0);
+  }
+
+  /* Hand what we know about the DFG nodes in this module over to afl-fuzz
+     (see dfg-meta.h). */
+
+  if (!module_nodes.empty()) {
+    std::string Nodes, Strings;
+    std::map<std::string, u32> string_offs;
+
+    auto addString = [&](const std::string &str) {
+      auto it = string_offs.find(str);
+      if (it != string_offs.end()) return it->second;
+      u32 off = Strings.size();
+      Strings.append(str.c_str(), str.size() + 1);
+      string_offs.emplace(str, off);
+      return off;
+    };
+
+    for (auto &it : module_nodes) {
+      const DFGNodeMeta &meta = it.second;
+      struct dfg_meta_node ent = {};
+      ent.idx = meta.node.idx;
+      ent.score = meta.node.score;
+      ent.path_cnt = meta.node.path_cnt;
+      ent.line = meta.line;
+      ent.file_off = addString(meta.file);
+      ent.func_off = addString(meta.func);
+      Nodes.append((const char *)&ent, sizeof(ent));
+    }
+
+    std::string Table(DFG_NODES_SIG);
+    u32 cnt = module_nodes.size(), str_len = Strings.size();
+    Table.append((const char *)&cnt, sizeof(cnt));
+    Table.append((const char *)&str_len, sizeof(str_len));
+    Table += Nodes;
+    Table += Strings;
+
+    Constant *TableData = ConstantDataArray::getString(C, Table, false);
+    GlobalVariable *TableVar =
+        new GlobalVariable(M, TableData->getType(), true,
+                           GlobalValue::PrivateLinkage, TableData,
+                           "__afl_dfg_nodes");
+    TableVar->setSection(Triple(M.getTargetTriple()).isOSBinFormatMachO()
+                             ? DFG_META_SECTION_MACHO : DFG_META_SECTION);
+    appendToUsed(M, {TableVar});
+  }
+
+  /* Let afl-fuzz know that this binary flags the target line. */
+
+  if (inst_target_blocks) {
+    Constant *Sig = ConstantDataArray::getString(C, DFG_TARGET_SIG);
+    GlobalVariable *SigVar =
+        new GlobalVariable(M, Sig->getType(), true,
+                           GlobalValue::PrivateLinkage, Sig,
+                           "__afl_dfg_target_sig");
+    appendToUsed(M, {SigVar});
+    OKF("Target line %s found in %u block(s).", target_loc.c_str(),
+        inst_target_blocks);
+  }
+
   /* Say something nice. */
   for (auto it = covered_targets.begin(); it != covered_targets.end(); ++it)
     std::cout << "Covered " << (*it) << std::endl;
   OKF("Selected blocks: %u, skipped blocks: %u. instrumented DFG nodes: %u",
       inst_blocks, skip_blocks, inst_dfg_nodes);
 
+  NumInstBlocks += inst_blocks;
+  NumSkipBlocks += skip_blocks;
+  NumDFGNodes += inst_dfg_nodes;
+  NumLineLookups += line_lookups;
+
+  if (pass_stats) {
+    auto end_time = std::chrono::steady_clock::now();
+    auto ms = [](std::chrono::steady_clock::duration d) {
+      return std::chrono::duration<double, std::milli>(d).count();
+    };
+    OKF("Pass took %.1f ms (loading inputs: %.1f ms), %u DFG line lookups "
+        "for %s.", ms(end_time - start_time), ms(init_time - start_time),
+        line_lookups, M.getSourceFileName().c_str());
+  }
+
   return true;
 
 }
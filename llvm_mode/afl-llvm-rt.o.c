@@ -60,27 +60,81 @@
 u8  __afl_area_initial[MAP_SIZE];
 u8* __afl_area_ptr = __afl_area_initial;
 
-u32  __afl_area_initial_dfg[DFG_MAP_SIZE];
-u32* __afl_area_dfg_ptr = __afl_area_initial_dfg;
+u32  __afl_area_initial_dfg_list[(DFG_LIST_SIZE(DFG_MAP_SIZE) + 3) / 4];
+u32* __afl_area_dfg_list_ptr = __afl_area_initial_dfg_list;
+u8*  __afl_area_dfg_hit_ptr  = (u8*)__afl_area_initial_dfg_list +
+                               DFG_LIST_HIT_OFF(DFG_MAP_SIZE);
 
-u64  __afl_area_initial_dfg_count[DFG_MAP_SIZE];
-u64* __afl_area_dfg_count_ptr = __afl_area_initial_dfg_count;
+/* Number of DFG nodes the binary was built with, defined by the pass (see
+   DFG_SIZE_SIG). Binaries with no DFG instrumentation lack it, and get the
+   DFG_MAP_SIZE default. The initial DFG region above is replaced with a
+   bigger one in __afl_dfg_setup() if need be; __afl_dfg_list_dummy points
+   to whichever is in use. */
+
+extern const u32 __afl_dfg_size __attribute__((weak));
+
+static u32  __afl_dfg_nodes = DFG_MAP_SIZE;
+
+static u32* __afl_dfg_list_dummy = __afl_area_initial_dfg_list;
 
 __thread u32 __afl_prev_loc;
 
 
+/* Test case handed over through shared memory, for harnesses that use
+   __AFL_FUZZ_TESTCASE_BUF and __AFL_FUZZ_TESTCASE_LEN. When not running
+   under afl-fuzz, the test case is read from stdin, once, into a buffer of
+   our own instead; that buffer is only allocated if the macros are used. */
+
+static u8*  __afl_fuzz_ptr;
+static u32* __afl_fuzz_len;
+static s32  __afl_fuzz_alt_len = -1;
+
+
 /* Running in persistent mode? */
 
 static u8 is_persistent;
 
 
+/* Tells afl-fuzz that __afl_persistent_loop() resets the DFG maps. */
+
+static const char __afl_dfg_reset_sig[] __attribute__((used)) = DFG_RESET_SIG;
+
+
+/* Size the DFG region to the DFG. Every instrumented module calls this
+   from a constructor of the earliest priority, before any of its code can
+   run (see afl-llvm-pass.so.cc); until then, the initial regions are in
+   use. */
+
+void __afl_dfg_setup(void) {
+
+  static u8 setup_done;
+
+  if (setup_done) return;
+  setup_done = 1;
+
+  if (&__afl_dfg_size) __afl_dfg_nodes = __afl_dfg_size;
+
+  if (__afl_dfg_nodes > DFG_MAP_SIZE) {
+
+    __afl_dfg_list_dummy = calloc(DFG_LIST_SIZE(__afl_dfg_nodes) + 3, 1);
+    if (!__afl_dfg_list_dummy) abort();
+
+  }
+
+  __afl_area_dfg_list_ptr = __afl_dfg_list_dummy;
+  __afl_area_dfg_hit_ptr  = (u8*)__afl_dfg_list_dummy +
+                            DFG_LIST_HIT_OFF(__afl_dfg_nodes);
+
+}
+
+
 /* SHM setup. */
 
 static void __afl_map_shm(void) {
 
   u8 *id_str = getenv(SHM_ENV_VAR);
-  u8 *id_str_dfg = getenv(SHM_ENV_VAR_DFG);
-  u8 *id_str_dfg_count = getenv(SHM_ENV_VAR_DFG_COUNT);
+  u8 *id_str_dfg_list = getenv(SHM_ENV_VAR_DFG_LIST);
+  u8 *id_str_fuzz = getenv(SHM_FUZZ_ENV_VAR);
 
   /* If we're running under AFL, attach to the appropriate region, replacing the
      early-stage __afl_area_initial region that is needed to allow some really
@@ -89,18 +143,36 @@ static void __afl_map_shm(void) {
   if (id_str) {
 
     u32 shm_id = atoi(id_str);
-    u32 shm_id_dfg = atoi(id_str_dfg);
-    u32 shm_id_dfg_count = atoi(id_str_dfg_count);
 
     __afl_area_ptr = shmat(shm_id, NULL, 0);
-    __afl_area_dfg_ptr = shmat(shm_id_dfg, NULL, 0);
-    __afl_area_dfg_count_ptr = shmat(shm_id_dfg_count, NULL, 0);
 
     /* Whooooops. */
 
     if (__afl_area_ptr == (void *)-1) _exit(1);
-    if (__afl_area_dfg_ptr == (void *)-1) _exit(1);
-    if (__afl_area_dfg_count_ptr == (void *)-1) _exit(1);
+
+    /* The DFG region is optional; tools such as afl-showmap only set up
+       the coverage map, in which case we keep writing to the dummy one. */
+
+    if (id_str_dfg_list) {
+
+      __afl_area_dfg_list_ptr = shmat(atoi(id_str_dfg_list), NULL, 0);
+      if (__afl_area_dfg_list_ptr == (void *)-1) _exit(1);
+
+      __afl_area_dfg_hit_ptr = (u8*)__afl_area_dfg_list_ptr +
+                               DFG_LIST_HIT_OFF(__afl_dfg_nodes);
+
+    }
+
+    /* Only set when the harness takes its input through shared memory. */
+
+    if (id_str_fuzz) {
+
+      __afl_fuzz_len = shmat(atoi(id_str_fuzz), NULL, 0);
+      if (__afl_fuzz_len == (void *)-1) _exit(1);
+
+      __afl_fuzz_ptr = (u8*)(__afl_fuzz_len + 1);
+
+    }
 
     /* Write something into the bitmap so that even with low AFL_INST_RATIO,
        our parent doesn't give up on us. */
@@ -112,6 +184,48 @@ static void __afl_map_shm(void) {
 }
 
 
+/* The current test case, for __AFL_FUZZ_TESTCASE_BUF. */
+
+u8* __afl_fuzz_testcase_buf(void) {
+
+  if (!__afl_fuzz_ptr) {
+
+    __afl_fuzz_ptr = malloc(MAX_FILE);
+    if (!__afl_fuzz_ptr) abort();
+
+  }
+
+  return __afl_fuzz_ptr;
+
+}
+
+
+/* Length of the current test case, for __AFL_FUZZ_TESTCASE_LEN. Outside
+   of afl-fuzz, the first call reads stdin into the buffer, and later ones
+   return the same length. */
+
+u32 __afl_fuzz_testcase_len(void) {
+
+  u8* buf;
+  s32 ret;
+
+  if (__afl_fuzz_len) return *__afl_fuzz_len;
+
+  if (__afl_fuzz_alt_len >= 0) return __afl_fuzz_alt_len;
+
+  buf = __afl_fuzz_testcase_buf();
+  __afl_fuzz_alt_len = 0;
+
+  while (__afl_fuzz_alt_len < MAX_FILE &&
+         (ret = read(0, buf + __afl_fuzz_alt_len,
+                     MAX_FILE - __afl_fuzz_alt_len)) > 0)
+    __afl_fuzz_alt_len += ret;
+
+  return __afl_fuzz_alt_len;
+
+}
+
+
 /* Fork server logic. */
 
 static void __afl_start_forkserver(void) {
@@ -193,6 +307,47 @@ static void __afl_start_forkserver(void) {
 }
 
 
+/* Clear the DFG entries touched during the last persistent mode iteration.
+   With big DFGs, only the nodes on the list can be dirty, so this is usually
+   much cheaper than the parent sweeping the full region after every run.
+   Small ones have no list, and just get their hit map wiped. */
+
+static void __afl_reset_dfg(void) {
+
+  u32 i, cnt;
+
+  if (!DFG_SPARSE(__afl_dfg_nodes)) {
+
+    memset(__afl_area_dfg_hit_ptr, 0, __afl_dfg_nodes + 1);
+    return;
+
+  }
+
+  cnt = __afl_area_dfg_list_ptr[0];
+
+  if (cnt > __afl_dfg_nodes) {
+
+    memset(__afl_area_dfg_list_ptr, 0, DFG_LIST_SIZE(__afl_dfg_nodes));
+    return;
+
+  }
+
+  for (i = 1; i <= cnt; i++) {
+
+    u32 idx = __afl_area_dfg_list_ptr[i];
+
+    if (idx >= __afl_dfg_nodes) continue;
+
+    __afl_area_dfg_hit_ptr[idx] = 0;
+
+  }
+
+  __afl_area_dfg_hit_ptr[__afl_dfg_nodes] = 0;
+  __afl_area_dfg_list_ptr[0] = 0;
+
+}
+
+
 /* A simplified persistent mode handler, used as explained in README.llvm. */
 
 int __afl_persistent_loop(unsigned int max_cnt) {
@@ -203,15 +358,15 @@ int __afl_persistent_loop(unsigned int max_cnt) {
   if (first_pass) {
 
     /* Make sure that every iteration of __AFL_LOOP() starts with a clean slate.
-       On subsequent calls, the parent will take care of that, but on the first
+       On subsequent calls, the parent will take care of the coverage map
+       and we reset the DFG region after each stop, but on the first
        iteration, it's our job to erase any trace of whatever happened
        before the loop. */
 
     if (is_persistent) {
 
       memset(__afl_area_ptr, 0, MAP_SIZE);
-      memset(__afl_area_dfg_ptr, 0, sizeof(u32) * DFG_MAP_SIZE);
-      memset(__afl_area_dfg_count_ptr, 0, sizeof(u64) * DFG_MAP_SIZE);
+      memset(__afl_area_dfg_list_ptr, 0, DFG_LIST_SIZE(__afl_dfg_nodes));
       __afl_area_ptr[0] = 1;
       __afl_prev_loc = 0;
     }
@@ -228,6 +383,7 @@ int __afl_persistent_loop(unsigned int max_cnt) {
 
       raise(SIGSTOP);
 
+      __afl_reset_dfg();
       __afl_area_ptr[0] = 1;
       __afl_prev_loc = 0;
 
@@ -240,8 +396,9 @@ int __afl_persistent_loop(unsigned int max_cnt) {
          dummy output region. */
 
       __afl_area_ptr = __afl_area_initial;
-      __afl_area_dfg_ptr = __afl_area_initial_dfg;
-      __afl_area_dfg_count_ptr = __afl_area_initial_dfg_count;
+      __afl_area_dfg_list_ptr = __afl_dfg_list_dummy;
+      __afl_area_dfg_hit_ptr = (u8*)__afl_dfg_list_dummy +
+                               DFG_LIST_HIT_OFF(__afl_dfg_nodes);
 
     }
 
@@ -261,6 +418,7 @@ void __afl_manual_init(void) {
 
   if (!init_done) {
 
+    __afl_dfg_setup();
     __afl_map_shm();
     __afl_start_forkserver();
     init_done = 1;
@@ -274,6 +432,8 @@ void __afl_manual_init(void) {
 
 __attribute__((constructor(CONST_PRIO))) void __afl_auto_init(void) {
 
+  __afl_dfg_setup();
+
   is_persistent = !!getenv(PERSIST_ENV_VAR);
 
   if (getenv(DEFER_ENV_VAR)) return;
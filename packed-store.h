@@ -0,0 +1,58 @@
+/*
+   DAFL - packed corpus store
+   --------------------------
+
+   On-disk format shared by afl-fuzz (AFL_PACKED_STORE) and afl-unpack.
+
+   Long campaigns save a very large number of small files under normals/,
+   crashes/ and memory/{pos,neg}. With the packed store enabled, these go to
+   append-only segments under <out_dir>/packed/ instead:
+
+     seg_NNNNNN.dat - back-to-back entries, each made of the classic file
+                      name relative to <out_dir> (no terminator), followed
+                      by the file contents,
+
+     seg_NNNNNN.idx - PACKED_MAGIC, followed by one struct packed_rec per
+                      entry, in the same order.
+
+   Data is always written out before the index records that point to it, so
+   after a crash, the index never refers to missing data; at most, a torn
+   record at the very end of an index file has to be ignored.
+
+   A segment is closed once it grows past PACKED_SEG_SIZE, and the next one
+   gets a higher number. afl-unpack expands all segments back into the
+   classic directory layout.
+*/
+
+#ifndef _HAVE_PACKED_STORE_H
+#define _HAVE_PACKED_STORE_H
+
+#include "types.h"
+
+#define PACKED_MAGIC     "AFLPACK1"
+#define PACKED_MAGIC_LEN 8
+
+/* Entry kinds. */
+
+enum {
+  /* 00 */ PACKED_NORMAL,
+  /* 01 */ PACKED_CRASH,
+  /* 02 */ PACKED_MEM_POS,
+  /* 03 */ PACKED_MEM_NEG
+};
+
+/* Index record, one per entry. */
+
+struct packed_rec {
+
+  u64 offset;                         /* Entry offset in the .dat file    */
+  u64 hash[2];                        /* hash128() of the file contents   */
+  u64 prox_score;                     /* Proximity score, if known        */
+  u32 len;                            /* Length of the file contents      */
+  u16 name_len;                       /* Length of the name preceding it  */
+  u8  kind;                           /* PACKED_*                         */
+  u8  sig;                            /* Signal that killed the target    */
+
+};
+
+#endif /* !_HAVE_PACKED_STORE_H */
@@ -0,0 +1,87 @@
+/*
+   DAFL - shared memory sync bus
+   -----------------------------
+
+   Layout of the ring that local afl-fuzz instances (-M / -S, same sync
+   directory) use to hand each other new queue entries with AFL_SYNC_BUS,
+   instead of scanning each other's queue/ directories.
+
+   The bus is a file, <sync_dir>/.sync_bus, mapped with MAP_SHARED by every
+   instance: a struct sync_bus header, followed by SYNC_BUS_SIZE bytes of
+   ring. Records are appended at 'head', a byte offset that only ever grows;
+   a record starting at offset 'pos' lives at ring[pos % SYNC_BUS_SIZE].
+
+   Writers reserve space by advancing 'head' with a compare-and-swap, fill in
+   the record, and only then set its 'stamp' to pos + 1. A record never
+   wraps around the end of the ring; if it doesn't fit, the writer reserves
+   the rest of the ring too and marks it as padding (if there is room for a
+   header; readers skip shorter gaps on their own).
+
+   Every reader keeps its own cursor and never blocks writers. A record is
+   valid if its stamp matches the cursor, and if 'head' has not moved more
+   than SYNC_BUS_SIZE past it by the time the reader is done copying it out;
+   otherwise, the reader has been lapped and skips ahead to 'head'.
+
+   Each record carries the test case along with what the producer learned
+   from it: proximity score, execution time, trace checksum, and compact
+   digests of the trace (the non-zero bytes of the classified map, as u16
+   offsets followed by u8 values) and of the DFG nodes reached (u32 node
+   IDs; the scores and path counts of the nodes are in the binary). This
+   lets peers import the entry without running it again. Node IDs are only
+   meaningful for the DFG the producer's binary was built with, so records
+   also carry its size, and readers skip those from binaries with a
+   different one. All
+   fields after the header are packed, with no alignment.
+*/
+
+#ifndef _HAVE_SYNC_BUS_H
+#define _HAVE_SYNC_BUS_H
+
+#include "types.h"
+
+#define SYNC_BUS_MAGIC     "AFLSBUS3"
+#define SYNC_BUS_MAGIC_LEN 8
+
+/* Maximum length of a fuzzer ID (see fix_up_sync()), plus the NUL. */
+
+#define SYNC_BUS_NAME_LEN  33
+
+/* Bus header, at the start of the file. */
+
+struct sync_bus {
+
+  u8  magic[SYNC_BUS_MAGIC_LEN];      /* SYNC_BUS_MAGIC                   */
+  u64 size;                           /* Size of the ring                 */
+  u64 head;                           /* Offset of the next record        */
+  u8  pad[40];                        /* Keeps the ring cache-aligned     */
+
+};
+
+/* Record header, followed by the test case, the trace digest and the DFG
+   digest. */
+
+struct sync_rec {
+
+  u64 stamp;                          /* Record offset + 1, once complete */
+  u32 rec_len;                        /* Total size, header included      */
+  u32 entry_id;                       /* ID in the producer's queue       */
+  u64 prox_score;                     /* Proximity score                  */
+  u64 exec_us;                        /* Execution time (us)              */
+  u32 len;                            /* Test case length                 */
+  u32 trace_cnt;                      /* Non-zero bytes in the trace      */
+  u32 dfg_cnt;                        /* Number of DFG nodes reached      */
+  u32 exec_cksum;                     /* Checksum of the execution trace  */
+  u32 bitmap_size;                    /* Number of bits set in the trace  */
+  u32 dfg_size;                       /* Nodes in the producer's DFG      */
+  u8  name[SYNC_BUS_NAME_LEN];        /* Producer's fuzzer ID, "" = pad   */
+  u8  pad[7];
+
+};
+
+/* Size of a record, padded to keep the next one 8-byte aligned. */
+
+#define SYNC_REC_LEN(_len, _trace_cnt, _dfg_cnt) \
+  ((sizeof(struct sync_rec) + (_len) + (_trace_cnt) * 3 + (_dfg_cnt) * 4 + 7) \
+   & ~7)
+
+#endif /* !_HAVE_SYNC_BUS_H */